@@ -0,0 +1,40 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/src/core/archive.cpp" "CMakeFiles/kcomp.dir/src/core/archive.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/core/archive.cpp.o.d"
+  "/root/repo/src/core/benchmark.cpp" "CMakeFiles/kcomp.dir/src/core/benchmark.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/core/benchmark.cpp.o.d"
+  "/root/repo/src/core/checksum.cpp" "CMakeFiles/kcomp.dir/src/core/checksum.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/core/checksum.cpp.o.d"
+  "/root/repo/src/core/container.cpp" "CMakeFiles/kcomp.dir/src/core/container.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/core/container.cpp.o.d"
+  "/root/repo/src/core/data_stats.cpp" "CMakeFiles/kcomp.dir/src/core/data_stats.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/core/data_stats.cpp.o.d"
+  "/root/repo/src/core/dedup.cpp" "CMakeFiles/kcomp.dir/src/core/dedup.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/core/dedup.cpp.o.d"
+  "/root/repo/src/core/range_coder.cpp" "CMakeFiles/kcomp.dir/src/core/range_coder.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/core/range_coder.cpp.o.d"
+  "/root/repo/src/io/file_io.cpp" "CMakeFiles/kcomp.dir/src/io/file_io.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/io/file_io.cpp.o.d"
+  "/root/repo/src/main.cpp" "CMakeFiles/kcomp.dir/src/main.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/main.cpp.o.d"
+  "/root/repo/src/models/blocks.cpp" "CMakeFiles/kcomp.dir/src/models/blocks.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/models/blocks.cpp.o.d"
+  "/root/repo/src/models/bwt.cpp" "CMakeFiles/kcomp.dir/src/models/bwt.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/models/bwt.cpp.o.d"
+  "/root/repo/src/models/cm.cpp" "CMakeFiles/kcomp.dir/src/models/cm.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/models/cm.cpp.o.d"
+  "/root/repo/src/models/dict.cpp" "CMakeFiles/kcomp.dir/src/models/dict.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/models/dict.cpp.o.d"
+  "/root/repo/src/models/lz77.cpp" "CMakeFiles/kcomp.dir/src/models/lz77.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/models/lz77.cpp.o.d"
+  "/root/repo/src/models/lzma.cpp" "CMakeFiles/kcomp.dir/src/models/lzma.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/models/lzma.cpp.o.d"
+  "/root/repo/src/models/lzopt.cpp" "CMakeFiles/kcomp.dir/src/models/lzopt.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/models/lzopt.cpp.o.d"
+  "/root/repo/src/models/lzx.cpp" "CMakeFiles/kcomp.dir/src/models/lzx.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/models/lzx.cpp.o.d"
+  "/root/repo/src/models/mixer.cpp" "CMakeFiles/kcomp.dir/src/models/mixer.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/models/mixer.cpp.o.d"
+  "/root/repo/src/models/model257.cpp" "CMakeFiles/kcomp.dir/src/models/model257.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/models/model257.cpp.o.d"
+  "/root/repo/src/models/pipeline.cpp" "CMakeFiles/kcomp.dir/src/models/pipeline.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/models/pipeline.cpp.o.d"
+  "/root/repo/src/models/ppm.cpp" "CMakeFiles/kcomp.dir/src/models/ppm.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/models/ppm.cpp.o.d"
+  "/root/repo/src/models/rle.cpp" "CMakeFiles/kcomp.dir/src/models/rle.cpp.o" "gcc" "CMakeFiles/kcomp.dir/src/models/rle.cpp.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
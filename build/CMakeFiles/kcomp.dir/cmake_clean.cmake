@@ -0,0 +1,53 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/kcomp.dir/src/core/archive.cpp.o"
+  "CMakeFiles/kcomp.dir/src/core/archive.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/core/benchmark.cpp.o"
+  "CMakeFiles/kcomp.dir/src/core/benchmark.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/core/checksum.cpp.o"
+  "CMakeFiles/kcomp.dir/src/core/checksum.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/core/container.cpp.o"
+  "CMakeFiles/kcomp.dir/src/core/container.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/core/data_stats.cpp.o"
+  "CMakeFiles/kcomp.dir/src/core/data_stats.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/core/dedup.cpp.o"
+  "CMakeFiles/kcomp.dir/src/core/dedup.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/core/range_coder.cpp.o"
+  "CMakeFiles/kcomp.dir/src/core/range_coder.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/io/file_io.cpp.o"
+  "CMakeFiles/kcomp.dir/src/io/file_io.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/main.cpp.o"
+  "CMakeFiles/kcomp.dir/src/main.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/models/blocks.cpp.o"
+  "CMakeFiles/kcomp.dir/src/models/blocks.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/models/bwt.cpp.o"
+  "CMakeFiles/kcomp.dir/src/models/bwt.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/models/cm.cpp.o"
+  "CMakeFiles/kcomp.dir/src/models/cm.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/models/dict.cpp.o"
+  "CMakeFiles/kcomp.dir/src/models/dict.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/models/lz77.cpp.o"
+  "CMakeFiles/kcomp.dir/src/models/lz77.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/models/lzma.cpp.o"
+  "CMakeFiles/kcomp.dir/src/models/lzma.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/models/lzopt.cpp.o"
+  "CMakeFiles/kcomp.dir/src/models/lzopt.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/models/lzx.cpp.o"
+  "CMakeFiles/kcomp.dir/src/models/lzx.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/models/mixer.cpp.o"
+  "CMakeFiles/kcomp.dir/src/models/mixer.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/models/model257.cpp.o"
+  "CMakeFiles/kcomp.dir/src/models/model257.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/models/pipeline.cpp.o"
+  "CMakeFiles/kcomp.dir/src/models/pipeline.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/models/ppm.cpp.o"
+  "CMakeFiles/kcomp.dir/src/models/ppm.cpp.o.d"
+  "CMakeFiles/kcomp.dir/src/models/rle.cpp.o"
+  "CMakeFiles/kcomp.dir/src/models/rle.cpp.o.d"
+  "kcomp"
+  "kcomp.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/kcomp.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,350 @@
+#include "archive.hpp"
+#include "../io/file_io.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+void Put16(std::vector<uint8_t> &out, size_t v) {
+  out.push_back((uint8_t)(v & 0xFF));
+  out.push_back((uint8_t)((v >> 8) & 0xFF));
+}
+
+void Put32(std::vector<uint8_t> &out, size_t v) {
+  for (int i = 0; i < 4; i++) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+void Put64(std::vector<uint8_t> &out, uint64_t v) {
+  for (int i = 0; i < 8; i++) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+uint32_t Get32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+uint64_t Get64(const uint8_t *p) { return Get32(p) | ((uint64_t)Get32(p + 4) << 32); }
+
+[[noreturn]] void Corrupt() { throw std::runtime_error("corrupt .kc archive"); }
+
+// A file to archive and where its contents go in the raw data
+struct Source {
+  fs::path path;
+  ArchiveMember member;
+};
+
+std::string Extension(const std::string &name) {
+  size_t slash = name.find_last_of('/');
+  size_t dot = name.find_last_of('.');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return "";
+  std::string ext = name.substr(dot + 1);
+  for (char &c : ext) c = (char)std::tolower((unsigned char)c);
+  return ext;
+}
+
+void AddSource(std::vector<Source> &out, const fs::path &path, const std::string &name) {
+  Source s;
+  s.path = path;
+  s.member.name = name;
+  s.member.size = fs::file_size(path);
+  s.member.mode = (uint32_t)fs::status(path).permissions() & 0777;
+  if (name.size() > 65535) throw std::runtime_error("path too long: " + name);
+  out.push_back(std::move(s));
+}
+
+// Every regular file under `inputs`, named relative to each input's parent
+std::vector<Source> Collect(const std::vector<std::string> &inputs) {
+  std::vector<Source> out;
+  for (const auto &input : inputs) {
+    fs::path root = fs::path(input).lexically_normal();
+    if (root.filename().empty()) root = root.parent_path();  // "dir/" -> "dir"
+    if (!fs::exists(root)) throw std::runtime_error("no such file: " + input);
+
+    if (!fs::is_directory(root)) {
+      AddSource(out, root, root.filename().generic_string());
+      continue;
+    }
+    fs::path base = root.parent_path();
+    for (const auto &entry : fs::recursive_directory_iterator(root)) {
+      if (!entry.is_regular_file()) continue;
+      fs::path rel = base.empty() ? entry.path() : entry.path().lexically_relative(base);
+      AddSource(out, entry.path(), rel.generic_string());
+    }
+  }
+  return out;
+}
+
+std::vector<uint8_t> EncodeTable(const std::vector<ArchiveMember> &members) {
+  std::vector<uint8_t> out;
+  Put32(out, members.size());
+  for (const auto &m : members) {
+    Put16(out, m.name.size());
+    out.insert(out.end(), m.name.begin(), m.name.end());
+    Put32(out, m.mode);
+    Put64(out, m.offset);
+    Put64(out, m.size);
+  }
+  return out;
+}
+
+std::vector<ArchiveMember> DecodeTable(const std::vector<uint8_t> &table) {
+  const uint8_t *p = table.data();
+  size_t n = table.size(), pos = 4;
+  if (n < 4) Corrupt();
+  uint32_t count = Get32(p);
+  std::vector<ArchiveMember> members;
+  uint64_t next = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (n - pos < 2) Corrupt();
+    size_t len = p[pos] | (p[pos + 1] << 8);
+    pos += 2;
+    if (n - pos < len + 20) Corrupt();
+    ArchiveMember m;
+    m.name.assign((const char *)p + pos, len);
+    pos += len;
+    m.mode = Get32(p + pos);
+    m.offset = Get64(p + pos + 4);
+    m.size = Get64(p + pos + 12);
+    pos += 20;
+    if (m.offset != next || m.size > UINT64_MAX - next) Corrupt();
+    next += m.size;
+    members.push_back(std::move(m));
+  }
+  if (pos != n) Corrupt();
+  return members;
+}
+
+// Where member `name` goes under `dest`; refuses names that would escape it
+fs::path Destination(const fs::path &dest, const std::string &name) {
+  fs::path rel(name);
+  if (name.empty() || rel.is_absolute() || rel.has_root_name())
+    throw std::runtime_error("unsafe member name: " + name);
+  for (const auto &part : rel) {
+    if (part == "..") throw std::runtime_error("unsafe member name: " + name);
+  }
+  return dest / rel;
+}
+
+void WriteMember(const fs::path &dest, const ArchiveMember &m, const uint8_t *data, size_t n) {
+  fs::path out = Destination(dest, m.name);
+  if (out.has_parent_path()) fs::create_directories(out.parent_path());
+  std::FILE *f = std::fopen(out.string().c_str(), "wb");
+  if (!f) throw std::runtime_error("open failed: " + out.string());
+  WriteBytes(f, data, n);
+  if (std::fclose(f) != 0) throw std::runtime_error("write failed: " + out.string());
+  fs::permissions(out, (fs::perms)(m.mode & 0777));
+}
+
+// Splits the decoded raw data back into member files, in archive order
+class MemberSink : public ByteSink {
+public:
+  MemberSink(const fs::path &dest, const std::vector<ArchiveMember> &members)
+      : dest_(dest), members_(members) {}
+
+  ~MemberSink() override {
+    if (file_) std::fclose(file_);
+  }
+
+  void Write(const uint8_t *data, size_t n) override {
+    while (n > 0) {
+      Open();
+      if (next_ == members_.size() && !file_) Corrupt();  // Data past the last member
+      const ArchiveMember &m = members_[next_];
+      size_t take = (size_t)std::min<uint64_t>(n, m.size - done_);
+      WriteBytes(file_, data, take);
+      done_ += take;
+      data += take;
+      n -= take;
+      if (done_ == m.size) CloseMember();
+    }
+  }
+
+  void Close() override {
+    Open();  // Trailing empty members
+    if (next_ != members_.size()) Corrupt();
+  }
+
+  size_t Written() const { return next_; }
+
+private:
+  // Open the next member with data left, creating empty ones on the way
+  void Open() {
+    while (!file_ && next_ < members_.size()) {
+      const ArchiveMember &m = members_[next_];
+      if (m.size == 0) {
+        WriteMember(dest_, m, nullptr, 0);
+        next_++;
+        continue;
+      }
+      path_ = Destination(dest_, m.name);
+      if (path_.has_parent_path()) fs::create_directories(path_.parent_path());
+      file_ = std::fopen(path_.string().c_str(), "wb");
+      if (!file_) throw std::runtime_error("open failed: " + path_.string());
+      done_ = 0;
+    }
+  }
+
+  void CloseMember() {
+    std::FILE *f = file_;
+    file_ = nullptr;
+    if (std::fclose(f) != 0) throw std::runtime_error("write failed: " + path_.string());
+    fs::permissions(path_, (fs::perms)(members_[next_].mode & 0777));
+    next_++;
+  }
+
+  fs::path dest_;
+  const std::vector<ArchiveMember> &members_;
+  size_t next_ = 0;
+  uint64_t done_ = 0;
+  fs::path path_;
+  std::FILE *file_ = nullptr;
+};
+
+} // namespace
+
+std::vector<ArchiveMember> WriteArchive(const std::string &out_path,
+                                        const std::vector<std::string> &inputs,
+                                        const HybridOptions &opts, ContainerOptions copts) {
+  size_t frame_size = copts.frame_size ? copts.frame_size : DEFAULT_FRAME_SIZE;
+  copts.index = true;
+
+  // Small members first, grouped by extension, then the large ones
+  std::vector<Source> sources = Collect(inputs);
+  std::stable_sort(sources.begin(), sources.end(), [&](const Source &a, const Source &b) {
+    bool small_a = a.member.size < frame_size, small_b = b.member.size < frame_size;
+    if (small_a != small_b) return small_a;
+    std::string ext_a = small_a ? Extension(a.member.name) : "";
+    std::string ext_b = small_b ? Extension(b.member.name) : "";
+    if (ext_a != ext_b) return ext_a < ext_b;
+    return a.member.name < b.member.name;
+  });
+
+  // Frame ends in raw coordinates: solid frames close before a small member
+  // that would not fit, large members are cut every frame_size bytes
+  std::vector<ArchiveMember> members;
+  std::vector<uint64_t> ends;
+  uint64_t raw = 0, frame_start = 0;
+  for (auto &s : sources) {
+    s.member.offset = raw;
+    members.push_back(s.member);
+    uint64_t size = s.member.size;
+    if (size == 0) continue;
+    if (size < frame_size) {
+      if (raw - frame_start + size > frame_size) {
+        ends.push_back(raw);
+        frame_start = raw;
+      }
+      raw += size;
+      continue;
+    }
+    if (raw > frame_start) ends.push_back(raw);
+    for (uint64_t off = 0; off < size; off += frame_size) {
+      ends.push_back(raw + std::min<uint64_t>(size, off + frame_size));
+    }
+    raw += size;
+    frame_start = raw;
+  }
+  if (raw > frame_start) ends.push_back(raw);
+
+  std::FILE *out = std::fopen(out_path.c_str(), "wb");
+  if (!out) throw std::runtime_error("open failed: " + out_path);
+  try {
+    ContainerWriter writer(out, "", copts, EncodeTable(members));
+
+    // One frame per thread at a time, read piece by piece from the members
+    unsigned batch = opts.threads ? opts.threads : ThreadPool::DefaultThreads();
+    size_t src = 0;
+    uint64_t start = 0;
+    for (size_t f = 0; f < ends.size(); f += batch) {
+      size_t last = std::min(ends.size(), f + batch);
+      std::vector<uint8_t> buf;
+      buf.reserve((size_t)(ends[last - 1] - start));
+      std::vector<size_t> batch_ends;
+      for (size_t e = f; e < last; e++) batch_ends.push_back((size_t)(ends[e] - start));
+
+      uint64_t end = ends[last - 1];
+      while (start + buf.size() < end) {
+        const ArchiveMember &m = sources[src].member;
+        uint64_t pos = start + buf.size();
+        if (pos >= m.offset + m.size) {
+          src++;
+          continue;
+        }
+        size_t take = (size_t)(std::min(m.offset + m.size, end) - pos);
+        std::vector<uint8_t> piece =
+            RandomAccessFile(sources[src].path.string()).ReadAt(pos - m.offset, take);
+        buf.insert(buf.end(), piece.begin(), piece.end());
+      }
+      writer.AddFrames(buf, batch_ends, opts);
+      start = end;
+    }
+    writer.Finish();
+  } catch (...) {
+    std::fclose(out);
+    throw;
+  }
+  if (std::fclose(out) != 0) throw std::runtime_error("write failed: " + out_path);
+  return members;
+}
+
+std::vector<ArchiveMember> ListArchive(const std::string &path) {
+  std::FILE *in = std::fopen(path.c_str(), "rb");
+  if (!in) throw std::runtime_error("open failed: " + path);
+  std::vector<uint8_t> table;
+  uint8_t flags = 0;
+  try {
+    ContainerReader reader(in, 1);
+    flags = reader.Flags();
+    table = reader.MemberTable();
+  } catch (...) {
+    std::fclose(in);
+    throw;
+  }
+  std::fclose(in);
+  if (!(flags & KC_FLAG_ARCHIVE)) throw std::runtime_error("not a kcomp archive: " + path);
+  return DecodeTable(table);
+}
+
+size_t ExtractArchive(const std::string &path, const std::string &dest,
+                      const std::vector<std::string> &names, unsigned threads) {
+  // Selected members: seek straight to the frames holding each one
+  if (!names.empty()) {
+    std::vector<ArchiveMember> members = ListArchive(path);
+    for (const auto &name : names) {
+      auto m = std::find_if(members.begin(), members.end(),
+                            [&](const ArchiveMember &a) { return a.name == name; });
+      if (m == members.end()) throw std::runtime_error("not in archive: " + name);
+      std::string stored;
+      std::vector<uint8_t> data =
+          m->size ? ReadContainerRange(path, m->offset, m->size, stored, threads)
+                  : std::vector<uint8_t>();
+      if (data.size() != m->size) Corrupt();
+      WriteMember(dest, *m, data.data(), data.size());
+    }
+    return names.size();
+  }
+
+  // Everything: decode front to back, one frame per thread at a time
+  std::FILE *in = std::fopen(path.c_str(), "rb");
+  if (!in) throw std::runtime_error("open failed: " + path);
+  size_t written = 0;
+  try {
+    ContainerReader reader(in, threads);
+    if (!(reader.Flags() & KC_FLAG_ARCHIVE))
+      throw std::runtime_error("not a kcomp archive: " + path);
+    std::vector<ArchiveMember> members = DecodeTable(reader.MemberTable());
+    MemberSink sink(dest, members);
+    reader.DecodeTo(sink);
+    written = sink.Written();
+  } catch (...) {
+    std::fclose(in);
+    throw;
+  }
+  std::fclose(in);
+  return written;
+}
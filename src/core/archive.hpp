@@ -0,0 +1,47 @@
+#pragma once
+
+#include "container.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Multi-file archives (kcomp a / kcomp x): a v3 container with
+// KC_FLAG_ARCHIVE whose raw data is every member's contents back to back.
+//
+// Member table, little-endian:
+//   u32 count, then per member: u16 name length, name (relative,
+//   '/'-separated), u32 mode (permission bits), u64 raw offset, u64 size
+// Members are stored in raw offset order without gaps.
+//
+// Members smaller than a frame are sorted by extension and packed into
+// shared ("solid") frames, so similar files share PPM/LZ context; a member
+// never straddles two solid frames. Larger members get frames of their
+// own. Frames are compressed and decoded one per thread at a time, and
+// archives always carry the frame index, so a single member is extracted
+// by reading only the frames that hold it.
+
+struct ArchiveMember {
+  std::string name;
+  uint32_t mode = 0644;
+  uint64_t offset = 0;  // In the concatenated raw data
+  uint64_t size = 0;
+};
+
+// Archive the files in `inputs`, recursing into directories. A directory
+// argument keeps its own name as the first path component (like tar).
+// Returns the members in archive order.
+std::vector<ArchiveMember> WriteArchive(const std::string &out_path,
+                                        const std::vector<std::string> &inputs,
+                                        const HybridOptions &opts,
+                                        ContainerOptions copts = {});
+
+// Member table of the archive at `path`; throws std::runtime_error if it
+// is not an archive or the table is malformed
+std::vector<ArchiveMember> ListArchive(const std::string &path);
+
+// Extract every member into `dest`, or only those named in `names` (each
+// read through the index without decoding the rest). Returns the number
+// of files written. Throws on a corrupt archive, an unknown name, or a
+// member name that would escape `dest`.
+size_t ExtractArchive(const std::string &path, const std::string &dest,
+                      const std::vector<std::string> &names = {}, unsigned threads = 0);
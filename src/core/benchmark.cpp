@@ -1,9 +1,12 @@
 #include "benchmark.hpp"
 #include "../io/file_io.hpp"
+#include "../models/pipeline.hpp"
 #include "../models/ppm.hpp"
 #include "../models/rle.hpp"
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
+#include <mutex>
 
 static uint64_t NowNs() {
   return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
@@ -18,7 +21,13 @@ static void PrintBench(const char *name, size_t in_sz, size_t out_sz,
               out_sz, ratio, sec_c, sec_d);
 }
 
-int Bench(const std::string &path) {
+// Hybrid mode byte of a CompressHybrid result
+static int HybridMode(const std::vector<uint8_t> &out) {
+  return out.empty() ? -1 : out[0];
+}
+
+static int BenchFile(const std::string &path, const HybridOptions &opts,
+                     bool &sample_match) {
   auto input = ReadAll(path);
 
   {
@@ -99,9 +108,12 @@ int Bench(const std::string &path) {
                (t3 - t2) / 1e9);
   }
 
+  int exhaustive_mode = -1;
   {
+    HybridOptions exhaustive = opts;
+    exhaustive.sample = false;
     uint64_t t0 = NowNs();
-    auto out = CompressHybrid(input);
+    auto out = CompressHybrid(input, exhaustive);
     uint64_t t1 = NowNs();
     uint64_t t2 = NowNs();
     auto back = DecompressHybrid(out);
@@ -110,7 +122,154 @@ int Bench(const std::string &path) {
       return 2;
     PrintBench("hybrid", input.size(), out.size(), (t1 - t0) / 1e9,
                (t3 - t2) / 1e9);
+    exhaustive_mode = HybridMode(out);
+  }
+
+  {
+    HybridOptions sampled = opts;
+    sampled.sample = true;
+    uint64_t t0 = NowNs();
+    auto out = CompressHybrid(input, sampled);
+    uint64_t t1 = NowNs();
+    uint64_t t2 = NowNs();
+    auto back = DecompressHybrid(out);
+    uint64_t t3 = NowNs();
+    if (back != input)
+      return 2;
+    PrintBench("sampled", input.size(), out.size(), (t1 - t0) / 1e9,
+               (t3 - t2) / 1e9);
+    int sampled_mode = HybridMode(out);
+    sample_match = sampled_mode == exhaustive_mode;
+    std::printf("mode        exhaustive=%d  sampled=%d  (top-k=%u, slice=%zu)\n",
+                exhaustive_mode, sampled_mode, sampled.top_k, sampled.slice_size);
+  }
+
+  // Every level, fastest first (level 9 repeats the exhaustive row above)
+  for (int level = MIN_LEVEL; level <= MAX_LEVEL; level++) {
+    HybridOptions leveled = opts;
+    leveled.sample = false;
+    leveled.level = level;
+    uint64_t t0 = NowNs();
+    auto out = CompressHybrid(input, leveled);
+    uint64_t t1 = NowNs();
+    uint64_t t2 = NowNs();
+    auto back = DecompressHybrid(out);
+    uint64_t t3 = NowNs();
+    if (back != input)
+      return 2;
+    std::string name = "level-" + std::to_string(level);
+    PrintBench(name.c_str(), input.size(), out.size(), (t1 - t0) / 1e9,
+               (t3 - t2) / 1e9);
   }
 
   return 0;
 }
+
+int Bench(const std::vector<std::string> &paths, const HybridOptions &opts) {
+  int matches = 0;
+  for (size_t i = 0; i < paths.size(); i++) {
+    if (paths.size() > 1)
+      std::printf("%s== %s ==\n", i ? "\n" : "", paths[i].c_str());
+    bool match = false;
+    int rc = BenchFile(paths[i], opts, match);
+    if (rc != 0)
+      return rc;
+    matches += match ? 1 : 0;
+  }
+
+  std::printf("\nsampled winner matched exhaustive: %d/%zu files\n", matches,
+              paths.size());
+  return 0;
+}
+
+// Bytes of the first input used to measure per-mode setup cost
+constexpr size_t CALIBRATE_PROBE_SIZE = 256;
+static const char DECODE_PROFILE_MAGIC[] = "kcomp-decode-profile 1";
+
+// Decode time in ms of every mode on `input`, indexed by mode (-1 = not run)
+static std::array<double, 256> TimeDecodes(const std::vector<uint8_t> &input,
+                                           ThreadPool &pool) {
+  std::array<std::vector<uint8_t>, 256> streams;
+  std::mutex mutex;
+  ModeSet modes = AdmissibleModes(AllPipelineModes(), input.size());
+  PipelineSchedule schedule;
+  schedule.headroom = [](int, const StageSizes &) { return size_t(1); };  // The mode byte
+  RunPipelines(input, modes, pool, [&](int mode, Payload &&payload, StageSizes &&) {
+    payload.bytes[0] = (uint8_t)mode;
+    std::lock_guard<std::mutex> lock(mutex);
+    streams[mode] = std::move(payload.bytes);
+  }, schedule);
+
+  std::array<double, 256> ms;
+  ms.fill(-1);
+  for (int m = 0; m < 256; m++) {
+    if (streams[m].empty()) continue;
+    uint64_t t0 = NowNs();
+    auto back = DecompressHybrid(streams[m]);
+    uint64_t t1 = NowNs();
+    if (back == input) ms[m] = (t1 - t0) / 1e6;
+  }
+  return ms;
+}
+
+int CalibrateDecode(const std::vector<std::string> &paths,
+                    const std::string &profile_path, const HybridOptions &opts) {
+  ThreadPool pool(opts.threads);
+  DecodeProfile profile = DefaultDecodeProfile();
+
+  auto first = ReadAll(paths[0]);
+  first.resize(std::min(first.size(), CALIBRATE_PROBE_SIZE));
+  std::array<double, 256> setup = TimeDecodes(first, pool);
+
+  std::array<double, 256> work_ms{};
+  std::array<size_t, 256> work_bytes{};
+  for (const auto &path : paths) {
+    auto input = ReadAll(path);
+    std::array<double, 256> ms = TimeDecodes(input, pool);
+    for (int m = 0; m < 256; m++) {
+      if (ms[m] < 0 || setup[m] < 0) continue;
+      work_ms[m] += std::max(0.0, ms[m] - setup[m]);
+      work_bytes[m] += input.size();
+    }
+  }
+
+  std::FILE *f = std::fopen(profile_path.c_str(), "w");
+  if (!f) {
+    std::fprintf(stderr, "error: cannot write %s\n", profile_path.c_str());
+    return 1;
+  }
+  std::fprintf(f, "%s\n", DECODE_PROFILE_MAGIC);
+  std::printf("mode  setup_ms   ns/byte\n");
+  for (int m = 0; m < 256; m++) {
+    if (work_bytes[m] == 0) continue;
+    profile[m].setup_ms = setup[m];
+    profile[m].ns_per_byte = work_ms[m] * 1e6 / (double)work_bytes[m];
+    std::printf("%4d  %8.2f  %8.1f\n", m, profile[m].setup_ms, profile[m].ns_per_byte);
+    std::fprintf(f, "%d %.4f %.4f\n", m, profile[m].setup_ms, profile[m].ns_per_byte);
+  }
+  std::fclose(f);
+  std::printf("\nwrote %s\n", profile_path.c_str());
+  return 0;
+}
+
+bool LoadDecodeProfile(const std::string &path, DecodeProfile &profile) {
+  std::FILE *f = std::fopen(path.c_str(), "r");
+  if (!f)
+    return false;
+  char magic[64] = {};
+  bool ok = std::fgets(magic, sizeof(magic), f) &&
+            std::string(magic) == std::string(DECODE_PROFILE_MAGIC) + "\n";
+  profile = DefaultDecodeProfile();
+  int mode;
+  double setup_ms, ns_per_byte;
+  while (ok && std::fscanf(f, "%d %lf %lf", &mode, &setup_ms, &ns_per_byte) == 3) {
+    if (mode < 0 || mode > 255 || setup_ms < 0 || ns_per_byte < 0) {
+      ok = false;
+      break;
+    }
+    profile[mode] = {setup_ms, ns_per_byte};
+  }
+  ok = ok && std::feof(f);
+  std::fclose(f);
+  return ok;
+}
@@ -1,5 +1,19 @@
 #pragma once
 
+#include "../models/ppm.hpp"
 #include <string>
+#include <vector>
 
-int Bench(const std::string &path);
+// Benchmark every file and report how often sample-then-confirm selection
+// picked the same hybrid mode as the exhaustive search
+int Bench(const std::vector<std::string> &paths, const HybridOptions &opts);
+
+// Measure the decode cost of every hybrid mode on this machine: setup time
+// on a tiny probe and per-byte time on `paths`. Prints the table and writes
+// it to `profile_path` for `kcomp c --decode-profile`.
+int CalibrateDecode(const std::vector<std::string> &paths,
+                    const std::string &profile_path, const HybridOptions &opts);
+
+// Read a profile written by CalibrateDecode; modes it does not list keep
+// the built-in estimates. Returns false if the file is missing or malformed.
+bool LoadDecodeProfile(const std::string &path, DecodeProfile &profile);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+
+// Cooperative cancellation for long-running coders. A pipeline worker
+// installs a token for the duration of one job (CancelScope); the coders
+// call PollCancel() from their main loop, which throws Cancelled once the
+// token has expired. Code running without a token never throws.
+
+struct Cancelled : std::exception {
+  const char *what() const noexcept override { return "cancelled"; }
+};
+
+// Deadline that only takes effect once armed, so work keeps going until
+// at least one usable result exists
+class CancelToken {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit CancelToken(Clock::time_point deadline) : deadline_(deadline) {}
+
+  void Arm() { armed_.store(true, std::memory_order_relaxed); }
+
+  bool Expired() const {
+    return armed_.load(std::memory_order_relaxed) && Clock::now() >= deadline_;
+  }
+
+private:
+  Clock::time_point deadline_;
+  std::atomic<bool> armed_{false};
+};
+
+inline const CancelToken *&CurrentCancelToken() {
+  thread_local const CancelToken *token = nullptr;
+  return token;
+}
+
+// Installs `token` for the calling thread until the scope ends
+class CancelScope {
+public:
+  explicit CancelScope(const CancelToken *token) : prev_(CurrentCancelToken()) {
+    CurrentCancelToken() = token;
+  }
+  ~CancelScope() { CurrentCancelToken() = prev_; }
+
+  CancelScope(const CancelScope &) = delete;
+  CancelScope &operator=(const CancelScope &) = delete;
+
+private:
+  const CancelToken *prev_;
+};
+
+// Check the current token every 64 KB of input (`pos` = bytes processed)
+inline void PollCancel(size_t pos) {
+  if ((pos & 0xFFFF) != 0) return;
+  const CancelToken *token = CurrentCancelToken();
+  if (token && token->Expired()) throw Cancelled();
+}
@@ -0,0 +1,149 @@
+#include "checksum.hpp"
+#include <array>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define KCOMP_HAVE_SSE42 1
+#endif
+
+namespace {
+
+constexpr uint32_t CRC32C_POLY = 0x82F63B78;  // Reflected Castagnoli polynomial
+
+// table[k][b]: CRC of byte b followed by k zero bytes
+struct CrcTables {
+  std::array<std::array<uint32_t, 256>, 8> t;
+
+  CrcTables() {
+    for (uint32_t b = 0; b < 256; b++) {
+      uint32_t c = b;
+      for (int i = 0; i < 8; i++) c = (c >> 1) ^ (CRC32C_POLY & (0u - (c & 1)));
+      t[0][b] = c;
+    }
+    for (int k = 1; k < 8; k++)
+      for (int b = 0; b < 256; b++) t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xFF];
+  }
+};
+
+const CrcTables &Tables() {
+  static const CrcTables tables;
+  return tables;
+}
+
+uint64_t Load64(const uint8_t *p) {
+  uint64_t v;
+  std::memcpy(&v, p, 8);
+  return v;  // Little-endian hosts only, like the rest of the codecs
+}
+
+uint32_t Load32(const uint8_t *p) {
+  uint32_t v;
+  std::memcpy(&v, p, 4);
+  return v;
+}
+
+#ifdef KCOMP_HAVE_SSE42
+__attribute__((target("sse4.2"))) uint32_t CrcHardware(uint32_t crc, const uint8_t *p,
+                                                        size_t n) {
+#ifdef __x86_64__
+  uint64_t c = crc;
+  for (; n >= 8; p += 8, n -= 8) c = _mm_crc32_u64(c, Load64(p));
+  crc = (uint32_t)c;
+#endif
+  for (; n >= 4; p += 4, n -= 4) crc = _mm_crc32_u32(crc, Load32(p));
+  for (; n > 0; p++, n--) crc = _mm_crc32_u8(crc, *p);
+  return crc;
+}
+
+bool HasSse42() {
+  static const bool has = __builtin_cpu_supports("sse4.2");
+  return has;
+}
+#endif
+
+constexpr uint64_t P1 = 11400714785074694791ULL;
+constexpr uint64_t P2 = 14029467366897019727ULL;
+constexpr uint64_t P3 = 1609587929392839161ULL;
+constexpr uint64_t P4 = 9650029242287828579ULL;
+constexpr uint64_t P5 = 2870177450012600261ULL;
+
+uint64_t Rotl(uint64_t v, int r) { return (v << r) | (v >> (64 - r)); }
+
+uint64_t Round(uint64_t acc, uint64_t lane) { return Rotl(acc + lane * P2, 31) * P1; }
+
+uint64_t Merge(uint64_t h, uint64_t acc) { return (h ^ Round(0, acc)) * P1 + P4; }
+
+} // namespace
+
+uint32_t Crc32cSoftware(const uint8_t *data, size_t n, uint32_t crc) {
+  const auto &t = Tables().t;
+  crc = ~crc;
+  for (; n >= 8; data += 8, n -= 8) {
+    uint64_t v = Load64(data) ^ crc;
+    crc = t[7][v & 0xFF] ^ t[6][(v >> 8) & 0xFF] ^ t[5][(v >> 16) & 0xFF] ^
+          t[4][(v >> 24) & 0xFF] ^ t[3][(v >> 32) & 0xFF] ^ t[2][(v >> 40) & 0xFF] ^
+          t[1][(v >> 48) & 0xFF] ^ t[0][v >> 56];
+  }
+  for (; n > 0; data++, n--) crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFF];
+  return ~crc;
+}
+
+uint32_t Crc32c(const uint8_t *data, size_t n, uint32_t crc) {
+#ifdef KCOMP_HAVE_SSE42
+  if (HasSse42()) return ~CrcHardware(~crc, data, n);
+#endif
+  return Crc32cSoftware(data, n, crc);
+}
+
+Hash64::Hash64(uint64_t seed) : seed_(seed), acc_{seed + P1 + P2, seed + P2, seed, seed - P1} {}
+
+void Hash64::Update(const uint8_t *data, size_t n) {
+  total_ += n;
+  if (buffered_ + n < 32) {
+    std::memcpy(buf_ + buffered_, data, n);
+    buffered_ += n;
+    return;
+  }
+  if (buffered_) {
+    size_t fill = 32 - buffered_;
+    std::memcpy(buf_ + buffered_, data, fill);
+    for (int i = 0; i < 4; i++) acc_[i] = Round(acc_[i], Load64(buf_ + 8 * i));
+    data += fill;
+    n -= fill;
+    buffered_ = 0;
+  }
+  for (; n >= 32; data += 32, n -= 32) {
+    for (int i = 0; i < 4; i++) acc_[i] = Round(acc_[i], Load64(data + 8 * i));
+  }
+  std::memcpy(buf_, data, n);
+  buffered_ = n;
+}
+
+uint64_t Hash64::Digest() const {
+  uint64_t h;
+  if (total_ >= 32) {
+    h = Rotl(acc_[0], 1) + Rotl(acc_[1], 7) + Rotl(acc_[2], 12) + Rotl(acc_[3], 18);
+    for (int i = 0; i < 4; i++) h = Merge(h, acc_[i]);
+  } else {
+    h = seed_ + P5;
+  }
+  h += total_;
+
+  const uint8_t *p = buf_;
+  size_t n = buffered_;
+  for (; n >= 8; p += 8, n -= 8) h = Rotl(h ^ Round(0, Load64(p)), 27) * P1 + P4;
+  if (n >= 4) {
+    h = Rotl(h ^ (uint64_t)Load32(p) * P1, 23) * P2 + P3;
+    p += 4;
+    n -= 4;
+  }
+  for (; n > 0; p++, n--) h = Rotl(h ^ *p * P5, 11) * P1;
+
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
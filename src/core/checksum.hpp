@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli), as in iSCSI and ext4. Pass the previous result as
+// `crc` to continue a checksum over several buffers. Uses the SSE4.2 crc32
+// instruction when the CPU has it, slice-by-8 tables otherwise.
+uint32_t Crc32c(const uint8_t *data, size_t n, uint32_t crc = 0);
+
+// Portable slice-by-8 CRC32C; same results as Crc32c
+uint32_t Crc32cSoftware(const uint8_t *data, size_t n, uint32_t crc = 0);
+
+// Incremental 64-bit hash (XXH64) for whole-file integrity checks and
+// chunk fingerprints
+class Hash64 {
+public:
+  explicit Hash64(uint64_t seed = 0);
+
+  void Update(const uint8_t *data, size_t n);
+  uint64_t Digest() const;
+
+private:
+  uint64_t seed_;
+  uint64_t acc_[4];
+  uint8_t buf_[32];
+  size_t buffered_ = 0;
+  uint64_t total_ = 0;
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "../io/byte_sink.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <vector>
+
+// Bounded single-producer/single-consumer queue of byte chunks connecting
+// two pipeline stages on different threads. Push() blocks while `capacity`
+// chunks are waiting, which caps the memory between the stages. Either
+// side can end the stream: the producer with Close() once done, the
+// consumer with Abandon() when it fails, which makes further pushes throw
+// so the producer does not wait forever.
+class ChunkChannel {
+public:
+  struct Abandoned : std::exception {
+    const char *what() const noexcept override { return "stream abandoned"; }
+  };
+
+  explicit ChunkChannel(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+  ChunkChannel(const ChunkChannel &) = delete;
+  ChunkChannel &operator=(const ChunkChannel &) = delete;
+
+  void Push(std::vector<uint8_t> &&chunk) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    space_cv_.wait(lock, [&] { return abandoned_ || queue_.size() < capacity_; });
+    if (abandoned_) throw Abandoned();
+    queue_.push_back(std::move(chunk));
+    data_cv_.notify_one();
+  }
+
+  // False once the producer has closed the channel and it is drained
+  bool Pop(std::vector<uint8_t> &chunk) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    data_cv_.wait(lock, [&] { return closed_ || !queue_.empty(); });
+    if (queue_.empty()) return false;
+    chunk = std::move(queue_.front());
+    queue_.pop_front();
+    space_cv_.notify_one();
+    return true;
+  }
+
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    data_cv_.notify_all();
+  }
+
+  void Abandon() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    abandoned_ = true;
+    queue_.clear();
+    space_cv_.notify_all();
+  }
+
+private:
+  size_t capacity_;
+  std::deque<std::vector<uint8_t>> queue_;
+  bool closed_ = false;
+  bool abandoned_ = false;
+  std::mutex mutex_;
+  std::condition_variable data_cv_;
+  std::condition_variable space_cv_;
+};
+
+// Producer-side adapter: every Write becomes one chunk in the channel
+class ChannelSink : public ByteSink {
+public:
+  explicit ChannelSink(ChunkChannel &channel) : channel_(channel) {}
+
+  void Write(const uint8_t *data, size_t n) override {
+    channel_.Push(std::vector<uint8_t>(data, data + n));
+  }
+  void Close() override { channel_.Close(); }
+
+private:
+  ChunkChannel &channel_;
+};
@@ -0,0 +1,1506 @@
+#include "container.hpp"
+#include "../io/file_io.hpp"
+#include "../models/blocks.hpp"
+#include "checksum.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <stdexcept>
+#include <sys/stat.h>
+
+namespace {
+
+constexpr uint8_t V2 = 2;
+
+constexpr uint8_t INDEX_MAGIC[4] = {'K', 'C', 'I', 'X'};
+constexpr size_t INDEX_FOOTER = 16;
+
+// Metadata fields this version writes and reads (see ContainerMeta)
+constexpr size_t META_SIZE = 60;
+
+// Deduplicated frames kept decoded for references into earlier frames
+constexpr size_t CACHED_FRAMES = 8;
+
+// Largest read issued at once while pulling a frame from a stream, so a
+// corrupt size field cannot make the reader allocate gigabytes up front
+constexpr size_t STREAM_READ = 1 << 20;
+
+// Batches read ahead from a pipe while the current one is compressed
+constexpr size_t READ_AHEAD_BATCHES = 2;
+
+// io_uring reads of a regular input: the next batch is split into
+// requests of at least RING_READ bytes, up to RING_DEPTH of them in flight
+constexpr size_t RING_READ = 1 << 20;
+constexpr unsigned RING_DEPTH = 64;
+
+// How often the pipe reader checks whether the compressor has given up
+constexpr int READ_POLL_MS = 100;
+
+void Put16(std::vector<uint8_t> &out, size_t v) {
+  out.push_back((uint8_t)(v & 0xFF));
+  out.push_back((uint8_t)((v >> 8) & 0xFF));
+}
+
+void Put32(std::vector<uint8_t> &out, size_t v) {
+  for (int i = 0; i < 4; i++) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+void Put64(std::vector<uint8_t> &out, uint64_t v) {
+  for (int i = 0; i < 8; i++) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+uint32_t Get16(const uint8_t *p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8); }
+
+uint32_t Get32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+uint64_t Get64(const uint8_t *p) { return Get32(p) | ((uint64_t)Get32(p + 4) << 32); }
+
+std::string BaseName(const std::string &path) {
+  size_t pos = path.find_last_of("/\\");
+  std::string base = pos == std::string::npos ? path : path.substr(pos + 1);
+  if (base.size() > 65535) base.resize(65535);
+  return base;
+}
+
+[[noreturn]] void Corrupt() { throw std::runtime_error("corrupt .kc file"); }
+
+[[noreturn]] void Mismatch(const std::string &what) {
+  throw std::runtime_error("corrupt .kc file: " + what + " checksum mismatch");
+}
+
+// Bytes before a frame's stream, and between the end marker (inclusive)
+// and the index
+size_t HeaderSize(uint8_t flags) { return (flags & KC_FLAG_CRC) ? 16 : 8; }
+size_t TrailerSize(uint8_t flags) { return (flags & KC_FLAG_HASH) ? 12 : 4; }
+size_t IndexEntrySize(uint8_t flags) { return (flags & KC_FLAG_FRAME_HASH) ? 24 : 16; }
+
+uint64_t FrameHash(const uint8_t *raw, size_t n) {
+  Hash64 hash;
+  hash.Update(raw, n);
+  return hash.Digest();
+}
+
+// Metadata block, length prefix included
+std::vector<uint8_t> EncodeMeta(const ContainerMeta &meta) {
+  std::vector<uint8_t> out;
+  Put16(out, META_SIZE);
+  Put64(out, meta.raw_size);
+  Put32(out, meta.frames > UINT32_MAX ? UINT32_MAX : meta.frames);
+  Put64(out, (uint64_t)meta.mtime);
+  Put64(out, (uint64_t)meta.created);
+  for (int i = 0; i < 32; i++) {
+    uint8_t bits = 0;
+    for (int b = 0; b < 8; b++) bits |= meta.modes[8 * i + b] << b;
+    out.push_back(bits);
+  }
+  return out;
+}
+
+// Parse the `n` metadata bytes after the length prefix
+ContainerMeta DecodeMeta(const uint8_t *p, size_t n) {
+  if (n < META_SIZE) Corrupt();
+  ContainerMeta meta;
+  meta.raw_size = Get64(p);
+  uint32_t frames = Get32(p + 8);
+  meta.frames = frames == UINT32_MAX ? KC_UNKNOWN : frames;
+  meta.mtime = (int64_t)Get64(p + 12);
+  meta.created = (int64_t)Get64(p + 20);
+  for (int m = 0; m < 256; m++) meta.modes[m] = (p[28 + m / 8] >> (m % 8)) & 1;
+  return meta;
+}
+
+// Hybrid modes of a frame stream (the literal stream of a deduplicated
+// frame) into `modes`
+void FrameModes(const uint8_t *stream, size_t n, uint8_t flags, uint64_t raw_offset,
+                size_t raw_size, std::bitset<256> &modes) {
+  size_t skip = 0;
+  if (flags & KC_FLAG_DEDUP) skip = ParseRecipe(stream, n, raw_offset, (uint32_t)raw_size).header_size;
+  StreamModes(stream + skip, n - skip, modes);
+}
+
+struct FrameHeader {
+  uint32_t raw_size = 0;
+  uint32_t size = 0;
+  uint32_t stream_crc = 0;
+  uint32_t raw_crc = 0;
+};
+
+// Writers never make frames larger than MAX_FRAME_SIZE, or empty ones,
+// which would read as the end marker
+bool ValidRawSize(uint64_t raw_size) { return raw_size != 0 && raw_size <= MAX_FRAME_SIZE; }
+
+// Parse the HeaderSize(flags) bytes at `p`; the raw size is checked here,
+// before any buffer is sized from it
+FrameHeader GetHeader(const uint8_t *p, uint8_t flags) {
+  FrameHeader h;
+  h.raw_size = Get32(p);
+  if (!ValidRawSize(h.raw_size)) Corrupt();
+  h.size = Get32(p + 4);
+  if (flags & KC_FLAG_CRC) {
+    h.stream_crc = Get32(p + 8);
+    h.raw_crc = Get32(p + 12);
+  }
+  return h;
+}
+
+// The HeaderSize(flags) bytes in front of a frame's stream
+void PutFrameHeader(std::vector<uint8_t> &out, const uint8_t *raw, size_t raw_size,
+                    const uint8_t *stream, size_t n, uint8_t flags) {
+  Put32(out, raw_size);
+  Put32(out, n);
+  if (flags & KC_FLAG_CRC) {
+    Put32(out, Crc32c(stream, n));
+    Put32(out, Crc32c(raw, raw_size));
+  }
+}
+
+// Raw bytes per frame for `copts`
+size_t FrameSize(const ContainerOptions &copts) {
+  return std::min(copts.frame_size ? copts.frame_size : DEFAULT_FRAME_SIZE, MAX_FRAME_SIZE);
+}
+
+void PutFrame(std::vector<uint8_t> &out, const uint8_t *raw, size_t raw_size,
+              const uint8_t *stream, size_t n, uint8_t flags) {
+  PutFrameHeader(out, raw, raw_size, stream, n, flags);
+  out.insert(out.end(), stream, stream + n);
+}
+
+// Copies `n` raw bytes from raw offset `source`, before the frames being
+// decoded, to `dst`
+using EarlierReader = std::function<void(uint64_t source, size_t n, uint8_t *dst)>;
+
+// Decode the literal streams of deduplicated frames in parallel, then
+// assemble the frames in order. References resolve into the output so
+// far, or through `earlier` if they reach back before `base`, the raw
+// offset of the first frame.
+std::vector<uint8_t> DecodeDedupFrames(const std::vector<BlockRef> &refs, size_t raw_total,
+                                       unsigned threads, uint64_t base,
+                                       const EarlierReader &earlier) {
+  std::vector<DedupRecipe> recipes;
+  std::vector<BlockRef> literal_refs;
+  std::vector<size_t> literal_start;
+  size_t literal_total = 0;
+  for (const auto &r : refs) {
+    recipes.push_back(ParseRecipe(r.data, r.size, base + r.raw_offset, (uint32_t)r.raw_size));
+    const DedupRecipe &recipe = recipes.back();
+    literal_start.push_back(literal_total);
+    if (recipe.literal_size > 0) {
+      literal_refs.push_back({literal_total, recipe.literal_size, r.data + recipe.header_size,
+                              r.size - recipe.header_size});
+    }
+    literal_total += recipe.literal_size;
+  }
+  std::vector<uint8_t> literals = DecompressBlockStreams(literal_refs, literal_total, threads);
+
+  std::vector<uint8_t> raw(raw_total);
+  for (size_t f = 0; f < refs.size(); f++) {
+    for (const DedupEntry &e : recipes[f].entries) {
+      uint8_t *dst = raw.data() + (e.raw_offset - base);
+      if (!e.reference) {
+        std::memcpy(dst, literals.data() + literal_start[f] + e.literal, e.length);
+        continue;
+      }
+      size_t before = e.source < base ? (size_t)std::min<uint64_t>(e.length, base - e.source) : 0;
+      if (before > 0) {
+        if (!earlier) Corrupt();
+        earlier(e.source, before, dst);
+      }
+      std::memcpy(dst + before, raw.data() + (e.source + before - base), e.length - before);
+    }
+  }
+  return raw;
+}
+
+// Decode `refs` into one `raw_total`-byte buffer. With KC_FLAG_CRC every
+// stream is checked before it reaches a decoder (so damage is reported
+// instead of tripping the decoders) and every frame's output after.
+// `first` numbers the frames in error messages; `base` and `earlier` are
+// for deduplicated files, as in DecodeDedupFrames.
+std::vector<uint8_t> DecodeFrames(const std::vector<BlockRef> &refs,
+                                  const std::vector<FrameHeader> &headers, size_t raw_total,
+                                  uint8_t flags, unsigned threads, size_t first = 0,
+                                  uint64_t base = 0, const EarlierReader &earlier = nullptr) {
+  if (flags & KC_FLAG_CRC) {
+    for (size_t f = 0; f < refs.size(); f++) {
+      if (Crc32c(refs[f].data, refs[f].size) != headers[f].stream_crc)
+        Mismatch("frame " + std::to_string(first + f) + " stream");
+    }
+  }
+  std::vector<uint8_t> raw = (flags & KC_FLAG_DEDUP)
+                                 ? DecodeDedupFrames(refs, raw_total, threads, base, earlier)
+                                 : DecompressBlockStreams(refs, raw_total, threads);
+  if (flags & KC_FLAG_CRC) {
+    for (size_t f = 0; f < refs.size(); f++) {
+      if (Crc32c(raw.data() + refs[f].raw_offset, refs[f].raw_size) != headers[f].raw_crc)
+        Mismatch("frame " + std::to_string(first + f) + " data");
+    }
+  }
+  return raw;
+}
+
+// Frames of a deduplicated file that were already passed, fetched again
+// (as header + stream, through `load`) when a reference reaches back to
+// them. The literals of the last few frames stay decoded.
+class EarlierFrames {
+public:
+  using Loader = std::function<std::vector<uint8_t>(size_t frame)>;
+
+  EarlierFrames(const std::vector<FrameEntry> &table, uint8_t flags, unsigned threads,
+                Loader load)
+      : table_(table), flags_(flags), threads_(threads), load_(std::move(load)) {}
+
+  void Copy(uint64_t source, size_t n, uint8_t *dst) {
+    while (n > 0) {
+      // Follow references back to the literal bytes they copy; each hop
+      // moves strictly backwards, so this ends
+      uint64_t at = source;
+      size_t len = n;
+      const uint8_t *src = nullptr;
+      while (!src) {
+        const Frame &frame = Get(FrameAt(at));
+        const auto &entries = frame.recipe.entries;
+        auto e = std::upper_bound(entries.begin(), entries.end(), at,
+                                  [](uint64_t v, const DedupEntry &x) { return v < x.raw_offset; }) -
+                 1;
+        len = (size_t)std::min<uint64_t>(len, e->raw_offset + e->length - at);
+        if (e->reference) {
+          at = e->source + (at - e->raw_offset);
+        } else {
+          src = frame.literals.data() + e->literal + (at - e->raw_offset);
+        }
+      }
+      std::memcpy(dst, src, len);
+      dst += len;
+      source += len;
+      n -= len;
+    }
+  }
+
+private:
+  struct Frame {
+    size_t index;
+    DedupRecipe recipe;
+    std::vector<uint8_t> literals;
+  };
+
+  size_t FrameAt(uint64_t raw) const {
+    auto f = std::upper_bound(table_.begin(), table_.end(), raw,
+                              [](uint64_t v, const FrameEntry &x) { return v < x.raw_offset; });
+    if (f == table_.begin() || raw - (f - 1)->raw_offset >= (f - 1)->raw_size) Corrupt();
+    return f - 1 - table_.begin();
+  }
+
+  const Frame &Get(size_t f) {
+    for (const auto &c : cache_) {
+      if (c.index == f) return c;
+    }
+    std::vector<uint8_t> bytes = load_(f);
+    size_t header = HeaderSize(flags_);
+    if (bytes.size() < header) Corrupt();
+    FrameHeader h = GetHeader(bytes.data(), flags_);
+    if (h.raw_size != table_[f].raw_size || bytes.size() - header != h.size) Corrupt();
+    const uint8_t *stream = bytes.data() + header;
+    if ((flags_ & KC_FLAG_CRC) && Crc32c(stream, h.size) != h.stream_crc)
+      Mismatch("frame " + std::to_string(f) + " stream");
+
+    Frame frame{f, ParseRecipe(stream, h.size, table_[f].raw_offset, h.raw_size), {}};
+    size_t literal = frame.recipe.literal_size, skip = frame.recipe.header_size;
+    if (literal > 0) {
+      frame.literals =
+          DecompressBlockStreams({{0, literal, stream + skip, h.size - skip}}, literal, threads_);
+    }
+    if (cache_.size() == CACHED_FRAMES) cache_.pop_front();
+    cache_.push_back(std::move(frame));
+    return cache_.back();
+  }
+
+  const std::vector<FrameEntry> &table_;
+  uint8_t flags_;
+  unsigned threads_;
+  Loader load_;
+  std::deque<Frame> cache_;
+};
+
+// Read the index of a v3 file whose first frame starts at `pos`
+std::vector<FrameEntry> ReadIndex(const RandomAccessFile &file, uint64_t pos, uint8_t flags) {
+  uint64_t size = file.Size();
+  uint64_t trailer = TrailerSize(flags);
+  if (size < pos + trailer + INDEX_FOOTER) Corrupt();
+  std::vector<uint8_t> footer = file.ReadAt(size - INDEX_FOOTER, INDEX_FOOTER);
+  if (!std::equal(INDEX_MAGIC, INDEX_MAGIC + 4, footer.begin() + 12)) Corrupt();
+  uint64_t raw_total = Get64(footer.data());
+  uint64_t count = Get32(footer.data() + 8);
+  size_t entry = IndexEntrySize(flags);
+  if (count * entry > size - pos - trailer - INDEX_FOOTER) Corrupt();
+  uint64_t start = size - INDEX_FOOTER - count * entry;
+  std::vector<uint8_t> raw = file.ReadAt(start, count * entry);
+
+  std::vector<FrameEntry> table(count);
+  for (size_t i = 0; i < count; i++) {
+    table[i].offset = Get64(&raw[i * entry]);
+    table[i].raw_offset = Get64(&raw[i * entry + 8]);
+    if (flags & KC_FLAG_FRAME_HASH) table[i].raw_hash = Get64(&raw[i * entry + 16]);
+  }
+  // Frames must tile the output and sit in order between the header and
+  // the end marker; each frame's own header is checked again when read
+  for (size_t i = 0; i < count; i++) {
+    uint64_t raw_end = i + 1 < count ? table[i + 1].raw_offset : raw_total;
+    uint64_t next = i + 1 < count ? table[i + 1].offset : start - trailer;
+    if ((i == 0 ? table[i].offset != pos || table[i].raw_offset != 0
+                : table[i].offset <= table[i - 1].offset) ||
+        raw_end <= table[i].raw_offset || !ValidRawSize(raw_end - table[i].raw_offset) ||
+        next < table[i].offset + HeaderSize(flags) + 1)
+      Corrupt();
+    table[i].raw_size = raw_end - table[i].raw_offset;
+  }
+  if (count == 0 && (raw_total != 0 || start - trailer != pos)) Corrupt();
+  return table;
+}
+
+// Read the header of the v3 file `file`: the stored name, the flags, the
+// offset of the first frame and, if `meta` is set, the metadata. Returns
+// false for older layouts and bare streams.
+bool ReadV3Header(const RandomAccessFile &file, std::string &name, uint8_t &flags,
+                  uint64_t &pos, ContainerMeta *meta = nullptr) {
+  uint64_t size = file.Size();
+  std::vector<uint8_t> head = file.ReadAt(0, std::min<uint64_t>(size, 5));
+  if (head.size() < 5 || head[0] != KC_MAGIC[0] || head[1] != KC_MAGIC[1] ||
+      head[2] != KC_VERSION) {
+    return false;
+  }
+
+  pos = 5 + (uint64_t)(head[3] | (head[4] << 8));
+  if (size <= pos) Corrupt();
+  std::vector<uint8_t> stored = file.ReadAt(5, pos - 5);
+  name.assign(stored.begin(), stored.end());
+  flags = file.ReadAt(pos, 1)[0];
+  if (flags & ~KC_KNOWN_FLAGS) Corrupt();
+  pos++;
+  if (flags & KC_FLAG_META) {
+    if (size - pos < 2) Corrupt();
+    uint64_t len = Get16(file.ReadAt(pos, 2).data());
+    if (size - pos - 2 < len) Corrupt();
+    if (meta) *meta = DecodeMeta(file.ReadAt(pos + 2, len).data(), len);
+    pos += 2 + len;
+  }
+  if (flags & KC_FLAG_ARCHIVE) {
+    if (size - pos < 4) Corrupt();
+    uint64_t table = Get32(file.ReadAt(pos, 4).data());
+    if (size - pos - 4 < table) Corrupt();
+    pos += 4 + table;
+  }
+  return true;
+}
+
+// Locate the frames of an unindexed v3 file by hopping over their headers
+std::vector<FrameEntry> WalkFrames(const RandomAccessFile &file, uint64_t pos, uint8_t flags) {
+  uint64_t size = file.Size();
+  size_t header = HeaderSize(flags);
+  std::vector<FrameEntry> table;
+  uint64_t raw_total = 0;
+  while (true) {
+    if (size - pos < 4) Corrupt();
+    std::vector<uint8_t> hdr = file.ReadAt(pos, std::min<uint64_t>(header, size - pos));
+    uint32_t raw_size = Get32(hdr.data());
+    if (raw_size == 0) break;
+    if (hdr.size() < header || !ValidRawSize(raw_size)) Corrupt();
+    uint32_t stream = Get32(hdr.data() + 4);
+    if (stream == 0 || size - pos - header < stream) Corrupt();
+    table.push_back({pos, raw_total, raw_size});
+    raw_total += raw_size;
+    pos += header + (uint64_t)stream;
+  }
+  if (pos + TrailerSize(flags) != size) Corrupt();
+  return table;
+}
+
+// Stream of the frame `f` of `file`; `h` receives its header
+std::vector<uint8_t> ReadFrameStream(const RandomAccessFile &file, const FrameEntry &f,
+                                     uint8_t flags, FrameHeader &h) {
+  uint64_t size = file.Size();
+  size_t header = HeaderSize(flags);
+  if (size - f.offset < header) Corrupt();
+  h = GetHeader(file.ReadAt(f.offset, header).data(), flags);
+  if (h.raw_size != f.raw_size || h.size == 0 || size - f.offset - header < h.size) Corrupt();
+  return file.ReadAt(f.offset + header, h.size);
+}
+
+// Fill in the raw hash of every frame of a file written without them by
+// decoding the frames, one per thread at a time
+void HashFrames(const RandomAccessFile &file, uint8_t flags, std::vector<FrameEntry> &table,
+                unsigned threads) {
+  for (size_t first = 0; first < table.size(); first += threads) {
+    size_t count = std::min<size_t>(threads, table.size() - first);
+    std::vector<std::vector<uint8_t>> streams(count);
+    std::vector<FrameHeader> headers(count);
+    for (size_t i = 0; i < count; i++) {
+      streams[i] = ReadFrameStream(file, table[first + i], flags, headers[i]);
+    }
+    std::vector<BlockRef> refs;
+    size_t raw_total = 0;
+    for (size_t i = 0; i < count; i++) {
+      refs.push_back({raw_total, headers[i].raw_size, streams[i].data(), streams[i].size()});
+      raw_total += headers[i].raw_size;
+    }
+    std::vector<uint8_t> raw = DecodeFrames(refs, headers, raw_total, flags, threads, first);
+    for (size_t i = 0; i < count; i++) {
+      table[first + i].raw_hash = FrameHash(raw.data() + refs[i].raw_offset, refs[i].raw_size);
+    }
+  }
+}
+
+std::vector<uint8_t> Slice(const std::vector<uint8_t> &data, uint64_t offset,
+                           uint64_t length) {
+  if (offset >= data.size()) return {};
+  size_t n = (size_t)std::min<uint64_t>(length, data.size() - offset);
+  return std::vector<uint8_t>(data.begin() + offset, data.begin() + offset + n);
+}
+
+void PutHeader(std::vector<uint8_t> &out, const std::string &base, uint8_t flags,
+               const ContainerMeta &meta, const std::vector<uint8_t> &member_table = {}) {
+  out.push_back(KC_MAGIC[0]);
+  out.push_back(KC_MAGIC[1]);
+  out.push_back(KC_VERSION);
+  Put16(out, base.size());
+  out.insert(out.end(), base.begin(), base.end());
+  out.push_back(flags);
+  if (flags & KC_FLAG_META) {
+    std::vector<uint8_t> block = EncodeMeta(meta);
+    out.insert(out.end(), block.begin(), block.end());
+  }
+  if (flags & KC_FLAG_ARCHIVE) {
+    Put32(out, member_table.size());
+    out.insert(out.end(), member_table.begin(), member_table.end());
+  }
+}
+
+void PutIndex(std::vector<uint8_t> &out, const std::vector<FrameEntry> &table,
+              uint64_t raw_total, uint8_t flags) {
+  for (const auto &f : table) {
+    Put64(out, f.offset);
+    Put64(out, f.raw_offset);
+    if (flags & KC_FLAG_FRAME_HASH) Put64(out, f.raw_hash);
+  }
+  Put64(out, raw_total);
+  Put32(out, table.size());
+  out.insert(out.end(), INDEX_MAGIC, INDEX_MAGIC + 4);
+}
+
+// The `n` bytes after the end marker must be an index of exactly `table`
+// (frame hashes are not checked; the frame CRCs cover the data)
+void CheckIndex(const uint8_t *p, size_t n, const std::vector<FrameEntry> &table,
+                uint64_t raw_total, uint8_t flags) {
+  size_t entry = IndexEntrySize(flags);
+  if (n != entry * table.size() + INDEX_FOOTER) Corrupt();
+  for (const auto &f : table) {
+    if (Get64(p) != f.offset || Get64(p + 8) != f.raw_offset) Corrupt();
+    p += entry;
+  }
+  if (Get64(p) != raw_total || Get32(p + 8) != table.size() ||
+      !std::equal(INDEX_MAGIC, INDEX_MAGIC + 4, p + 12))
+    Corrupt();
+}
+
+// Exactly `n` bytes from a stream, read in bounded steps
+std::vector<uint8_t> ReadExactly(std::FILE *in, size_t n) {
+  std::vector<uint8_t> buf;
+  while (buf.size() < n) {
+    size_t old = buf.size();
+    size_t step = std::min(n - old, STREAM_READ);
+    buf.resize(old + step);
+    if (ReadUpTo(in, buf.data() + old, step) != step) Corrupt();
+  }
+  return buf;
+}
+
+class FileSink : public ByteSink {
+public:
+  explicit FileSink(std::FILE *f) : f_(f) {}
+  void Write(const uint8_t *data, size_t n) override {
+    if (f_) WriteBytes(f_, data, n);
+  }
+  void Flush() override {
+    if (f_ && std::fflush(f_) != 0) throw std::runtime_error("write failed");
+  }
+
+private:
+  std::FILE *f_;
+};
+
+// Everything left in a stream
+void ReadRest(std::FILE *in, std::vector<uint8_t> &buf) {
+  while (true) {
+    size_t old = buf.size();
+    buf.resize(old + STREAM_READ);
+    size_t got = ReadUpTo(in, buf.data() + old, STREAM_READ);
+    buf.resize(old + got);
+    if (got < STREAM_READ) return;
+  }
+}
+
+} // namespace
+
+std::vector<uint8_t> WriteContainer(const std::vector<uint8_t> &in, const std::string &name,
+                                    const HybridOptions &opts,
+                                    const ContainerOptions &copts) {
+  return WriteContainer(in.data(), in.size(), name, opts, copts);
+}
+
+std::vector<uint8_t> WriteContainer(const uint8_t *in, size_t in_size, const std::string &name,
+                                    const HybridOptions &opts,
+                                    const ContainerOptions &copts) {
+  std::vector<std::vector<uint8_t>> frames;
+  std::vector<size_t> ends;
+  if (in_size > 0) {
+    ends = SplitBlocks(in, in_size, FrameSize(copts), false);
+    HybridOptions frame_opts = StartBudget(opts);
+    frame_opts.record_sizes = true;
+    frames = copts.dedup ? Deduplicator().CompressFrames(in, in_size, ends, 0, frame_opts)
+                         : CompressBlockStreams(in, in_size, ends, frame_opts);
+  }
+
+  uint8_t flags = ContainerFlags(copts);
+  std::string base = BaseName(name);
+  size_t total = 6 + base.size() + HeaderSize(flags) * frames.size() + TrailerSize(flags);
+  if (copts.index) total += IndexEntrySize(flags) * frames.size() + INDEX_FOOTER;
+  if (copts.meta) total += 2 + META_SIZE;
+  for (const auto &f : frames) total += f.size();
+
+  ContainerMeta meta;
+  if (copts.meta) {
+    meta.raw_size = in_size;
+    meta.frames = frames.size();
+    meta.mtime = copts.mtime;
+    meta.created = copts.created;
+    size_t start = 0;
+    for (size_t f = 0; f < frames.size(); f++) {
+      FrameModes(frames[f].data(), frames[f].size(), flags, start, ends[f] - start, meta.modes);
+      start = ends[f];
+    }
+  }
+
+  std::vector<uint8_t> out;
+  out.reserve(total);
+  PutHeader(out, base, flags, meta);
+
+  std::vector<FrameEntry> table;
+  size_t start = 0;
+  for (size_t f = 0; f < frames.size(); f++) {
+    const uint8_t *raw = in + start;
+    size_t raw_size = ends[f] - start;
+    table.push_back({out.size(), start, raw_size});
+    if (flags & KC_FLAG_FRAME_HASH) table.back().raw_hash = FrameHash(raw, raw_size);
+    PutFrame(out, raw, raw_size, frames[f].data(), frames[f].size(), flags);
+    std::vector<uint8_t>().swap(frames[f]);  // Copied into the file; free it now
+    start = ends[f];
+  }
+  Put32(out, 0);
+
+  if (copts.hash) {
+    Hash64 hash;
+    hash.Update(in, in_size);
+    Put64(out, hash.Digest());
+  }
+  if (copts.index) PutIndex(out, table, in_size, flags);
+  return out;
+}
+
+std::vector<uint8_t> ReadContainer(const std::vector<uint8_t> &file, std::string &name,
+                                   unsigned threads) {
+  return ReadContainer(file.data(), file.size(), name, threads);
+}
+
+std::vector<uint8_t> ReadContainer(const uint8_t *p, size_t n, std::string &name,
+                                   unsigned threads) {
+  name.clear();
+  bool tagged = n >= 5 && p[0] == KC_MAGIC[0] && p[1] == KC_MAGIC[1];
+  uint8_t version = tagged ? p[2] : 0;
+  size_t name_len = tagged ? (size_t)(p[3] | (p[4] << 8)) : 0;
+
+  if (!tagged || (version != V2 && version != KC_VERSION) || n < 5 + name_len) {
+    return DecompressHybrid(p, n, threads);
+  }
+  name.assign((const char *)p + 5, name_len);
+  size_t pos = 5 + name_len;
+
+  // v2: the hybrid stream follows the name, decoded in place
+  if (version == V2) return DecompressHybrid(p + pos, n - pos, threads);
+
+  if (pos >= n || (p[pos] & ~KC_KNOWN_FLAGS)) Corrupt();
+  uint8_t flags = p[pos++];
+  size_t header = HeaderSize(flags);
+
+  // Locate every frame, then decode them in parallel
+  if (flags & KC_FLAG_META) {
+    if (n - pos < 2 || n - pos - 2 < Get16(p + pos)) Corrupt();
+    pos += 2 + (size_t)Get16(p + pos);
+  }
+  if (flags & KC_FLAG_ARCHIVE) {
+    if (n - pos < 4 || n - pos - 4 < Get32(p + pos)) Corrupt();
+    pos += 4 + (size_t)Get32(p + pos);
+  }
+  std::vector<BlockRef> frames;
+  std::vector<FrameHeader> headers;
+  std::vector<FrameEntry> table;
+  size_t raw_total = 0;
+  while (true) {
+    if (n - pos < 4) Corrupt();
+    if (Get32(p + pos) == 0) break;
+    if (n - pos < header) Corrupt();
+    FrameHeader h = GetHeader(p + pos, flags);
+    table.push_back({pos, raw_total, h.raw_size});
+    pos += header;
+    if (h.size == 0 || n - pos < h.size) Corrupt();
+    frames.push_back({raw_total, h.raw_size, p + pos, h.size});
+    headers.push_back(h);
+    raw_total += h.raw_size;
+    pos += h.size;
+  }
+  if (n - pos < TrailerSize(flags)) Corrupt();
+  uint64_t stored_hash = (flags & KC_FLAG_HASH) ? Get64(p + pos + 4) : 0;
+  pos += TrailerSize(flags);
+
+  if (flags & KC_FLAG_INDEX) {
+    CheckIndex(p + pos, n - pos, table, raw_total, flags);
+  } else if (pos != n) {
+    Corrupt();
+  }
+
+  std::vector<uint8_t> out = DecodeFrames(frames, headers, raw_total, flags, threads);
+  if (flags & KC_FLAG_HASH) {
+    Hash64 hash;
+    hash.Update(out.data(), out.size());
+    if (hash.Digest() != stored_hash) Mismatch("file");
+  }
+  return out;
+}
+
+std::vector<uint8_t> ReadContainerRange(const std::string &path, uint64_t offset,
+                                        uint64_t length, std::string &name,
+                                        unsigned threads) {
+  name.clear();
+  RandomAccessFile file(path);
+  uint64_t size = file.Size();
+  uint8_t flags = 0;
+  uint64_t pos = 0;
+  if (!ReadV3Header(file, name, flags, pos)) {
+    MappedFile whole(path);
+    return Slice(ReadContainer(whole.Data(), whole.Size(), name, threads), offset, length);
+  }
+  std::vector<FrameEntry> table =
+      (flags & KC_FLAG_INDEX) ? ReadIndex(file, pos, flags) : WalkFrames(file, pos, flags);
+  size_t header = HeaderSize(flags);
+
+  uint64_t raw_total = table.empty() ? 0 : table.back().raw_offset + table.back().raw_size;
+  if (offset >= raw_total || length == 0) return {};
+  uint64_t end = offset + std::min(length, raw_total - offset);
+
+  // Read just the frames overlapping [offset, end)
+  auto first = std::upper_bound(table.begin(), table.end(), offset,
+                                [](uint64_t v, const FrameEntry &f) { return v < f.raw_offset; }) - 1;
+  std::vector<std::vector<uint8_t>> streams;
+  std::vector<BlockRef> refs;
+  std::vector<FrameHeader> headers;
+  uint64_t base = first->raw_offset;
+  for (auto f = first; f != table.end() && f->raw_offset < end; ++f) {
+    FrameHeader h;
+    streams.push_back(ReadFrameStream(file, *f, flags, h));
+    refs.push_back({(size_t)(f->raw_offset - base), (size_t)f->raw_size,
+                    streams.back().data(), streams.back().size()});
+    headers.push_back(h);
+  }
+  uint64_t span = refs.back().raw_offset + refs.back().raw_size;
+  EarlierFrames earlier(table, flags, threads, [&](size_t f) {
+    if (size - table[f].offset < header) Corrupt();
+    FrameHeader h = GetHeader(file.ReadAt(table[f].offset, header).data(), flags);
+    if (size - table[f].offset - header < h.size) Corrupt();
+    return file.ReadAt(table[f].offset, header + h.size);
+  });
+  std::vector<uint8_t> out =
+      DecodeFrames(refs, headers, (size_t)span, flags, threads, first - table.begin(), base,
+                   [&](uint64_t source, size_t n, uint8_t *dst) { earlier.Copy(source, n, dst); });
+  return Slice(out, offset - base, end - offset);
+}
+
+ContainerInfo InspectContainer(const std::string &path) {
+  RandomAccessFile file(path);
+  ContainerInfo info;
+  info.size = file.Size();
+  uint64_t pos = 0;
+  if (ReadV3Header(file, info.name, info.flags, pos, &info.meta)) {
+    info.version = KC_VERSION;
+    // Older writers and pipes leave the totals to the frames themselves
+    if (info.meta.raw_size == KC_UNKNOWN || info.meta.frames == KC_UNKNOWN) {
+      std::vector<FrameEntry> table = (info.flags & KC_FLAG_INDEX)
+                                          ? ReadIndex(file, pos, info.flags)
+                                          : WalkFrames(file, pos, info.flags);
+      info.meta.raw_size = table.empty() ? 0 : table.back().raw_offset + table.back().raw_size;
+      info.meta.frames = table.size();
+    }
+    return info;
+  }
+
+  std::vector<uint8_t> head = file.ReadAt(0, std::min<uint64_t>(info.size, 5));
+  if (head.size() == 5 && head[0] == KC_MAGIC[0] && head[1] == KC_MAGIC[1] && head[2] == V2) {
+    size_t name_len = head[3] | (head[4] << 8);
+    if (info.size >= 5 + name_len) {
+      std::vector<uint8_t> stored = file.ReadAt(5, name_len);
+      info.name.assign(stored.begin(), stored.end());
+      info.version = V2;
+    }
+  }
+  return info;
+}
+
+ContainerWriter::ContainerWriter(std::FILE *out, const std::string &name,
+                                 const ContainerOptions &copts,
+                                 const std::vector<uint8_t> &member_table)
+    : out_(out),
+      flags_(ContainerFlags(copts) | (member_table.empty() ? 0 : KC_FLAG_ARCHIVE)),
+      origin_(IsAppendOnly(out) ? -1 : ftello(out)) {
+  std::string base = BaseName(name);
+  meta_.mtime = copts.mtime;
+  meta_.created = copts.created;
+  meta_at_ = 6 + base.size();
+  std::vector<uint8_t> head;
+  PutHeader(head, base, flags_, meta_, member_table);
+  WriteBytes(out_, head.data(), head.size());
+  written_ = head.size();
+}
+
+ContainerWriter::ContainerWriter(std::FILE *out, const std::string &stored_name, uint8_t flags,
+                                 const ContainerMeta &meta)
+    : out_(out), flags_(flags), origin_(0), meta_at_(6 + stored_name.size()), meta_(meta) {
+  written_ = meta_at_ + ((flags & KC_FLAG_META) ? 2 + META_SIZE : 0);
+}
+
+void ContainerWriter::AddFrames(const std::vector<uint8_t> &raw, const std::vector<size_t> &ends,
+                                const HybridOptions &opts) {
+  AddFrames(raw.data(), raw.size(), ends, opts);
+}
+
+void ContainerWriter::AddFrames(const uint8_t *raw, size_t n, const std::vector<size_t> &ends,
+                                const HybridOptions &opts) {
+  // The time budget covers the whole file, from the first frames on
+  if (opts.time_budget > 0 && deadline_ == std::chrono::steady_clock::time_point{}) {
+    deadline_ = StartBudget(opts).deadline;
+  }
+  HybridOptions frame_opts = opts;
+  if (opts.deadline == std::chrono::steady_clock::time_point{}) frame_opts.deadline = deadline_;
+  frame_opts.record_sizes = true;
+  std::vector<std::vector<uint8_t>> frames =
+      (flags_ & KC_FLAG_DEDUP) ? dedup_.CompressFrames(raw, n, ends, raw_total_, frame_opts)
+                               : CompressBlockStreams(raw, n, ends, frame_opts);
+  size_t start = 0;
+  for (size_t f = 0; f < frames.size(); f++) {
+    PutFrameAt(raw + start, ends[f] - start, std::move(frames[f]));
+    start = ends[f];
+  }
+}
+
+void ContainerWriter::CopyFrame(const uint8_t *raw, size_t raw_size, const uint8_t *stream,
+                                size_t n) {
+  PutFrameAt(raw, raw_size, stream, n);
+}
+
+void ContainerWriter::KeepFrame(const uint8_t *raw, size_t raw_size, const uint8_t *stream,
+                                size_t n) {
+  if (flags_ & KC_FLAG_DEDUP) dedup_.Learn(raw, raw_size, raw_total_);
+  Account(raw, raw_size, stream, n);
+}
+
+// The frame header and the stream are written separately, so the stream
+// is never copied behind its header
+void ContainerWriter::PutFrameAt(const uint8_t *raw, size_t raw_size, const uint8_t *stream,
+                                 size_t n) {
+  if (behind_ || ring_) {
+    // The queue owns what it writes
+    PutFrameAt(raw, raw_size, std::vector<uint8_t>(stream, stream + n));
+    return;
+  }
+  std::vector<uint8_t> header;
+  PutFrameHeader(header, raw, raw_size, stream, n, flags_);
+  WriteBytes(out_, header.data(), header.size());
+  WriteBytes(out_, stream, n);
+  Account(raw, raw_size, stream, n);
+}
+
+void ContainerWriter::PutFrameAt(const uint8_t *raw, size_t raw_size,
+                                 std::vector<uint8_t> &&stream) {
+  if (!behind_ && !ring_) {
+    PutFrameAt(raw, raw_size, stream.data(), stream.size());
+    return;
+  }
+  std::vector<uint8_t> header;
+  PutFrameHeader(header, raw, raw_size, stream.data(), stream.size(), flags_);
+  Account(raw, raw_size, stream.data(), stream.size());
+  Queue(std::move(header));
+  Queue(std::move(stream));
+}
+
+void ContainerWriter::Queue(std::vector<uint8_t> &&bytes) {
+  if (ring_) {
+    while (ring_->Pending() >= ring_->Capacity()) Reap();
+    uint64_t tag = next_tag_++;
+    RingWrite &w = in_flight_[tag];
+    w.bytes = std::move(bytes);
+    w.offset = ring_at_;
+    ring_at_ += w.bytes.size();
+    if (!ring_->Write(fileno(out_), w.bytes.data(), w.bytes.size(), w.offset, tag)) {
+      WriteAt(fileno(out_), w.bytes.data(), w.bytes.size(), w.offset);  // Not queued
+      in_flight_.erase(tag);
+      return;
+    }
+    ring_->Submit();
+    return;
+  }
+  try {
+    behind_->Push(std::move(bytes));
+  } catch (const ChunkChannel::Abandoned &) {
+    DrainWrites();  // The writer failed; report its error
+  }
+}
+
+void ContainerWriter::Reap() {
+  uint64_t tag;
+  int64_t res;
+  ring_->Wait(tag, res);
+  auto it = in_flight_.find(tag);
+  if (it == in_flight_.end()) throw std::logic_error("unknown io_uring completion");
+  RingWrite w = std::move(it->second);
+  in_flight_.erase(it);
+  if (res < 0) throw std::runtime_error("write failed");
+  // A short write is finished synchronously
+  if ((size_t)res < w.bytes.size()) {
+    WriteAt(fileno(out_), w.bytes.data() + res, w.bytes.size() - res, w.offset + res);
+  }
+}
+
+ContainerWriter::~ContainerWriter() {
+  ring_.reset();  // Waits for the writes in flight
+  if (!behind_) return;
+  behind_->Close();
+  writer_.join();
+}
+
+void ContainerWriter::WriteBehind(size_t frames, bool io_uring) {
+  if (behind_ || ring_) return;
+  // Positional writes would land in any order on an O_APPEND file (`>>`)
+  if (io_uring && IsRegularFile(out_) && !IsAppendOnly(out_)) {
+    // Header and stream of each frame in flight; stdio's buffer goes out
+    // first, and the stream position is restored once the writes drain
+    auto ring = std::make_unique<IoRing>((unsigned)std::min<size_t>(2 * frames, 4096));
+    off_t at = std::fflush(out_) == 0 ? ftello(out_) : -1;
+    if (ring->Available() && at >= 0) {
+      ring_at_ = (uint64_t)at;
+      ring_ = std::move(ring);
+      return;
+    }
+  }
+  behind_ = std::make_unique<ChunkChannel>(2 * frames);  // Header and stream of each
+  writer_ = std::thread([this] {
+    try {
+      std::vector<uint8_t> bytes;
+      while (behind_->Pop(bytes)) WriteBytes(out_, bytes.data(), bytes.size());
+    } catch (...) {
+      write_error_ = std::current_exception();
+      behind_->Abandon();
+    }
+  });
+}
+
+void ContainerWriter::DrainWrites() {
+  if (ring_) {
+    while (!in_flight_.empty()) Reap();
+    ring_.reset();
+    if (fseeko(out_, (off_t)ring_at_, SEEK_SET) != 0) throw std::runtime_error("write failed");
+    return;
+  }
+  if (!behind_) return;
+  behind_->Close();
+  writer_.join();
+  behind_.reset();
+  if (write_error_) std::rethrow_exception(write_error_);
+}
+
+void ContainerWriter::Account(const uint8_t *raw, size_t raw_size, const uint8_t *stream,
+                              size_t n) {
+  table_.push_back({written_, raw_total_, raw_size});
+  if (flags_ & KC_FLAG_FRAME_HASH) table_.back().raw_hash = FrameHash(raw, raw_size);
+  if (flags_ & KC_FLAG_META) FrameModes(stream, n, flags_, raw_total_, raw_size, meta_.modes);
+  written_ += HeaderSize(flags_) + n;
+  if (flags_ & KC_FLAG_HASH) hash_.Update(raw, raw_size);
+  raw_total_ += raw_size;
+}
+
+uint64_t ContainerWriter::Finish() {
+  DrainWrites();
+  std::vector<uint8_t> tail;
+  Put32(tail, 0);
+  if (flags_ & KC_FLAG_HASH) Put64(tail, hash_.Digest());
+  if (flags_ & KC_FLAG_INDEX) PutIndex(tail, table_, raw_total_, flags_);
+  WriteBytes(out_, tail.data(), tail.size());
+  written_ += tail.size();
+
+  // Fill in the metadata now that the totals are known; a pipe or an
+  // appending output (where the write would land at the end) keeps the
+  // placeholder written with the header
+  if ((flags_ & KC_FLAG_META) && origin_ >= 0) {
+    meta_.raw_size = raw_total_;
+    meta_.frames = table_.size();
+    std::vector<uint8_t> block = EncodeMeta(meta_);
+    if (fseeko(out_, origin_ + (off_t)meta_at_, SEEK_SET) != 0) {
+      throw std::runtime_error("cannot seek back to the .kc header");
+    }
+    WriteBytes(out_, block.data(), block.size());
+    if (fseeko(out_, origin_ + (off_t)written_, SEEK_SET) != 0) {
+      throw std::runtime_error("cannot seek to the end of the .kc file");
+    }
+  }
+  return written_;
+}
+
+namespace {
+
+// Compress the rest of `in` into `writer`, which writes to `out`, and
+// finish the file
+uint64_t CompressRest(std::FILE *in, std::FILE *out, ContainerWriter &writer,
+                      const HybridOptions &opts, const ContainerOptions &copts,
+                      const std::function<void(uint64_t)> &progress) {
+  size_t frame_size = FrameSize(copts);
+  unsigned batch = opts.threads ? opts.threads : ThreadPool::DefaultThreads();
+
+  // Live input: one frame at a time, cut at whichever flush point comes
+  // first and pushed through to the reader. The frame's own coder state
+  // ends with it; frames stay independent, so nothing carries over.
+  if (copts.flush_bytes || copts.flush_interval > 0) {
+    using Clock = std::chrono::steady_clock;
+    size_t limit = copts.flush_bytes ? std::min(copts.flush_bytes, frame_size) : frame_size;
+    auto interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(copts.flush_interval));
+    Clock::time_point due;
+    std::vector<uint8_t> buf;
+    bool eof = false;
+    while (!eof) {
+      int wait = -1;
+      if (!buf.empty() && copts.flush_interval > 0) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(due - Clock::now());
+        wait = (int)std::max<int64_t>(0, left.count());
+      }
+      size_t old = buf.size();
+      buf.resize(limit);
+      size_t got = ReadSome(in, buf.data() + old, limit - old, wait, eof);
+      buf.resize(old + got);
+      if (old == 0 && got > 0) due = Clock::now() + interval;
+
+      bool timed_out = copts.flush_interval > 0 && Clock::now() >= due;
+      if (buf.empty() || (buf.size() < limit && !eof && !timed_out)) continue;
+      writer.AddFrames(buf, {buf.size()}, opts);
+      if (std::fflush(out) != 0) throw std::runtime_error("write failed");
+      if (progress) progress(writer.RawSize());
+      buf.clear();
+    }
+    return writer.Finish();
+  }
+
+  // One frame per thread at a time; frames cut the same way as in
+  // WriteContainer, so the file matches its output byte for byte. Reading,
+  // compressing and writing overlap: a batch is compressed while the next
+  // one is read and the previous one written behind.
+  size_t batch_size = frame_size * batch;
+  writer.WriteBehind(batch, copts.io_uring);
+
+  // A regular file is read through io_uring: the next batch is in flight,
+  // as several requests, while this one is compressed. The buffers are
+  // declared first so they outlive the ring, whose destructor waits for
+  // requests in flight.
+  std::vector<uint8_t> current, next;
+  std::unique_ptr<IoRing> ring;
+  if (copts.io_uring && IsRegularFile(in)) ring = std::make_unique<IoRing>(RING_DEPTH);
+  if (ring && ring->Available()) {
+    int fd = fileno(in);
+    off_t at = ftello(in);
+    struct stat st;
+    if (at < 0 || ::fstat(fd, &st) != 0 || at > st.st_size) throw std::runtime_error("read failed");
+    uint64_t pos = (uint64_t)at, end = (uint64_t)st.st_size;
+    size_t piece = std::max(RING_READ, (batch_size + ring->Capacity() - 1) / ring->Capacity());
+    IoRing &reads = *ring;
+    auto start = [&](std::vector<uint8_t> &buf, uint64_t from) {
+      buf.resize((size_t)std::min<uint64_t>(batch_size, end - from));
+      for (size_t off = 0; off < buf.size(); off += piece) {
+        size_t len = std::min(piece, buf.size() - off);
+        // A piece the ring has no room for is read here instead
+        if (!reads.Read(fd, buf.data() + off, len, from + off, off)) {
+          ReadAt(fd, buf.data() + off, len, from + off);
+        }
+      }
+      reads.Submit();
+    };
+    // Short reads are finished synchronously
+    auto finish = [&](std::vector<uint8_t> &buf, uint64_t from) {
+      while (reads.Pending() > 0) {
+        uint64_t off;
+        int64_t res;
+        reads.Wait(off, res);
+        if (res < 0) throw std::runtime_error("read failed");
+        size_t want = std::min(piece, buf.size() - off);
+        if ((size_t)res < want) ReadAt(fd, buf.data() + off + res, want - res, from + off + res);
+      }
+    };
+
+    start(next, pos);
+    while (!next.empty()) {
+      finish(next, pos);
+      std::swap(current, next);
+      uint64_t at_next = pos + current.size();
+      if (at_next < end) start(next, at_next);
+      else next.clear();
+      writer.AddFrames(current, SplitBlocks(current, frame_size, false), opts);
+      pos = at_next;
+      if (progress) progress(writer.RawSize());
+    }
+    ring.reset();
+    fseeko(in, 0, SEEK_END);
+    return writer.Finish();
+  }
+  ring.reset();
+
+  // Without io_uring a regular file is mapped and its batches compressed in place, so the
+  // only copies are the one block per worker the coders take; the kernel
+  // is asked for the next batch while this one is compressed
+  if (IsRegularFile(in)) {
+    off_t at = ftello(in);
+    MappedFile map(in);
+    if (at < 0 || (uint64_t)at > map.Size()) throw std::runtime_error("read failed");
+    for (size_t pos = at; pos < map.Size();) {
+      size_t n = std::min(map.Size() - pos, batch_size);
+      map.Prefetch(pos + n, batch_size);
+      writer.AddFrames(map.Data() + pos, n, SplitBlocks(map.Data() + pos, n, frame_size, false),
+                       opts);
+      pos += n;
+      if (progress) progress(writer.RawSize());
+    }
+    fseeko(in, 0, SEEK_END);
+    return writer.Finish();
+  }
+
+  // Anything else is read ahead on a thread of its own. A pipe serves one
+  // read at a time, so io_uring could not keep more in flight. The reader
+  // polls, so it notices within READ_POLL_MS when the compressor gives up
+  // even if the input has gone quiet.
+  ChunkChannel batches(READ_AHEAD_BATCHES);
+  std::exception_ptr error;
+  std::atomic<bool> stop{false};
+  std::thread reader([&] {
+    try {
+      bool eof = false;
+      while (!eof && !stop) {
+        std::vector<uint8_t> buf(batch_size);
+        size_t got = 0;
+        while (got < batch_size && !eof && !stop) {
+          got += ReadSome(in, buf.data() + got, batch_size - got, READ_POLL_MS, eof);
+        }
+        buf.resize(got);
+        if (!buf.empty() && !stop) batches.Push(std::move(buf));
+      }
+    } catch (const ChunkChannel::Abandoned &) {
+      // The compressing side failed and reports its own error
+    } catch (...) {
+      error = std::current_exception();
+    }
+    batches.Close();
+  });
+
+  try {
+    std::vector<uint8_t> buf;
+    while (batches.Pop(buf)) {
+      writer.AddFrames(buf, SplitBlocks(buf, frame_size, false), opts);
+      if (progress) progress(writer.RawSize());
+    }
+  } catch (...) {
+    stop = true;
+    batches.Abandon();
+    reader.join();
+    throw;
+  }
+  reader.join();
+  if (error) std::rethrow_exception(error);
+  return writer.Finish();
+}
+
+} // namespace
+
+uint64_t WriteContainerStream(std::FILE *in, std::FILE *out, const std::string &name,
+                              const HybridOptions &opts, const ContainerOptions &copts,
+                              const std::function<void(uint64_t)> &progress) {
+  ContainerWriter writer(out, name, copts);
+  return CompressRest(in, out, writer, opts, copts, progress);
+}
+
+ResumeStats ResumeContainer(const std::string &in_path, const std::string &out_path,
+                            const HybridOptions &opts, const ContainerOptions &copts,
+                            const std::function<void(uint64_t)> &progress) {
+  ResumeStats stats;
+  std::FILE *in = std::fopen(in_path.c_str(), "rb");
+  if (!in) throw std::runtime_error("open failed: " + in_path);
+  bool fresh = GetFileSize(out_path) == 0;
+  std::FILE *out = std::fopen(out_path.c_str(), fresh ? "wb" : "r+b");
+  if (!out) {
+    std::fclose(in);
+    throw std::runtime_error("open failed: " + out_path);
+  }
+  try {
+    if (fresh) {
+      stats.size = WriteContainerStream(in, out, in_path, opts, copts, progress);
+    } else {
+      RandomAccessFile partial(out_path);
+      RandomAccessFile input(in_path);
+      std::string name;
+      uint8_t flags = 0;
+      uint64_t pos = 0;
+      ContainerMeta meta;
+      bool v3 = false;
+      try {
+        v3 = ReadV3Header(partial, name, flags, pos, &meta);
+      } catch (const std::runtime_error &) {
+      }
+      if (!v3) throw std::runtime_error(out_path + " is not a v3 .kc file; cannot resume");
+      if (!(flags & KC_FLAG_CRC)) {
+        throw std::runtime_error(out_path + " has no frame checksums; cannot resume");
+      }
+      if (flags & KC_FLAG_ARCHIVE) {
+        throw std::runtime_error(out_path + " is an archive; --resume continues single files");
+      }
+
+      // Keep frames up to the first one that is cut short or damaged; the
+      // end marker and anything after it are written again
+      ContainerWriter writer(out, name, flags, meta);
+      if (writer.Size() != pos) {
+        throw std::runtime_error(out_path + " has a newer header layout; cannot resume");
+      }
+      size_t header = HeaderSize(flags);
+      uint64_t size = partial.Size();
+      size_t frame_size = 0;
+      while (size - pos >= header) {
+        std::vector<uint8_t> bytes = partial.ReadAt(pos, header);
+        if (!ValidRawSize(Get32(bytes.data()))) break;
+        FrameHeader h = GetHeader(bytes.data(), flags);
+        uint64_t raw_at = writer.RawSize();
+        if (h.size == 0 || size - pos - header < h.size ||
+            input.Size() - raw_at < h.raw_size)
+          break;
+        std::vector<uint8_t> stream = partial.ReadAt(pos + header, h.size);
+        if (Crc32c(stream.data(), stream.size()) != h.stream_crc) break;
+        std::vector<uint8_t> raw = input.ReadAt(raw_at, h.raw_size);
+        if (Crc32c(raw.data(), raw.size()) != h.raw_crc) {
+          throw std::runtime_error(in_path + " does not match the data in " + out_path);
+        }
+        writer.KeepFrame(raw.data(), raw.size(), stream.data(), stream.size());
+        frame_size = std::max<size_t>(frame_size, h.raw_size);
+        pos += header + h.size;
+        stats.kept_frames++;
+      }
+      stats.kept_bytes = writer.RawSize();
+
+      std::filesystem::resize_file(out_path, pos);
+      if (fseeko(out, (off_t)pos, SEEK_SET) != 0 ||
+          fseeko(in, (off_t)stats.kept_bytes, SEEK_SET) != 0) {
+        throw std::runtime_error("cannot seek to resume " + out_path);
+      }
+      ContainerOptions rest = copts;
+      if (frame_size) rest.frame_size = frame_size;
+      if (progress) progress(stats.kept_bytes);
+      stats.size = CompressRest(in, out, writer, opts, rest, progress);
+    }
+  } catch (...) {
+    std::fclose(in);
+    std::fclose(out);
+    throw;
+  }
+  std::fclose(in);
+  if (std::fclose(out) != 0) throw std::runtime_error("write failed: " + out_path);
+  return stats;
+}
+
+UpdateStats UpdateContainer(const std::string &old_path, const std::string &in_path,
+                            std::FILE *out, const HybridOptions &opts, ContainerOptions copts,
+                            const std::function<void(uint64_t)> &progress) {
+  unsigned threads = opts.threads ? opts.threads : ThreadPool::DefaultThreads();
+
+  // Frames of the old file and the hashes of their raw data; an older
+  // layout has no frames to offer, so everything is compressed afresh
+  RandomAccessFile old(old_path);
+  std::string old_name;
+  uint8_t flags = 0;
+  uint64_t first = 0;
+  std::vector<FrameEntry> table;
+  if (ReadV3Header(old, old_name, flags, first)) {
+    if (flags & KC_FLAG_ARCHIVE) {
+      throw std::runtime_error(old_path + " is an archive; kcomp u updates single files");
+    }
+    if (flags & KC_FLAG_DEDUP) {
+      throw std::runtime_error(old_path + " is deduplicated and cannot be updated");
+    }
+    table = (flags & KC_FLAG_INDEX) ? ReadIndex(old, first, flags) : WalkFrames(old, first, flags);
+    if (!(flags & KC_FLAG_FRAME_HASH)) HashFrames(old, flags, table, threads);
+  }
+  uint64_t old_total = table.empty() ? 0 : table.back().raw_offset + table.back().raw_size;
+
+  // The largest old frame is a full one unless the file had a single frame
+  size_t frame_size = copts.frame_size;
+  if (frame_size == 0 && table.size() > 1) {
+    for (const auto &f : table) frame_size = std::max<size_t>(frame_size, f.raw_size);
+  }
+  if (frame_size == 0) frame_size = DEFAULT_FRAME_SIZE;
+  frame_size = std::min(frame_size, MAX_FRAME_SIZE);
+  copts.frame_size = frame_size;
+  copts.index = true;
+  copts.frame_hashes = true;
+  copts.dedup = false;
+
+  RandomAccessFile in(in_path);
+  uint64_t n = in.Size();
+  ContainerWriter writer(out, in_path, copts);
+  UpdateStats stats;
+  stats.raw_size = n;
+
+  // An old frame may reappear in place, or moved by the change in size
+  // (the data after an insertion or deletion)
+  int64_t delta = (int64_t)n - (int64_t)old_total;
+  std::vector<int64_t> shifts = {0};
+  if (delta != 0) shifts.push_back(delta);
+
+  // Changed bytes wait here until a copied frame or a full batch flushes
+  // them, cut into frames as in WriteContainer
+  std::vector<uint8_t> pending;
+  auto compress = [&](bool all) {
+    size_t take = all ? pending.size() : pending.size() / frame_size * frame_size;
+    if (take == 0) return;
+    std::vector<uint8_t> rest(pending.begin() + take, pending.end());
+    pending.resize(take);
+    writer.AddFrames(pending, SplitBlocks(pending, frame_size, false), opts);
+    pending.swap(rest);
+  };
+  auto by_offset = [](uint64_t v, const FrameEntry &f) { return v < f.raw_offset; };
+
+  uint64_t pos = 0;
+  while (pos < n) {
+    bool copied = false;
+    for (int64_t shift : shifts) {
+      int64_t at = (int64_t)pos - shift;
+      if (at < 0 || (uint64_t)at >= old_total) continue;
+      auto f = std::upper_bound(table.begin(), table.end(), (uint64_t)at, by_offset) - 1;
+      if (f->raw_offset != (uint64_t)at || n - pos < f->raw_size) continue;
+      // A short last frame followed by appended data is recompressed with
+      // it, so repeated appends do not leave a trail of small frames
+      if (f + 1 == table.end() && f->raw_size < frame_size && n - pos > f->raw_size) continue;
+      std::vector<uint8_t> raw = in.ReadAt(pos, f->raw_size);
+      if (FrameHash(raw.data(), raw.size()) != f->raw_hash) continue;
+
+      // The old stream must be intact; its raw CRC confirms the match
+      FrameHeader h;
+      std::vector<uint8_t> stream = ReadFrameStream(old, *f, flags, h);
+      if (flags & KC_FLAG_CRC) {
+        if (Crc32c(stream.data(), stream.size()) != h.stream_crc)
+          Mismatch("frame " + std::to_string(f - table.begin()) + " stream");
+        if (Crc32c(raw.data(), raw.size()) != h.raw_crc) continue;
+      }
+      compress(true);
+      writer.CopyFrame(raw.data(), raw.size(), stream.data(), stream.size());
+      stats.reused_frames++;
+      stats.reused_bytes += raw.size();
+      pos += raw.size();
+      copied = true;
+      break;
+    }
+
+    if (!copied) {
+      // Changed: take the bytes up to the next place an old frame could
+      // start again
+      uint64_t next = std::min<uint64_t>(n, pos + frame_size);
+      for (int64_t shift : shifts) {
+        int64_t at = (int64_t)pos - shift;
+        auto f = at < 0 ? table.begin()
+                        : std::upper_bound(table.begin(), table.end(), (uint64_t)at, by_offset);
+        if (f != table.end()) {
+          next = std::min<uint64_t>(next, (uint64_t)((int64_t)f->raw_offset + shift));
+        }
+      }
+      std::vector<uint8_t> raw = in.ReadAt(pos, next - pos);
+      pending.insert(pending.end(), raw.begin(), raw.end());
+      pos = next;
+      if (pending.size() >= (size_t)threads * frame_size) compress(false);
+    }
+    if (progress) progress(writer.RawSize());
+  }
+  compress(true);
+
+  stats.frames = writer.FrameCount();
+  stats.size = writer.Finish();
+  if (progress) progress(n);
+  return stats;
+}
+
+ContainerReader::ContainerReader(std::FILE *in, unsigned threads)
+    : in_(in), threads_(threads ? threads : ThreadPool::DefaultThreads()),
+      origin_(ftello(in)) {
+  uint8_t head[5];
+  size_t got = ReadUpTo(in_, head, 5);
+  pending_.assign(head, head + got);
+  bool tagged = got == 5 && head[0] == KC_MAGIC[0] && head[1] == KC_MAGIC[1];
+  if (!tagged || (head[2] != V2 && head[2] != KC_VERSION)) return;
+
+  size_t name_len = head[3] | (head[4] << 8);
+  pending_.resize(5 + name_len);
+  size_t stored = ReadUpTo(in_, pending_.data() + 5, name_len);
+  if (stored != name_len) {
+    pending_.resize(5 + stored);  // Too short for a header: a bare stream
+    return;
+  }
+  name_.assign(pending_.begin() + 5, pending_.end());
+  version_ = head[2];
+  pending_.clear();
+  if (version_ != KC_VERSION) return;
+  if (ReadUpTo(in_, &flags_, 1) != 1 || (flags_ & ~KC_KNOWN_FLAGS)) Corrupt();
+  header_size_ = 6 + name_len;
+  if (flags_ & KC_FLAG_META) {
+    uint8_t len[2];
+    if (ReadUpTo(in_, len, 2) != 2) Corrupt();
+    std::vector<uint8_t> block = ReadExactly(in_, Get16(len));
+    meta_ = DecodeMeta(block.data(), block.size());
+    header_size_ += 2 + block.size();
+  }
+  if (flags_ & KC_FLAG_ARCHIVE) {
+    uint8_t len[4];
+    if (ReadUpTo(in_, len, 4) != 4) Corrupt();
+    member_table_ = ReadExactly(in_, Get32(len));
+    header_size_ += 4 + member_table_.size();
+  }
+}
+
+uint64_t ContainerReader::DecodeTo(std::FILE *out,
+                                   const std::function<void(uint64_t)> &progress) {
+  FileSink sink(out);
+  return DecodeTo(sink, progress);
+}
+
+uint64_t ContainerReader::DecodeTo(ByteSink &sink, const std::function<void(uint64_t)> &progress) {
+  // Older layouts hold a single stream, which is decoded whole
+  if (version_ != KC_VERSION) {
+    std::vector<uint8_t> raw;
+    off_t at = IsRegularFile(in_) ? ftello(in_) - (off_t)pending_.size() : -1;
+    if (at >= 0) {
+      MappedFile map(in_);  // Decoded in place rather than read into memory
+      if ((uint64_t)at > map.Size()) Corrupt();
+      raw = DecompressHybrid(map.Data() + at, map.Size() - at, threads_);
+    } else {
+      ReadRest(in_, pending_);
+      raw = DecompressHybrid(pending_, threads_);
+    }
+    sink.Write(raw.data(), raw.size());
+    sink.Close();
+    if (progress) progress(raw.size());
+    return raw.size();
+  }
+
+  uint8_t flags = flags_;
+  size_t header = HeaderSize(flags);
+  uint64_t pos = header_size_;
+  uint64_t raw_total = 0;
+  std::vector<FrameEntry> table;
+  Hash64 hash;
+
+  // References in deduplicated files reach back to earlier frames, which
+  // are read again from a seekable input and kept in memory (compressed)
+  // from a pipe
+  bool keep = (flags & KC_FLAG_DEDUP) && origin_ < 0;
+  std::vector<std::vector<uint8_t>> kept;
+  EarlierFrames earlier(table, flags, threads_, [&](size_t f) {
+    if (keep) return kept[f];
+    off_t resume = ftello(in_);
+    if (fseeko(in_, origin_ + (off_t)table[f].offset, SEEK_SET) != 0) Corrupt();
+    std::vector<uint8_t> bytes = ReadExactly(in_, header);
+    std::vector<uint8_t> stream = ReadExactly(in_, GetHeader(bytes.data(), flags).size);
+    bytes.insert(bytes.end(), stream.begin(), stream.end());
+    if (fseeko(in_, resume, SEEK_SET) != 0) Corrupt();
+    return bytes;
+  });
+  auto earlier_copy = [&](uint64_t source, size_t n, uint8_t *dst) {
+    earlier.Copy(source, n, dst);
+  };
+
+  // Decode one frame per thread at a time
+  std::vector<std::vector<uint8_t>> streams;
+  std::vector<BlockRef> refs;
+  std::vector<FrameHeader> headers;
+  size_t batch_raw = 0;
+  auto flush = [&] {
+    if (refs.empty()) return;
+    for (size_t f = 0; f < refs.size(); f++) {
+      refs[f].data = streams[f].data();
+      refs[f].size = streams[f].size();
+    }
+    std::vector<uint8_t> raw = DecodeFrames(refs, headers, batch_raw, flags, threads_,
+                                            table.size() - refs.size(), raw_total, earlier_copy);
+    sink.Write(raw.data(), raw.size());
+    if (flags & KC_FLAG_HASH) hash.Update(raw.data(), raw.size());
+    raw_total += raw.size();
+    if (progress) progress(raw_total);
+    streams.clear();
+    refs.clear();
+    headers.clear();
+    batch_raw = 0;
+  };
+
+  while (true) {
+    uint8_t hdr[16];
+    if (ReadUpTo(in_, hdr, 4) != 4) Corrupt();
+    if (Get32(hdr) == 0) break;
+    if (ReadUpTo(in_, hdr + 4, header - 4) != header - 4) Corrupt();
+    FrameHeader h = GetHeader(hdr, flags);
+    if (h.size == 0) Corrupt();
+    table.push_back({pos, raw_total + batch_raw, h.raw_size});
+    streams.push_back(ReadExactly(in_, h.size));
+    if (keep) {
+      kept.emplace_back(hdr, hdr + header);
+      kept.back().insert(kept.back().end(), streams.back().begin(), streams.back().end());
+    }
+    refs.push_back({batch_raw, h.raw_size, nullptr, 0});
+    headers.push_back(h);
+    batch_raw += h.raw_size;
+    pos += header + (uint64_t)h.size;
+    if (live_) {
+      flush();
+      sink.Flush();
+    } else if (refs.size() == threads_) {
+      flush();
+    }
+  }
+  flush();
+
+  if (flags & KC_FLAG_HASH) {
+    uint8_t stored[8];
+    if (ReadUpTo(in_, stored, 8) != 8) Corrupt();
+    if (Get64(stored) != hash.Digest()) Mismatch("file");
+  }
+
+  // Nothing may follow except a matching index
+  std::vector<uint8_t> tail;
+  if (flags & KC_FLAG_INDEX) {
+    size_t expect = IndexEntrySize(flags) * table.size() + INDEX_FOOTER;
+    tail.resize(expect + 1);
+    tail.resize(ReadUpTo(in_, tail.data(), tail.size()));
+    CheckIndex(tail.data(), tail.size(), table, raw_total, flags);
+  } else if (std::fgetc(in_) != EOF) {
+    Corrupt();
+  }
+  sink.Close();
+  return raw_total;
+}
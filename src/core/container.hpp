@@ -0,0 +1,353 @@
+#pragma once
+
+#include "../io/byte_sink.hpp"
+#include "../models/ppm.hpp"
+#include "checksum.hpp"
+#include "chunk_channel.hpp"
+#include "dedup.hpp"
+#include <bitset>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class IoRing;
+
+// .kc file container. Integers are little-endian.
+//
+// v3 (written by kcomp):
+//   'K' 'C' 3, u16 name length, name, u8 flags
+//   if KC_FLAG_META: u16 length + metadata (see ContainerMeta)
+//   if KC_FLAG_ARCHIVE: u32 length + member table (see archive.hpp)
+//   frames: u32 raw size, u32 stream size, [u32 CRC32C of the stream,
+//     u32 CRC32C of the raw data if KC_FLAG_CRC], hybrid stream
+//     (mode byte + payload), or with KC_FLAG_DEDUP a deduplicated frame
+//     stream (see dedup.hpp)
+//   end marker: u32 0
+//   if KC_FLAG_HASH: u64 XXH64 of all raw data
+//   if KC_FLAG_INDEX: per frame u64 file offset (of its raw size field),
+//   u64 raw offset and, if KC_FLAG_FRAME_HASH, u64 XXH64 of its raw data;
+//   then the footer u64 raw total, u32 frame count, "KCIX"
+// Frames are compressed independently, so both directions run them in
+// parallel, and the output does not depend on the thread count. The index
+// sits at a fixed distance from the end of the file, so a reader can find
+// the frames covering a byte range without scanning the rest. Checksums
+// are verified on every read; a mismatch throws. References in
+// deduplicated files may reach back to any earlier frame; readers fetch
+// those frames again as needed.
+//
+// v2: 'K' 'C' 2, u16 name length, name, then one hybrid stream.
+// Files without the magic (or with an unknown version) are read as a bare
+// hybrid stream, as v2 readers did.
+
+constexpr uint8_t KC_MAGIC[2] = {'K', 'C'};
+constexpr uint8_t KC_VERSION = 3;
+
+// v3 flag bits; any other bit set makes the file unreadable
+constexpr uint8_t KC_FLAG_INDEX = 0x01;
+constexpr uint8_t KC_FLAG_CRC = 0x02;
+constexpr uint8_t KC_FLAG_HASH = 0x04;
+constexpr uint8_t KC_FLAG_ARCHIVE = 0x08;
+constexpr uint8_t KC_FLAG_DEDUP = 0x10;
+constexpr uint8_t KC_FLAG_FRAME_HASH = 0x20;  // Only together with KC_FLAG_INDEX
+constexpr uint8_t KC_FLAG_META = 0x40;
+constexpr uint8_t KC_KNOWN_FLAGS = KC_FLAG_INDEX | KC_FLAG_CRC | KC_FLAG_HASH |
+                                   KC_FLAG_ARCHIVE | KC_FLAG_DEDUP | KC_FLAG_FRAME_HASH |
+                                   KC_FLAG_META;
+
+// Size or count not known (see ContainerMeta)
+constexpr uint64_t KC_UNKNOWN = UINT64_MAX;
+
+// Header metadata (KC_FLAG_META), so a listing needs only the first few
+// hundred bytes of a file. Fields, little-endian: u64 raw size, u32 frame
+// count, i64 source modification time, i64 creation time (Unix seconds,
+// 0 = unknown), 32-byte bitmap of the hybrid modes the frames use (bit m
+// of byte m / 8). Readers skip any fields after the ones they know.
+// Writers fill the header in at the end; one writing to a pipe cannot, and
+// leaves the size and count unknown and the bitmap empty.
+struct ContainerMeta {
+  uint64_t raw_size = KC_UNKNOWN;
+  uint64_t frames = KC_UNKNOWN;
+  int64_t mtime = 0;
+  int64_t created = 0;
+  std::bitset<256> modes;
+};
+
+// Raw bytes per frame unless the caller asks otherwise
+constexpr size_t DEFAULT_FRAME_SIZE = 4 << 20;
+
+// Frame headers carry 32-bit sizes; larger frame sizes are clamped to this,
+// and readers reject frames that claim more
+constexpr size_t MAX_FRAME_SIZE = (size_t)1 << 30;
+
+struct ContainerOptions {
+  size_t frame_size = DEFAULT_FRAME_SIZE;  // Raw bytes per frame
+  bool index = false;                      // Append the seek index
+  bool checksum = true;                    // Per-frame CRC32C
+  bool hash = false;                       // Whole-file XXH64
+  bool dedup = false;                      // Store repeated chunks once
+  bool frame_hashes = false;               // Per-frame XXH64 in the index
+  bool meta = false;                       // Header metadata
+  int64_t mtime = 0;                       // Times stored in the metadata
+  int64_t created = 0;
+  // Flush points for live input (WriteContainerStream): end the frame once
+  // this many bytes are pending, or this many seconds after its first byte
+  // arrived, and write it out at once. 0 = only full frames.
+  size_t flush_bytes = 0;
+  double flush_interval = 0;
+  // Overlap reading and writing regular files through io_uring where the
+  // kernel allows it; otherwise (and for pipes) threads read ahead and
+  // write behind
+  bool io_uring = true;
+};
+
+inline uint8_t ContainerFlags(const ContainerOptions &copts) {
+  return (copts.index ? KC_FLAG_INDEX : 0) | (copts.checksum ? KC_FLAG_CRC : 0) |
+         (copts.hash ? KC_FLAG_HASH : 0) | (copts.dedup ? KC_FLAG_DEDUP : 0) |
+         (copts.index && copts.frame_hashes ? KC_FLAG_FRAME_HASH : 0) |
+         (copts.meta ? KC_FLAG_META : 0);
+}
+
+// Build a v3 file for `in`, stored under `name` (its last path component)
+std::vector<uint8_t> WriteContainer(const std::vector<uint8_t> &in, const std::string &name,
+                                    const HybridOptions &opts,
+                                    const ContainerOptions &copts = {});
+// The same for the `n` bytes at `in` (e.g. a MappedFile), read in place
+std::vector<uint8_t> WriteContainer(const uint8_t *in, size_t n, const std::string &name,
+                                    const HybridOptions &opts,
+                                    const ContainerOptions &copts = {});
+
+// Decode a .kc file of any version. `name` receives the stored file name,
+// or "" if there is none. Throws std::runtime_error on a corrupt v3 file.
+std::vector<uint8_t> ReadContainer(const std::vector<uint8_t> &file, std::string &name,
+                                   unsigned threads = 0);
+std::vector<uint8_t> ReadContainer(const uint8_t *file, size_t n, std::string &name,
+                                   unsigned threads = 0);
+
+// Decode only bytes [offset, offset + length) of the .kc file at `path`,
+// clamped to the end of the data; `name` as for ReadContainer. On v3 files
+// only the frames covering the range are read and decoded (located through
+// the index, or by hopping over frame headers without one); older files
+// are decoded in full.
+std::vector<uint8_t> ReadContainerRange(const std::string &path, uint64_t offset,
+                                        uint64_t length, std::string &name,
+                                        unsigned threads = 0);
+
+// What a listing shows about a .kc file
+struct ContainerInfo {
+  uint8_t version = 0;  // 0 = bare stream
+  std::string name;
+  uint8_t flags = 0;
+  uint64_t size = 0;    // Of the .kc file
+  ContainerMeta meta;
+};
+
+// Describe the .kc file at `path` without decoding it: positioned reads of
+// the header, and for v3 files without metadata of the index or the frame
+// headers (for the raw size and frame count). Older files report an
+// unknown raw size. Throws std::runtime_error on a corrupt v3 header.
+ContainerInfo InspectContainer(const std::string &path);
+
+// Streaming counterparts for pipes and files too large to hold in memory.
+// Both hold one frame per thread at a time (except that a deduplicated
+// file read from a pipe keeps its compressed frames); `progress`, if set,
+// receives the raw bytes handled so far after every batch.
+
+// Where a frame sits in the file (its raw size field) and in the output
+struct FrameEntry {
+  uint64_t offset;
+  uint64_t raw_offset;
+  uint64_t raw_size;
+  uint64_t raw_hash = 0;  // XXH64 of the raw data (KC_FLAG_FRAME_HASH)
+};
+
+// Writes a v3 file front to back: the header, then frames as they are
+// added, then the end marker, hash and index. Metadata is filled in by
+// seeking back to the header if `out` is seekable.
+class ContainerWriter {
+public:
+  // `member_table` is stored (with KC_FLAG_ARCHIVE) if not empty
+  ContainerWriter(std::FILE *out, const std::string &name, const ContainerOptions &copts,
+                  const std::vector<uint8_t> &member_table = {});
+
+  // Continue the file open for update in `out`, whose header (stored name
+  // `stored_name`, `flags`, `meta`) is already written; nothing is written
+  // until frames are added after the ones taken over with KeepFrame
+  ContainerWriter(std::FILE *out, const std::string &stored_name, uint8_t flags,
+                  const ContainerMeta &meta);
+  ~ContainerWriter();
+
+  ContainerWriter(const ContainerWriter &) = delete;
+  ContainerWriter &operator=(const ContainerWriter &) = delete;
+
+  // Write frames to `out` behind the caller from now on, up to `frames`
+  // of them queued, so compressing the next frames overlaps with writing
+  // these: as io_uring writes in flight if `out` is a regular file and
+  // `io_uring` is allowed and available, else on a background thread. A
+  // failed write is reported by a later call. Finish waits for the queue
+  // to drain.
+  void WriteBehind(size_t frames, bool io_uring = true);
+
+  // Compress `raw` cut at `ends` (in parallel, see CompressBlockStreams)
+  // and append the frames
+  void AddFrames(const std::vector<uint8_t> &raw, const std::vector<size_t> &ends,
+                 const HybridOptions &opts);
+  void AddFrames(const uint8_t *raw, size_t n, const std::vector<size_t> &ends,
+                 const HybridOptions &opts);
+
+  // Append a frame whose stream was compressed before (read from another
+  // file), for the `raw_size` bytes at `raw`. Not for deduplicated files,
+  // whose streams depend on the frames before them.
+  void CopyFrame(const uint8_t *raw, size_t raw_size, const uint8_t *stream, size_t n);
+
+  // Account for a frame that is already in the file after the ones before
+  // it, for the `raw_size` bytes at `raw`; it is not written again
+  void KeepFrame(const uint8_t *raw, size_t raw_size, const uint8_t *stream, size_t n);
+
+  // Bytes of the file written or kept so far
+  uint64_t Size() const { return written_; }
+
+  // Write the trailer and return the file size
+  uint64_t Finish();
+
+  uint64_t RawSize() const { return raw_total_; }
+  size_t FrameCount() const { return table_.size(); }
+
+  // Raw bytes stored as references to earlier chunks (KC_FLAG_DEDUP)
+  uint64_t DuplicateBytes() const { return dedup_.DuplicateBytes(); }
+
+private:
+  void PutFrameAt(const uint8_t *raw, size_t raw_size, const uint8_t *stream, size_t n);
+  void PutFrameAt(const uint8_t *raw, size_t raw_size, std::vector<uint8_t> &&stream);
+  void Queue(std::vector<uint8_t> &&bytes);  // For the background writer
+  void Reap();  // Wait for one io_uring write and check it
+  void Account(const uint8_t *raw, size_t raw_size, const uint8_t *stream, size_t n);
+  void DrainWrites();  // Stop the background writer; rethrows its error
+
+  std::FILE *out_;
+  uint8_t flags_;
+  off_t origin_;          // Offset of the header in `out`, -1 for pipes and appends
+  uint64_t meta_at_ = 0;  // Offset of the metadata in the file
+  ContainerMeta meta_;
+  uint64_t written_ = 0;
+  uint64_t raw_total_ = 0;
+  std::vector<FrameEntry> table_;
+  Hash64 hash_;
+  Deduplicator dedup_;
+  std::unique_ptr<ChunkChannel> behind_;  // Frames queued for `writer_`
+  std::thread writer_;
+  std::exception_ptr write_error_;
+  struct RingWrite {
+    std::vector<uint8_t> bytes;
+    uint64_t offset;
+  };
+  std::unordered_map<uint64_t, RingWrite> in_flight_;  // io_uring writes by tag
+  std::unique_ptr<IoRing> ring_;  // Declared after the buffers it may still use
+  uint64_t ring_at_ = 0;          // File offset of the next io_uring write
+  uint64_t next_tag_ = 0;
+  std::chrono::steady_clock::time_point deadline_{};  // Of the time budget
+};
+
+// Compress everything readable from `in` into a v3 file on `out` and
+// return the bytes written; they match WriteContainer for the same input
+// and options. With flush points set, `in` is read as data arrives (see
+// ReadSome) and every frame reaches `out` as soon as it ends, so a reader
+// on the other end of a pipe decodes up to the last flush point.
+uint64_t WriteContainerStream(std::FILE *in, std::FILE *out, const std::string &name,
+                              const HybridOptions &opts, const ContainerOptions &copts = {},
+                              const std::function<void(uint64_t)> &progress = nullptr);
+
+// Result of UpdateContainer
+struct UpdateStats {
+  uint64_t frames = 0;         // Frames in the new file
+  uint64_t reused_frames = 0;  // Copied from the old file as they were
+  uint64_t raw_size = 0;       // Size of the new input
+  uint64_t reused_bytes = 0;   // Raw bytes in the copied frames
+  uint64_t size = 0;           // Size of the new file
+};
+
+// Compress the file at `in_path` into a v3 file on `out`, copying the
+// compressed frames of the old .kc file at `old_path` wherever the new
+// file holds the same raw bytes at the same offset or at the same
+// distance from the end, so a patch, an append or an insertion only
+// recompresses the frames around it. Changed regions are cut into frames
+// of copts.frame_size (0 = the old file's frame size). The output always
+// carries the index with frame hashes, so the next update reads only the
+// index of this one; older files are decoded once to hash their frames.
+// Throws std::runtime_error for archives and deduplicated files.
+UpdateStats UpdateContainer(const std::string &old_path, const std::string &in_path,
+                            std::FILE *out, const HybridOptions &opts,
+                            ContainerOptions copts = {},
+                            const std::function<void(uint64_t)> &progress = nullptr);
+
+// Result of ResumeContainer
+struct ResumeStats {
+  uint64_t kept_frames = 0;  // Frames of the partial file found intact
+  uint64_t kept_bytes = 0;   // Raw bytes in them, not compressed again
+  uint64_t size = 0;         // Size of the finished file
+};
+
+// Finish compressing the file at `in_path` into `out_path`, where an
+// interrupted WriteContainerStream left a partial v3 file: the frames whose
+// stream and raw CRC32Cs check out against the file and the input are
+// kept, everything after them is cut off, and compression continues from
+// the first raw byte they do not cover. The header (name, flags, metadata
+// times) and frame size come from the partial file. A missing or empty
+// output is written from scratch with `copts`. Throws std::runtime_error
+// if the output is not a v3 file with frame CRCs, is an archive, or holds
+// frames of different data than `in_path`.
+ResumeStats ResumeContainer(const std::string &in_path, const std::string &out_path,
+                            const HybridOptions &opts, const ContainerOptions &copts = {},
+                            const std::function<void(uint64_t)> &progress = nullptr);
+
+// Decodes a .kc stream front to back. The constructor reads the header, so
+// the stored name is known before the output is opened.
+class ContainerReader {
+public:
+  explicit ContainerReader(std::FILE *in, unsigned threads = 0);
+
+  // Stored file name, or "" if there is none
+  const std::string &Name() const { return name_; }
+
+  // v3 flags (KC_FLAG_*); 0 for older files, which carry no checksums
+  uint8_t Flags() const { return flags_; }
+
+  // Archive member table (KC_FLAG_ARCHIVE), empty otherwise
+  const std::vector<uint8_t> &MemberTable() const { return member_table_; }
+
+  // Header metadata (KC_FLAG_META); all unknown otherwise
+  const ContainerMeta &Meta() const { return meta_; }
+
+  // Decode and flush every frame as soon as it is read instead of one
+  // batch per thread, for live streams written with flush points
+  void SetLive(bool live) { live_ = live; }
+
+  // Decode the rest of the stream to `sink` and return the decoded size;
+  // throws std::runtime_error on a corrupt v3 stream or a checksum
+  // mismatch. v2 files and bare streams are decoded whole.
+  uint64_t DecodeTo(ByteSink &sink, const std::function<void(uint64_t)> &progress = nullptr);
+
+  // Same, writing to `out`, or nowhere if null (to verify the stream)
+  uint64_t DecodeTo(std::FILE *out, const std::function<void(uint64_t)> &progress = nullptr);
+
+private:
+  std::FILE *in_;
+  unsigned threads_;
+  std::string name_;
+  off_t origin_;                  // Offset of the header in `in`, -1 for pipes
+  uint8_t version_ = 0;           // 0 = bare stream
+  uint8_t flags_ = 0;
+  bool live_ = false;
+  uint64_t header_size_ = 0;      // Bytes before the first frame
+  ContainerMeta meta_;
+  std::vector<uint8_t> member_table_;
+  std::vector<uint8_t> pending_;  // Bytes already read from a bare stream
+};
@@ -0,0 +1,142 @@
+#include "data_stats.hpp"
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define KCOMP_STATS_SSE2 1
+#endif
+
+namespace {
+
+constexpr int GRAM_TABLE_BITS = 16;
+constexpr uint64_t GRAM_EMPTY = ~0ULL;
+
+inline bool IsText(uint8_t b) {
+  return (b >= 0x20 && b < 0x7F) || b == '\t' || b == '\n' || b == '\r';
+}
+
+struct ClassCounts {
+  size_t ascii = 0;
+  size_t zero_runs = 0;
+  size_t runs = 0;
+};
+
+// Count text bytes, zero-after-zero and byte-equals-predecessor over
+// data[begin, end). Requires begin >= 1.
+void CountClassesScalar(const uint8_t *data, size_t begin, size_t end, ClassCounts &c) {
+  for (size_t i = begin; i < end; i++) {
+    c.ascii += IsText(data[i]);
+    c.runs += data[i] == data[i - 1];
+    c.zero_runs += data[i] == 0 && data[i - 1] == 0;
+  }
+}
+
+#ifdef KCOMP_STATS_SSE2
+inline int Popcount16(int mask) { return __builtin_popcount((unsigned)mask); }
+
+// SSE2 version of CountClassesScalar for 16 bytes starting at data + i
+inline void CountClasses16(const uint8_t *data, size_t i, ClassCounts &c) {
+  __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+  __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i - 1));
+  __m128i zero = _mm_setzero_si128();
+
+  // Signed compares: bytes >= 0x80 are negative and fail the lower bound
+  __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(cur, _mm_set1_epi8(0x1F)),
+                                    _mm_cmplt_epi8(cur, _mm_set1_epi8(0x7F)));
+  __m128i space = _mm_or_si128(_mm_cmpeq_epi8(cur, _mm_set1_epi8('\t')),
+                               _mm_or_si128(_mm_cmpeq_epi8(cur, _mm_set1_epi8('\n')),
+                                            _mm_cmpeq_epi8(cur, _mm_set1_epi8('\r'))));
+  __m128i same = _mm_cmpeq_epi8(cur, prev);
+  __m128i zero_run = _mm_and_si128(_mm_cmpeq_epi8(cur, zero), _mm_cmpeq_epi8(prev, zero));
+
+  c.ascii += Popcount16(_mm_movemask_epi8(_mm_or_si128(printable, space)));
+  c.runs += Popcount16(_mm_movemask_epi8(same));
+  c.zero_runs += Popcount16(_mm_movemask_epi8(zero_run));
+}
+#endif
+
+double Entropy(const uint64_t *counts, size_t symbols, double total) {
+  double h = 0;
+  for (size_t s = 0; s < symbols; s++) {
+    if (counts[s] == 0) continue;
+    double p = counts[s] / total;
+    h -= p * std::log2(p);
+  }
+  return h;
+}
+
+}  // namespace
+
+DataStats AnalyzeData(const uint8_t *data, size_t n) {
+  DataStats st;
+  st.size = n;
+  if (n == 0) return st;
+
+  std::vector<uint64_t> pairs(256 * 256, 0);
+  std::vector<uint64_t> grams(size_t(1) << GRAM_TABLE_BITS, GRAM_EMPTY);
+  ClassCounts classes;
+  size_t repeats = 0;
+  uint32_t gram = 0;
+
+  classes.ascii = IsText(data[0]);
+  st.histogram[data[0]]++;
+  gram = data[0];
+
+  // Byte-class counts go 16 bytes at a time; the tables stay scalar
+  const size_t kChunk = 16;
+  size_t i = 1;
+  while (i < n) {
+    size_t end = n - i >= kChunk ? i + kChunk : n;
+#ifdef KCOMP_STATS_SSE2
+    if (end - i == kChunk) {
+      CountClasses16(data, i, classes);
+    } else {
+      CountClassesScalar(data, i, end, classes);
+    }
+#else
+    CountClassesScalar(data, i, end, classes);
+#endif
+    for (; i < end; i++) {
+      uint8_t b = data[i];
+      st.histogram[b]++;
+      pairs[(size_t)data[i - 1] << 8 | b]++;
+      gram = (gram << 8) | b;
+      if (i >= 3) {
+        uint32_t slot = (gram * 2654435761u) >> (32 - GRAM_TABLE_BITS);
+        if (grams[slot] == gram) {
+          repeats++;
+        } else {
+          grams[slot] = gram;
+        }
+      }
+    }
+  }
+
+  double total = (double)n;
+  st.entropy0 = Entropy(st.histogram.data(), 256, total);
+  if (n > 1) {
+    double h1 = 0;
+    for (size_t ctx = 0; ctx < 256; ctx++) {
+      const uint64_t *row = &pairs[ctx << 8];
+      double row_total = 0;
+      for (size_t s = 0; s < 256; s++) row_total += row[s];
+      if (row_total > 0) h1 += row_total * Entropy(row, 256, row_total);
+    }
+    st.entropy1 = h1 / (total - 1);
+  }
+
+  st.ascii_ratio = classes.ascii / total;
+  st.zero_ratio = st.histogram[0] / total;
+  st.zero_run_ratio = classes.zero_runs / total;
+  st.run_ratio = classes.runs / total;
+  st.repeat4_ratio = n > 3 ? repeats / (total - 3) : 0;
+  return st;
+}
+
+double ByteEntropy(const uint8_t *data, size_t n) {
+  if (n == 0) return 0;
+  uint64_t hist[256] = {};
+  for (size_t i = 0; i < n; i++) hist[data[i]]++;
+  return Entropy(hist, 256, (double)n);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Cheap whole-input statistics used to decide which hybrid candidates are
+// worth running. Gathered in a single pass (SSE2 for the byte-class counts
+// where available).
+struct DataStats {
+  size_t size = 0;
+  std::array<uint64_t, 256> histogram{};  // 64-bit: inputs may pass 4 GB
+  double entropy0 = 0;        // Order-0 entropy, bits/byte
+  double entropy1 = 0;        // Order-1 (previous byte) entropy, bits/byte
+  double ascii_ratio = 0;     // Printable ASCII plus \t \n \r
+  double zero_ratio = 0;      // Zero bytes
+  double zero_run_ratio = 0;  // Zero bytes preceded by a zero byte
+  double run_ratio = 0;       // Bytes equal to their predecessor
+  double repeat4_ratio = 0;   // Positions whose 4-gram occurred earlier
+};
+
+DataStats AnalyzeData(const uint8_t *data, size_t n);
+
+// Order-0 entropy in bits/byte (histogram only; much cheaper than AnalyzeData)
+double ByteEntropy(const uint8_t *data, size_t n);
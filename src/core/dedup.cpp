@@ -0,0 +1,252 @@
+#include "dedup.hpp"
+#include "../models/blocks.hpp"
+#include "checksum.hpp"
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+namespace {
+
+constexpr uint32_t REFERENCE_BIT = 0x80000000u;
+
+// Normalized chunking: a harder cut condition (15 bits) below the average
+// size and an easier one (11 bits) above it, so chunk sizes cluster
+// around CDC_AVG_CHUNK. The Gear hash shifts left, so the high bits see
+// the most bytes; the masks spread their bits over them (FastCDC paper).
+constexpr uint64_t MASK_SMALL = 0x0003590703530000ULL;
+constexpr uint64_t MASK_LARGE = 0x0000d90003530000ULL;
+
+constexpr uint64_t FINGERPRINT_SEED = 0x9E3779B97F4A7C15ULL;
+
+// Fixed pseudo-random Gear table (splitmix64), so chunk cuts and thus the
+// output never change between builds
+struct GearTable {
+  std::array<uint64_t, 256> g;
+
+  GearTable() {
+    uint64_t x = 0;
+    for (auto &v : g) {
+      uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      v = z ^ (z >> 31);
+    }
+  }
+};
+
+const std::array<uint64_t, 256> &Gear() {
+  static const GearTable table;
+  return table.g;
+}
+
+size_t NextCut(const uint8_t *p, size_t n) {
+  if (n <= CDC_MIN_CHUNK) return n;
+  if (n > CDC_MAX_CHUNK) n = CDC_MAX_CHUNK;
+  size_t normal = std::min(n, CDC_AVG_CHUNK);
+  const auto &gear = Gear();
+  uint64_t fp = 0;
+  size_t i = CDC_MIN_CHUNK;
+  for (; i < normal; i++) {
+    fp = (fp << 1) + gear[p[i]];
+    if (!(fp & MASK_SMALL)) return i + 1;
+  }
+  for (; i < n; i++) {
+    fp = (fp << 1) + gear[p[i]];
+    if (!(fp & MASK_LARGE)) return i + 1;
+  }
+  return n;
+}
+
+void Put32(std::vector<uint8_t> &out, size_t v) {
+  for (int i = 0; i < 4; i++) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+void Put64(std::vector<uint8_t> &out, uint64_t v) {
+  for (int i = 0; i < 8; i++) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+uint32_t Get32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+uint64_t Get64(const uint8_t *p) { return Get32(p) | ((uint64_t)Get32(p + 4) << 32); }
+
+[[noreturn]] void Corrupt() { throw std::runtime_error("corrupt .kc file"); }
+
+struct Piece {
+  uint32_t length;
+  bool reference;
+  uint64_t source;
+};
+
+void PutPieces(std::vector<uint8_t> &out, const std::vector<Piece> &pieces) {
+  Put32(out, pieces.size());
+  for (const auto &p : pieces) {
+    Put32(out, p.length | (p.reference ? REFERENCE_BIT : 0));
+    if (p.reference) Put64(out, p.source);
+  }
+}
+
+} // namespace
+
+std::vector<size_t> ChunkEnds(const uint8_t *data, size_t n) {
+  std::vector<size_t> ends;
+  for (size_t pos = 0; pos < n;) {
+    pos += NextCut(data + pos, n - pos);
+    ends.push_back(pos);
+  }
+  return ends;
+}
+
+Fingerprint FingerprintOf(const uint8_t *data, size_t n) {
+  Hash64 lo, hi(FINGERPRINT_SEED);
+  lo.Update(data, n);
+  hi.Update(data, n);
+  return {lo.Digest(), hi.Digest()};
+}
+
+std::vector<std::vector<uint8_t>> Deduplicator::CompressFrames(const std::vector<uint8_t> &in,
+                                                               const std::vector<size_t> &ends,
+                                                               uint64_t raw_offset,
+                                                               const HybridOptions &opts) {
+  return CompressFrames(in.data(), in.size(), ends, raw_offset, opts);
+}
+
+std::vector<std::vector<uint8_t>> Deduplicator::CompressFrames(const uint8_t *in, size_t n,
+                                                               const std::vector<size_t> &ends,
+                                                               uint64_t raw_offset,
+                                                               const HybridOptions &opts) {
+  if (!ends.empty() && ends.back() != n) throw std::runtime_error("frames do not end at the input");
+  if (opts.max_memory) {
+    window_ = std::max<size_t>(1, std::min(window_, opts.max_memory / DEDUP_ENTRY_BYTES));
+    Evict();
+  }
+
+  // Build every frame's entries in file order, gathering the literals of
+  // all frames into one buffer cut at frame boundaries
+  std::vector<std::vector<uint8_t>> headers(ends.size());
+  std::vector<uint8_t> literals;
+  std::vector<size_t> literal_ends;
+  std::vector<bool> has_literals(ends.size(), false);
+  size_t start = 0;
+  for (size_t f = 0; f < ends.size(); f++) {
+    std::vector<Piece> pieces;
+    size_t before = literals.size();
+    size_t pos = start;
+    for (size_t cut : ChunkEnds(in + start, ends[f] - start)) {
+      size_t end = start + cut;
+      uint32_t len = (uint32_t)(end - pos);
+      uint64_t at = raw_offset + pos;
+      bool repeat = false;
+      uint64_t source = 0;
+      if (len >= CDC_MIN_CHUNK) repeat = Remember(FingerprintOf(in + pos, len), at, source);
+
+      // Extend the previous entry where possible; lengths stay below bit 31
+      Piece *last = pieces.empty() ? nullptr : &pieces.back();
+      bool extend = last && last->reference == repeat &&
+                    last->length + (uint64_t)len < REFERENCE_BIT &&
+                    (!repeat || last->source + last->length == source);
+      if (extend) {
+        last->length += len;
+      } else {
+        pieces.push_back({len, repeat, source});
+      }
+      if (repeat) {
+        duplicate_ += len;
+      } else {
+        literals.insert(literals.end(), in + pos, in + end);
+      }
+      pos = end;
+    }
+    PutPieces(headers[f], pieces);
+    if (literals.size() > before) {
+      literal_ends.push_back(literals.size());
+      has_literals[f] = true;
+    }
+    start = ends[f];
+  }
+
+  // Each literal stream leaves room for its frame's entries in front
+  std::vector<size_t> fronts;
+  for (size_t f = 0; f < ends.size(); f++) {
+    if (has_literals[f]) fronts.push_back(headers[f].size());
+  }
+  std::vector<std::vector<uint8_t>> streams;
+  if (!literal_ends.empty()) {
+    streams = CompressBlockStreams(literals.data(), literals.size(), literal_ends, opts, fronts);
+  }
+
+  std::vector<std::vector<uint8_t>> frames(ends.size());
+  size_t next = 0;
+  for (size_t f = 0; f < ends.size(); f++) {
+    if (has_literals[f]) {
+      frames[f] = std::move(streams[next++]);
+      std::copy(headers[f].begin(), headers[f].end(), frames[f].begin());
+    } else {
+      frames[f] = std::move(headers[f]);
+    }
+  }
+  return frames;
+}
+
+void Deduplicator::Learn(const uint8_t *data, size_t n, uint64_t raw_offset) {
+  size_t pos = 0;
+  for (size_t end : ChunkEnds(data, n)) {
+    uint64_t source;
+    if (end - pos >= CDC_MIN_CHUNK) {
+      Remember(FingerprintOf(data + pos, end - pos), raw_offset + pos, source);
+    }
+    pos = end;
+  }
+}
+
+bool Deduplicator::Remember(const Fingerprint &fp, uint64_t at, uint64_t &source) {
+  auto found = seen_.emplace(fp, at);
+  source = found.first->second;
+  if (!found.second) return true;
+  order_.push_back(fp);
+  Evict();
+  return false;
+}
+
+void Deduplicator::Evict() {
+  while (order_.size() > window_) {
+    seen_.erase(order_.front());
+    order_.pop_front();
+  }
+}
+
+DedupRecipe ParseRecipe(const uint8_t *stream, size_t n, uint64_t raw_offset,
+                        uint32_t raw_size) {
+  DedupRecipe recipe;
+  if (n < 4) Corrupt();
+  uint32_t count = Get32(stream);
+  if (count > raw_size || count > (n - 4) / 4) Corrupt();
+  size_t pos = 4;
+  uint64_t raw = raw_offset;
+  recipe.entries.reserve(count);
+  for (uint32_t i = 0; i < count; i++) {
+    if (n - pos < 4) Corrupt();
+    uint32_t field = Get32(stream + pos);
+    pos += 4;
+    DedupEntry e{raw, field & ~REFERENCE_BIT, (field & REFERENCE_BIT) != 0, 0, 0};
+    if (e.length == 0 || e.length > raw_offset + raw_size - raw) Corrupt();
+    if (e.reference) {
+      if (n - pos < 8) Corrupt();
+      e.source = Get64(stream + pos);
+      pos += 8;
+      if (e.source > raw || raw - e.source < e.length) Corrupt();
+    } else {
+      e.literal = recipe.literal_size;
+      recipe.literal_size += e.length;
+    }
+    recipe.entries.push_back(e);
+    raw += e.length;
+  }
+  if (raw != raw_offset + raw_size) Corrupt();
+  // A literal stream follows exactly when there are literal bytes
+  if ((recipe.literal_size > 0) != (pos < n)) Corrupt();
+  recipe.header_size = pos;
+  return recipe;
+}
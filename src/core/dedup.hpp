@@ -0,0 +1,110 @@
+#pragma once
+
+#include "../models/ppm.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+// Content-defined chunk deduplication (.kc KC_FLAG_DEDUP). Each frame is
+// cut into chunks with FastCDC (Gear rolling hash, normalized chunking),
+// and every chunk whose fingerprint was seen before, among the most recent
+// chunks of the file (see DEDUP_WINDOW), becomes a reference to that copy. Only the remaining
+// literal bytes reach the hybrid compressor, so repeats far beyond the LZ
+// windows cost a few bytes each and no modelling time.
+//
+// Deduplicated frame stream, little-endian:
+//   u32 entry count, then per entry: u32 length (bit 31 set for a
+//   reference) and, for references, u64 raw offset of the source; then
+//   the hybrid stream of the literal entries' bytes back to back (absent
+//   if there are none)
+// Entries tile the frame. A source lies entirely before its reference.
+
+// Chunk sizes; a frame's last chunk may be shorter than the minimum
+constexpr size_t CDC_MIN_CHUNK = 2 << 10;
+constexpr size_t CDC_AVG_CHUNK = 8 << 10;
+constexpr size_t CDC_MAX_CHUNK = 64 << 10;
+
+// Fingerprints kept by default: about 256 MB of index, covering some 32 GB
+// of distinct data at the average chunk size. Older chunks are forgotten,
+// so a repeat of one is stored again.
+constexpr size_t DEDUP_WINDOW = 4 << 20;
+
+// Approximate index bytes per fingerprint (map node plus window slot)
+constexpr size_t DEDUP_ENTRY_BYTES = 64;
+
+// End offset of every chunk of data[0, n) (the last one is n)
+std::vector<size_t> ChunkEnds(const uint8_t *data, size_t n);
+
+// 128-bit chunk fingerprint: two independently seeded XXH64s. A collision
+// would also fail the frame's raw CRC32C on decode.
+struct Fingerprint {
+  uint64_t lo = 0;
+  uint64_t hi = 0;
+
+  bool operator==(const Fingerprint &o) const { return lo == o.lo && hi == o.hi; }
+};
+
+Fingerprint FingerprintOf(const uint8_t *data, size_t n);
+
+// Fingerprint index of a file being written, holding the `window` most
+// recently seen chunks. Frames must be passed in file order; the output
+// depends only on the data, the frame cuts and the window.
+class Deduplicator {
+public:
+  explicit Deduplicator(size_t window = DEDUP_WINDOW) : window_(window ? window : 1) {}
+
+  // Compress the frames of `in` cut at `ends`, which start at raw offset
+  // `raw_offset` of the file, into deduplicated frame streams (the literal
+  // parts in parallel, see CompressBlockStreams). With opts.max_memory the
+  // window shrinks to what fits in it at DEDUP_ENTRY_BYTES per chunk.
+  std::vector<std::vector<uint8_t>> CompressFrames(const std::vector<uint8_t> &in,
+                                                   const std::vector<size_t> &ends,
+                                                   uint64_t raw_offset, const HybridOptions &opts);
+  std::vector<std::vector<uint8_t>> CompressFrames(const uint8_t *in, size_t n,
+                                                   const std::vector<size_t> &ends,
+                                                   uint64_t raw_offset, const HybridOptions &opts);
+
+  // Index the chunks of a frame written earlier (the `n` bytes at
+  // `raw_offset`), as CompressFrames would have, so later frames can
+  // refer to them
+  void Learn(const uint8_t *data, size_t n, uint64_t raw_offset);
+
+  // Raw bytes stored as references so far
+  uint64_t DuplicateBytes() const { return duplicate_; }
+
+private:
+  struct FingerprintHash {
+    size_t operator()(const Fingerprint &f) const { return (size_t)f.lo; }
+  };
+
+  // Index the chunk at raw offset `at`; true, with the offset of the
+  // earlier copy in `source`, if it is already known
+  bool Remember(const Fingerprint &fp, uint64_t at, uint64_t &source);
+  void Evict();  // Forget the oldest chunks beyond the window
+
+  size_t window_;
+  std::unordered_map<Fingerprint, uint64_t, FingerprintHash> seen_;  // -> raw offset
+  std::deque<Fingerprint> order_;  // Keys of `seen_`, oldest first
+  uint64_t duplicate_ = 0;
+};
+
+struct DedupEntry {
+  uint64_t raw_offset;  // In the file's raw data
+  uint32_t length;
+  bool reference;
+  uint64_t source;   // Raw offset of the copied bytes if `reference`
+  size_t literal;    // Offset in the frame's literal bytes otherwise
+};
+
+struct DedupRecipe {
+  std::vector<DedupEntry> entries;
+  size_t literal_size = 0;  // Bytes in the literal stream once decoded
+  size_t header_size = 0;   // Bytes before the literal stream
+};
+
+// Parse the entries at the front of the stream of a `raw_size`-byte frame
+// starting at `raw_offset`; throws std::runtime_error if they do not tile
+// the frame or a source does not precede its reference
+DedupRecipe ParseRecipe(const uint8_t *stream, size_t n, uint64_t raw_offset, uint32_t raw_size);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+// Byte-counting admission control for concurrent jobs. Acquire() blocks
+// until a reservation fits under the cap next to the ones already held;
+// a reservation larger than the whole cap is refused outright, so a job
+// that can never fit is skipped instead of waiting forever.
+class MemoryBudget {
+public:
+  explicit MemoryBudget(size_t cap) : cap_(cap) {}
+
+  MemoryBudget(const MemoryBudget&) = delete;
+  MemoryBudget& operator=(const MemoryBudget&) = delete;
+
+  bool Acquire(size_t bytes) {
+    if (bytes > cap_) return false;
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&] { return used_ + bytes <= cap_; });
+    used_ += bytes;
+    peak_ = std::max(peak_, used_);
+    return true;
+  }
+
+  void Release(size_t bytes) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      used_ -= bytes;
+    }
+    cv_.notify_all();
+  }
+
+  size_t Cap() const { return cap_; }
+
+  // Largest total reservation held at any one time
+  size_t Peak() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peak_;
+  }
+
+private:
+  size_t cap_;
+  size_t used_ = 0;
+  size_t peak_ = 0;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+};
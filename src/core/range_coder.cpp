@@ -1,5 +1,15 @@
 #include "range_coder.hpp"
 
+// The coder is carry-less, so low and high can get stuck straddling a byte
+// boundary while the range shrinks below the model total. Once that happens
+// symbols collapse to zero width and the stream becomes undecodable. Both
+// sides detect it identically and truncate the range to the next 64K
+// boundary (Subbotin-style) so bytes can be shifted out again. Every model
+// total stays below 2^16, so the truncated interval is never empty.
+static inline bool NeedsUnderflowFix(uint32_t low, uint32_t high, uint32_t total) {
+  return (uint64_t)high - low + 1 < total;
+}
+
 void RangeEnc::Init(OutBuf &o) {
   out = &o;
   low = 0;
@@ -7,6 +17,15 @@ void RangeEnc::Init(OutBuf &o) {
 }
 
 void RangeEnc::Encode(uint32_t cum_low, uint32_t cum_high, uint32_t total) {
+  if (NeedsUnderflowFix(low, high, total)) {
+    high = low | 0xFFFFu;
+    while ((low ^ high) < (1u << 24)) {
+      out->Put((uint8_t)(high >> 24));
+      low <<= 8;
+      high = (high << 8) | 0xFFu;
+    }
+  }
+
   uint64_t range = (uint64_t)high - low + 1;
   high = low + (uint32_t)((range * cum_high) / total - 1);
   low = low + (uint32_t)((range * cum_low) / total);
@@ -35,13 +54,26 @@ void RangeDec::Init(InBuf &ib) {
   }
 }
 
+void RangeDec::FixUnderflow(uint32_t total) {
+  if (!NeedsUnderflowFix(low, high, total))
+    return;
+  high = low | 0xFFFFu;
+  while ((low ^ high) < (1u << 24)) {
+    low <<= 8;
+    high = (high << 8) | 0xFFu;
+    code = (code << 8) | in->Get();
+  }
+}
+
 uint32_t RangeDec::GetFreq(uint32_t total) {
+  FixUnderflow(total);
   uint64_t range = (uint64_t)high - low + 1;
   uint64_t off = (uint64_t)code - low;
   return (uint32_t)(((off + 1) * total - 1) / range);
 }
 
 void RangeDec::Decode(uint32_t cum_low, uint32_t cum_high, uint32_t total) {
+  FixUnderflow(total);
   uint64_t range = (uint64_t)high - low + 1;
   high = low + (uint32_t)((range * cum_high) / total - 1);
   low = low + (uint32_t)((range * cum_low) / total);
@@ -22,4 +22,7 @@ struct RangeDec {
   void Init(InBuf &ib);
   uint32_t GetFreq(uint32_t total);
   void Decode(uint32_t cum_low, uint32_t cum_high, uint32_t total);
+
+private:
+  void FixUnderflow(uint32_t total);
 };
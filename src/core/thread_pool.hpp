@@ -0,0 +1,111 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size worker pool for running independent jobs concurrently.
+// With a single thread no workers are spawned and Submit() runs the job
+// inline, so the serial path has no scheduling overhead at all.
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned threads = 0) {
+    if (threads == 0) threads = DefaultThreads();
+    if (threads <= 1) return;
+    workers_.reserve(threads);
+    for (unsigned i = 0; i < threads; i++) {
+      workers_.emplace_back([this] { WorkerLoop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& t : workers_) t.join();
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Number of threads that execute jobs (1 when running inline)
+  unsigned Size() const {
+    return workers_.empty() ? 1u : static_cast<unsigned>(workers_.size());
+  }
+
+  void Submit(std::function<void()> job) {
+    if (workers_.empty()) {
+      RunJob(job);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      jobs_.push_back(std::move(job));
+      pending_++;
+    }
+    work_cv_.notify_one();
+  }
+
+  // Block until every submitted job has finished. Rethrows the first
+  // exception raised by a job, if any.
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return pending_ == 0; });
+    if (error_) {
+      std::exception_ptr e = error_;
+      error_ = nullptr;
+      std::rethrow_exception(e);
+    }
+  }
+
+  // Thread count used when the caller asks for auto-detection
+  static unsigned DefaultThreads() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+  }
+
+private:
+  void RunJob(std::function<void()>& job) {
+    try {
+      job();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!error_) error_ = std::current_exception();
+    }
+  }
+
+  void WorkerLoop() {
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_cv_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+        if (jobs_.empty()) return;
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      RunJob(job);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_--;
+      }
+      done_cv_.notify_all();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::deque<std::function<void()>> jobs_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  size_t pending_ = 0;
+  bool stopping_ = false;
+  std::exception_ptr error_;
+};
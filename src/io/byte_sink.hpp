@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Destination for data produced a piece at a time. Streaming decoders
+// write their output here; Flush() pushes out what was written so far to
+// a live consumer, and Close() marks the end of the stream.
+class ByteSink {
+public:
+  virtual ~ByteSink() = default;
+  virtual void Write(const uint8_t *data, size_t n) = 0;
+  virtual void Flush() {}
+  virtual void Close() {}
+};
+
+// Collects everything written into a vector
+class VectorSink : public ByteSink {
+public:
+  explicit VectorSink(size_t reserve = 0) { data_.reserve(reserve); }
+
+  void Write(const uint8_t *data, size_t n) override { data_.insert(data_.end(), data, data + n); }
+
+  std::vector<uint8_t> Take() { return std::move(data_); }
+
+private:
+  std::vector<uint8_t> data_;
+};
+
+// Batches single bytes into chunks before handing them to a sink, so
+// byte-at-a-time decoders do not pay a virtual call per byte
+class ChunkWriter {
+public:
+  static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+  explicit ChunkWriter(ByteSink &sink) : sink_(sink) { buf_.reserve(CHUNK_SIZE); }
+
+  void Put(uint8_t b) {
+    buf_.push_back(b);
+    if (buf_.size() == CHUNK_SIZE) Flush();
+  }
+
+  void Flush() {
+    if (buf_.empty()) return;
+    sink_.Write(buf_.data(), buf_.size());
+    buf_.clear();
+  }
+
+private:
+  ByteSink &sink_;
+  std::vector<uint8_t> buf_;
+};
@@ -1,29 +1,49 @@
 #include "file_io.hpp"
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
 #include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#define KCOMP_HAVE_IO_URING 1
+#endif
 
 constexpr size_t CHUNK_SIZE = 64 * 1024; // 64KB chunks for progress
 
 size_t GetFileSize(const std::string &path) {
   std::FILE *f = std::fopen(path.c_str(), "rb");
   if (!f) return 0;
-  std::fseek(f, 0, SEEK_END);
-  long n = std::ftell(f);
+  fseeko(f, 0, SEEK_END);
+  off_t n = ftello(f);
   std::fclose(f);
   return n > 0 ? static_cast<size_t>(n) : 0;
 }
 
+int64_t GetFileTime(const std::string &path) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) return 0;
+  return (int64_t)st.st_mtime;
+}
+
 std::vector<uint8_t> ReadAll(const std::string &path) {
   std::FILE *f = std::fopen(path.c_str(), "rb");
   if (!f)
     throw std::runtime_error("open failed: " + path);
-  std::fseek(f, 0, SEEK_END);
-  long n = std::ftell(f);
+  fseeko(f, 0, SEEK_END);
+  off_t n = ftello(f);
   if (n < 0) {
     std::fclose(f);
     throw std::runtime_error("ftell failed");
   }
-  std::fseek(f, 0, SEEK_SET);
+  fseeko(f, 0, SEEK_SET);
   std::vector<uint8_t> buf((size_t)n);
   if (!buf.empty() && std::fread(buf.data(), 1, buf.size(), f) != buf.size()) {
     std::fclose(f);
@@ -37,13 +57,13 @@ std::vector<uint8_t> ReadAllWithProgress(const std::string &path, ProgressCallba
   std::FILE *f = std::fopen(path.c_str(), "rb");
   if (!f)
     throw std::runtime_error("open failed: " + path);
-  std::fseek(f, 0, SEEK_END);
-  long n = std::ftell(f);
+  fseeko(f, 0, SEEK_END);
+  off_t n = ftello(f);
   if (n < 0) {
     std::fclose(f);
     throw std::runtime_error("ftell failed");
   }
-  std::fseek(f, 0, SEEK_SET);
+  fseeko(f, 0, SEEK_SET);
 
   size_t total = static_cast<size_t>(n);
   std::vector<uint8_t> buf(total);
@@ -98,3 +118,328 @@ void WriteAllWithProgress(const std::string &path, const std::vector<uint8_t> &d
   }
   std::fclose(f);
 }
+
+size_t ReadUpTo(std::FILE *f, uint8_t *buf, size_t n) {
+  size_t got = 0;
+  while (got < n) {
+    size_t r = std::fread(buf + got, 1, n - got, f);
+    if (r == 0) {
+      if (std::ferror(f))
+        throw std::runtime_error("read failed");
+      break;
+    }
+    got += r;
+  }
+  return got;
+}
+
+size_t ReadSome(std::FILE *f, uint8_t *buf, size_t n, int timeout_ms, bool &eof) {
+  eof = false;
+  int fd = fileno(f);
+  struct pollfd p = {fd, POLLIN, 0};
+  int ready;
+  do {
+    ready = ::poll(&p, 1, timeout_ms);
+  } while (ready < 0 && errno == EINTR);
+  if (ready < 0)
+    throw std::runtime_error("read failed");
+  if (ready == 0)
+    return 0;
+  ssize_t r;
+  do {
+    r = ::read(fd, buf, n);
+  } while (r < 0 && errno == EINTR);
+  if (r < 0)
+    throw std::runtime_error("read failed");
+  eof = r == 0;
+  return static_cast<size_t>(r);
+}
+
+void WriteBytes(std::FILE *f, const uint8_t *data, size_t n) {
+  if (n && std::fwrite(data, 1, n, f) != n)
+    throw std::runtime_error("write failed");
+}
+
+RandomAccessFile::RandomAccessFile(const std::string &path)
+    : fd_(::open(path.c_str(), O_RDONLY)) {
+  if (fd_ < 0)
+    throw std::runtime_error("open failed: " + path);
+  struct stat st;
+  if (::fstat(fd_, &st) != 0) {
+    ::close(fd_);
+    throw std::runtime_error("stat failed: " + path);
+  }
+  size_ = static_cast<uint64_t>(st.st_size);
+}
+
+RandomAccessFile::~RandomAccessFile() { ::close(fd_); }
+
+std::vector<uint8_t> RandomAccessFile::ReadAt(uint64_t offset, size_t n) const {
+  if (offset > size_ || n > size_ - offset)
+    throw std::runtime_error("read past end of file");
+  std::vector<uint8_t> buf(n);
+  for (size_t done = 0; done < n;) {
+    ssize_t got = ::pread(fd_, buf.data() + done, n - done, static_cast<off_t>(offset + done));
+    if (got < 0 && errno == EINTR) continue;
+    if (got <= 0)
+      throw std::runtime_error("read failed");
+    done += static_cast<size_t>(got);
+  }
+  return buf;
+}
+
+bool IsRegularFile(std::FILE *f) {
+  struct stat st;
+  return ::fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+bool IsAppendOnly(std::FILE *f) {
+  int flags = ::fcntl(fileno(f), F_GETFL);
+  return flags >= 0 && (flags & O_APPEND);
+}
+
+MappedFile::MappedFile(const std::string &path, bool populate) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("open failed: " + path);
+  try {
+    Open(fd, populate);
+  } catch (...) {
+    ::close(fd);
+    throw;
+  }
+  ::close(fd);  // The mapping outlives the descriptor
+}
+
+MappedFile::MappedFile(std::FILE *f, bool populate) { Open(fileno(f), populate); }
+
+MappedFile::~MappedFile() {
+  if (map_)
+    ::munmap(map_, size_);
+}
+
+void MappedFile::Prefetch(size_t offset, size_t n) const {
+  if (!map_ || offset >= size_)
+    return;
+  // madvise wants a page-aligned start
+  size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  size_t start = offset / page * page;
+  size_t end = std::min(size_, offset + n);
+  ::madvise(static_cast<uint8_t *>(map_) + start, end - start, MADV_WILLNEED);
+}
+
+void MappedFile::Open(int fd, bool populate) {
+  struct stat st;
+  if (::fstat(fd, &st) != 0)
+    throw std::runtime_error("stat failed");
+  if (S_ISREG(st.st_mode)) {
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ == 0)
+      return;
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    if (populate)
+      flags |= MAP_POPULATE;
+#endif
+    void *p = ::mmap(nullptr, size_, PROT_READ, flags, fd, 0);
+    if (p != MAP_FAILED) {
+      map_ = p;
+      data_ = static_cast<const uint8_t *>(p);
+      if (!populate)
+        ::madvise(p, size_, MADV_SEQUENTIAL);
+      return;
+    }
+  }
+
+  // Pipes, devices and files mmap refuses: read from the current position
+  // to the end
+  size_ = 0;
+  while (true) {
+    copy_.resize(size_ + CHUNK_SIZE);
+    ssize_t got = ::read(fd, copy_.data() + size_, CHUNK_SIZE);
+    if (got < 0 && errno == EINTR)
+      continue;
+    if (got < 0)
+      throw std::runtime_error("read failed");
+    if (got == 0)
+      break;
+    size_ += static_cast<size_t>(got);
+  }
+  copy_.resize(size_);
+  data_ = copy_.data();
+}
+
+void WriteAt(int fd, const uint8_t *data, size_t n, uint64_t offset) {
+  while (n > 0) {
+    ssize_t r = ::pwrite(fd, data, n, static_cast<off_t>(offset));
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      throw std::runtime_error("write failed");
+    data += r;
+    n -= static_cast<size_t>(r);
+    offset += static_cast<uint64_t>(r);
+  }
+}
+
+void ReadAt(int fd, uint8_t *buf, size_t n, uint64_t offset) {
+  while (n > 0) {
+    ssize_t r = ::pread(fd, buf, n, static_cast<off_t>(offset));
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      throw std::runtime_error("read failed");
+    buf += r;
+    n -= static_cast<size_t>(r);
+    offset += static_cast<uint64_t>(r);
+  }
+}
+
+#ifdef KCOMP_HAVE_IO_URING
+
+IoRing::IoRing(unsigned entries) {
+  io_uring_params p = {};
+  int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+  if (fd < 0)
+    return;
+  // IORING_OP_READ/WRITE arrived with IORING_FEAT_RW_CUR_POS (5.6)
+  if (!(p.features & IORING_FEAT_RW_CUR_POS) || !(p.features & IORING_FEAT_NODROP)) {
+    ::close(fd);
+    return;
+  }
+
+  sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single)
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+  void *sq = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                    IORING_OFF_SQ_RING);
+  void *cq = single ? sq
+                    : ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  void *sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                      IORING_OFF_SQES);
+  if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+    if (sq != MAP_FAILED)
+      ::munmap(sq, sq_ring_size_);
+    if (!single && cq != MAP_FAILED)
+      ::munmap(cq, cq_ring_size_);
+    if (sqes != MAP_FAILED)
+      ::munmap(sqes, sqes_size_);
+    ::close(fd);
+    return;
+  }
+
+  uint8_t *sqb = static_cast<uint8_t *>(sq), *cqb = static_cast<uint8_t *>(cq);
+  sq_ring_ = sq;
+  cq_ring_ = cq;
+  sqes_ = sqes;
+  sq_tail_ = reinterpret_cast<unsigned *>(sqb + p.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned *>(sqb + p.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned *>(sqb + p.sq_off.array);
+  cq_head_ = reinterpret_cast<unsigned *>(cqb + p.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(cqb + p.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned *>(cqb + p.cq_off.ring_mask);
+  cqes_ = cqb + p.cq_off.cqes;
+  entries_ = p.sq_entries;
+  fd_ = fd;
+}
+
+IoRing::~IoRing() {
+  if (fd_ < 0)
+    return;
+  // The kernel may still be filling or reading caller buffers
+  try {
+    uint64_t tag;
+    int64_t res;
+    while (pending_ > 0)
+      Wait(tag, res);
+  } catch (...) {
+  }
+  ::munmap(sqes_, sqes_size_);
+  if (cq_ring_ != sq_ring_)
+    ::munmap(cq_ring_, cq_ring_size_);
+  ::munmap(sq_ring_, sq_ring_size_);
+  ::close(fd_);
+}
+
+bool IoRing::Queue(uint8_t op, int fd, const void *buf, size_t n, uint64_t offset,
+                   uint64_t tag) {
+  if (fd_ < 0 || pending_ >= entries_)
+    return false;
+  unsigned tail = *sq_tail_;
+  unsigned index = tail & *sq_mask_;
+  io_uring_sqe *sqe = static_cast<io_uring_sqe *>(sqes_) + index;
+  std::memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buf);
+  sqe->len = static_cast<uint32_t>(std::min<size_t>(n, UINT32_MAX));
+  sqe->off = offset;
+  sqe->user_data = tag;
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  queued_++;
+  pending_++;
+  return true;
+}
+
+bool IoRing::Read(int fd, void *buf, size_t n, uint64_t offset, uint64_t tag) {
+  return Queue(IORING_OP_READ, fd, buf, n, offset, tag);
+}
+
+bool IoRing::Write(int fd, const void *buf, size_t n, uint64_t offset, uint64_t tag) {
+  return Queue(IORING_OP_WRITE, fd, buf, n, offset, tag);
+}
+
+void IoRing::Enter(unsigned min_complete) {
+  unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+  while (queued_ > 0 || min_complete > 0) {
+    long r = ::syscall(__NR_io_uring_enter, fd_, queued_, min_complete, flags, nullptr, 0);
+    if (r < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+      continue;
+    if (r < 0)
+      throw std::runtime_error("io_uring_enter failed");
+    queued_ -= std::min<unsigned>(queued_, static_cast<unsigned>(r));
+    return;
+  }
+}
+
+void IoRing::Submit() {
+  if (fd_ >= 0 && queued_ > 0)
+    Enter(0);
+}
+
+void IoRing::Wait(uint64_t &tag, int64_t &res) {
+  if (fd_ < 0 || pending_ == 0)
+    throw std::logic_error("IoRing::Wait with nothing pending");
+  while (true) {
+    unsigned head = *cq_head_;
+    if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+      const io_uring_cqe *cqe = static_cast<const io_uring_cqe *>(cqes_) + (head & *cq_mask_);
+      tag = cqe->user_data;
+      res = cqe->res;
+      __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+      pending_--;
+      return;
+    }
+    Enter(1);
+  }
+}
+
+#else
+
+IoRing::IoRing(unsigned) {}
+IoRing::~IoRing() {}
+bool IoRing::Queue(uint8_t, int, const void *, size_t, uint64_t, uint64_t) { return false; }
+bool IoRing::Read(int, void *, size_t, uint64_t, uint64_t) { return false; }
+bool IoRing::Write(int, const void *, size_t, uint64_t, uint64_t) { return false; }
+void IoRing::Enter(unsigned) {}
+void IoRing::Submit() {}
+void IoRing::Wait(uint64_t &, int64_t &) {
+  throw std::logic_error("IoRing::Wait with nothing pending");
+}
+
+#endif
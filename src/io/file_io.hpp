@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <cstdio>
 #include <functional>
 #include <string>
 #include <vector>
@@ -12,3 +13,138 @@ std::vector<uint8_t> ReadAllWithProgress(const std::string &path, ProgressCallba
 void WriteAll(const std::string &path, const std::vector<uint8_t> &data);
 void WriteAllWithProgress(const std::string &path, const std::vector<uint8_t> &data, ProgressCallback cb);
 size_t GetFileSize(const std::string &path);
+
+// Modification time in Unix seconds, 0 if the file cannot be stat'ed
+int64_t GetFileTime(const std::string &path);
+
+// Read up to `n` bytes from a stream (pipe, stdin, file); fewer only at EOF
+size_t ReadUpTo(std::FILE *f, uint8_t *buf, size_t n);
+
+// Read what is available from the descriptor behind `f`, up to `n` bytes,
+// waiting at most `timeout_ms` for the first one (-1 = no limit). Returns
+// 0 on a timeout or at the end of the input, which sets `eof`. Bypasses
+// stdio, so `f` must not have been read through it.
+size_t ReadSome(std::FILE *f, uint8_t *buf, size_t n, int timeout_ms, bool &eof);
+
+// Write all of `data` to a stream; throws on failure
+void WriteBytes(std::FILE *f, const uint8_t *data, size_t n);
+
+// Read-only file with positioned reads (pread), for formats that are read
+// by seeking rather than front to back. Reads go straight to the requested
+// bytes without filling a stream buffer, and may run concurrently.
+class RandomAccessFile {
+public:
+  explicit RandomAccessFile(const std::string &path);  // Throws if it cannot be opened
+  ~RandomAccessFile();
+
+  RandomAccessFile(const RandomAccessFile &) = delete;
+  RandomAccessFile &operator=(const RandomAccessFile &) = delete;
+
+  uint64_t Size() const { return size_; }
+
+  // Exactly `n` bytes at `offset`; throws if the file is shorter
+  std::vector<uint8_t> ReadAt(uint64_t offset, size_t n) const;
+
+private:
+  int fd_;
+  uint64_t size_ = 0;
+};
+
+// True if `f` is backed by a regular file (not a pipe, socket or device)
+bool IsRegularFile(std::FILE *f);
+
+// True if `f` was opened for appending (O_APPEND), so every write lands at
+// the end whatever offset it asks for
+bool IsAppendOnly(std::FILE *f);
+
+// Whole-file read-only view without copying into anonymous memory: regular
+// files are mmap'ed, with sequential read-ahead advice (or prefaulted with
+// MAP_POPULATE if `populate`); pipes and other files mmap refuses are read
+// into memory instead
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path, bool populate = false);  // Throws if unreadable
+  // The file behind `f`: a regular file whole, whatever the stream
+  // position; anything else from the descriptor position on
+  explicit MappedFile(std::FILE *f, bool populate = false);
+  ~MappedFile();
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  const uint8_t *Data() const { return data_; }
+  size_t Size() const { return size_; }
+  bool Mapped() const { return map_ != nullptr; }
+
+  // Start reading [offset, offset + n) into the page cache in the
+  // background (MADV_WILLNEED), ahead of its use
+  void Prefetch(size_t offset, size_t n) const;
+
+private:
+  void Open(int fd, bool populate);
+
+  void *map_ = nullptr;
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  std::vector<uint8_t> copy_;  // Contents of an unmappable file
+};
+
+// Minimal io_uring (Linux, raw syscalls): reads and writes at explicit
+// offsets, several in flight at once, completing in any order. Available()
+// is false where the kernel is too old (before 5.6), io_uring is disabled
+// or the platform has none; callers then fall back to threads.
+class IoRing {
+public:
+  explicit IoRing(unsigned entries);
+  ~IoRing();  // Waits for requests still in flight, which use caller memory
+
+  IoRing(const IoRing &) = delete;
+  IoRing &operator=(const IoRing &) = delete;
+
+  bool Available() const { return fd_ >= 0; }
+
+  // Requests queued or in flight whose completion Wait has not returned
+  unsigned Pending() const { return pending_; }
+  unsigned Capacity() const { return entries_; }
+
+  // Queue a request for `n` bytes at `offset` of `fd`; `tag` comes back
+  // with its completion. False if Capacity() requests are pending.
+  bool Read(int fd, void *buf, size_t n, uint64_t offset, uint64_t tag);
+  bool Write(int fd, const void *buf, size_t n, uint64_t offset, uint64_t tag);
+
+  // Hand the queued requests to the kernel without waiting
+  void Submit();
+
+  // Submit, then wait for the next completion: its tag, and the bytes
+  // transferred or -errno in `res`. Throws if nothing is pending.
+  void Wait(uint64_t &tag, int64_t &res);
+
+private:
+  bool Queue(uint8_t op, int fd, const void *buf, size_t n, uint64_t offset, uint64_t tag);
+  void Enter(unsigned min_complete);
+
+  int fd_ = -1;
+  unsigned entries_ = 0;
+  unsigned queued_ = 0;   // In the submission queue, not yet submitted
+  unsigned pending_ = 0;  // Queued or in flight
+  void *sq_ring_ = nullptr;
+  void *cq_ring_ = nullptr;
+  void *sqes_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  size_t cq_ring_size_ = 0;
+  size_t sqes_size_ = 0;
+  unsigned *sq_tail_ = nullptr;
+  unsigned *sq_mask_ = nullptr;
+  unsigned *sq_array_ = nullptr;
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned *cq_mask_ = nullptr;
+  void *cqes_ = nullptr;
+};
+
+// Write all `n` bytes at `offset` of `fd` (pwrite); throws on failure
+void WriteAt(int fd, const uint8_t *data, size_t n, uint64_t offset);
+
+// Read exactly `n` bytes at `offset` of `fd` (pread); throws on failure or
+// if the file ends first
+void ReadAt(int fd, uint8_t *buf, size_t n, uint64_t offset);
@@ -1,34 +1,67 @@
+#include "core/archive.hpp"
 #include "core/benchmark.hpp"
+#include "core/container.hpp"
 #include "core/progress.hpp"
 #include "io/file_io.hpp"
 #include "models/ppm.hpp"
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <exception>
+#include <memory>
+#include <stdexcept>
 #include <chrono>
+#include <ctime>
 
 #ifndef KCOMP_VERSION
 #define KCOMP_VERSION "1.0.2"
 #endif
 
-// File format magic bytes
-static const uint8_t MAGIC[2] = {'K', 'C'};
-static const uint8_t FORMAT_VERSION = 2;
-
 static void print_usage() {
   std::fprintf(stderr,
     "kcomp %s - High-performance compression utility\n"
     "\n"
     "Usage:\n"
     "  kcomp <input>              Compress (output: <input>.kc)\n"
-    "  kcomp c <input> [output]   Compress a file\n"
-    "  kcomp d <input> [output]   Decompress a file\n"
-    "  kcomp b <input>            Benchmark compression\n"
+    "  kcomp c <input> [output]   Compress a file (- = stdin/stdout)\n"
+    "  kcomp d <input> [output]   Decompress a file (- = stdin/stdout)\n"
+    "  kcomp t <input>...         Verify .kc files without writing output\n"
+    "  kcomp l <input>...         List .kc files from their headers alone\n"
+    "  kcomp u <old.kc> <input> [output]  Recompress only what changed since old.kc\n"
+    "  kcomp a <out.kc> <path>... Archive files and directories\n"
+    "  kcomp x <archive> [name]...  Extract an archive (or only the named members)\n"
+    "  kcomp b <input>...         Benchmark compression\n"
     "  kcomp -v, --version        Show version and credits\n"
     "  kcomp -h, --help           Show this help message\n"
     "\n"
     "Options:\n"
     "  -s, --silent               Disable progress bar\n"
+    "  -c, --stdout               (c, d) Write to stdout\n"
+    "  -1 ... -9                  Compression level: fastest to best (default: -9)\n"
+    "  -T, --threads <n>          Compression / decompression threads (default: auto)\n"
+    "  --time-budget <t>          Stop the mode search after t, e.g. 2 or 500ms\n"
+    "  --max-memory <size>        Memory cap for the mode search, e.g. 512M\n"
+    "  --sample                   Pick modes on sampled slices, then confirm\n"
+    "  -k, --top-k <n>            Modes confirmed on the full input (default: 3)\n"
+    "  --slice <size>             Sample slice size, e.g. 64K (default: 64K)\n"
+    "  --no-prefilter             Try every mode, even ones the input stats rule out\n"
+    "  --frame-size <size>        Independently coded frames of this size (default: 4M;\n"
+    "                             u: the old file's)\n"
+    "  --index                    (c) Append a frame index for fast --range reads\n"
+    "  --hash                     (c, a, u) Store a whole-file XXH64 next to the frame CRCs\n"
+    "  --dedup                    (c, a) Store repeated chunks once, however far apart\n"
+    "  --resume                   (c) Keep the intact frames of an interrupted output\n"
+    "  --flush <t>                (c) Write a frame at most t after its first byte arrives\n"
+    "  --flush-bytes <size>       (c) Write a frame once this much input is pending\n"
+    "  --live                     (d) Decode and write each frame as soon as it arrives\n"
+    "  -C <dir>                   (x) Extract into this directory (default: .)\n"
+    "  --range <off>:<len>        (d) Decode only these bytes, e.g. 1G:64K\n"
+    "  --block-size <size>        Pick a mode per block of this size, e.g. 1M\n"
+    "  --adaptive-blocks          Cut blocks where the content changes (max: --block-size)\n"
+    "  --decode-weight <w>        Trade w bytes of output per ms of estimated decode time\n"
+    "  --min-decode-speed <MB/s>  Only consider modes estimated to decode this fast\n"
+    "  --decode-profile <file>    Decode cost estimates from `kcomp b --calibrate-decode`\n"
+    "  --calibrate-decode <file>  (b) Measure per-mode decode cost and save a profile\n"
     "\n"
     "Examples:\n"
     "  kcomp video.mp4                        # -> video.mp4.kc\n"
@@ -37,6 +70,27 @@ static void print_usage() {
     "  kcomp d archive.kc                     # -> original filename\n"
     "  kcomp d archive.kc document.txt        # Explicit output\n"
     "  kcomp c -s file.txt                    # Silent mode\n"
+    "  tar cf - dir | kcomp c - > dir.tar.kc  # Compress a pipe\n"
+    "  kcomp d -c dir.tar.kc | tar xf -       # Decompress to a pipe\n"
+    "  kcomp t -T 8 store/*.kc                # Scrub archives on 8 threads\n"
+    "  kcomp l store/*.kc                     # Sizes, modes and dates without decoding\n"
+    "  kcomp a src.kc src/                    # Archive a directory\n"
+    "  kcomp c --dedup vm.img vm.img.kc       # Backups with long-range repeats\n"
+    "  kcomp u db.dump.kc db.dump             # Refresh db.dump.kc after a change\n"
+    "  kcomp c --resume huge.img              # Continue after a crash or kill\n"
+    "  tail -f a.log | kcomp c --flush 1 -    # Live, at most 1s behind the log\n"
+    "  kcomp x src.kc -C /tmp src/main.cpp    # Extract one member\n"
+    "  kcomp c -T 4 file.txt                  # Use 4 threads\n"
+    "  kcomp c -3 file.txt                    # Fast, fewer modes\n"
+    "  kcomp c --sample -k 2 big.log          # Fast selection for large files\n"
+    "  kcomp c --time-budget 500ms req.json   # Best result within 0.5s\n"
+    "  kcomp c --max-memory 512M big.bin      # Fit a 512 MB container\n"
+    "  kcomp c --adaptive-blocks backup.tar   # Mode per region of mixed content\n"
+    "  kcomp c --index --frame-size 1M db.log # Seekable output\n"
+    "  kcomp d --range 300M:4K db.log.kc part # Decode 4 KB at offset 300 MB\n"
+    "  kcomp b --slice 32K a.txt b.bin        # Sampled vs exhaustive agreement\n"
+    "  kcomp c --min-decode-speed 50 app.js   # Keep decoding at 50 MB/s or more\n"
+    "  kcomp b --calibrate-decode cpu.prof *.txt  # Profile this machine's decoders\n"
     "\n"
     "Algorithms: PPM, LZ77, BWT, Context Mixing with adaptive selection.\n",
     KCOMP_VERSION
@@ -58,13 +112,6 @@ static void print_version() {
   );
 }
 
-// Extract basename from path (without directory)
-static std::string get_basename(const std::string& path) {
-  size_t pos = path.find_last_of("/\\");
-  if (pos == std::string::npos) return path;
-  return path.substr(pos + 1);
-}
-
 // Generate output path for compression: input.ext -> input.ext.kc
 static std::string make_compress_output(const std::string& input) {
   return input + ".kc";
@@ -82,201 +129,443 @@ static std::string make_decompress_output(const std::string& input) {
 static bool is_file_arg(const std::string& arg) {
   if (arg.empty()) return false;
   if (arg[0] == '-') return false;
-  if (arg == "c" || arg == "d" || arg == "b") return false;
+  if (arg == "c" || arg == "d" || arg == "t" || arg == "l" || arg == "u" || arg == "a" ||
+      arg == "x" || arg == "b")
+    return false;
   return true;
 }
 
-// Add file header with original filename
-static std::vector<uint8_t> add_header(const std::vector<uint8_t>& compressed, const std::string& original_name) {
-  std::string basename = get_basename(original_name);
-  if (basename.size() > 65535) basename = basename.substr(0, 65535);
-
-  std::vector<uint8_t> result;
-  result.reserve(5 + basename.size() + compressed.size());
-
-  // Magic bytes
-  result.push_back(MAGIC[0]);
-  result.push_back(MAGIC[1]);
-
-  // Version
-  result.push_back(FORMAT_VERSION);
-
-  // Filename length (2 bytes, little-endian)
-  uint16_t name_len = static_cast<uint16_t>(basename.size());
-  result.push_back(name_len & 0xFF);
-  result.push_back((name_len >> 8) & 0xFF);
-
-  // Filename
-  result.insert(result.end(), basename.begin(), basename.end());
+// Parse a positive count in [1, max] for options such as --top-k
+static bool parse_count(const std::string& value, unsigned max, unsigned& count) {
+  char* end = nullptr;
+  unsigned long n = std::strtoul(value.c_str(), &end, 10);
+  if (value.empty() || *end != '\0' || n == 0 || n > max) return false;
+  count = static_cast<unsigned>(n);
+  return true;
+}
 
-  // Compressed data
-  result.insert(result.end(), compressed.begin(), compressed.end());
+// Parse a byte count with an optional K, M or G suffix (e.g. 0, 65536, 64K, 1M)
+static bool parse_bytes(const std::string& value, unsigned long long& bytes) {
+  char* end = nullptr;
+  unsigned long long n = std::strtoull(value.c_str(), &end, 10);
+  if (value.empty() || end == value.c_str() || value[0] == '-') return false;
+  std::string suffix = end;
+  if (suffix == "K" || suffix == "k") {
+    n <<= 10;
+  } else if (suffix == "M" || suffix == "m") {
+    n <<= 20;
+  } else if (suffix == "G" || suffix == "g") {
+    n <<= 30;
+  } else if (!suffix.empty()) {
+    return false;
+  }
+  bytes = n;
+  return true;
+}
 
-  return result;
+// Parse a positive byte size such as --max-memory 512M
+static bool parse_size(const std::string& value, size_t& size) {
+  unsigned long long n = 0;
+  if (!parse_bytes(value, n) || n == 0) return false;
+  size = static_cast<size_t>(n);
+  return true;
 }
 
-// Parse file header and extract original filename
-// Returns empty string if no header (legacy format)
-static std::string parse_header(const std::vector<uint8_t>& data, size_t& data_offset) {
-  data_offset = 0;
+// Parse --range <offset>:<length>; the offset may be 0, the length may not
+static bool parse_range(const std::string& value, uint64_t& offset, uint64_t& length) {
+  size_t colon = value.find(':');
+  unsigned long long off = 0, len = 0;
+  if (colon == std::string::npos || !parse_bytes(value.substr(0, colon), off) ||
+      !parse_bytes(value.substr(colon + 1), len) || len == 0)
+    return false;
+  offset = off;
+  length = len;
+  return true;
+}
 
-  // Check for magic bytes
-  if (data.size() < 5 || data[0] != MAGIC[0] || data[1] != MAGIC[1]) {
-    // Legacy format (no header)
-    return "";
+// Parse a duration in seconds with an optional s or ms suffix (e.g. 2, 0.5, 250ms)
+static bool parse_seconds(const std::string& value, double& seconds) {
+  char* end = nullptr;
+  double n = std::strtod(value.c_str(), &end);
+  if (value.empty() || end == value.c_str() || !(n > 0)) return false;
+  std::string suffix = end;
+  if (suffix == "ms") {
+    n /= 1000;
+  } else if (!suffix.empty() && suffix != "s") {
+    return false;
   }
+  seconds = n;
+  return true;
+}
+
+// Parse a non-negative rate such as --decode-weight 0.5
+static bool parse_rate(const std::string& value, double& rate) {
+  char* end = nullptr;
+  double n = std::strtod(value.c_str(), &end);
+  if (value.empty() || *end != '\0' || !(n >= 0) || n > 1e12) return false;
+  rate = n;
+  return true;
+}
 
-  uint8_t version = data[2];
-  if (version != FORMAT_VERSION) {
-    // Unknown version, treat as legacy
-    return "";
+// Parse a hybrid option shared by `kcomp c` and `kcomp b`. Returns 1 if
+// argv[i] was consumed (advancing i past any value), 0 if it is not a
+// hybrid option, and -1 on a malformed value.
+static int parse_hybrid_option(int argc, char** argv, int& i, HybridOptions& opts) {
+  std::string arg = argv[i];
+  bool has_value = i + 1 < argc;
+  if (arg.size() == 2 && arg[0] == '-' && arg[1] >= '0' + MIN_LEVEL && arg[1] <= '0' + MAX_LEVEL) {
+    opts.level = arg[1] - '0';
+    return 1;
+  } else if (arg == "-T" || arg == "--threads") {
+    if (!has_value || !parse_count(argv[i + 1], 1024, opts.threads)) {
+      std::fprintf(stderr, "error: %s expects a thread count\n", arg.c_str());
+      return -1;
+    }
+  } else if (arg == "-k" || arg == "--top-k") {
+    if (!has_value || !parse_count(argv[i + 1], 255, opts.top_k)) {
+      std::fprintf(stderr, "error: %s expects a mode count\n", arg.c_str());
+      return -1;
+    }
+    opts.sample = true;
+  } else if (arg == "--slice") {
+    if (!has_value || !parse_size(argv[i + 1], opts.slice_size)) {
+      std::fprintf(stderr, "error: %s expects a size\n", arg.c_str());
+      return -1;
+    }
+    opts.sample = true;
+  } else if (arg == "--time-budget") {
+    if (!has_value || !parse_seconds(argv[i + 1], opts.time_budget)) {
+      std::fprintf(stderr, "error: %s expects a duration, e.g. 2 or 500ms\n", arg.c_str());
+      return -1;
+    }
+  } else if (arg == "--max-memory") {
+    if (!has_value || !parse_size(argv[i + 1], opts.max_memory)) {
+      std::fprintf(stderr, "error: %s expects a size, e.g. 512M\n", arg.c_str());
+      return -1;
+    }
+  } else if (arg == "--decode-weight") {
+    if (!has_value || !parse_rate(argv[i + 1], opts.decode_weight)) {
+      std::fprintf(stderr, "error: %s expects bytes per ms of decode time\n", arg.c_str());
+      return -1;
+    }
+  } else if (arg == "--min-decode-speed") {
+    if (!has_value || !parse_rate(argv[i + 1], opts.min_decode_speed)) {
+      std::fprintf(stderr, "error: %s expects a speed in MB/s\n", arg.c_str());
+      return -1;
+    }
+  } else if (arg == "--decode-profile") {
+    auto profile = std::make_shared<DecodeProfile>();
+    if (!has_value || !LoadDecodeProfile(argv[i + 1], *profile)) {
+      std::fprintf(stderr, "error: %s expects a profile from `kcomp b --calibrate-decode`\n",
+                   arg.c_str());
+      return -1;
+    }
+    opts.decode_profile = profile;
+  } else if (arg == "--block-size") {
+    if (!has_value || !parse_size(argv[i + 1], opts.block_size)) {
+      std::fprintf(stderr, "error: %s expects a size, e.g. 1M\n", arg.c_str());
+      return -1;
+    }
+  } else if (arg == "--adaptive-blocks") {
+    opts.adaptive_blocks = true;
+    return 1;
+  } else if (arg == "--sample") {
+    opts.sample = true;
+    return 1;
+  } else if (arg == "--no-prefilter") {
+    opts.prefilter = false;
+    return 1;
+  } else {
+    return 0;
   }
+  i++;
+  return 1;
+}
 
-  // Read filename length
-  uint16_t name_len = data[3] | (data[4] << 8);
+// "-" names stdin or stdout, so kcomp can sit in a pipeline
+static std::FILE* open_stream(const std::string& path, const char* mode) {
+  if (path == "-") return mode[0] == 'r' ? stdin : stdout;
+  std::FILE* f = std::fopen(path.c_str(), mode);
+  if (!f) throw std::runtime_error("open failed: " + path);
+  return f;
+}
 
-  if (data.size() < 5 + name_len) {
-    // Corrupted header, treat as legacy
-    return "";
+static void close_stream(std::FILE* f) {
+  if (f == stdin) return;
+  if ((f == stdout ? std::fflush(f) : std::fclose(f)) != 0) {
+    throw std::runtime_error("write failed");
   }
+}
 
-  // Extract filename
-  std::string filename(data.begin() + 5, data.begin() + 5 + name_len);
-  data_offset = 5 + name_len;
+static const char* display_path(const std::string& path) {
+  return path == "-" ? "<stdout>" : path.c_str();
+}
 
-  return filename;
+// Files written by the CLI carry header metadata for `kcomp l`
+static ContainerOptions with_meta(ContainerOptions copts, int64_t mtime) {
+  copts.meta = true;
+  copts.mtime = mtime;
+  copts.created = (int64_t)std::time(nullptr);
+  return copts;
 }
 
-static int do_compress(const char* input_path, const char* output_path, bool silent) {
-  size_t file_size = GetFileSize(input_path);
+// Compress frame by frame, so memory stays bounded whatever the input size
+static int do_compress(const std::string& input_path, const std::string& output_path, bool silent,
+                       const HybridOptions& opts = HybridOptions{},
+                       const ContainerOptions& copts = ContainerOptions{}) {
+  size_t file_size = input_path == "-" ? 0 : GetFileSize(input_path);
   bool show_progress = !silent && file_size > 0;
-
-  std::vector<uint8_t> input;
   auto start = std::chrono::high_resolution_clock::now();
 
-  // Read with progress
-  if (show_progress) {
-    ProgressBar read_bar(file_size, "Reading", true);
-    input = ReadAllWithProgress(input_path, [&](size_t current, size_t) {
-      read_bar.update(current);
-    });
-    read_bar.finish();
-  } else {
-    input = ReadAll(input_path);
-  }
+  std::FILE* in = open_stream(input_path, "rb");
+  std::FILE* out = open_stream(output_path, "wb");
+
+  // Input from stdin has no name or time to store
+  ContainerOptions file_copts = with_meta(copts, input_path == "-" ? 0 : GetFileTime(input_path));
+  uint64_t raw_size = 0;
+  ProgressBar bar(file_size, "Compressing", show_progress);
+  uint64_t out_size = WriteContainerStream(in, out, input_path == "-" ? "" : input_path, opts,
+                                           file_copts, [&](uint64_t done) {
+    raw_size = done;
+    bar.update(done);
+  });
+  if (show_progress) bar.finish();
+  close_stream(in);
+  close_stream(out);
 
-  // Compress with spinner
-  std::vector<uint8_t> compressed;
-  if (show_progress) {
-    Spinner compress_spinner("Compressing", true);
-    compressed = CompressHybrid(input);
-    compress_spinner.finish("done");
-  } else {
-    compressed = CompressHybrid(input);
+  auto end = std::chrono::high_resolution_clock::now();
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+  if (!silent) {
+    double ratio = raw_size > 0 ? (100.0 * out_size / raw_size) : 0;
+    std::fprintf(stderr, "\n%s -> %s\n", format_size(raw_size).c_str(), format_size(out_size).c_str());
+    std::fprintf(stderr, "Ratio: %.1f%% | Time: %.2fs\n", ratio, duration / 1000.0);
+    std::fprintf(stderr, "Output: %s\n", display_path(output_path));
   }
 
-  // Add header with original filename
-  std::vector<uint8_t> out = add_header(compressed, input_path);
+  return 0;
+}
 
-  // Write with progress
-  if (show_progress) {
-    ProgressBar write_bar(out.size(), "Writing", true);
-    WriteAllWithProgress(output_path, out, [&](size_t current, size_t) {
-      write_bar.update(current);
-    });
-    write_bar.finish();
-  } else {
-    WriteAll(output_path, out);
-  }
+// Compress into `output_path`, keeping whatever an interrupted run of the
+// same command left there
+static int do_resume(const std::string& input_path, const std::string& output_path, bool silent,
+                     const HybridOptions& opts, const ContainerOptions& copts) {
+  size_t file_size = GetFileSize(input_path);
+  bool show_progress = !silent && file_size > 0;
+  auto start = std::chrono::high_resolution_clock::now();
+
+  ProgressBar bar(file_size, "Compressing", show_progress);
+  ResumeStats stats = ResumeContainer(input_path, output_path, opts,
+                                      with_meta(copts, GetFileTime(input_path)),
+                                      [&](uint64_t done) { bar.update(done); });
+  if (show_progress) bar.finish();
 
   auto end = std::chrono::high_resolution_clock::now();
   auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
 
   if (!silent) {
-    double ratio = input.size() > 0 ? (100.0 * out.size() / input.size()) : 0;
-    std::fprintf(stderr, "\n%s -> %s\n", format_size(input.size()).c_str(), format_size(out.size()).c_str());
-    std::fprintf(stderr, "Ratio: %.1f%% | Time: %.2fs\n", ratio, duration / 1000.0);
-    std::fprintf(stderr, "Output: %s\n", output_path);
+    std::fprintf(stderr, "\n%s -> %s\n", format_size(file_size).c_str(),
+                 format_size(stats.size).c_str());
+    std::fprintf(stderr, "Resumed after %llu frames (%s)\n",
+                 (unsigned long long)stats.kept_frames, format_size(stats.kept_bytes).c_str());
+    std::fprintf(stderr, "Time: %.2fs\n", duration / 1000.0);
+    std::fprintf(stderr, "Output: %s\n", output_path.c_str());
   }
-
   return 0;
 }
 
-static int do_decompress(const char* input_path, const std::string& explicit_output, bool silent) {
+// Compress `input_path` reusing the unchanged frames of `old_path`. The
+// file is written next to `output_path` and renamed over it at the end, so
+// the output may be the old file itself.
+static int do_update(const std::string& old_path, const std::string& input_path,
+                     const std::string& output_path, bool silent, const HybridOptions& opts,
+                     const ContainerOptions& copts) {
   size_t file_size = GetFileSize(input_path);
   bool show_progress = !silent && file_size > 0;
-
-  std::vector<uint8_t> input;
   auto start = std::chrono::high_resolution_clock::now();
 
-  // Read with progress
-  if (show_progress) {
-    ProgressBar read_bar(file_size, "Reading", true);
-    input = ReadAllWithProgress(input_path, [&](size_t current, size_t) {
-      read_bar.update(current);
-    });
-    read_bar.finish();
-  } else {
-    input = ReadAll(input_path);
+  std::string temp_path = output_path + ".tmp";
+  std::FILE* out = open_stream(temp_path, "wb");
+  UpdateStats stats;
+  ProgressBar bar(file_size, "Updating", show_progress);
+  try {
+    stats = UpdateContainer(old_path, input_path, out, opts,
+                            with_meta(copts, GetFileTime(input_path)),
+                            [&](uint64_t done) { bar.update(done); });
+  } catch (...) {
+    std::fclose(out);
+    std::remove(temp_path.c_str());
+    throw;
+  }
+  if (show_progress) bar.finish();
+  if (std::fclose(out) != 0 || std::rename(temp_path.c_str(), output_path.c_str()) != 0) {
+    std::remove(temp_path.c_str());
+    throw std::runtime_error("write failed: " + output_path);
   }
 
-  // Parse header to get original filename
-  size_t data_offset = 0;
-  std::string original_name = parse_header(input, data_offset);
+  auto end = std::chrono::high_resolution_clock::now();
+  auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
 
-  // Determine output path
-  std::string output_path;
-  if (!explicit_output.empty()) {
-    output_path = explicit_output;
-  } else if (!original_name.empty()) {
-    // Use original filename from header
-    output_path = original_name;
-  } else {
-    // Fallback: remove .kc extension
-    output_path = make_decompress_output(input_path);
+  if (!silent) {
+    std::fprintf(stderr, "\n%s -> %s\n", format_size(stats.raw_size).c_str(),
+                 format_size(stats.size).c_str());
+    std::fprintf(stderr, "Reused: %llu of %llu frames (%s), recompressed %s\n",
+                 (unsigned long long)stats.reused_frames, (unsigned long long)stats.frames,
+                 format_size(stats.reused_bytes).c_str(),
+                 format_size(stats.raw_size - stats.reused_bytes).c_str());
+    std::fprintf(stderr, "Time: %.2fs\n", duration / 1000.0);
+    std::fprintf(stderr, "Output: %s\n", output_path.c_str());
   }
+  return 0;
+}
 
-  // Extract compressed data (skip header if present)
-  std::vector<uint8_t> compressed_data;
-  if (data_offset > 0) {
-    compressed_data.assign(input.begin() + data_offset, input.end());
-  } else {
-    compressed_data = std::move(input);
-  }
+// Bytes of the decompressed data to produce with `kcomp d --range`
+struct DecodeRange {
+  bool active = false;
+  uint64_t offset = 0;
+  uint64_t length = 0;
+};
+
+// Output path for decompression: explicit, else the name stored in the
+// header, else the input minus .kc; stdin decodes to stdout
+static std::string decompress_output(const std::string& input_path,
+                                     const std::string& explicit_output,
+                                     const std::string& original_name) {
+  if (!explicit_output.empty()) return explicit_output;
+  if (input_path == "-") return "-";
+  if (!original_name.empty()) return original_name;
+  return make_decompress_output(input_path);
+}
 
-  // Decompress with spinner
-  std::vector<uint8_t> out;
-  if (show_progress) {
-    Spinner decompress_spinner("Decompressing", true);
-    out = DecompressHybrid(compressed_data);
-    decompress_spinner.finish("done");
-  } else {
-    out = DecompressHybrid(compressed_data);
-  }
+// Decompress a batch of frames at a time, or with a range only the frames
+// covering it
+static int do_decompress(const std::string& input_path, const std::string& explicit_output,
+                         bool silent, unsigned threads = 0,
+                         const DecodeRange& range = DecodeRange{}, bool live = false) {
+  size_t file_size = input_path == "-" ? 0 : GetFileSize(input_path);
+  bool show_progress = !silent && file_size > 0;
+  auto start = std::chrono::high_resolution_clock::now();
 
-  // Write with progress
-  if (show_progress) {
-    ProgressBar write_bar(out.size(), "Writing", true);
-    WriteAllWithProgress(output_path.c_str(), out, [&](size_t current, size_t) {
-      write_bar.update(current);
-    });
-    write_bar.finish();
+  std::string output_path;
+  uint64_t out_size = 0;
+  if (range.active) {
+    if (input_path == "-") {
+      std::fprintf(stderr, "error: --range needs a seekable input file\n");
+      return 1;
+    }
+    std::string original_name;
+    std::vector<uint8_t> out =
+        ReadContainerRange(input_path, range.offset, range.length, original_name, threads);
+    output_path = decompress_output(input_path, explicit_output, original_name);
+    std::FILE* f = open_stream(output_path, "wb");
+    WriteBytes(f, out.data(), out.size());
+    close_stream(f);
+    out_size = out.size();
   } else {
-    WriteAll(output_path, out);
+    std::FILE* in = open_stream(input_path, "rb");
+    ContainerReader reader(in, threads);
+    reader.SetLive(live);
+    if (reader.Flags() & KC_FLAG_ARCHIVE) {
+      throw std::runtime_error(input_path + " is an archive; extract it with kcomp x");
+    }
+    output_path = decompress_output(input_path, explicit_output, reader.Name());
+    std::FILE* out = open_stream(output_path, "wb");
+
+    Spinner spinner("Decompressing", show_progress);
+    out_size = reader.DecodeTo(out, [&](uint64_t) { spinner.tick(); });
+    if (show_progress) spinner.finish("done");
+    close_stream(in);
+    close_stream(out);
   }
 
   auto end = std::chrono::high_resolution_clock::now();
   auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
 
   if (!silent) {
-    std::fprintf(stderr, "\n%s -> %s\n", format_size(file_size).c_str(), format_size(out.size()).c_str());
+    std::fprintf(stderr, "\n%s -> %s\n", format_size(file_size).c_str(), format_size(out_size).c_str());
     std::fprintf(stderr, "Time: %.2fs\n", duration / 1000.0);
-    std::fprintf(stderr, "Output: %s\n", output_path.c_str());
+    std::fprintf(stderr, "Output: %s\n", display_path(output_path));
   }
 
   return 0;
 }
 
+// Checksums a v3 file carries, or null for none
+static const char* checksum_name(uint8_t flags) {
+  return (flags & KC_FLAG_HASH)  ? "CRC32C + XXH64"
+         : (flags & KC_FLAG_CRC) ? "CRC32C"
+                                 : nullptr;
+}
+
+// Unix seconds as UTC, "-" if unknown
+static std::string format_time(int64_t t) {
+  if (t == 0) return "-";
+  std::time_t tt = (std::time_t)t;
+  std::tm tm{};
+  char buf[32];
+  if (!gmtime_r(&tt, &tm) || !std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm)) {
+    return "-";
+  }
+  return buf;
+}
+
+// Describe every file from its header (and index or frame headers if it
+// predates metadata) without decoding it; one line per file
+static int do_list(const std::vector<std::string>& paths) {
+  int bad = 0;
+  for (const auto& path : paths) {
+    try {
+      ContainerInfo info = InspectContainer(path);
+      if (info.version != KC_VERSION) {
+        std::printf("%s: %s, %s packed, original size unknown\n", path.c_str(),
+                    info.version ? "v2 file" : "bare stream", format_size(info.size).c_str());
+        continue;
+      }
+      const ContainerMeta& meta = info.meta;
+      double ratio = meta.raw_size > 0 ? (100.0 * info.size / meta.raw_size) : 0;
+      std::string modes;
+      for (int m = 0; m < 256; m++) {
+        if (meta.modes[m]) modes += (modes.empty() ? "" : ",") + std::to_string(m);
+      }
+      const char* checks = checksum_name(info.flags);
+      std::printf("%s: %s -> %s (%.1f%%), %llu frames, %s, modes %s, modified %s, created %s%s%s\n",
+                  path.c_str(), format_size(meta.raw_size).c_str(),
+                  format_size(info.size).c_str(), ratio, (unsigned long long)meta.frames,
+                  checks ? checks : "no checksums", modes.empty() ? "-" : modes.c_str(),
+                  format_time(meta.mtime).c_str(), format_time(meta.created).c_str(),
+                  (info.flags & KC_FLAG_ARCHIVE) ? ", archive" : "",
+                  info.name.empty() ? "" : (", name " + info.name).c_str());
+    } catch (const std::exception& e) {
+      std::printf("%s: FAILED (%s)\n", path.c_str(), e.what());
+      bad++;
+    }
+  }
+  return bad > 0 ? 2 : 0;
+}
+
+// Decode every file without writing it, checking frame CRCs and the
+// whole-file hash where present; one line per file
+static int do_test(const std::vector<std::string>& paths, bool silent, unsigned threads) {
+  int bad = 0;
+  for (const auto& path : paths) {
+    try {
+      std::FILE* in = open_stream(path, "rb");
+      ContainerReader reader(in, threads);
+      uint64_t size = reader.DecodeTo(nullptr);
+      close_stream(in);
+      if (!silent) {
+        const char* checks = checksum_name(reader.Flags());
+        std::printf("%s: OK (%s, %s)\n", path.c_str(), format_size(size).c_str(),
+                    checks ? checks : "decodes, no checksums");
+      }
+    } catch (const std::exception& e) {
+      std::printf("%s: FAILED (%s)\n", path.c_str(), e.what());
+      bad++;
+    }
+  }
+  return bad > 0 ? 2 : 0;
+}
+
 int main(int argc, char **argv) {
   try {
     if (argc < 2) {
@@ -304,7 +593,7 @@ int main(int argc, char **argv) {
       }
       std::string input_path = argv[2];
       std::string output_path = make_compress_output(input_path);
-      return do_compress(input_path.c_str(), output_path.c_str(), true);
+      return do_compress(input_path, output_path, true);
     }
 
     // Shorthand: kcomp file.txt -> compress to file.txt.kc
@@ -326,57 +615,328 @@ int main(int argc, char **argv) {
     if (cmd == "c") {
       // Parse optional flags
       bool silent = false;
+      HybridOptions opts;
+      ContainerOptions copts;
+      bool to_stdout = false;
+      bool resume = false;
       std::vector<std::string> args;
 
       for (int i = 2; i < argc; i++) {
         std::string arg = argv[i];
         if (arg == "-s" || arg == "--silent") {
           silent = true;
-        } else {
-          args.push_back(arg);
+          continue;
+        }
+        if (arg == "-c" || arg == "--stdout") {
+          to_stdout = true;
+          continue;
+        }
+        if (arg == "--index") {
+          copts.index = true;
+          continue;
+        }
+        if (arg == "--dedup") {
+          copts.dedup = true;
+          continue;
+        }
+        if (arg == "--resume") {
+          resume = true;
+          continue;
+        }
+        if (arg == "--hash") {
+          copts.hash = true;
+          continue;
+        }
+        if (arg == "--frame-size" || arg == "--flush-bytes") {
+          size_t& size = arg == "--frame-size" ? copts.frame_size : copts.flush_bytes;
+          if (i + 1 >= argc || !parse_size(argv[i + 1], size)) {
+            std::fprintf(stderr, "error: %s expects a size, e.g. 4M\n", arg.c_str());
+            return 1;
+          }
+          i++;
+          continue;
+        }
+        if (arg == "--flush") {
+          if (i + 1 >= argc || !parse_seconds(argv[i + 1], copts.flush_interval)) {
+            std::fprintf(stderr, "error: --flush expects a duration, e.g. 1 or 200ms\n");
+            return 1;
+          }
+          i++;
+          continue;
         }
+        int parsed = parse_hybrid_option(argc, argv, i, opts);
+        if (parsed < 0) return 1;
+        if (parsed == 0) args.push_back(arg);
       }
 
       if (args.empty()) {
-        std::fprintf(stderr, "Usage: kcomp c [-s|--silent] <input> [output]\n");
+        std::fprintf(stderr, "Usage: kcomp c [options] <input> [output]\n");
         return 1;
       }
 
+      // stdin compresses to stdout unless an output is named
       std::string input_path = args[0];
-      std::string output_path = args.size() > 1 ? args[1] : make_compress_output(input_path);
-
-      return do_compress(input_path.c_str(), output_path.c_str(), silent);
+      std::string output_path = to_stdout ? "-"
+                                : args.size() > 1 ? args[1]
+                                : input_path == "-" ? "-"
+                                : make_compress_output(input_path);
+
+      if (resume) {
+        if (input_path == "-" || output_path == "-") {
+          std::fprintf(stderr, "error: --resume needs an input file and an output file\n");
+          return 1;
+        }
+        return do_resume(input_path, output_path, silent, opts, copts);
+      }
+      return do_compress(input_path, output_path, silent, opts, copts);
     }
 
     if (cmd == "d") {
       // Parse optional flags
       bool silent = false;
+      unsigned threads = 0;
+      DecodeRange range;
+      bool to_stdout = false;
+      bool live = false;
       std::vector<std::string> args;
 
       for (int i = 2; i < argc; i++) {
         std::string arg = argv[i];
         if (arg == "-s" || arg == "--silent") {
           silent = true;
+        } else if (arg == "-c" || arg == "--stdout") {
+          to_stdout = true;
+        } else if (arg == "--live") {
+          live = true;
+        } else if (arg == "-T" || arg == "--threads") {
+          if (i + 1 >= argc || !parse_count(argv[i + 1], 1024, threads)) {
+            std::fprintf(stderr, "error: %s expects a thread count\n", arg.c_str());
+            return 1;
+          }
+          i++;
+        } else if (arg == "--range") {
+          if (i + 1 >= argc || !parse_range(argv[i + 1], range.offset, range.length)) {
+            std::fprintf(stderr, "error: --range expects <offset>:<length>, e.g. 1M:64K\n");
+            return 1;
+          }
+          range.active = true;
+          i++;
         } else {
           args.push_back(arg);
         }
       }
 
       if (args.empty()) {
-        std::fprintf(stderr, "Usage: kcomp d [-s|--silent] <input> [output]\n");
+        std::fprintf(stderr,
+                     "Usage: kcomp d [-s|--silent] [-c] [-T <n>] [--live] [--range <off>:<len>] <input> [output]\n");
         return 1;
       }
 
       std::string input_path = args[0];
-      std::string explicit_output = args.size() > 1 ? args[1] : "";
+      std::string explicit_output = to_stdout ? "-" : args.size() > 1 ? args[1] : "";
 
-      return do_decompress(input_path.c_str(), explicit_output, silent);
+      return do_decompress(input_path, explicit_output, silent, threads, range, live);
+    }
+
+    if (cmd == "t") {
+      bool silent = false;
+      unsigned threads = 0;
+      std::vector<std::string> paths;
+
+      for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-s" || arg == "--silent") {
+          silent = true;
+        } else if (arg == "-T" || arg == "--threads") {
+          if (i + 1 >= argc || !parse_count(argv[i + 1], 1024, threads)) {
+            std::fprintf(stderr, "error: %s expects a thread count\n", arg.c_str());
+            return 1;
+          }
+          i++;
+        } else {
+          paths.push_back(arg);
+        }
+      }
+
+      if (paths.empty()) {
+        std::fprintf(stderr, "Usage: kcomp t [-s|--silent] [-T <n>] <input>...\n");
+        return 1;
+      }
+      return do_test(paths, silent, threads);
+    }
+
+    if (cmd == "l") {
+      std::vector<std::string> paths(argv + 2, argv + argc);
+      if (paths.empty()) {
+        std::fprintf(stderr, "Usage: kcomp l <input>...\n");
+        return 1;
+      }
+      return do_list(paths);
+    }
+
+    if (cmd == "u") {
+      bool silent = false;
+      HybridOptions opts;
+      ContainerOptions copts;
+      copts.frame_size = 0;  // Keep the old file's
+      std::vector<std::string> args;
+
+      for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-s" || arg == "--silent") {
+          silent = true;
+          continue;
+        }
+        if (arg == "--hash") {
+          copts.hash = true;
+          continue;
+        }
+        if (arg == "--frame-size") {
+          if (i + 1 >= argc || !parse_size(argv[i + 1], copts.frame_size)) {
+            std::fprintf(stderr, "error: %s expects a size, e.g. 4M\n", arg.c_str());
+            return 1;
+          }
+          i++;
+          continue;
+        }
+        int parsed = parse_hybrid_option(argc, argv, i, opts);
+        if (parsed < 0) return 1;
+        if (parsed == 0) args.push_back(arg);
+      }
+
+      if (args.size() < 2 || args.size() > 3) {
+        std::fprintf(stderr, "Usage: kcomp u [options] <old.kc> <input> [output]\n");
+        return 1;
+      }
+      std::string output_path = args.size() > 2 ? args[2] : make_compress_output(args[1]);
+      return do_update(args[0], args[1], output_path, silent, opts, copts);
+    }
+
+    if (cmd == "a") {
+      bool silent = false;
+      HybridOptions opts;
+      ContainerOptions copts;
+      std::vector<std::string> args;
+
+      for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-s" || arg == "--silent") {
+          silent = true;
+          continue;
+        }
+        if (arg == "--dedup") {
+          copts.dedup = true;
+          continue;
+        }
+        if (arg == "--hash") {
+          copts.hash = true;
+          continue;
+        }
+        if (arg == "--frame-size") {
+          if (i + 1 >= argc || !parse_size(argv[i + 1], copts.frame_size)) {
+            std::fprintf(stderr, "error: %s expects a size, e.g. 4M\n", arg.c_str());
+            return 1;
+          }
+          i++;
+          continue;
+        }
+        int parsed = parse_hybrid_option(argc, argv, i, opts);
+        if (parsed < 0) return 1;
+        if (parsed == 0) args.push_back(arg);
+      }
+
+      if (args.size() < 2) {
+        std::fprintf(stderr, "Usage: kcomp a [options] <out.kc> <path>...\n");
+        return 1;
+      }
+
+      auto start = std::chrono::high_resolution_clock::now();
+      std::vector<std::string> inputs(args.begin() + 1, args.end());
+      std::vector<ArchiveMember> members = WriteArchive(args[0], inputs, opts, with_meta(copts, 0));
+      auto end = std::chrono::high_resolution_clock::now();
+
+      if (!silent) {
+        uint64_t raw = members.empty() ? 0 : members.back().offset + members.back().size;
+        size_t out_size = GetFileSize(args[0]);
+        double ratio = raw > 0 ? (100.0 * out_size / raw) : 0;
+        std::fprintf(stderr, "%zu files, %s -> %s\n", members.size(), format_size(raw).c_str(),
+                     format_size(out_size).c_str());
+        std::fprintf(stderr, "Ratio: %.1f%% | Time: %.2fs\n", ratio,
+                     std::chrono::duration<double>(end - start).count());
+        std::fprintf(stderr, "Output: %s\n", args[0].c_str());
+      }
+      return 0;
+    }
+
+    if (cmd == "x") {
+      bool silent = false;
+      unsigned threads = 0;
+      std::string dest = ".";
+      std::vector<std::string> args;
+
+      for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-s" || arg == "--silent") {
+          silent = true;
+        } else if (arg == "-T" || arg == "--threads") {
+          if (i + 1 >= argc || !parse_count(argv[i + 1], 1024, threads)) {
+            std::fprintf(stderr, "error: %s expects a thread count\n", arg.c_str());
+            return 1;
+          }
+          i++;
+        } else if (arg == "-C") {
+          if (i + 1 >= argc) {
+            std::fprintf(stderr, "error: -C expects a directory\n");
+            return 1;
+          }
+          dest = argv[++i];
+        } else {
+          args.push_back(arg);
+        }
+      }
+
+      if (args.empty()) {
+        std::fprintf(stderr, "Usage: kcomp x [-s] [-T <n>] [-C <dir>] <archive> [name]...\n");
+        return 1;
+      }
+
+      auto start = std::chrono::high_resolution_clock::now();
+      std::vector<std::string> names(args.begin() + 1, args.end());
+      size_t count = ExtractArchive(args[0], dest, names, threads);
+      auto end = std::chrono::high_resolution_clock::now();
+
+      if (!silent) {
+        std::fprintf(stderr, "%zu files extracted to %s\n", count, dest.c_str());
+        std::fprintf(stderr, "Time: %.2fs\n", std::chrono::duration<double>(end - start).count());
+      }
+      return 0;
     }
 
     if (cmd == "b") {
-      if (argc != 3)
+      HybridOptions opts;
+      std::vector<std::string> paths;
+      std::string calibrate_path;
+
+      for (int i = 2; i < argc; i++) {
+        if (std::strcmp(argv[i], "--calibrate-decode") == 0) {
+          if (i + 1 >= argc) {
+            std::fprintf(stderr, "error: --calibrate-decode expects an output profile path\n");
+            return 1;
+          }
+          calibrate_path = argv[++i];
+          continue;
+        }
+        int parsed = parse_hybrid_option(argc, argv, i, opts);
+        if (parsed < 0) return 1;
+        if (parsed == 0) paths.push_back(argv[i]);
+      }
+
+      if (paths.empty()) {
+        std::fprintf(stderr, "Usage: kcomp b [options] <input>...\n");
         return 1;
-      return Bench(argv[2]);
+      }
+      if (!calibrate_path.empty()) return CalibrateDecode(paths, calibrate_path, opts);
+      return Bench(paths, opts);
     }
 
     print_usage();
@@ -0,0 +1,243 @@
+#include "blocks.hpp"
+#include "../core/data_stats.hpp"
+#include "../core/thread_pool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// Change-point detection granularity and thresholds
+constexpr size_t WINDOW_SIZE = 16 * 1024;
+constexpr size_t MIN_BLOCK = 64 * 1024;
+constexpr double ENTROPY_SHIFT = 1.5;  // bits/byte
+constexpr double TEXT_SHIFT = 0.4;
+
+struct WindowStats {
+  double entropy;
+  double text_ratio;
+};
+
+WindowStats Measure(const uint8_t *data, size_t n) {
+  size_t text = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint8_t c = data[i];
+    text += (c >= 0x20 && c < 0x7F) || c == '\t' || c == '\n' || c == '\r';
+  }
+  return {ByteEntropy(data, n), n ? (double)text / (double)n : 0.0};
+}
+
+void Put32(std::vector<uint8_t> &out, size_t v) {
+  for (int i = 0; i < 4; i++) out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+uint32_t Get32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+} // namespace
+
+std::vector<size_t> SplitBlocks(const std::vector<uint8_t> &in, size_t block_size,
+                                bool adaptive) {
+  return SplitBlocks(in.data(), in.size(), block_size, adaptive);
+}
+
+std::vector<size_t> SplitBlocks(const uint8_t *in, size_t n, size_t block_size, bool adaptive) {
+  std::vector<size_t> ends;
+  if (!adaptive) {
+    if (block_size == 0) block_size = n;
+    for (size_t end = block_size; end < n; end += block_size) ends.push_back(end);
+    ends.push_back(n);
+    return ends;
+  }
+
+  // Compare each window with the running mean of the block it would extend;
+  // cut when either statistic jumps and the block is big enough to stand on
+  // its own
+  size_t max_block = block_size ? block_size : DEFAULT_MAX_BLOCK;
+  size_t start = 0;
+  double entropy_sum = 0, text_sum = 0;
+  size_t windows = 0;
+  for (size_t pos = 0; pos < n; pos += WINDOW_SIZE) {
+    size_t len = std::min(WINDOW_SIZE, n - pos);
+    WindowStats w = Measure(in + pos, len);
+    bool shifted = windows > 0 &&
+                   (std::fabs(w.entropy - entropy_sum / windows) > ENTROPY_SHIFT ||
+                    std::fabs(w.text_ratio - text_sum / windows) > TEXT_SHIFT);
+    if ((shifted && pos - start >= MIN_BLOCK) || pos - start + len > max_block) {
+      ends.push_back(pos);
+      start = pos;
+      entropy_sum = text_sum = 0;
+      windows = 0;
+    }
+    entropy_sum += w.entropy;
+    text_sum += w.text_ratio;
+    windows++;
+  }
+  ends.push_back(n);
+  return ends;
+}
+
+std::vector<std::vector<uint8_t>> CompressBlockStreams(const std::vector<uint8_t> &in,
+                                                       const std::vector<size_t> &ends,
+                                                       const HybridOptions &opts) {
+  return CompressBlockStreams(in.data(), in.size(), ends, opts);
+}
+
+std::vector<std::vector<uint8_t>> CompressBlockStreams(const uint8_t *in, size_t n,
+                                                       const std::vector<size_t> &ends,
+                                                       const HybridOptions &opts,
+                                                       const std::vector<size_t> &fronts) {
+  if (!ends.empty() && ends.back() != n) throw std::runtime_error("blocks do not end at the input");
+  if (!fronts.empty() && fronts.size() != ends.size()) {
+    throw std::runtime_error("one front per block expected");
+  }
+  size_t count = ends.size();
+  std::vector<std::vector<uint8_t>> streams(count);
+
+  // Blocks run side by side, so each gets a share of the threads and
+  // memory; a block's own candidates use whatever threads are left over.
+  // All of them work towards the same deadline.
+  ThreadPool pool(opts.threads);
+  unsigned workers = pool.Size();
+  HybridOptions block_opts = StartBudget(opts);
+  block_opts.threads = std::max<unsigned>(1, workers / (unsigned)std::max<size_t>(count, 1));
+  if (opts.max_memory) block_opts.max_memory = opts.max_memory / std::min<size_t>(workers, count);
+
+  size_t start = 0;
+  for (size_t b = 0; b < count; b++) {
+    size_t begin = start, end = ends[b];
+    start = end;
+    pool.Submit([&, b, begin, end] {
+      std::vector<uint8_t> block(in + begin, in + end);
+      HybridOptions o = block_opts;
+      o.front = fronts.empty() ? 0 : fronts[b];
+      streams[b] = CompressHybrid(block, o);
+    });
+  }
+  pool.Wait();
+  return streams;
+}
+
+std::vector<uint8_t> DecompressBlockStreams(const std::vector<BlockRef> &blocks,
+                                            size_t raw_total, unsigned threads) {
+  // A lone block is the output itself; no need to copy it into place
+  if (blocks.size() == 1 && blocks[0].raw_offset == 0 && blocks[0].raw_size == raw_total) {
+    auto raw = DecompressHybrid(blocks[0].data, blocks[0].size, threads, raw_total);
+    if (raw.size() != raw_total) throw std::runtime_error("block decodes to the wrong size");
+    return raw;
+  }
+
+  std::vector<uint8_t> out(raw_total);
+  ThreadPool pool(threads);
+  unsigned inner = std::max<unsigned>(1, pool.Size() / (unsigned)std::max<size_t>(blocks.size(), 1));
+  for (const BlockRef &blk : blocks) {
+    pool.Submit([&, blk] {
+      auto raw = DecompressHybrid(blk.data, blk.size, inner, blk.raw_size);
+      if (raw.size() != blk.raw_size) throw std::runtime_error("block decodes to the wrong size");
+      std::copy(raw.begin(), raw.end(), out.begin() + blk.raw_offset);
+    });
+  }
+  pool.Wait();
+  return out;
+}
+
+std::vector<uint8_t> CompressBlocks(const std::vector<uint8_t> &in,
+                                    const std::vector<size_t> &ends,
+                                    const HybridOptions &opts) {
+  HybridOptions block_opts = opts;
+  block_opts.block_size = 0;
+  block_opts.adaptive_blocks = false;
+  block_opts.front = 0;
+  auto streams = CompressBlockStreams(in, ends, block_opts);
+
+  size_t count = ends.size();
+  size_t total = opts.front + 5 + 8 * count;
+  for (const auto &s : streams) total += s.size();
+  std::vector<uint8_t> out;
+  out.reserve(total);
+  out.resize(opts.front);
+  out.push_back(BLOCK_MODE);
+  Put32(out, count);
+  size_t start = 0;
+  for (size_t b = 0; b < count; b++) {
+    Put32(out, ends[b] - start);
+    Put32(out, streams[b].size());
+    out.insert(out.end(), streams[b].begin(), streams[b].end());
+    start = ends[b];
+  }
+  return out;
+}
+
+std::vector<uint8_t> DecompressBlocks(const uint8_t *p, size_t n, unsigned threads,
+                                      size_t out_size) {
+  if (n < 4) throw std::runtime_error("corrupt block container");
+  size_t count = Get32(p);
+  if (count > (n - 4) / 9) throw std::runtime_error("corrupt block container");
+
+  // Locate every block first so they can be decoded independently
+  std::vector<BlockRef> blocks;
+  size_t pos = 4, raw_total = 0;
+  for (size_t b = 0; b < count; b++) {
+    if (n - pos < 8) throw std::runtime_error("corrupt block container");
+    size_t raw_size = Get32(p + pos);
+    size_t size = Get32(p + pos + 4);
+    pos += 8;
+    if (size == 0 || n - pos < size || p[pos] == BLOCK_MODE ||
+        (out_size && raw_size > out_size - raw_total)) {
+      throw std::runtime_error("corrupt block container");
+    }
+    blocks.push_back({raw_total, raw_size, p + pos, size});
+    raw_total += raw_size;
+    pos += size;
+  }
+  if (pos != n || (out_size && raw_total != out_size)) {
+    throw std::runtime_error("corrupt block container");
+  }
+  if (out_size || blocks.size() <= 1) return DecompressBlockStreams(blocks, raw_total, threads);
+
+  // Nothing vouches for the recorded sizes, so decode the blocks before
+  // allocating the output from them
+  std::vector<std::vector<uint8_t>> raws(blocks.size());
+  ThreadPool pool(threads);
+  unsigned inner = std::max<unsigned>(1, pool.Size() / (unsigned)blocks.size());
+  for (size_t b = 0; b < blocks.size(); b++) {
+    pool.Submit([&, b] {
+      const BlockRef &blk = blocks[b];
+      raws[b] = DecompressHybrid(blk.data, blk.size, inner, blk.raw_size);
+      if (raws[b].size() != blk.raw_size) throw std::runtime_error("block decodes to the wrong size");
+    });
+  }
+  pool.Wait();
+  std::vector<uint8_t> out;
+  out.reserve(raw_total);
+  for (auto &raw : raws) {
+    out.insert(out.end(), raw.begin(), raw.end());
+    std::vector<uint8_t>().swap(raw);
+  }
+  return out;
+}
+
+void StreamModes(const uint8_t *stream, size_t n, std::bitset<256> &modes) {
+  if (n > 0 && stream[0] == SIZED_MODE) {
+    size_t skip = n > 1 ? 2 + 4 * (size_t)stream[1] : n;
+    if (skip >= n) return;
+    stream += skip;
+    n -= skip;
+  }
+  if (n == 0) return;
+  if (stream[0] != BLOCK_MODE) {
+    modes.set(stream[0]);
+    return;
+  }
+  size_t count = n >= 5 ? Get32(stream + 1) : 0;
+  size_t pos = 5;
+  for (size_t b = 0; b < count && n - pos >= 8; b++) {
+    size_t size = Get32(stream + pos + 4);
+    pos += 8;
+    if (n - pos < size) return;
+    if (size > 0 && stream[pos] != BLOCK_MODE) StreamModes(stream + pos, size, modes);
+    pos += size;
+  }
+}
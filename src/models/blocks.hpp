@@ -0,0 +1,75 @@
+#pragma once
+
+#include "ppm.hpp"
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Per-block adaptive selection for heterogeneous inputs (archives, PDFs,
+// containers mixing text, binary and compressed regions). The input is cut
+// into blocks, either fixed-size or where the content changes, and every
+// block is coded with its own hybrid mode. Blocks are independent, so they
+// are selected, coded and decoded in parallel.
+//
+// Block container (hybrid mode 254), sizes little-endian:
+//   u32 block count, then per block: u32 raw size, u32 stream size and the
+//   block's hybrid stream (mode byte + payload; never another container)
+
+constexpr uint8_t BLOCK_MODE = 254;
+
+// Largest block when cutting at change points and no block size is given
+constexpr size_t DEFAULT_MAX_BLOCK = 4 << 20;
+
+// End offset of every block of `in` (the last one is in.size()). Fixed
+// `block_size` blocks unless `adaptive`, in which case blocks end where the
+// byte statistics of consecutive 16 KB windows shift (entropy or text
+// ratio), and `block_size` only caps their length.
+std::vector<size_t> SplitBlocks(const std::vector<uint8_t> &in, size_t block_size,
+                                bool adaptive);
+std::vector<size_t> SplitBlocks(const uint8_t *in, size_t n, size_t block_size, bool adaptive);
+
+// Compress every block of `in` (cut at `ends`) as its own hybrid stream,
+// in parallel. Each block gets a share of the threads and memory cap in
+// `opts`, and all of them work towards its deadline; the streams do not
+// depend on the thread count. Only the blocks being coded are copied out of
+// `in`, so it may be a mapping of a file larger than memory. Stream `b`
+// starts with `fronts[b]` zero bytes (HybridOptions::front) when given.
+std::vector<std::vector<uint8_t>> CompressBlockStreams(const std::vector<uint8_t> &in,
+                                                       const std::vector<size_t> &ends,
+                                                       const HybridOptions &opts);
+std::vector<std::vector<uint8_t>> CompressBlockStreams(const uint8_t *in, size_t n,
+                                                       const std::vector<size_t> &ends,
+                                                       const HybridOptions &opts,
+                                                       const std::vector<size_t> &fronts = {});
+
+// One block's hybrid stream inside a larger buffer, and where its output goes
+struct BlockRef {
+  size_t raw_offset;
+  size_t raw_size;
+  const uint8_t *data;
+  size_t size;
+};
+
+// Decode `blocks` in parallel into one `raw_total`-byte buffer; throws
+// std::runtime_error if a block does not decode to its raw size
+std::vector<uint8_t> DecompressBlockStreams(const std::vector<BlockRef> &blocks,
+                                            size_t raw_total, unsigned threads);
+
+// Hybrid stream (BLOCK_MODE + container) for `in` cut at `ends`
+std::vector<uint8_t> CompressBlocks(const std::vector<uint8_t> &in,
+                                    const std::vector<size_t> &ends,
+                                    const HybridOptions &opts);
+
+// Decode a block container (the stream after its mode byte); throws
+// std::runtime_error if it is malformed. With `out_size` (the decoded
+// size, if known) the recorded block sizes are checked against it before
+// the output is allocated; without it the blocks are decoded first and
+// the output is allocated from what they actually decode to.
+std::vector<uint8_t> DecompressBlocks(const uint8_t *p, size_t n, unsigned threads,
+                                      size_t out_size = 0);
+
+// Set in `modes` every hybrid mode that codes data in `stream`, looking
+// through recorded stage sizes and block containers; bytes that do not
+// parse are skipped
+void StreamModes(const uint8_t *stream, size_t n, std::bitset<256> &modes);
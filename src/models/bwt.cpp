@@ -1,15 +1,17 @@
 #include "bwt.hpp"
 #include <algorithm>
+#include <array>
 #include <numeric>
+#include <stdexcept>
 
 namespace {
 
-void BuildSuffixArraySimple(const std::vector<uint8_t>& text, std::vector<int>& sa) {
+void BuildSuffixArraySimple(const std::vector<uint8_t>& text, std::vector<size_t>& sa) {
   size_t n = text.size();
   sa.resize(n);
   std::iota(sa.begin(), sa.end(), 0);
 
-  std::sort(sa.begin(), sa.end(), [&](int a, int b) {
+  std::sort(sa.begin(), sa.end(), [&](size_t a, size_t b) {
     for (size_t i = 0; i < n; i++) {
       size_t idx_a = (a + i) % n;
       size_t idx_b = (b + i) % n;
@@ -29,7 +31,7 @@ std::vector<uint8_t> BWTEncode(const std::vector<uint8_t>& in, uint32_t& primary
 
   size_t n = in.size();
 
-  std::vector<int> sa;
+  std::vector<size_t> sa;
   BuildSuffixArraySimple(in, sa);
 
   std::vector<uint8_t> out(n);
@@ -51,21 +53,22 @@ std::vector<uint8_t> BWTDecode(const std::vector<uint8_t>& in, uint32_t primary_
   if (in.empty()) return {};
 
   size_t n = in.size();
+  if (primary_index >= n) throw std::runtime_error("corrupt BWT primary index");
 
-  std::array<int, 256> count{};
+  std::array<size_t, 256> count{};
   for (uint8_t c : in) {
     count[c]++;
   }
 
-  std::array<int, 256> first{};
-  int sum = 0;
+  std::array<size_t, 256> first{};
+  size_t sum = 0;
   for (int i = 0; i < 256; i++) {
     first[i] = sum;
     sum += count[i];
   }
 
-  std::vector<int> T(n);
-  std::array<int, 256> next_pos{};
+  std::vector<size_t> T(n);
+  std::array<size_t, 256> next_pos{};
   std::copy(first.begin(), first.end(), next_pos.begin());
 
   for (size_t i = 0; i < n; i++) {
@@ -73,7 +76,7 @@ std::vector<uint8_t> BWTDecode(const std::vector<uint8_t>& in, uint32_t primary_
   }
 
   std::vector<uint8_t> out(n);
-  int j = primary_index;
+  size_t j = primary_index;
   for (size_t i = n; i > 0; i--) {
     out[i - 1] = in[j];
     j = T[j];
@@ -123,3 +126,22 @@ std::vector<uint8_t> MTFDecode(const std::vector<uint8_t>& in) {
 
   return out;
 }
+
+MTFStreamDecoder::MTFStreamDecoder(ByteSink &next) : next_(next) {
+  std::iota(list_.begin(), list_.end(), 0);
+}
+
+void MTFStreamDecoder::Write(const uint8_t *data, size_t n) {
+  out_.resize(n);
+  for (size_t k = 0; k < n; k++) {
+    uint8_t pos = data[k];
+    uint8_t c = list_[pos];
+    out_[k] = c;
+
+    for (int i = pos; i > 0; i--) {
+      list_[i] = list_[i - 1];
+    }
+    list_[0] = c;
+  }
+  next_.Write(out_.data(), n);
+}
@@ -1,13 +1,29 @@
 #pragma once
 
+#include "../io/byte_sink.hpp"
+#include <array>
 #include <cstdint>
 #include <vector>
 
 // Burrows-Wheeler Transform
 // Groups similar characters together for better PPM compression
 std::vector<uint8_t> BWTEncode(const std::vector<uint8_t>& in, uint32_t& primary_index);
+// Throws std::runtime_error if `primary_index` is out of range
 std::vector<uint8_t> BWTDecode(const std::vector<uint8_t>& in, uint32_t primary_index);
 
 // Move-to-Front transform (often used with BWT)
 std::vector<uint8_t> MTFEncode(const std::vector<uint8_t>& in);
 std::vector<uint8_t> MTFDecode(const std::vector<uint8_t>& in);
+
+// Incremental MTFDecode for streaming decode chains (see lz77.hpp)
+class MTFStreamDecoder : public ByteSink {
+public:
+  explicit MTFStreamDecoder(ByteSink &next);
+  void Write(const uint8_t *data, size_t n) override;
+  void Close() override { next_.Close(); }
+
+private:
+  ByteSink &next_;
+  std::array<uint8_t, 256> list_;
+  std::vector<uint8_t> out_;
+};
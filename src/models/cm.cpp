@@ -1,17 +1,26 @@
 #include "cm.hpp"
+#include "../core/cancel.hpp"
 #include <array>
 #include <vector>
 #include <cmath>
 #include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
 
 namespace {
 
+// Size field value announcing a u64 size after it
+constexpr uint64_t CM_SIZE_ESCAPE = 0xFFFFFFFF;
+
+// Most output reserved up front from an unconfirmed size field
+constexpr uint64_t CM_RESERVE_LIMIT = 64 << 20;
+
 std::array<int, 4096> stretch_tbl;
 std::array<int, 8192> squash_tbl;
-bool tables_init = false;
+std::once_flag tables_init;
 
-void InitTables() {
-  if (tables_init) return;
+void BuildTables() {
   for (int i = 0; i < 4096; i++) {
     double p = (i + 0.5) / 4096.0;
     stretch_tbl[i] = int(512.0 * std::log(p / (1.0 - p)));
@@ -21,9 +30,11 @@ void InitTables() {
     squash_tbl[i] = int(4096.0 / (1.0 + std::exp(-x)));
     squash_tbl[i] = std::clamp(squash_tbl[i], 1, 4095);
   }
-  tables_init = true;
 }
 
+// Hybrid compression runs codecs on several threads at once
+void InitTables() { std::call_once(tables_init, BuildTables); }
+
 inline int Stretch(int p) { return stretch_tbl[std::clamp(p, 0, 4095)]; }
 inline int Squash(int x) { return squash_tbl[std::clamp(x + 4096, 0, 8191)]; }
 
@@ -72,7 +83,7 @@ public:
 };
 
 class MatchModel {
-  std::vector<uint32_t> hash_table;
+  std::vector<size_t> hash_table;
   std::vector<uint8_t> history;
   size_t hist_pos = 0;
   int match_len = 0;
@@ -262,19 +273,22 @@ public:
 
 }
 
-std::vector<uint8_t> CompressCM(const std::vector<uint8_t>& in) {
-  if (in.empty()) return {};
+std::vector<uint8_t> CompressCM(const std::vector<uint8_t>& in, size_t front) {
+  if (in.empty()) return std::vector<uint8_t>(front);
 
   InitTables();
 
   std::vector<uint8_t> out;
-  out.reserve(in.size());
-
-  uint32_t size = in.size();
-  out.push_back((size >> 24) & 0xFF);
-  out.push_back((size >> 16) & 0xFF);
-  out.push_back((size >> 8) & 0xFF);
-  out.push_back(size & 0xFF);
+  out.reserve(front + in.size());
+  out.resize(front);
+
+  // Big-endian size; 0xFFFFFFFF escapes to a u64 for inputs of 4 GB on
+  uint64_t size = in.size();
+  int bytes = size < CM_SIZE_ESCAPE ? 4 : 12;
+  if (bytes == 12) out.insert(out.end(), 4, 0xFF);
+  for (int i = 7; i >= 0; i--) {
+    if (bytes == 12 || i < 4) out.push_back((uint8_t)(size >> (8 * i)));
+  }
 
   BitEncoder enc(out);
 
@@ -292,7 +306,9 @@ std::vector<uint8_t> CompressCM(const std::vector<uint8_t>& in) {
   uint32_t ctx3 = 0;
   uint32_t ctx4 = 0;
 
+  size_t pos = 0;
   for (uint8_t byte : in) {
+    PollCancel(pos++);
     uint32_t bit_ctx = 1;
 
     for (int i = 7; i >= 0; i--) {
@@ -341,20 +357,33 @@ std::vector<uint8_t> CompressCM(const std::vector<uint8_t>& in) {
   return out;
 }
 
-std::vector<uint8_t> DecompressCM(const std::vector<uint8_t>& in) {
-  if (in.size() < 4) return {};
+std::vector<uint8_t> DecompressCM(const std::vector<uint8_t>& in, size_t out_size) {
+  return DecompressCM(in.data(), in.size(), out_size);
+}
 
-  InitTables();
+std::vector<uint8_t> DecompressCM(const uint8_t* in, size_t n, size_t out_size) {
+  if (n < 4) return {};
 
-  uint32_t size = ((uint32_t)in[0] << 24) | ((uint32_t)in[1] << 16) |
-                  ((uint32_t)in[2] << 8) | in[3];
+  InitTables();
 
-  if (size > 100 * 1024 * 1024) return {};
+  uint64_t size = 0;
+  size_t head = 4;
+  for (int i = 0; i < 4; i++) size = (size << 8) | in[i];
+  if (size == CM_SIZE_ESCAPE) {
+    if (n < 12) return {};
+    size = 0;
+    for (int i = 4; i < 12; i++) size = (size << 8) | in[i];
+    head = 12;
+  }
+  if (out_size && size != out_size) throw std::runtime_error("corrupt CM stream size");
+  if (size > SIZE_MAX) return {};
 
+  // Without a recorded size the header is all there is to go on, so a
+  // damaged one must not reserve gigabytes before the first byte decodes
   std::vector<uint8_t> out;
-  out.reserve(size);
+  out.reserve(out_size ? out_size : (size_t)std::min<uint64_t>(size, CM_RESERVE_LIMIT));
 
-  BitDecoder dec(in.data() + 4, in.size() - 4);
+  BitDecoder dec(in + head, n - head);
 
   ContextModel cm0(8);
   ContextModel cm1(16);
@@ -370,7 +399,7 @@ std::vector<uint8_t> DecompressCM(const std::vector<uint8_t>& in) {
   uint32_t ctx3 = 0;
   uint32_t ctx4 = 0;
 
-  for (uint32_t n = 0; n < size; n++) {
+  for (uint64_t n = 0; n < size; n++) {
     uint32_t bit_ctx = 1;
     uint8_t byte = 0;
 
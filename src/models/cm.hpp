@@ -1,9 +1,14 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
 // Context Mixing Compressor (PAQ-style)
-// Uses multiple models + neural network mixer for state-of-the-art compression
-std::vector<uint8_t> CompressCM(const std::vector<uint8_t>& in);
-std::vector<uint8_t> DecompressCM(const std::vector<uint8_t>& in);
+// Uses multiple models + neural network mixer for state-of-the-art compression.
+// The stream follows `front` zero bytes left for the caller's header.
+std::vector<uint8_t> CompressCM(const std::vector<uint8_t>& in, size_t front = 0);
+// `out_size`, if known, is the decoded size; a stream claiming another one
+// throws std::runtime_error
+std::vector<uint8_t> DecompressCM(const std::vector<uint8_t>& in, size_t out_size = 0);
+std::vector<uint8_t> DecompressCM(const uint8_t* in, size_t n, size_t out_size = 0);
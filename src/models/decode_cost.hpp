@@ -0,0 +1,22 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+// Estimated time to decode one hybrid mode: a fixed setup cost (allocating
+// and initialising model tables) plus a rate per byte of raw output.
+struct DecodeCost {
+  double setup_ms = 0;
+  double ns_per_byte = 0;
+
+  double Millis(size_t n) const { return setup_ms + ns_per_byte * (double)n / 1e6; }
+
+  // Estimated throughput in MB/s for an `n`-byte output
+  double MBps(size_t n) const {
+    double ms = Millis(n);
+    return ms > 0 ? (double)n / 1e3 / ms : 1e12;
+  }
+};
+
+// Indexed by mode byte
+using DecodeProfile = std::array<DecodeCost, 256>;
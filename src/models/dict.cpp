@@ -267,11 +267,11 @@ std::vector<uint8_t> DictEncode(const std::vector<uint8_t> &in) {
   return out;
 }
 
-std::vector<uint8_t> DictDecode(const std::vector<uint8_t> &in) {
+std::vector<uint8_t> DictDecode(const std::vector<uint8_t> &in, size_t out_size) {
   const auto& dict = GetStaticDict();
 
   std::vector<uint8_t> out;
-  out.reserve(in.size() * 2);
+  out.reserve(out_size ? out_size : in.size() * 2);
 
   for (size_t i = 0; i < in.size();) {
     if (in[i] == DICT_ESC_LIT) {
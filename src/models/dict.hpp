@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -8,7 +9,7 @@
 
 // Compress with dictionary prepended (for PPM learning)
 std::vector<uint8_t> DictEncode(const std::vector<uint8_t> &in);
-std::vector<uint8_t> DictDecode(const std::vector<uint8_t> &in);
+std::vector<uint8_t> DictDecode(const std::vector<uint8_t> &in, size_t out_size = 0);
 
 // Get the static dictionary
 const std::vector<uint8_t>& GetStaticDict();
@@ -1,6 +1,7 @@
 #include "lz77.hpp"
 #include <unordered_map>
 #include <algorithm>
+#include <cstring>
 
 constexpr uint8_t ESC_SHORT = 0xFE;
 constexpr uint8_t ESC_LONG = 0xFF;
@@ -29,7 +30,8 @@ static int FindBestMatch(const std::vector<uint8_t>& in, size_t pos,
   int checked = 0;
   for (auto pit = it->second.rbegin(); pit != it->second.rend() && checked < HASH_CHAIN_LEN; ++pit, ++checked) {
     size_t match_pos = *pit;
-    if (pos - match_pos > WINDOW_SIZE) break;
+    // Offsets are 16 bits and 0 means none, so the window ends one short
+    if (pos - match_pos >= WINDOW_SIZE) break;
 
     int len = 0;
     size_t max_len = std::min((size_t)MAX_MATCH, in.size() - pos);
@@ -130,9 +132,9 @@ std::vector<uint8_t> LZ77Compress(const std::vector<uint8_t> &in) {
   return out;
 }
 
-std::vector<uint8_t> LZ77Decompress(const std::vector<uint8_t> &in) {
+std::vector<uint8_t> LZ77Decompress(const std::vector<uint8_t> &in, size_t out_size) {
   std::vector<uint8_t> out;
-  out.reserve(in.size() * 3);
+  out.reserve(out_size ? out_size : in.size() * 3);
 
   for (size_t i = 0; i < in.size();) {
     if (in[i] == ESC_SHORT) {
@@ -199,7 +201,9 @@ std::vector<uint8_t> RLECompress(const std::vector<uint8_t> &in) {
       run++;
     }
 
-    if (run >= RLE_MIN_RUN) {
+    // A run of the escape byte itself would read back as an escaped literal,
+    // so those are always written byte by byte
+    if (run >= RLE_MIN_RUN && byte != RLE_ESC) {
       out.push_back(RLE_ESC);
       out.push_back(byte);
       out.push_back((uint8_t)(run - RLE_MIN_RUN));
@@ -218,9 +222,9 @@ std::vector<uint8_t> RLECompress(const std::vector<uint8_t> &in) {
   return out;
 }
 
-std::vector<uint8_t> RLEDecompress(const std::vector<uint8_t> &in) {
+std::vector<uint8_t> RLEDecompress(const std::vector<uint8_t> &in, size_t out_size) {
   std::vector<uint8_t> out;
-  out.reserve(in.size() * 2);
+  out.reserve(out_size ? out_size : in.size() * 2);
 
   for (size_t i = 0; i < in.size();) {
     if (in[i] == RLE_ESC) {
@@ -321,10 +325,14 @@ std::vector<uint8_t> PatternEncode(const std::vector<uint8_t> &in) {
 }
 
 std::vector<uint8_t> PatternDecode(const std::vector<uint8_t> &in) {
-  if (in.size() < 7) return {};
+  return PatternDecode(in.data(), in.size());
+}
+
+std::vector<uint8_t> PatternDecode(const uint8_t *in, size_t n) {
+  if (n < 7) return {};
 
   size_t plen = in[0];
-  if (plen == 0 || in.size() < 1 + plen + 5) return {};
+  if (plen == 0 || n < 1 + plen + 5) return {};
 
   uint32_t rep_count = in[1 + plen] |
                        ((uint32_t)in[2 + plen] << 8) |
@@ -332,7 +340,7 @@ std::vector<uint8_t> PatternDecode(const std::vector<uint8_t> &in) {
                        ((uint32_t)in[4 + plen] << 24);
 
   size_t trailing_len = in[5 + plen];
-  if (in.size() < 1 + plen + 5 + trailing_len) return {};
+  if (n < 1 + plen + 5 + trailing_len) return {};
 
   std::vector<uint8_t> out;
   out.reserve(rep_count * plen + trailing_len);
@@ -364,6 +372,7 @@ const char* WORD_DICT[] = {
   "ing ", "tion", "ment", "ness",
   nullptr
 };
+constexpr size_t WORD_DICT_SIZE = sizeof(WORD_DICT) / sizeof(WORD_DICT[0]) - 1;
 
 int MatchWord(const uint8_t* data, size_t remaining) {
   for (int i = 0; WORD_DICT[i] != nullptr && i < 127; i++) {
@@ -405,9 +414,9 @@ std::vector<uint8_t> WordEncode(const std::vector<uint8_t> &in) {
   return out;
 }
 
-std::vector<uint8_t> WordDecode(const std::vector<uint8_t> &in) {
+std::vector<uint8_t> WordDecode(const std::vector<uint8_t> &in, size_t out_size) {
   std::vector<uint8_t> out;
-  out.reserve(in.size() * 2);
+  out.reserve(out_size ? out_size : in.size() * 2);
 
   for (size_t i = 0; i < in.size();) {
     if (in[i] == WORD_ESC && i + 1 < in.size()) {
@@ -461,17 +470,26 @@ std::vector<uint8_t> RecordDeinterleave(const std::vector<uint8_t> &in) {
   if (record_size == 0) return {};
 
   size_t data_size = in.size() - 2;
+  if (data_size == 0) return {};
   size_t num_records = (data_size + record_size - 1) / record_size;
+  size_t last_len = data_size - (num_records - 1) * record_size;  // Bytes in the last record
+
+  // Column `pos` holds one byte per record, except that columns at or past
+  // the end of a short last record are one byte shorter
+  std::vector<size_t> col_start(record_size);
+  size_t start = 2;
+  for (size_t pos = 0; pos < record_size; pos++) {
+    col_start[pos] = start;
+    start += pos < last_len ? num_records : num_records - 1;
+  }
 
   std::vector<uint8_t> out;
   out.reserve(data_size);
 
   for (size_t rec = 0; rec < num_records; rec++) {
-    for (size_t pos = 0; pos < record_size; pos++) {
-      size_t idx = pos * num_records + rec + 2;
-      if (idx < in.size() && out.size() < data_size) {
-        out.push_back(in[idx]);
-      }
+    size_t len = rec + 1 < num_records ? record_size : last_len;
+    for (size_t pos = 0; pos < len; pos++) {
+      out.push_back(in[col_start[pos] + rec]);
     }
   }
 
@@ -519,9 +537,9 @@ std::vector<uint8_t> SparseEncode(const std::vector<uint8_t> &in) {
   return out;
 }
 
-std::vector<uint8_t> SparseDecode(const std::vector<uint8_t> &in) {
+std::vector<uint8_t> SparseDecode(const std::vector<uint8_t> &in, size_t out_size) {
   std::vector<uint8_t> out;
-  out.reserve(in.size() * 2);
+  out.reserve(out_size ? out_size : in.size() * 2);
 
   for (size_t i = 0; i < in.size();) {
     if (in[i] == SPARSE_ESC) {
@@ -550,3 +568,131 @@ std::vector<uint8_t> SparseDecode(const std::vector<uint8_t> &in) {
 
   return out;
 }
+
+// Feed `data` to `token`, which decodes one complete token and returns its
+// length, or 0 if the token runs past the end of the chunk. A split token
+// is kept in `carry` and completed one byte at a time from the next chunk.
+template <typename TokenFn>
+static void FeedTokens(const uint8_t *data, size_t n, std::vector<uint8_t> &carry,
+                       TokenFn token) {
+  size_t i = 0;
+  while (i < n && !carry.empty()) {
+    carry.push_back(data[i++]);
+    if (token(carry.data(), carry.size()) != 0) carry.clear();
+  }
+  while (i < n) {
+    size_t used = token(data + i, n - i);
+    if (used == 0) {
+      carry.assign(data + i, data + n);
+      return;
+    }
+    i += used;
+  }
+}
+
+size_t LZ77StreamDecoder::Token(const uint8_t *p, size_t avail) {
+  if (stopped_) return avail;
+
+  uint8_t b = p[0];
+  if (b != ESC_SHORT && b != ESC_LONG) {
+    history_.push_back(b);
+    produced_++;
+    return 1;
+  }
+  if (avail < 2) return 0;
+  if (p[1] == b) {
+    history_.push_back(b);
+    produced_++;
+    return 2;
+  }
+
+  size_t size = b == ESC_SHORT ? 3 : 4;
+  if (avail < size) return 0;
+  int len = p[1] + MIN_MATCH;
+  size_t offset = b == ESC_SHORT ? p[2] : ((size_t)p[2] << 8) | p[3];
+  if (offset > produced_ || offset == 0) {
+    stopped_ = true;
+    return avail;
+  }
+
+  size_t pos = history_.size() - offset;
+  for (int j = 0; j < len; j++) {
+    history_.push_back(history_[pos + j]);
+  }
+  produced_ += len;
+  return size;
+}
+
+void LZ77StreamDecoder::Write(const uint8_t *data, size_t n) {
+  FeedTokens(data, n, carry_, [this](const uint8_t *p, size_t avail) { return Token(p, avail); });
+  if (history_.size() > fresh_) next_.Write(history_.data() + fresh_, history_.size() - fresh_);
+
+  // Offsets reach back at most 64 KB
+  if (history_.size() > 2 * WINDOW_SIZE) {
+    history_.erase(history_.begin(), history_.end() - WINDOW_SIZE);
+  }
+  fresh_ = history_.size();
+}
+
+size_t RLEStreamDecoder::Token(const uint8_t *p, size_t avail) {
+  uint8_t b = p[0];
+  if (b != RLE_ESC) {
+    out_.push_back(b);
+    return 1;
+  }
+  if (avail < 2) return 0;
+  if (p[1] == RLE_ESC) {
+    out_.push_back(RLE_ESC);
+    return 2;
+  }
+  if (avail < 3) return 0;
+  out_.insert(out_.end(), (size_t)p[2] + RLE_MIN_RUN, p[1]);
+  return 3;
+}
+
+void RLEStreamDecoder::Write(const uint8_t *data, size_t n) {
+  out_.clear();
+  FeedTokens(data, n, carry_, [this](const uint8_t *p, size_t avail) { return Token(p, avail); });
+  if (!out_.empty()) next_.Write(out_.data(), out_.size());
+}
+
+void DeltaStreamDecoder::Write(const uint8_t *data, size_t n) {
+  out_.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    prev_ = (uint8_t)(prev_ + data[i]);
+    out_[i] = prev_;
+  }
+  if (n) next_.Write(out_.data(), n);
+}
+
+size_t WordStreamDecoder::Token(const uint8_t *p, size_t avail) {
+  uint8_t b = p[0];
+  if (b == WORD_ESC) {
+    if (avail < 2) return 0;
+    out_.push_back(p[1]);
+    return 2;
+  }
+  if (b >= 0x80) {
+    size_t idx = b & 0x7F;
+    if (idx < WORD_DICT_SIZE) {
+      const char *word = WORD_DICT[idx];
+      out_.insert(out_.end(), word, word + strlen(word));
+    }
+    return 1;
+  }
+  out_.push_back(b);
+  return 1;
+}
+
+void WordStreamDecoder::Write(const uint8_t *data, size_t n) {
+  out_.clear();
+  FeedTokens(data, n, carry_, [this](const uint8_t *p, size_t avail) { return Token(p, avail); });
+  if (!out_.empty()) next_.Write(out_.data(), out_.size());
+}
+
+void WordStreamDecoder::Close() {
+  // A lone escape at the very end is an ordinary byte, as in WordDecode
+  if (!carry_.empty()) next_.Write(carry_.data(), carry_.size());
+  carry_.clear();
+  next_.Close();
+}
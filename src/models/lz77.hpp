@@ -1,19 +1,24 @@
 #pragma once
 
+#include "../io/byte_sink.hpp"
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
+// Decoders taking `out_size` reserve exactly that much when the decoded size
+// is known (0 = unknown: guess from the input size)
+
 // Simple LZ77 with match encoding for preprocessing
 // Match format: escape_byte, offset_hi, offset_lo, length
 // Minimum match length: 4 bytes
 
 std::vector<uint8_t> LZ77Compress(const std::vector<uint8_t> &in);
-std::vector<uint8_t> LZ77Decompress(const std::vector<uint8_t> &in);
+std::vector<uint8_t> LZ77Decompress(const std::vector<uint8_t> &in, size_t out_size = 0);
 
 // Run-Length Encoding for files with many repeated bytes
 // Format: ESC (0xFF), byte, length-4  for runs of 4+ same bytes
 std::vector<uint8_t> RLECompress(const std::vector<uint8_t> &in);
-std::vector<uint8_t> RLEDecompress(const std::vector<uint8_t> &in);
+std::vector<uint8_t> RLEDecompress(const std::vector<uint8_t> &in, size_t out_size = 0);
 
 // Delta encoding - encodes differences between consecutive bytes
 std::vector<uint8_t> DeltaEncode(const std::vector<uint8_t> &in);
@@ -23,10 +28,11 @@ std::vector<uint8_t> DeltaDecode(const std::vector<uint8_t> &in);
 // Format: pattern_len (1 byte), pattern (N bytes), repeat_count (4 bytes)
 std::vector<uint8_t> PatternEncode(const std::vector<uint8_t> &in);
 std::vector<uint8_t> PatternDecode(const std::vector<uint8_t> &in);
+std::vector<uint8_t> PatternDecode(const uint8_t *in, size_t n);
 
 // Word tokenizer - replaces common words/patterns with single bytes
 std::vector<uint8_t> WordEncode(const std::vector<uint8_t> &in);
-std::vector<uint8_t> WordDecode(const std::vector<uint8_t> &in);
+std::vector<uint8_t> WordDecode(const std::vector<uint8_t> &in, size_t out_size = 0);
 
 // Record interleave - groups bytes by position within fixed-size records
 // Improves compression of structured data like TAR (512-byte blocks)
@@ -38,4 +44,66 @@ std::vector<uint8_t> RecordDeinterleave(const std::vector<uint8_t> &in);
 // 0xFF 0x00 len_hi len_lo = run of zeros (len+4)
 // 0xFF 0xFF = literal 0xFF
 std::vector<uint8_t> SparseEncode(const std::vector<uint8_t> &in);
-std::vector<uint8_t> SparseDecode(const std::vector<uint8_t> &in);
+std::vector<uint8_t> SparseDecode(const std::vector<uint8_t> &in, size_t out_size = 0);
+
+// Incremental decoders for streaming decode chains. Each accepts its input
+// in chunks of any size and writes the decoded bytes to `next`; Close()
+// treats a trailing partial token the way the one-shot decoder does, then
+// closes `next`. The output is identical to LZ77Decompress, RLEDecompress,
+// DeltaDecode and WordDecode.
+class LZ77StreamDecoder : public ByteSink {
+public:
+  explicit LZ77StreamDecoder(ByteSink &next) : next_(next) {}
+  void Write(const uint8_t *data, size_t n) override;
+  void Close() override { next_.Close(); }
+
+private:
+  size_t Token(const uint8_t *p, size_t avail);
+
+  ByteSink &next_;
+  std::vector<uint8_t> carry_;    // Token split across chunks
+  std::vector<uint8_t> history_;  // Match window (last 64 KB of output)
+  size_t fresh_ = 0;              // Start of not yet forwarded output in history_
+  size_t produced_ = 0;
+  bool stopped_ = false;          // Bad offset: the one-shot decoder stops here
+};
+
+class RLEStreamDecoder : public ByteSink {
+public:
+  explicit RLEStreamDecoder(ByteSink &next) : next_(next) {}
+  void Write(const uint8_t *data, size_t n) override;
+  void Close() override { next_.Close(); }
+
+private:
+  size_t Token(const uint8_t *p, size_t avail);
+
+  ByteSink &next_;
+  std::vector<uint8_t> carry_;
+  std::vector<uint8_t> out_;
+};
+
+class DeltaStreamDecoder : public ByteSink {
+public:
+  explicit DeltaStreamDecoder(ByteSink &next) : next_(next) {}
+  void Write(const uint8_t *data, size_t n) override;
+  void Close() override { next_.Close(); }
+
+private:
+  ByteSink &next_;
+  std::vector<uint8_t> out_;
+  uint8_t prev_ = 0;
+};
+
+class WordStreamDecoder : public ByteSink {
+public:
+  explicit WordStreamDecoder(ByteSink &next) : next_(next) {}
+  void Write(const uint8_t *data, size_t n) override;
+  void Close() override;
+
+private:
+  size_t Token(const uint8_t *p, size_t avail);
+
+  ByteSink &next_;
+  std::vector<uint8_t> carry_;
+  std::vector<uint8_t> out_;
+};
@@ -1,4 +1,5 @@
 #include "lzma.hpp"
+#include "../core/cancel.hpp"
 #include <algorithm>
 #include <cstring>
 #include <unordered_map>
@@ -30,12 +31,12 @@ inline uint32_t Hash4(const uint8_t* p) {
 }
 
 // Cost in bits for encoding a literal
-inline int LiteralCost(uint8_t byte) {
+inline uint64_t LiteralCost(uint8_t byte) {
   return byte < 0x80 ? 16 : 24;  // 2 bytes or 3 bytes
 }
 
 // Cost in bits for encoding a match
-inline int MatchCost(int len, size_t offset) {
+inline uint64_t MatchCost(int len, size_t offset) {
   if (len >= 3 && len <= 18 && offset >= 1 && offset <= 256) {
     return 16;  // Short match: 2 bytes
   } else if (len >= 3 && len <= 34 && offset <= 65536) {
@@ -52,13 +53,13 @@ struct Match {
 };
 
 Match FindBestMatch(const std::vector<uint8_t>& in, size_t i,
-                    const std::vector<int>& head,
-                    const std::vector<int>& prev) {
+                    const std::vector<int64_t>& head,
+                    const std::vector<int64_t>& prev) {
   Match best = {0, 0};
   if (i + LZMA_MIN_MATCH > in.size()) return best;
 
   uint32_t h = Hash4(&in[i]);
-  int pos = head[h];
+  int64_t pos = head[h];
   int chain_len = 0;
 
   while (pos >= 0 && chain_len < MAX_CHAIN) {
@@ -81,8 +82,8 @@ Match FindBestMatch(const std::vector<uint8_t>& in, size_t i,
     // Keep if better than current best
     // Prefer shorter offsets for same length (better encoding)
     if (len >= LZMA_MIN_MATCH) {
-      int new_cost = MatchCost(len, off);
-      int old_cost = best.len > 0 ? MatchCost(best.len, best.off) : 0;
+      uint64_t new_cost = MatchCost(len, off);
+      uint64_t old_cost = best.len > 0 ? MatchCost(best.len, best.off) : 0;
 
       // Better if: longer match, or same length but cheaper encoding
       if (len > best.len || (len == best.len && new_cost < old_cost)) {
@@ -114,28 +115,30 @@ std::vector<uint8_t> LZMACompress(const std::vector<uint8_t> &in) {
   std::vector<uint8_t> out;
   out.reserve(in.size());
 
-  // Hash chain tables
-  std::vector<int> head(HASH_SIZE, -1);
-  std::vector<int> prev(in.size(), -1);
+  // Hash chain tables; positions and costs are 64-bit so inputs past
+  // 2 GB (or costs past 2^31 bits) do not wrap
+  std::vector<int64_t> head(HASH_SIZE, -1);
+  std::vector<int64_t> prev(in.size(), -1);
 
   // Build hash chains
   for (size_t i = 0; i + 3 < in.size(); i++) {
     uint32_t h = Hash4(&in[i]);
     prev[i] = head[h];
-    head[h] = (int)i;
+    head[h] = (int64_t)i;
   }
 
   // Optimal parsing: find minimum cost path
   size_t n = in.size();
-  std::vector<int> cost(n + 1, std::numeric_limits<int>::max());
+  std::vector<uint64_t> cost(n + 1, std::numeric_limits<uint64_t>::max());
   std::vector<Choice> choice(n + 1);
   cost[0] = 0;
 
   for (size_t i = 0; i < n; i++) {
-    if (cost[i] == std::numeric_limits<int>::max()) continue;
+    PollCancel(i);
+    if (cost[i] == std::numeric_limits<uint64_t>::max()) continue;
 
     // Option 1: Emit literal
-    int lit_cost = cost[i] + LiteralCost(in[i]);
+    uint64_t lit_cost = cost[i] + LiteralCost(in[i]);
     if (lit_cost < cost[i + 1]) {
       cost[i + 1] = lit_cost;
       choice[i + 1] = {0, 0};
@@ -146,7 +149,7 @@ std::vector<uint8_t> LZMACompress(const std::vector<uint8_t> &in) {
     if (m.len >= LZMA_MIN_MATCH) {
       // Try all lengths from min to best
       for (int len = LZMA_MIN_MATCH; len <= m.len; len++) {
-        int match_cost = cost[i] + MatchCost(len, m.off);
+        uint64_t match_cost = cost[i] + MatchCost(len, m.off);
         if (match_cost < cost[i + len]) {
           cost[i + len] = match_cost;
           choice[i + len] = {len, m.off};
@@ -210,9 +213,9 @@ std::vector<uint8_t> LZMACompress(const std::vector<uint8_t> &in) {
   return out;
 }
 
-std::vector<uint8_t> LZMADecompress(const std::vector<uint8_t> &in) {
+std::vector<uint8_t> LZMADecompress(const std::vector<uint8_t> &in, size_t out_size) {
   std::vector<uint8_t> out;
-  out.reserve(in.size() * 4);
+  out.reserve(out_size ? out_size : in.size() * 4);
 
   size_t i = 0;
   while (i < in.size()) {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -19,7 +20,7 @@ constexpr int LZMA_MAX_MATCH = 273;  // Standard LZMA max
 // Compress using LZMA-style optimal parsing
 // Returns LZ-encoded data suitable for entropy coding
 std::vector<uint8_t> LZMACompress(const std::vector<uint8_t> &in);
-std::vector<uint8_t> LZMADecompress(const std::vector<uint8_t> &in);
+std::vector<uint8_t> LZMADecompress(const std::vector<uint8_t> &in, size_t out_size = 0);
 
 // Finite State Entropy (FSE) - tANS-style entropy coding
 // More efficient than range coding for symbols with known distributions
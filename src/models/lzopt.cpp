@@ -163,13 +163,13 @@ std::vector<uint8_t> LZOptCompress(const std::vector<uint8_t> &in) {
     }
   }
 
-  std::vector<int> cost(n + 1, std::numeric_limits<int>::max());
+  std::vector<uint64_t> cost(n + 1, std::numeric_limits<uint64_t>::max());
   std::vector<int> choice_len(n + 1, 0);
   std::vector<size_t> choice_off(n + 1, 0);
   cost[0] = 0;
 
   for (size_t i = 0; i < n; i++) {
-    if (cost[i] == std::numeric_limits<int>::max()) continue;
+    if (cost[i] == std::numeric_limits<uint64_t>::max()) continue;
 
     int lit_cost = LiteralCost(in[i]);
     if (cost[i] + lit_cost < cost[i + 1]) {
@@ -244,9 +244,9 @@ std::vector<uint8_t> LZOptCompress(const std::vector<uint8_t> &in) {
   return out;
 }
 
-std::vector<uint8_t> LZOptDecompress(const std::vector<uint8_t> &in) {
+std::vector<uint8_t> LZOptDecompress(const std::vector<uint8_t> &in, size_t out_size) {
   std::vector<uint8_t> out;
-  out.reserve(in.size() * 3);
+  out.reserve(out_size ? out_size : in.size() * 3);
 
   for (size_t i = 0; i < in.size();) {
     if (in[i] == ESC_SHORT) {
@@ -266,9 +266,9 @@ std::vector<uint8_t> LZXCompress(const std::vector<uint8_t>& in) {
   return out;
 }
 
-std::vector<uint8_t> LZXDecompress(const std::vector<uint8_t>& in) {
+std::vector<uint8_t> LZXDecompress(const std::vector<uint8_t>& in, size_t out_size) {
   std::vector<uint8_t> out;
-  out.reserve(in.size() * 3);
+  out.reserve(out_size ? out_size : in.size() * 3);
 
   for (size_t i = 0; i < in.size();) {
     if (in[i] == ESC_TINY) {
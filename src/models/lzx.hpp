@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
@@ -10,4 +11,4 @@
 // - Variable-length offset encoding with position slots
 
 std::vector<uint8_t> LZXCompress(const std::vector<uint8_t>& in);
-std::vector<uint8_t> LZXDecompress(const std::vector<uint8_t>& in);
+std::vector<uint8_t> LZXDecompress(const std::vector<uint8_t>& in, size_t out_size = 0);
@@ -1,17 +1,16 @@
 #include "mixer.hpp"
 #include <cmath>
 #include <algorithm>
+#include <mutex>
 
 // Lookup tables for stretch and squash
 namespace {
 
 std::array<int, 4096> stretch_table;
 std::array<int, 8192> squash_table;
-bool tables_initialized = false;
-
-void InitTables() {
-  if (tables_initialized) return;
+std::once_flag tables_initialized;
 
+void BuildTables() {
   // Initialize stretch table: p -> log(p/(1-p))
   for (int i = 0; i < 4096; i++) {
     double p = (i + 0.5) / 4096.0;
@@ -24,10 +23,11 @@ void InitTables() {
     double p = 1.0 / (1.0 + std::exp(-x / 512.0));
     squash_table[i] = std::clamp((int)(p * 4096), 1, 4095);
   }
-
-  tables_initialized = true;
 }
 
+// Hybrid compression runs codecs on several threads at once
+void InitTables() { std::call_once(tables_initialized, BuildTables); }
+
 }  // namespace
 
 ContextMixer::ContextMixer() {
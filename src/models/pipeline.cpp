@@ -0,0 +1,551 @@
+#include "pipeline.hpp"
+#include "bwt.hpp"
+#include "cm.hpp"
+#include "dict.hpp"
+#include "lz77.hpp"
+#include "lzma.hpp"
+#include "lzopt.hpp"
+#include "lzx.hpp"
+#include "model257.hpp"
+#include "ppm.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <utility>
+
+namespace {
+
+// Limits for expensive algorithms
+constexpr size_t MAX_BWT_SIZE = 1 << 20;    // 1MB limit for BWT (O(n^2) sort)
+constexpr size_t MAX_LZX_SIZE = 1 << 18;    // 256KB limit for LZX (suffix array)
+constexpr size_t MAX_CM_SIZE = 512 * 1024;  // 512KB limit for CM (slow but best ratio)
+constexpr size_t MAX_LZOPT_SIZE = 512 * 1024;
+constexpr size_t MAX_DICT_SIZE = 65535;     // Dictionary bootstrapping only helps small files
+constexpr size_t NO_LIMIT = std::numeric_limits<size_t>::max();
+
+// Pre-classifier thresholds (see PrefilterModes)
+constexpr double TEXT_ASCII_RATIO = 0.95;    // At least this: text
+constexpr double BINARY_ASCII_RATIO = 0.6;   // Below this: binary
+constexpr double MIN_SPARSE_ZERO_RATIO = 0.02;
+constexpr double MIN_RLE_RUN_RATIO = 0.005;
+constexpr double STORE_ENTROPY0 = 7.9;       // bits/byte
+constexpr double STORE_MAX_REPEAT4 = 0.01;
+
+enum class StageKind : uint8_t {
+  kLZ77, kLZOpt, kLZX, kLZMA, kRLE, kDelta, kWord, kDict, kSparse, kRecord512,
+  kBWTMTF,  // BWT followed by MTF; the primary index is prefixed to the payload
+};
+
+// When a stage's result is only worth coding if something shrank
+enum class ShrinkGate : uint8_t {
+  kNone,
+  kSelf,    // Drop the stage unless its output is smaller than its input
+  kParent,  // Skip the stage unless its parent shrank its own input
+};
+
+// Stage indices; a stage's parent always precedes it
+enum Stage : int {
+  IN = -1,  // Raw input
+  LZ77, LZOPT, BWT, LZX, RLE, LZ77_BWT, DELTA, DELTA_RLE, WORD, WORD_RLE,
+  WORD_LZ77, LZ77_WORD, DELTA_BWT, RLE_LZ77, LZ77_RLE, RLE_BWT, LZOPT_RLE,
+  RLE_LZOPT, REC, REC_RLE, DICT, WORD_DICT, SPARSE, SPARSE_WORD, LZMA,
+  LZMA_BWT, WORD_LZMA, DICT_LZMA, RLE_LZMA,
+  STAGE_COUNT
+};
+
+struct StageDef {
+  Stage parent;
+  StageKind kind;
+  size_t max_in;  // Skip when the parent output is larger than this
+  ShrinkGate gate;
+};
+
+const StageDef kStages[STAGE_COUNT] = {
+  /* LZ77        */ {IN, StageKind::kLZ77, NO_LIMIT, ShrinkGate::kNone},
+  /* LZOPT       */ {IN, StageKind::kLZOpt, NO_LIMIT, ShrinkGate::kNone},
+  /* BWT         */ {IN, StageKind::kBWTMTF, NO_LIMIT, ShrinkGate::kNone},
+  /* LZX         */ {IN, StageKind::kLZX, NO_LIMIT, ShrinkGate::kNone},
+  /* RLE         */ {IN, StageKind::kRLE, NO_LIMIT, ShrinkGate::kNone},
+  /* LZ77_BWT    */ {LZ77, StageKind::kBWTMTF, NO_LIMIT, ShrinkGate::kNone},
+  /* DELTA       */ {IN, StageKind::kDelta, NO_LIMIT, ShrinkGate::kNone},
+  /* DELTA_RLE   */ {DELTA, StageKind::kRLE, NO_LIMIT, ShrinkGate::kNone},
+  /* WORD        */ {IN, StageKind::kWord, NO_LIMIT, ShrinkGate::kSelf},
+  /* WORD_RLE    */ {WORD, StageKind::kRLE, NO_LIMIT, ShrinkGate::kNone},
+  /* WORD_LZ77   */ {WORD, StageKind::kLZ77, NO_LIMIT, ShrinkGate::kNone},
+  /* LZ77_WORD   */ {LZ77, StageKind::kWord, NO_LIMIT, ShrinkGate::kSelf},
+  /* DELTA_BWT   */ {DELTA, StageKind::kBWTMTF, NO_LIMIT, ShrinkGate::kNone},
+  /* RLE_LZ77    */ {RLE, StageKind::kLZ77, NO_LIMIT, ShrinkGate::kNone},
+  /* LZ77_RLE    */ {LZ77, StageKind::kRLE, NO_LIMIT, ShrinkGate::kNone},
+  /* RLE_BWT     */ {RLE, StageKind::kBWTMTF, NO_LIMIT, ShrinkGate::kNone},
+  /* LZOPT_RLE   */ {LZOPT, StageKind::kRLE, NO_LIMIT, ShrinkGate::kNone},
+  /* RLE_LZOPT   */ {RLE, StageKind::kLZOpt, NO_LIMIT, ShrinkGate::kNone},
+  /* REC         */ {IN, StageKind::kRecord512, NO_LIMIT, ShrinkGate::kNone},
+  /* REC_RLE     */ {REC, StageKind::kRLE, NO_LIMIT, ShrinkGate::kNone},
+  /* DICT        */ {IN, StageKind::kDict, NO_LIMIT, ShrinkGate::kNone},
+  /* WORD_DICT   */ {WORD, StageKind::kDict, NO_LIMIT, ShrinkGate::kNone},
+  /* SPARSE      */ {IN, StageKind::kSparse, NO_LIMIT, ShrinkGate::kSelf},
+  /* SPARSE_WORD */ {SPARSE, StageKind::kWord, NO_LIMIT, ShrinkGate::kSelf},
+  /* LZMA        */ {IN, StageKind::kLZMA, NO_LIMIT, ShrinkGate::kNone},
+  /* LZMA_BWT    */ {LZMA, StageKind::kBWTMTF, MAX_BWT_SIZE, ShrinkGate::kNone},
+  /* WORD_LZMA   */ {WORD, StageKind::kLZMA, NO_LIMIT, ShrinkGate::kNone},
+  /* DICT_LZMA   */ {DICT, StageKind::kLZMA, NO_LIMIT, ShrinkGate::kNone},
+  /* RLE_LZMA    */ {RLE, StageKind::kLZMA, NO_LIMIT, ShrinkGate::kParent},
+};
+
+enum class Coder : uint8_t { kPPM3, kPPM5, kPPM6, kCM };
+
+struct CandidateDef {
+  uint8_t mode;
+  Stage stage;   // Last transform before the coder (IN = raw input)
+  Coder coder;
+  size_t min_n;  // Input size limits for the whole candidate
+  size_t max_n;
+};
+
+// Candidate order is the canonical tie-break order: when two payloads have
+// the same size the one listed first wins. Mode 19 (pattern repeat) is
+// decode-only.
+const CandidateDef kCandidates[] = {
+  {0, IN, Coder::kPPM5, 0, NO_LIMIT},
+  {3, IN, Coder::kPPM6, 0, NO_LIMIT},
+  {1, LZ77, Coder::kPPM3, 0, NO_LIMIT},
+  {2, LZ77, Coder::kPPM5, 0, NO_LIMIT},
+  {4, LZ77, Coder::kPPM6, 0, NO_LIMIT},
+  {5, LZOPT, Coder::kPPM3, 0, MAX_LZOPT_SIZE},
+  {6, LZOPT, Coder::kPPM5, 0, MAX_LZOPT_SIZE},
+  {7, LZOPT, Coder::kPPM6, 0, MAX_LZOPT_SIZE},
+  {8, BWT, Coder::kPPM3, 0, MAX_BWT_SIZE},
+  {9, BWT, Coder::kPPM5, 0, MAX_BWT_SIZE},
+  {13, BWT, Coder::kPPM6, 0, MAX_BWT_SIZE},
+  {10, LZX, Coder::kPPM5, 0, MAX_LZX_SIZE},
+  {11, LZX, Coder::kPPM6, 0, MAX_LZX_SIZE},
+  {12, IN, Coder::kCM, 0, MAX_CM_SIZE},
+  {14, RLE, Coder::kPPM5, 0, NO_LIMIT},
+  {15, RLE, Coder::kPPM6, 0, NO_LIMIT},
+  {16, LZ77_BWT, Coder::kPPM5, 0, MAX_BWT_SIZE},
+  {17, DELTA, Coder::kPPM5, 0, NO_LIMIT},
+  {18, DELTA_RLE, Coder::kPPM5, 0, NO_LIMIT},
+  {20, WORD, Coder::kPPM5, 0, NO_LIMIT},
+  {21, WORD, Coder::kPPM6, 0, NO_LIMIT},
+  {30, WORD_RLE, Coder::kPPM5, 0, NO_LIMIT},
+  {31, WORD_RLE, Coder::kPPM6, 0, NO_LIMIT},
+  {35, WORD_LZ77, Coder::kPPM5, 0, NO_LIMIT},
+  {36, WORD_LZ77, Coder::kPPM6, 0, NO_LIMIT},
+  {37, LZ77_WORD, Coder::kPPM5, 0, NO_LIMIT},
+  {38, LZ77_WORD, Coder::kPPM6, 0, NO_LIMIT},
+  {22, DELTA_BWT, Coder::kPPM5, 0, MAX_BWT_SIZE},
+  {23, RLE_LZ77, Coder::kPPM5, 0, NO_LIMIT},
+  {24, LZ77_RLE, Coder::kPPM5, 0, NO_LIMIT},
+  {25, RLE_BWT, Coder::kPPM5, 0, MAX_BWT_SIZE},
+  {26, LZOPT_RLE, Coder::kPPM5, 0, MAX_LZOPT_SIZE},
+  {27, RLE_LZOPT, Coder::kPPM5, 0, MAX_LZOPT_SIZE},
+  {28, REC, Coder::kPPM5, 1024, 1024 * 1024},
+  {29, REC_RLE, Coder::kPPM5, 1024, 1024 * 1024},
+  {32, DICT, Coder::kPPM5, 0, MAX_DICT_SIZE},
+  {33, DICT, Coder::kPPM6, 0, MAX_DICT_SIZE},
+  {34, WORD_DICT, Coder::kPPM6, 0, MAX_DICT_SIZE},
+  {39, SPARSE, Coder::kPPM5, 0, NO_LIMIT},
+  {40, SPARSE, Coder::kPPM6, 0, NO_LIMIT},
+  {41, SPARSE_WORD, Coder::kPPM6, 0, NO_LIMIT},
+  {42, LZMA, Coder::kPPM5, 0, NO_LIMIT},
+  {43, LZMA, Coder::kPPM6, 0, NO_LIMIT},
+  {44, LZMA_BWT, Coder::kPPM5, 0, NO_LIMIT},
+  {45, WORD_LZMA, Coder::kPPM5, 0, NO_LIMIT},
+  {46, WORD_LZMA, Coder::kPPM6, 0, NO_LIMIT},
+  {47, DICT_LZMA, Coder::kPPM5, 0, MAX_DICT_SIZE},
+  {48, DICT_LZMA, Coder::kPPM6, 0, MAX_DICT_SIZE},
+  {49, RLE_LZMA, Coder::kPPM5, 0, NO_LIMIT},
+  {50, RLE_LZMA, Coder::kPPM6, 0, NO_LIMIT},
+};
+
+constexpr int CANDIDATE_COUNT = sizeof(kCandidates) / sizeof(kCandidates[0]);
+
+std::vector<uint8_t> ApplyStage(StageKind kind, const std::vector<uint8_t>& in,
+                                uint32_t& bwt_idx) {
+  switch (kind) {
+    case StageKind::kLZ77: return LZ77Compress(in);
+    case StageKind::kLZOpt: return LZOptCompress(in);
+    case StageKind::kLZX: return LZXCompress(in);
+    case StageKind::kLZMA: return LZMACompress(in);
+    case StageKind::kRLE: return RLECompress(in);
+    case StageKind::kDelta: return DeltaEncode(in);
+    case StageKind::kWord: return WordEncode(in);
+    case StageKind::kDict: return DictEncode(in);
+    case StageKind::kSparse: return SparseEncode(in);
+    case StageKind::kRecord512: return RecordInterleave(in, 512);
+    case StageKind::kBWTMTF: {
+      auto bwt_data = BWTEncode(in, bwt_idx);
+      return MTFEncode(bwt_data);
+    }
+  }
+  return {};
+}
+
+std::vector<uint8_t> ApplyCoder(Coder coder, const std::vector<uint8_t>& in, size_t front) {
+  switch (coder) {
+    case Coder::kPPM3: return CompressPPM3(in, front);
+    case Coder::kPPM5: return CompressPPM5(in, front);
+    case Coder::kPPM6: return CompressPPM6(in, front);
+    case Coder::kCM: return CompressCM(in, front);
+  }
+  return std::vector<uint8_t>(front);
+}
+
+// Peak memory estimates. The PPM coders dominate: a dense order-2 table of
+// 64K Model257 (~100 MB) plus one hash-map node per distinct order-3..6
+// context, which grows with the entropy of the data (a few thousand nodes
+// for text, about one per byte for random data).
+constexpr size_t PPM_NODE_BYTES = sizeof(Model257) + 64;
+constexpr size_t PPM_DENSE_BYTES = (256 * 256 + 256 + 1) * sizeof(Model257);
+constexpr size_t CM_TABLE_BYTES = (1 << 8) + (1 << 16) + (1 << 20) + (1 << 22) + (1 << 24);
+
+// Upper bound on distinct order-`k` contexts in `n` bytes of entropy `h0`
+size_t DistinctContexts(size_t n, double h0, int k) {
+  double bits = std::min(h0 * k, 60.0);
+  return std::min(n, (size_t)std::ceil(std::exp2(bits)));
+}
+
+size_t StagePeakMemory(StageKind kind, size_t n, double h0) {
+  switch (kind) {
+    case StageKind::kLZ77:
+    case StageKind::kLZOpt:  // Hash chains: a position list per distinct 4-gram
+      return DistinctContexts(n, h0, 4) * 88 + n * 16;
+    case StageKind::kLZX: return n * 32;    // Suffix, rank, LCP arrays + sort pairs
+    case StageKind::kLZMA: return n * 48;   // Hash chains + DP cost/choice arrays
+    case StageKind::kBWTMTF: return n * 9;
+    default: return n * 3;                  // Byte-oriented transforms
+  }
+}
+
+size_t CoderPeakMemory(Coder coder, size_t n, double h0) {
+  int max_order = 0;
+  switch (coder) {
+    case Coder::kPPM3: max_order = 3; break;
+    case Coder::kPPM5: max_order = 5; break;
+    case Coder::kPPM6: max_order = 6; break;
+    case Coder::kCM: return CM_TABLE_BYTES + n * 2;
+  }
+  size_t nodes = 0;
+  for (int k = 3; k <= max_order; k++) nodes += DistinctContexts(n, h0, k);
+  return PPM_DENSE_BYTES + nodes * PPM_NODE_BYTES + n;
+}
+
+// Decode cost estimates (setup ms, ns per byte), rough figures rather than
+// measurements; `kcomp b --calibrate-decode` replaces them with numbers for
+// the machine at hand. PPM setup is dominated by the dense order-2 table.
+DecodeCost CoderDecodeCost(Coder coder) {
+  switch (coder) {
+    case Coder::kPPM3: return {400, 4500};
+    case Coder::kPPM5: return {420, 7500};
+    case Coder::kPPM6: return {500, 10500};
+    case Coder::kCM: return {10, 2400};
+  }
+  return {};
+}
+
+// Inverse transform cost in ns per byte
+double StageDecodeNs(StageKind kind) {
+  switch (kind) {
+    case StageKind::kBWTMTF: return 150;
+    case StageKind::kLZMA: return 30;
+    case StageKind::kWord:
+    case StageKind::kDict: return 30;
+    case StageKind::kLZ77:
+    case StageKind::kLZOpt:
+    case StageKind::kLZX: return 20;
+    default: return 10;
+  }
+}
+
+// Holds a MemoryBudget reservation for one job
+class Reservation {
+public:
+  Reservation(MemoryBudget* budget, size_t bytes) : budget_(budget), bytes_(bytes) {
+    ok_ = !budget_ || budget_->Acquire(bytes_);
+  }
+  ~Reservation() {
+    if (budget_ && ok_) budget_->Release(bytes_);
+  }
+  Reservation(const Reservation&) = delete;
+  Reservation& operator=(const Reservation&) = delete;
+
+  bool ok() const { return ok_; }
+
+private:
+  MemoryBudget* budget_;
+  size_t bytes_;
+  bool ok_ = true;
+};
+
+// Cached output of one stage. `pending` counts consumers that still need
+// `data`: child stages not yet computed plus candidates not yet coded.
+struct StageSlot {
+  std::vector<uint8_t> data;
+  uint32_t bwt_idx = 0;
+  bool has_bwt_idx = false;
+  size_t in_size = 0;  // Size of the parent output this stage consumed
+  std::atomic<int> pending{0};
+};
+
+class PipelineRun {
+public:
+  PipelineRun(const std::vector<uint8_t>& in, ThreadPool& pool, const CandidateSink& sink,
+              const PipelineSchedule& schedule)
+      : in_(in), pool_(pool), sink_(sink), cancel_(schedule.cancel),
+        memory_(schedule.memory), headroom_(schedule.headroom) {
+    // Listed modes first, then everything else in canonical order
+    for (int c = 0; c < CANDIDATE_COUNT; c++) cand_prio_[c] = CANDIDATE_COUNT + c;
+    for (size_t i = 0; i < schedule.order.size(); i++) {
+      int c = PipelineRank(schedule.order[i]);
+      if (c < CANDIDATE_COUNT && cand_prio_[c] >= CANDIDATE_COUNT) cand_prio_[c] = (int)i;
+    }
+    std::fill(stage_prio_, stage_prio_ + STAGE_COUNT, 2 * CANDIDATE_COUNT);
+  }
+
+  void Start(const ModeSet& modes) {
+    // Count direct consumers of every stage reachable from a live candidate
+    for (int c = 0; c < CANDIDATE_COUNT; c++) {
+      const CandidateDef& cand = kCandidates[c];
+      if (!modes[cand.mode] || in_.size() < cand.min_n || in_.size() > cand.max_n)
+        continue;
+      live_[c] = true;
+      if (cand.stage == IN) continue;
+      AddConsumer(cand.stage);
+      for (Stage s = cand.stage; s != IN; s = kStages[s].parent) {
+        stage_prio_[s] = std::min(stage_prio_[s], cand_prio_[c]);
+      }
+    }
+
+    Launch(IN);
+  }
+
+private:
+  // Register one more consumer of `stage`; the first registration also makes
+  // the stage itself a consumer of its parent
+  void AddConsumer(Stage stage) {
+    if (slots_[stage].pending.fetch_add(1) == 0 && kStages[stage].parent != IN) {
+      AddConsumer(kStages[stage].parent);
+    }
+  }
+
+  const std::vector<uint8_t>& Output(Stage stage) const {
+    return stage == IN ? in_ : slots_[stage].data;
+  }
+
+  bool Expired() const { return cancel_ && cancel_->Expired(); }
+
+  // Submit everything that consumes `stage` once its output is available,
+  // in schedule priority order
+  void Launch(Stage stage) {
+    std::vector<std::pair<int, std::function<void()>>> jobs;
+    for (int s = 0; s < STAGE_COUNT; s++) {
+      if (kStages[s].parent == stage && slots_[s].pending.load() > 0) {
+        jobs.emplace_back(stage_prio_[s], [this, s] { Compute(static_cast<Stage>(s)); });
+      }
+    }
+    for (int c = 0; c < CANDIDATE_COUNT; c++) {
+      if (live_[c] && kCandidates[c].stage == stage) {
+        jobs.emplace_back(cand_prio_[c], [this, c] { Code(c); });
+      }
+    }
+    std::stable_sort(jobs.begin(), jobs.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+    for (auto& job : jobs) pool_.Submit(std::move(job.second));
+  }
+
+  void Compute(Stage stage) {
+    const StageDef& def = kStages[stage];
+    const std::vector<uint8_t>& src = Output(def.parent);
+    StageSlot& slot = slots_[stage];
+
+    bool skip = src.size() > def.max_in || Expired();
+    if (def.gate == ShrinkGate::kParent && def.parent != IN) {
+      skip = skip || src.size() >= slots_[def.parent].in_size;
+    }
+
+    if (!skip) {
+      slot.in_size = src.size();
+      try {
+        size_t bytes = memory_ ? StagePeakMemory(def.kind, src.size(),
+                                                 ByteEntropy(src.data(), src.size()))
+                               : 0;
+        Reservation reservation(memory_, bytes);
+        if (!reservation.ok()) throw Cancelled();
+        CancelScope scope(cancel_);
+        slot.data = ApplyStage(def.kind, src, slot.bwt_idx);
+        slot.has_bwt_idx = def.kind == StageKind::kBWTMTF;
+        skip = def.gate == ShrinkGate::kSelf && slot.data.size() >= src.size();
+      } catch (const Cancelled&) {
+        skip = true;
+      }
+    }
+
+    // Parent data is no longer needed by this stage either way
+    Release(def.parent);
+
+    if (skip) {
+      std::vector<uint8_t>().swap(slot.data);
+      return;
+    }
+    Launch(stage);
+  }
+
+  void Code(int c) {
+    const CandidateDef& cand = kCandidates[c];
+    const std::vector<uint8_t>& src = Output(cand.stage);
+
+    // The coder input, then the input of every stage back to the raw data
+    StageSizes sizes{src.size()};
+    for (Stage s = cand.stage; s != IN; s = kStages[s].parent) sizes.push_back(slots_[s].in_size);
+
+    // The coder leaves room for the caller's header and the BWT index
+    bool bwt = cand.stage != IN && slots_[cand.stage].has_bwt_idx;
+    Payload payload;
+    payload.front = headroom_ ? headroom_(cand.mode, sizes) : 0;
+    try {
+      if (Expired()) throw Cancelled();
+      size_t bytes = memory_ ? CoderPeakMemory(cand.coder, src.size(),
+                                               ByteEntropy(src.data(), src.size()))
+                             : 0;
+      Reservation reservation(memory_, bytes);
+      if (!reservation.ok()) throw Cancelled();
+      CancelScope scope(cancel_);
+      payload.bytes = ApplyCoder(cand.coder, src, payload.front + (bwt ? 4 : 0));
+    } catch (const Cancelled&) {
+      Release(cand.stage);
+      return;
+    }
+
+    if (bwt) {
+      uint32_t idx = slots_[cand.stage].bwt_idx;
+      uint8_t *head = payload.bytes.data() + payload.front;
+      for (int i = 0; i < 4; i++) head[i] = (uint8_t)(idx >> (24 - 8 * i));
+    }
+
+    Release(cand.stage);
+    sink_(cand.mode, std::move(payload), std::move(sizes));
+  }
+
+  void Release(Stage stage) {
+    if (stage == IN) return;
+    if (slots_[stage].pending.fetch_sub(1) == 1) {
+      std::vector<uint8_t>().swap(slots_[stage].data);
+    }
+  }
+
+  const std::vector<uint8_t>& in_;
+  ThreadPool& pool_;
+  const CandidateSink& sink_;
+  const CancelToken* cancel_;
+  MemoryBudget* memory_;
+  const std::function<size_t(int, const StageSizes&)>& headroom_;
+  StageSlot slots_[STAGE_COUNT];
+  bool live_[CANDIDATE_COUNT] = {};
+  int cand_prio_[CANDIDATE_COUNT];
+  int stage_prio_[STAGE_COUNT];
+};
+
+// Does the chain of transforms ending at `stage` include a `kind` stage?
+bool ChainUses(Stage stage, StageKind kind) {
+  for (; stage != IN; stage = kStages[stage].parent) {
+    if (kStages[stage].kind == kind) return true;
+  }
+  return false;
+}
+
+// First transform applied to the raw input (only meaningful for stage != IN)
+StageKind FirstKind(Stage stage) {
+  while (kStages[stage].parent != IN) stage = kStages[stage].parent;
+  return kStages[stage].kind;
+}
+
+}  // namespace
+
+ModeSet AllPipelineModes() {
+  ModeSet modes;
+  for (const auto& cand : kCandidates) modes.set(cand.mode);
+  return modes;
+}
+
+ModeSet PrefilterModes(const ModeSet& modes, const DataStats& stats) {
+  bool text = stats.ascii_ratio >= TEXT_ASCII_RATIO;
+  bool binary = stats.ascii_ratio < BINARY_ASCII_RATIO;
+
+  ModeSet out = modes;
+  for (const auto& cand : kCandidates) {
+    Stage st = cand.stage;
+    if (st == IN) continue;
+    bool skip = false;
+    if (binary) {
+      skip = ChainUses(st, StageKind::kWord) || ChainUses(st, StageKind::kDict);
+    }
+    if (text) {
+      skip = skip || ChainUses(st, StageKind::kDelta) || ChainUses(st, StageKind::kSparse) ||
+             ChainUses(st, StageKind::kRecord512);
+    }
+    if (stats.zero_ratio < MIN_SPARSE_ZERO_RATIO) {
+      skip = skip || ChainUses(st, StageKind::kSparse);
+    }
+    if (stats.run_ratio < MIN_RLE_RUN_RATIO) {
+      skip = skip || FirstKind(st) == StageKind::kRLE;
+    }
+    if (skip) out.reset(cand.mode);
+  }
+  return out;
+}
+
+bool LikelyIncompressible(const DataStats& stats) {
+  return stats.size > 0 && stats.entropy0 >= STORE_ENTROPY0 &&
+         stats.repeat4_ratio < STORE_MAX_REPEAT4;
+}
+
+ModeSet AdmissibleModes(const ModeSet& modes, size_t n) {
+  ModeSet out;
+  for (const auto& cand : kCandidates) {
+    if (modes[cand.mode] && n >= cand.min_n && n <= cand.max_n) out.set(cand.mode);
+  }
+  return out;
+}
+
+size_t PipelinePeakMemory(int mode, const std::vector<uint8_t>& in) {
+  int c = PipelineRank(mode);
+  if (c >= CANDIDATE_COUNT) return 0;
+  double h0 = ByteEntropy(in.data(), in.size());
+  size_t peak = CoderPeakMemory(kCandidates[c].coder, in.size(), h0);
+  for (Stage s = kCandidates[c].stage; s != IN; s = kStages[s].parent) {
+    peak = std::max(peak, StagePeakMemory(kStages[s].kind, in.size(), h0));
+  }
+  return peak;
+}
+
+const DecodeProfile& DefaultDecodeProfile() {
+  static const DecodeProfile profile = [] {
+    DecodeProfile p{};  // Store raw and decode-only modes cost nothing
+    for (const auto& cand : kCandidates) {
+      DecodeCost cost = CoderDecodeCost(cand.coder);
+      for (Stage s = cand.stage; s != IN; s = kStages[s].parent) {
+        cost.ns_per_byte += StageDecodeNs(kStages[s].kind);
+      }
+      p[cand.mode] = cost;
+    }
+    return p;
+  }();
+  return profile;
+}
+
+int PipelineRank(int mode) {
+  for (int c = 0; c < CANDIDATE_COUNT; c++) {
+    if (kCandidates[c].mode == mode) return c;
+  }
+  return CANDIDATE_COUNT;
+}
+
+void RunPipelines(const std::vector<uint8_t>& in, const ModeSet& modes,
+                  ThreadPool& pool, const CandidateSink& sink,
+                  const PipelineSchedule& schedule) {
+  PipelineRun run(in, pool, sink, schedule);
+  run.Start(modes);
+  pool.Wait();
+}
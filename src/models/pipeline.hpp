@@ -0,0 +1,92 @@
+#pragma once
+
+#include "../core/cancel.hpp"
+#include "../core/data_stats.hpp"
+#include "../core/memory_budget.hpp"
+#include "../core/thread_pool.hpp"
+#include "decode_cost.hpp"
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Hybrid candidate pipelines expressed as a DAG of transform stages.
+// Every candidate mode is a chain of stages (LZ77, RLE, Word, BWT+MTF, ...)
+// ending in an entropy coder. Chains that share a prefix share the cached
+// stage output, so e.g. LZ77(in) is computed once for modes 1/2/4/16/24/37/38.
+// Cached outputs are reference-counted by their pending consumers and freed
+// as soon as the last one has run.
+
+using ModeSet = std::bitset<256>;
+
+// Size of every stage output of a candidate in decode order: the coder's
+// output first, then each inverse transform's, ending with the input size
+using StageSizes = std::vector<size_t>;
+
+// A finished candidate: the payload starts `front` bytes into `bytes`,
+// after the room asked for by PipelineSchedule::headroom, so the caller's
+// header is written in place instead of moving the payload behind it
+struct Payload {
+  std::vector<uint8_t> bytes;
+  size_t front = 0;
+
+  const uint8_t* data() const { return bytes.data() + front; }
+  size_t size() const { return bytes.size() - front; }
+};
+
+// Receives each finished candidate; called concurrently from pool workers
+using CandidateSink = std::function<void(int mode, Payload&& payload, StageSizes&& sizes)>;
+
+// Every mode CompressHybrid knows how to produce (excluding store raw)
+ModeSet AllPipelineModes();
+
+// Subset of `modes` whose input size limits admit an input of `n` bytes
+ModeSet AdmissibleModes(const ModeSet& modes, size_t n);
+
+// Drop candidates the input statistics say cannot win: Word/Dict on
+// binary data, Delta/Sparse/RecordInterleave on text, Sparse without
+// zeros and RLE-first chains without runs
+ModeSet PrefilterModes(const ModeSet& modes, const DataStats& stats);
+
+// True when the input looks like random or already-compressed data, so
+// storing it raw is the expected winner and no candidate needs to run
+bool LikelyIncompressible(const DataStats& stats);
+
+// Built-in decode cost estimates for every mode, from its coder and the
+// inverse transforms of its chain (see `kcomp b --calibrate-decode` to
+// measure the current machine instead)
+const DecodeProfile& DefaultDecodeProfile();
+
+// Position of a mode in the canonical candidate order (used for tie-breaks)
+int PipelineRank(int mode);
+
+// Optional scheduling controls for RunPipelines
+struct PipelineSchedule {
+  // Modes to start first, in this order; unlisted modes follow in canonical
+  // order. Stages start in the order of the earliest candidate they feed.
+  std::vector<int> order;
+
+  // Once expired, stages and candidates that have not started are skipped
+  // and running coders are aborted (they produce no payload)
+  const CancelToken* cancel = nullptr;
+
+  // Every stage and coder reserves its estimated peak memory here before it
+  // runs (blocking while others hold the budget) and is skipped when the
+  // estimate alone exceeds the cap
+  MemoryBudget* memory = nullptr;
+
+  // Bytes to leave free in front of a `mode` payload with these stage sizes
+  // (called concurrently; none if unset)
+  std::function<size_t(int mode, const StageSizes& sizes)> headroom;
+};
+
+// Estimated peak heap use of the whole `mode` pipeline on `in`: the largest
+// single step, assuming intermediate stages keep roughly the input size
+size_t PipelinePeakMemory(int mode, const std::vector<uint8_t>& in);
+
+// Run every mode in `modes` whose size limits admit `in` and hand each
+// payload (without the mode byte) to `sink`. Returns once all have finished.
+void RunPipelines(const std::vector<uint8_t>& in, const ModeSet& modes,
+                  ThreadPool& pool, const CandidateSink& sink,
+                  const PipelineSchedule& schedule = PipelineSchedule{});
@@ -1,6 +1,11 @@
 #include "ppm.hpp"
+#include "../core/cancel.hpp"
+#include "../core/chunk_channel.hpp"
 #include "../core/range_coder.hpp"
+#include "../core/thread_pool.hpp"
 #include "../io/buffer.hpp"
+#include "../io/byte_sink.hpp"
+#include "blocks.hpp"
 #include "lz77.hpp"
 #include "lzopt.hpp"
 #include "lzx.hpp"
@@ -9,9 +14,15 @@
 #include "dict.hpp"
 #include "lzma.hpp"
 #include "model257.hpp"
+#include "pipeline.hpp"
+#include <algorithm>
 #include <array>
 #include <unordered_map>
 #include <bitset>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
 
 std::vector<uint8_t> CompressPPM1(const std::vector<uint8_t> &in) {
   std::array<Model257, 256> ctx{};
@@ -64,7 +75,7 @@ std::vector<uint8_t> CompressPPM1(const std::vector<uint8_t> &in) {
   return out.data;
 }
 
-std::vector<uint8_t> DecompressPPM1(const std::vector<uint8_t> &in) {
+std::vector<uint8_t> DecompressPPM1(const std::vector<uint8_t> &in, size_t out_size) {
   std::array<Model257, 256> ctx{};
   for (auto &m : ctx)
     m.InitEscOnly();
@@ -77,7 +88,7 @@ std::vector<uint8_t> DecompressPPM1(const std::vector<uint8_t> &in) {
   dec.Init(ib);
 
   std::vector<uint8_t> out;
-  out.reserve(in.size() * 3);
+  out.reserve(out_size ? out_size : in.size() * 3);
 
   uint8_t prev = 0;
 
@@ -209,7 +220,7 @@ std::vector<uint8_t> CompressPPM2(const std::vector<uint8_t> &in) {
   return out.data;
 }
 
-std::vector<uint8_t> DecompressPPM2(const std::vector<uint8_t> &in) {
+std::vector<uint8_t> DecompressPPM2(const std::vector<uint8_t> &in, size_t out_size) {
   std::vector<Model257> ctx2(256 * 256);
   std::vector<Model257> ctx1(256);
 
@@ -226,7 +237,7 @@ std::vector<uint8_t> DecompressPPM2(const std::vector<uint8_t> &in) {
   dec.Init(ib);
 
   std::vector<uint8_t> out;
-  out.reserve(in.size() * 3);
+  out.reserve(out_size ? out_size : in.size() * 3);
 
   uint8_t prev1 = 0;
   uint8_t prev2 = 0;
@@ -295,7 +306,7 @@ std::vector<uint8_t> DecompressPPM2(const std::vector<uint8_t> &in) {
 }
 
 // PPM3: Order-3 with sparse context and Witten-Bell exclusion
-std::vector<uint8_t> CompressPPM3(const std::vector<uint8_t> &in) {
+std::vector<uint8_t> CompressPPM3(const std::vector<uint8_t> &in, size_t front) {
   std::unordered_map<uint32_t, Model257> ctx3;  // Sparse order-3
   std::vector<Model257> ctx2(256 * 256);
   std::vector<Model257> ctx1(256);
@@ -309,12 +320,15 @@ std::vector<uint8_t> CompressPPM3(const std::vector<uint8_t> &in) {
   order0.InitUniform256();
 
   OutBuf out;
+  out.data.resize(front);
   RangeEnc enc;
   enc.Init(out);
 
   uint32_t h = 0;  // Rolling hash for context
 
+  size_t pos = 0;
   for (uint8_t b : in) {
+    PollCancel(pos++);
     std::bitset<256> excl;
     bool encoded = false;
 
@@ -418,7 +432,7 @@ std::vector<uint8_t> CompressPPM3(const std::vector<uint8_t> &in) {
   return out.data;
 }
 
-std::vector<uint8_t> DecompressPPM3(const std::vector<uint8_t> &in) {
+void DecompressPPM3(const uint8_t *in, size_t n, ByteSink &sink) {
   std::unordered_map<uint32_t, Model257> ctx3;
   std::vector<Model257> ctx2(256 * 256);
   std::vector<Model257> ctx1(256);
@@ -431,12 +445,11 @@ std::vector<uint8_t> DecompressPPM3(const std::vector<uint8_t> &in) {
   Model257 order0;
   order0.InitUniform256();
 
-  InBuf ib{in.data(), in.data() + in.size()};
+  InBuf ib{in, in + n};
   RangeDec dec;
   dec.Init(ib);
 
-  std::vector<uint8_t> out;
-  out.reserve(in.size() * 3);
+  ChunkWriter out(sink);
 
   uint32_t h = 0;
 
@@ -512,7 +525,7 @@ std::vector<uint8_t> DecompressPPM3(const std::vector<uint8_t> &in) {
     }
 
     uint8_t b = (uint8_t)sym;
-    out.push_back(b);
+    out.Put(b);
 
     ctx3[h3].Bump(b);
     ctx2[h & 0xFFFF].Bump(b);
@@ -522,13 +535,23 @@ std::vector<uint8_t> DecompressPPM3(const std::vector<uint8_t> &in) {
     h = (h << 8) | b;
   }
 
-  return out;
+  out.Flush();
+}
+
+std::vector<uint8_t> DecompressPPM3(const std::vector<uint8_t> &in, size_t out_size) {
+  VectorSink out(out_size ? out_size : in.size() * 3);
+  DecompressPPM3(in.data(), in.size(), out);
+  return out.Take();
 }
 
 struct ModelEx {
   std::array<uint16_t, 257> cnt{};
   uint32_t total = 0;
 
+  // Contexts are created on first use via operator[], so they must start
+  // with a usable escape symbol
+  ModelEx() { InitEscOnly(); }
+
   void InitEscOnly() {
     cnt.fill(0);
     cnt[256] = 1;
@@ -618,12 +641,12 @@ std::vector<uint8_t> CompressPPM4(const std::vector<uint8_t> &in) {
       enc.Encode(lo, hi, tot);
       encoded = true;
     } else if (it4 != ctx4.end()) {
-      for (int i = 0; i < 256; ++i)
-        if (it4->second.Get(i) != 0)
-          excl[i] = true;
       uint32_t lo, hi, tot;
       it4->second.CumEx(256, excl, lo, hi, tot);
       enc.Encode(lo, hi, tot);
+      for (int i = 0; i < 256; ++i)
+        if (it4->second.Get(i) != 0)
+          excl[i] = true;
     }
 
     if (!encoded) {
@@ -635,12 +658,12 @@ std::vector<uint8_t> CompressPPM4(const std::vector<uint8_t> &in) {
         enc.Encode(lo, hi, tot);
         encoded = true;
       } else if (it3 != ctx3.end()) {
-        for (int i = 0; i < 256; ++i)
-          if (it3->second.Get(i) != 0)
-            excl[i] = true;
         uint32_t lo, hi, tot;
         it3->second.CumEx(256, excl, lo, hi, tot);
         enc.Encode(lo, hi, tot);
+        for (int i = 0; i < 256; ++i)
+          if (it3->second.Get(i) != 0)
+            excl[i] = true;
       }
     }
 
@@ -653,12 +676,12 @@ std::vector<uint8_t> CompressPPM4(const std::vector<uint8_t> &in) {
         enc.Encode(lo, hi, tot);
         encoded = true;
       } else if (it2 != ctx2.end()) {
-        for (int i = 0; i < 256; ++i)
-          if (it2->second.Get(i) != 0)
-            excl[i] = true;
         uint32_t lo, hi, tot;
         it2->second.CumEx(256, excl, lo, hi, tot);
         enc.Encode(lo, hi, tot);
+        for (int i = 0; i < 256; ++i)
+          if (it2->second.Get(i) != 0)
+            excl[i] = true;
       }
     }
 
@@ -670,12 +693,12 @@ std::vector<uint8_t> CompressPPM4(const std::vector<uint8_t> &in) {
         enc.Encode(lo, hi, tot);
         encoded = true;
       } else {
-        for (int i = 0; i < 256; ++i)
-          if (m1.Get(i) != 0)
-            excl[i] = true;
         uint32_t lo, hi, tot;
         m1.CumEx(256, excl, lo, hi, tot);
         enc.Encode(lo, hi, tot);
+        for (int i = 0; i < 256; ++i)
+          if (m1.Get(i) != 0)
+            excl[i] = true;
       }
     }
 
@@ -698,43 +721,43 @@ std::vector<uint8_t> CompressPPM4(const std::vector<uint8_t> &in) {
     std::bitset<256> excl;
     auto it4 = ctx4.find(h);
     if (it4 != ctx4.end()) {
-      for (int i = 0; i < 256; ++i)
-        if (it4->second.Get(i) != 0)
-          excl[i] = true;
       uint32_t lo, hi, tot;
       it4->second.CumEx(256, excl, lo, hi, tot);
       enc.Encode(lo, hi, tot);
+      for (int i = 0; i < 256; ++i)
+        if (it4->second.Get(i) != 0)
+          excl[i] = true;
     }
 
     uint32_t h3 = h & 0xFFFFFF;
     auto it3 = ctx3.find(h3);
     if (it3 != ctx3.end()) {
-      for (int i = 0; i < 256; ++i)
-        if (it3->second.Get(i) != 0)
-          excl[i] = true;
       uint32_t lo, hi, tot;
       it3->second.CumEx(256, excl, lo, hi, tot);
       enc.Encode(lo, hi, tot);
+      for (int i = 0; i < 256; ++i)
+        if (it3->second.Get(i) != 0)
+          excl[i] = true;
     }
 
     uint16_t h2 = h & 0xFFFF;
     auto it2 = ctx2.find(h2);
     if (it2 != ctx2.end()) {
-      for (int i = 0; i < 256; ++i)
-        if (it2->second.Get(i) != 0)
-          excl[i] = true;
       uint32_t lo, hi, tot;
       it2->second.CumEx(256, excl, lo, hi, tot);
       enc.Encode(lo, hi, tot);
+      for (int i = 0; i < 256; ++i)
+        if (it2->second.Get(i) != 0)
+          excl[i] = true;
     }
 
     ModelEx &m1 = ctx1[h & 0xFF];
-    for (int i = 0; i < 256; ++i)
-      if (m1.Get(i) != 0)
-        excl[i] = true;
     uint32_t lo, hi, tot;
     m1.CumEx(256, excl, lo, hi, tot);
     enc.Encode(lo, hi, tot);
+    for (int i = 0; i < 256; ++i)
+      if (m1.Get(i) != 0)
+        excl[i] = true;
 
     uint32_t lo0, hi0;
     order0.Cum(256, lo0, hi0);
@@ -745,7 +768,7 @@ std::vector<uint8_t> CompressPPM4(const std::vector<uint8_t> &in) {
   return out.data;
 }
 
-std::vector<uint8_t> DecompressPPM4(const std::vector<uint8_t> &in) {
+std::vector<uint8_t> DecompressPPM4(const std::vector<uint8_t> &in, size_t out_size) {
   std::unordered_map<uint32_t, ModelEx> ctx4;
   std::unordered_map<uint32_t, ModelEx> ctx3;
   std::unordered_map<uint16_t, ModelEx> ctx2;
@@ -762,7 +785,7 @@ std::vector<uint8_t> DecompressPPM4(const std::vector<uint8_t> &in) {
   dec.Init(ib);
 
   std::vector<uint8_t> out;
-  out.reserve(in.size() * 3);
+  out.reserve(out_size ? out_size : in.size() * 3);
 
   uint32_t h = 0;
 
@@ -896,7 +919,7 @@ std::vector<uint8_t> DecompressPPM4(const std::vector<uint8_t> &in) {
 }
 
 // PPM5: Order-5 with sparse contexts and Witten-Bell exclusion
-std::vector<uint8_t> CompressPPM5(const std::vector<uint8_t> &in) {
+std::vector<uint8_t> CompressPPM5(const std::vector<uint8_t> &in, size_t front) {
   std::unordered_map<uint64_t, Model257> ctx5;
   std::unordered_map<uint32_t, Model257> ctx4;
   std::unordered_map<uint32_t, Model257> ctx3;
@@ -912,12 +935,15 @@ std::vector<uint8_t> CompressPPM5(const std::vector<uint8_t> &in) {
   order0.InitUniform256();
 
   OutBuf out;
+  out.data.resize(front);
   RangeEnc enc;
   enc.Init(out);
 
   uint64_t h = 0;
 
+  size_t pos = 0;
   for (uint8_t b : in) {
+    PollCancel(pos++);
     std::bitset<256> excl;
     bool encoded = false;
 
@@ -1075,7 +1101,7 @@ std::vector<uint8_t> CompressPPM5(const std::vector<uint8_t> &in) {
   return out.data;
 }
 
-std::vector<uint8_t> DecompressPPM5(const std::vector<uint8_t> &in) {
+void DecompressPPM5(const uint8_t *in, size_t n, ByteSink &sink) {
   std::unordered_map<uint64_t, Model257> ctx5;
   std::unordered_map<uint32_t, Model257> ctx4;
   std::unordered_map<uint32_t, Model257> ctx3;
@@ -1090,12 +1116,11 @@ std::vector<uint8_t> DecompressPPM5(const std::vector<uint8_t> &in) {
   Model257 order0;
   order0.InitUniform256();
 
-  InBuf ib{in.data(), in.data() + in.size()};
+  InBuf ib{in, in + n};
   RangeDec dec;
   dec.Init(ib);
 
-  std::vector<uint8_t> out;
-  out.reserve(in.size() * 3);
+  ChunkWriter out(sink);
 
   uint64_t h = 0;
 
@@ -1211,7 +1236,7 @@ std::vector<uint8_t> DecompressPPM5(const std::vector<uint8_t> &in) {
     }
 
     uint8_t b = (uint8_t)sym;
-    out.push_back(b);
+    out.Put(b);
 
     ctx5[h5].Bump(b);
     ctx4[h & 0xFFFFFFFF].Bump(b);
@@ -1223,11 +1248,17 @@ std::vector<uint8_t> DecompressPPM5(const std::vector<uint8_t> &in) {
     h = (h << 8) | b;
   }
 
-  return out;
+  out.Flush();
+}
+
+std::vector<uint8_t> DecompressPPM5(const std::vector<uint8_t> &in, size_t out_size) {
+  VectorSink out(out_size ? out_size : in.size() * 3);
+  DecompressPPM5(in.data(), in.size(), out);
+  return out.Take();
 }
 
 // PPM6: Order-6 with sparse contexts and Witten-Bell exclusion
-std::vector<uint8_t> CompressPPM6(const std::vector<uint8_t> &in) {
+std::vector<uint8_t> CompressPPM6(const std::vector<uint8_t> &in, size_t front) {
   std::unordered_map<uint64_t, Model257> ctx6;
   std::unordered_map<uint64_t, Model257> ctx5;
   std::unordered_map<uint32_t, Model257> ctx4;
@@ -1244,12 +1275,15 @@ std::vector<uint8_t> CompressPPM6(const std::vector<uint8_t> &in) {
   order0.InitUniform256();
 
   OutBuf out;
+  out.data.resize(front);
   RangeEnc enc;
   enc.Init(out);
 
   uint64_t h = 0;
 
+  size_t pos = 0;
   for (uint8_t b : in) {
+    PollCancel(pos++);
     std::bitset<256> excl;
     bool encoded = false;
 
@@ -1434,7 +1468,7 @@ std::vector<uint8_t> CompressPPM6(const std::vector<uint8_t> &in) {
   return out.data;
 }
 
-std::vector<uint8_t> DecompressPPM6(const std::vector<uint8_t> &in) {
+void DecompressPPM6(const uint8_t *in, size_t n, ByteSink &sink) {
   std::unordered_map<uint64_t, Model257> ctx6;
   std::unordered_map<uint64_t, Model257> ctx5;
   std::unordered_map<uint32_t, Model257> ctx4;
@@ -1450,12 +1484,11 @@ std::vector<uint8_t> DecompressPPM6(const std::vector<uint8_t> &in) {
   Model257 order0;
   order0.InitUniform256();
 
-  InBuf ib{in.data(), in.data() + in.size()};
+  InBuf ib{in, in + n};
   RangeDec dec;
   dec.Init(ib);
 
-  std::vector<uint8_t> out;
-  out.reserve(in.size() * 3);
+  ChunkWriter out(sink);
 
   uint64_t h = 0;
 
@@ -1591,7 +1624,7 @@ std::vector<uint8_t> DecompressPPM6(const std::vector<uint8_t> &in) {
     }
 
     uint8_t b = (uint8_t)sym;
-    out.push_back(b);
+    out.Put(b);
 
     ctx6[h6].Bump(b);
     ctx5[h & 0xFFFFFFFFFFULL].Bump(b);
@@ -1604,20 +1637,193 @@ std::vector<uint8_t> DecompressPPM6(const std::vector<uint8_t> &in) {
     h = (h << 8) | b;
   }
 
-  return out;
+  out.Flush();
+}
+
+std::vector<uint8_t> DecompressPPM6(const std::vector<uint8_t> &in, size_t out_size) {
+  VectorSink out(out_size ? out_size : in.size() * 3);
+  DecompressPPM6(in.data(), in.size(), out);
+  return out.Take();
+}
+
+// Memory-efficient helper: try compression and keep if better.
+// Thread-safe so pool workers can offer candidates as they finish. Score ties
+// go to the mode listed first in the pipeline table, so the result does not
+// depend on which worker finishes first. The score is the payload size, plus
+// `decode_weight` bytes per estimated millisecond of decoding when set.
+// Stage sizes are u32 on disk, at most one per stage plus the coder output
+constexpr size_t MAX_STAGE_SIZES = 8;
+
+class CandidateSelector {
+public:
+  CandidateSelector(size_t raw_size, double decode_weight, const DecodeProfile &profile)
+      : raw_size_(raw_size), decode_weight_(decode_weight), profile_(profile) {}
+
+  void Offer(Payload&& candidate, int mode, StageSizes&& sizes) {
+    int rank = PipelineRank(mode);
+    double score = Score(candidate.size(), mode);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (best_mode_ < 0 || score < best_score_ ||
+        (score == best_score_ && rank < best_rank_)) {
+      best_ = std::move(candidate);
+      best_mode_ = mode;
+      best_sizes_ = std::move(sizes);
+      best_rank_ = rank;
+      best_score_ = score;
+    }
+  }
+
+  double Score(size_t size, int mode) const {
+    if (decode_weight_ <= 0) return (double)size;
+    return (double)size + decode_weight_ * profile_[mode].Millis(raw_size_);
+  }
+
+  const Payload& Best() const { return best_; }
+  Payload TakeBest() { return std::move(best_); }
+  int BestMode() const { return best_mode_; }  // -1 if nothing was offered
+  const StageSizes& BestSizes() const { return best_sizes_; }
+  double BestScore() const { return best_score_; }
+
+private:
+  size_t raw_size_;
+  double decode_weight_;
+  const DecodeProfile &profile_;
+  std::mutex mutex_;
+  Payload best_;
+  int best_mode_ = -1;
+  StageSizes best_sizes_;
+  int best_rank_ = 0;
+  double best_score_ = 0;
+};
+
+static std::vector<uint8_t> StoreRaw(const std::vector<uint8_t> &in, size_t front) {
+  std::vector<uint8_t> result;
+  result.reserve(front + 1 + in.size());
+  result.resize(front);
+  result.push_back(255);  // Store raw mode
+  result.insert(result.end(), in.begin(), in.end());
+  return result;
+}
+
+// Mode byte of a hybrid stream, after the stage sizes (SIZED_MODE) when
+// `record_sizes` is set and they fit
+static std::vector<uint8_t> HybridHeader(int mode, const StageSizes &sizes, bool record_sizes) {
+  size_t limit = sizes.empty() ? 0 : MaxStageSize(sizes.back());
+  bool sized = record_sizes && sizes.size() <= MAX_STAGE_SIZES &&
+               std::all_of(sizes.begin(), sizes.end(),
+                           [limit](size_t v) { return v <= UINT32_MAX && v <= limit; });
+  std::vector<uint8_t> head;
+  if (sized) {
+    head.push_back(SIZED_MODE);
+    head.push_back((uint8_t)sizes.size());
+    for (size_t v : sizes) {
+      for (int i = 0; i < 4; i++) head.push_back((uint8_t)(v >> (8 * i)));
+    }
+  }
+  head.push_back((uint8_t)mode);
+  return head;
+}
+
+// Number of slices (head, middle, tail) scored by sample-then-confirm
+constexpr int SAMPLE_SLICES = 3;
+
+// Score every mode in `modes` on slices of the input and return the
+// `top_k` smallest. A mode that produced nothing for a slice (size limit or
+// shrink gate) is charged the raw slice size. Ties go to the lower rank so
+// the choice does not depend on the thread count.
+static ModeSet SampleTopModes(const std::vector<uint8_t> &in, const ModeSet &modes,
+                              unsigned top_k, size_t slice_size, ThreadPool &pool,
+                              const PipelineSchedule &schedule) {
+  std::array<size_t, 256> total{};
+  for (int i = 0; i < SAMPLE_SLICES; i++) {
+    size_t start = (in.size() - slice_size) * i / (SAMPLE_SLICES - 1);
+    std::vector<uint8_t> slice(in.begin() + start, in.begin() + start + slice_size);
+
+    std::array<size_t, 256> sizes;
+    sizes.fill(slice.size());
+    std::mutex mutex;
+    RunPipelines(slice, modes, pool,
+                 [&](int mode, Payload&& payload, StageSizes&&) {
+                   std::lock_guard<std::mutex> lock(mutex);
+                   sizes[mode] = std::min(sizes[mode], payload.size());
+                 },
+                 schedule);
+    for (int m = 0; m < 256; m++) total[m] += sizes[m];
+  }
+
+  std::vector<int> ranked;
+  for (int m = 0; m < 256; m++) {
+    if (modes[m]) ranked.push_back(m);
+  }
+  std::sort(ranked.begin(), ranked.end(), [&](int a, int b) {
+    if (total[a] != total[b]) return total[a] < total[b];
+    return PipelineRank(a) < PipelineRank(b);
+  });
+
+  ModeSet top;
+  for (size_t i = 0; i < ranked.size() && i < top_k; i++) top.set(ranked[i]);
+  return top;
 }
 
-// Memory-efficient helper: try compression and keep if better
-static void TryCompress(std::vector<uint8_t>& best, int& best_mode,
-                        std::vector<uint8_t>&& candidate, int mode) {
-  if (best.empty() || candidate.size() < best.size()) {
-    best = std::move(candidate);
-    best_mode = mode;
+// Candidate modes per compression level. Low levels run one or two cheap
+// pipelines; middle levels drop CM, LZX and LZOpt (and LZMA below level 7);
+// an empty list (level 9) means every mode.
+static const std::vector<int> kLevelModes[MAX_LEVEL] = {
+  /* 1 */ {1},
+  /* 2 */ {1, 14},
+  /* 3 */ {0, 1, 2, 14},
+  /* 4 */ {0, 1, 2, 9, 14, 17, 20},
+  /* 5 */ {0, 1, 2, 3, 4, 8, 9, 13, 14, 16, 17, 18, 20, 24, 30, 35},
+  /* 6 */ {0, 1, 2, 3, 4, 8, 9, 13, 14, 15, 16, 17, 18, 20, 21, 22, 23, 24, 25,
+           28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41},
+  /* 7 */ {0, 1, 2, 3, 4, 8, 9, 13, 14, 15, 16, 17, 18, 20, 21, 22, 23, 24, 25,
+           28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41,
+           42, 43, 44, 45, 46, 47, 48, 49, 50},
+  /* 8 */ {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 14, 15, 16, 17, 18, 20, 21,
+           22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38,
+           39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50},
+  /* 9 */ {},
+};
+
+// Modes searched at `level` (clamped to MIN_LEVEL..MAX_LEVEL)
+static ModeSet LevelModes(int level) {
+  level = std::min(std::max(level, MIN_LEVEL), MAX_LEVEL);
+  const std::vector<int> &list = kLevelModes[level - 1];
+  if (list.empty()) return AllPipelineModes();
+  ModeSet modes;
+  for (int m : list) modes.set(m);
+  return modes;
+}
+
+// Every mode ordered by the lowest level that includes it, i.e. cheap,
+// usually-good pipelines first. Used as the launch order under a time budget.
+static std::vector<int> ModesByLevel() {
+  std::vector<int> order;
+  ModeSet seen;
+  for (int level = MIN_LEVEL; level <= MAX_LEVEL; level++) {
+    ModeSet modes = LevelModes(level);
+    for (int m = 0; m < 256; m++) {
+      if (modes[m] && !seen[m]) order.push_back(m);
+    }
+    seen |= modes;
   }
+  return order;
 }
 
 // Hybrid compressor: tries multiple strategies, picks best
 // Memory-efficient: only keeps the best result, discards others immediately
+// Candidate pipelines share intermediate stages (see pipeline.cpp) and run
+// concurrently on a thread pool (opts.threads). opts.level picks the modes
+// considered at all (see kLevelModes). With opts.time_budget the search is
+// an anytime one: cheap modes start first and the rest are cut off at the
+// deadline. With opts.prefilter a single
+// statistics pass gates the candidate set first. With opts.sample, large
+// inputs only run the modes that scored best on sampled slices. With
+// opts.max_memory candidates run only as far in parallel as their estimated
+// peak memory fits, and those that cannot fit at all are skipped. The winner
+// is the smallest payload unless opts.decode_weight / min_decode_speed trade
+// size for decode speed (see CandidateSelector). With opts.block_size or
+// opts.adaptive_blocks each block gets its own mode (mode 254, blocks.hpp).
 // Format: first byte is mode:
 //   0 = PPM5, 1 = LZ77+PPM3, 2 = LZ77+PPM5, 3 = PPM6, 4 = LZ77+PPM6
 //   5 = LZOpt+PPM3, 6 = LZOpt+PPM5, 7 = LZOpt+PPM6
@@ -1630,600 +1836,475 @@ static void TryCompress(std::vector<uint8_t>& best, int& best_mode,
 //   26 = LZOpt+RLE+PPM5, 27 = RLE+LZOpt+PPM5
 //   28 = RecordInterleave(512)+PPM5, 29 = RecordInterleave(512)+RLE+PPM5
 //   30 = Word+RLE+PPM5, 31 = Word+RLE+PPM6
-//   32 = Dict+PPM5, 33 = Dict+PPM6, 34 = Word+Dict+PPM6, 255 = Store raw
+//   32 = Dict+PPM5, 33 = Dict+PPM6, 34 = Word+Dict+PPM6
+//   35 = Word+LZ77+PPM5, 36 = Word+LZ77+PPM6
+//   37 = LZ77+Word+PPM5, 38 = LZ77+Word+PPM6
+//   39 = Sparse+PPM5, 40 = Sparse+PPM6, 41 = Sparse+Word+PPM6
+//   42 = LZMA+PPM5, 43 = LZMA+PPM6, 44 = LZMA+BWT+MTF+PPM5
+//   45 = Word+LZMA+PPM5, 46 = Word+LZMA+PPM6
+//   47 = Dict+LZMA+PPM5, 48 = Dict+LZMA+PPM6
+//   49 = RLE+LZMA+PPM5, 50 = RLE+LZMA+PPM6
+//   254 = Block container, 255 = Store raw
 std::vector<uint8_t> CompressHybrid(const std::vector<uint8_t> &in) {
-  std::vector<uint8_t> best;
-  int best_mode = 0;
-
-  // Limits for expensive algorithms
-  constexpr size_t MAX_BWT_SIZE = 1 << 20;   // 1MB limit for BWT (O(n^2) sort)
-  constexpr size_t MAX_LZX_SIZE = 1 << 18;   // 256KB limit for LZX (suffix array)
-  constexpr size_t MAX_CM_SIZE = 512 * 1024; // 512KB limit for CM (slow but best ratio)
-
-  // Try PPM5 alone (best for unique text)
-  TryCompress(best, best_mode, CompressPPM5(in), 0);
-
-  // Try PPM6 (higher order context)
-  TryCompress(best, best_mode, CompressPPM6(in), 3);
+  return CompressHybrid(in, HybridOptions{});
+}
 
-  // Try LZ77 preprocessing (64KB window) - fast, always try
-  {
-    auto lz77_data = LZ77Compress(in);
-    TryCompress(best, best_mode, CompressPPM3(lz77_data), 1);
-    TryCompress(best, best_mode, CompressPPM5(lz77_data), 2);
-    TryCompress(best, best_mode, CompressPPM6(lz77_data), 4);
+HybridOptions StartBudget(const HybridOptions &opts) {
+  HybridOptions o = opts;
+  if (o.time_budget > 0 && o.deadline == CancelToken::Clock::time_point{}) {
+    o.deadline = CancelToken::Clock::now() +
+                 std::chrono::duration_cast<CancelToken::Clock::duration>(
+                     std::chrono::duration<double>(o.time_budget));
   }
+  return o;
+}
 
-  // Try LZOpt preprocessing (1MB window) - only for smaller files
-  if (in.size() <= 512 * 1024) {
-    auto lzopt_data = LZOptCompress(in);
-    TryCompress(best, best_mode, CompressPPM3(lzopt_data), 5);
-    TryCompress(best, best_mode, CompressPPM5(lzopt_data), 6);
-    TryCompress(best, best_mode, CompressPPM6(lzopt_data), 7);
+std::vector<uint8_t> CompressHybrid(const std::vector<uint8_t> &in,
+                                    const HybridOptions &opts) {
+  if (opts.block_size > 0 || opts.adaptive_blocks) {
+    auto ends = SplitBlocks(in, opts.block_size, opts.adaptive_blocks);
+    if (ends.size() > 1) {
+      auto out = CompressBlocks(in, ends, opts);
+      if (out.size() - opts.front > in.size()) return StoreRaw(in, opts.front);
+      return out;
+    }
   }
 
-  if (in.size() <= MAX_BWT_SIZE) {
-    uint32_t bwt_idx = 0;
-    auto bwt_data = BWTEncode(in, bwt_idx);
-    auto mtf_data = MTFEncode(bwt_data);
-    bwt_data.clear();
-    std::vector<uint8_t> prefix = {
-      (uint8_t)((bwt_idx >> 24) & 0xFF),
-      (uint8_t)((bwt_idx >> 16) & 0xFF),
-      (uint8_t)((bwt_idx >> 8) & 0xFF),
-      (uint8_t)(bwt_idx & 0xFF)
-    };
-    auto ppm3 = CompressPPM3(mtf_data);
-    auto ppm5 = CompressPPM5(mtf_data);
-    auto ppm6 = CompressPPM6(mtf_data);
-    std::vector<uint8_t> full3, full5, full6;
-    full3.reserve(4 + ppm3.size());
-    full3.insert(full3.end(), prefix.begin(), prefix.end());
-    full3.insert(full3.end(), ppm3.begin(), ppm3.end());
-    full5.reserve(4 + ppm5.size());
-    full5.insert(full5.end(), prefix.begin(), prefix.end());
-    full5.insert(full5.end(), ppm5.begin(), ppm5.end());
-    full6.reserve(4 + ppm6.size());
-    full6.insert(full6.end(), prefix.begin(), prefix.end());
-    full6.insert(full6.end(), ppm6.begin(), ppm6.end());
-    TryCompress(best, best_mode, std::move(full3), 8);
-    TryCompress(best, best_mode, std::move(full5), 9);
-    TryCompress(best, best_mode, std::move(full6), 13);
+  HybridOptions budgeted = StartBudget(opts);
+  ModeSet modes = AdmissibleModes(LevelModes(opts.level), in.size());
+  if (opts.prefilter) {
+    DataStats stats = AnalyzeData(in.data(), in.size());
+    if (LikelyIncompressible(stats)) return StoreRaw(in, opts.front);
+    modes = PrefilterModes(modes, stats);
   }
 
-  // Try LZX preprocessing (64MB window) - only for smaller files (suffix array is expensive)
-  if (in.size() <= MAX_LZX_SIZE) {
-    auto lzx_data = LZXCompress(in);
-    TryCompress(best, best_mode, CompressPPM5(lzx_data), 10);
-    TryCompress(best, best_mode, CompressPPM6(lzx_data), 11);
+  const DecodeProfile &profile = opts.decode_profile ? *opts.decode_profile
+                                                     : DefaultDecodeProfile();
+  if (opts.min_decode_speed > 0) {
+    for (int m = 0; m < 256; m++) {
+      if (modes[m] && profile[m].MBps(in.size()) < opts.min_decode_speed) modes.reset(m);
+    }
   }
 
-  // Try CM (Context Mixing) - PAQ-style, best ratio but slow
-  if (in.size() <= MAX_CM_SIZE) {
-    TryCompress(best, best_mode, CompressCM(in), 12);
-  }
+  CandidateSelector sel(in.size(), opts.decode_weight, profile);
+  ThreadPool pool(opts.threads);
 
-  // Try RLE preprocessing - good for files with many repeated bytes (TAR, binary)
-  {
-    auto rle_data = RLECompress(in);
-    TryCompress(best, best_mode, CompressPPM5(rle_data), 14);
-    TryCompress(best, best_mode, CompressPPM6(rle_data), 15);
-  }
+  // The input, the best result and cached stage outputs are charged up front
+  size_t fixed = 3 * in.size();
+  MemoryBudget memory(opts.max_memory > fixed ? opts.max_memory - fixed : 0);
+  PipelineSchedule schedule;
+  if (opts.max_memory > 0) schedule.memory = &memory;
 
-  if (in.size() <= MAX_BWT_SIZE) {
-    auto lz_data = LZ77Compress(in);
-    uint32_t bwt_idx = 0;
-    auto bwt_data = BWTEncode(lz_data, bwt_idx);
-    auto mtf_data = MTFEncode(bwt_data);
-    bwt_data.clear();
-    std::vector<uint8_t> prefix = {
-      (uint8_t)((bwt_idx >> 24) & 0xFF),
-      (uint8_t)((bwt_idx >> 16) & 0xFF),
-      (uint8_t)((bwt_idx >> 8) & 0xFF),
-      (uint8_t)(bwt_idx & 0xFF)
-    };
-    auto ppm5 = CompressPPM5(mtf_data);
-    std::vector<uint8_t> full;
-    full.reserve(4 + ppm5.size());
-    full.insert(full.end(), prefix.begin(), prefix.end());
-    full.insert(full.end(), ppm5.begin(), ppm5.end());
-    TryCompress(best, best_mode, std::move(full), 16);
+  // The time budget covers sampling too, so it is set up first
+  CancelToken deadline(budgeted.deadline);
+  if (opts.time_budget > 0) {
+    schedule.order = ModesByLevel();
+    schedule.cancel = &deadline;
   }
 
-  // Try Delta encoding - good for binary files with gradual value changes
-  {
-    auto delta_data = DeltaEncode(in);
-    TryCompress(best, best_mode, CompressPPM5(delta_data), 17);
-
-    // Delta + RLE for binary with both patterns
-    auto delta_rle = RLECompress(delta_data);
-    TryCompress(best, best_mode, CompressPPM5(delta_rle), 18);
+  size_t slice_size = std::max<size_t>(opts.slice_size, 1);
+  if (opts.sample && opts.top_k > 0 && in.size() > SAMPLE_SLICES * slice_size) {
+    // Slices are cut short as soon as the deadline passes; the full-size
+    // run below still waits for its first candidate before cancelling
+    CancelToken sampling(budgeted.deadline);
+    sampling.Arm();
+    PipelineSchedule sample_schedule = schedule;
+    if (schedule.cancel) sample_schedule.cancel = &sampling;
+    modes = SampleTopModes(in, modes, opts.top_k, slice_size, pool, sample_schedule);
   }
 
-  // Pattern encoding disabled - decompression bug
-  // {
-  //   auto pattern_data = PatternEncode(in);
-  //   if (!pattern_data.empty()) {
-  //     TryCompress(best, best_mode, std::move(pattern_data), 19);
-  //   }
-  // }
-
-  // Try Word tokenization - good for HTML/text with common patterns
-  {
-    auto word_data = WordEncode(in);
-    if (word_data.size() < in.size()) {  // Only if tokenization helps
-      TryCompress(best, best_mode, CompressPPM5(word_data), 20);
-      TryCompress(best, best_mode, CompressPPM6(word_data), 21);
-
-      // Word+RLE is especially good for TAR and similar archives
-      auto word_rle = RLECompress(word_data);
-      TryCompress(best, best_mode, CompressPPM5(word_rle), 30);
-      TryCompress(best, best_mode, CompressPPM6(word_rle), 31);
-
-      // Word+LZ77+PPM - good for XML/Wiki content with repeated structures
-      auto word_lz = LZ77Compress(word_data);
-      TryCompress(best, best_mode, CompressPPM5(word_lz), 35);
-      TryCompress(best, best_mode, CompressPPM6(word_lz), 36);
+  // Every coder leaves room for the caller's header and ours, which then
+  // go in place in front of the winner
+  schedule.headroom = [&opts](int mode, const StageSizes &sizes) {
+    return opts.front + HybridHeader(mode, sizes, opts.record_sizes).size();
+  };
+  auto offer = [&sel, &deadline](int mode, Payload&& payload, StageSizes&& sizes) {
+    sel.Offer(std::move(payload), mode, std::move(sizes));
+    deadline.Arm();
+  };
+  RunPipelines(in, modes, pool, offer, schedule);
+
+  // A cap too tight for every candidate (at most three times the input
+  // leaves nothing for them) still runs the one estimated to need least,
+  // on its own, rather than quietly storing the input
+  if (schedule.memory && sel.BestMode() < 0) {
+    int cheapest = -1;
+    size_t least = SIZE_MAX;
+    for (int m = 0; m < 256; m++) {
+      if (!modes[m]) continue;
+      size_t bytes = PipelinePeakMemory(m, in);
+      if (bytes < least) {
+        least = bytes;
+        cheapest = m;
+      }
     }
-  }
-
-  // Try LZ77+Word+PPM - find matches first, then tokenize
-  {
-    auto lz_data = LZ77Compress(in);
-    auto lz_word = WordEncode(lz_data);
-    if (lz_word.size() < lz_data.size()) {
-      TryCompress(best, best_mode, CompressPPM5(lz_word), 37);
-      TryCompress(best, best_mode, CompressPPM6(lz_word), 38);
+    if (cheapest >= 0 && least > memory.Cap()) {
+      ModeSet one;
+      one.set(cheapest);
+      schedule.memory = nullptr;
+      RunPipelines(in, one, pool, offer, schedule);
     }
   }
 
-  if (in.size() <= MAX_BWT_SIZE) {
-    auto delta_data = DeltaEncode(in);
-    uint32_t bwt_idx = 0;
-    auto bwt_data = BWTEncode(delta_data, bwt_idx);
-    auto mtf_data = MTFEncode(bwt_data);
-    bwt_data.clear();
-    std::vector<uint8_t> prefix = {
-      (uint8_t)((bwt_idx >> 24) & 0xFF),
-      (uint8_t)((bwt_idx >> 16) & 0xFF),
-      (uint8_t)((bwt_idx >> 8) & 0xFF),
-      (uint8_t)(bwt_idx & 0xFF)
-    };
-    auto ppm5 = CompressPPM5(mtf_data);
-    std::vector<uint8_t> full;
-    full.reserve(4 + ppm5.size());
-    full.insert(full.end(), prefix.begin(), prefix.end());
-    full.insert(full.end(), ppm5.begin(), ppm5.end());
-    TryCompress(best, best_mode, std::move(full), 22);
-  }
+  int best_mode = sel.BestMode();
 
-  // Try RLE+LZ77 - RLE first removes runs, then LZ77 finds patterns
-  {
-    auto rle_data = RLECompress(in);
-    auto lz_data = LZ77Compress(rle_data);
-    TryCompress(best, best_mode, CompressPPM5(lz_data), 23);
-  }
-
-  // Try LZ77+RLE - LZ77 first finds patterns, then RLE handles remaining runs
-  {
-    auto lz_data = LZ77Compress(in);
-    auto rle_data = RLECompress(lz_data);
-    TryCompress(best, best_mode, CompressPPM5(rle_data), 24);
+  // If nothing compresses well, store raw (mode 255)
+  // Only store raw if compressed size (or score) >= original size
+  if (best_mode < 0 || sel.Best().size() >= in.size() ||
+      sel.BestScore() >= sel.Score(in.size(), 255)) {
+    return StoreRaw(in, opts.front);
   }
 
-  if (in.size() <= MAX_BWT_SIZE) {
-    auto rle_data = RLECompress(in);
-    uint32_t bwt_idx = 0;
-    auto bwt_data = BWTEncode(rle_data, bwt_idx);
-    auto mtf_data = MTFEncode(bwt_data);
-    bwt_data.clear();
-    std::vector<uint8_t> prefix = {
-      (uint8_t)((bwt_idx >> 24) & 0xFF),
-      (uint8_t)((bwt_idx >> 16) & 0xFF),
-      (uint8_t)((bwt_idx >> 8) & 0xFF),
-      (uint8_t)(bwt_idx & 0xFF)
-    };
-    auto ppm5 = CompressPPM5(mtf_data);
-    std::vector<uint8_t> full;
-    full.reserve(4 + ppm5.size());
-    full.insert(full.end(), prefix.begin(), prefix.end());
-    full.insert(full.end(), ppm5.begin(), ppm5.end());
-    TryCompress(best, best_mode, std::move(full), 25);
-  }
+  // Build final result: the header fills the room the coder left for it
+  std::vector<uint8_t> head = HybridHeader(best_mode, sel.BestSizes(), opts.record_sizes);
+  Payload best = sel.TakeBest();
+  std::copy(head.begin(), head.end(), best.bytes.begin() + opts.front);
+  return std::move(best.bytes);
+}
 
-  // Try LZOpt+RLE - optimal parsing + run encoding for archives
-  if (in.size() <= 512 * 1024) {
-    auto lzopt_data = LZOptCompress(in);
-    auto rle_data = RLECompress(lzopt_data);
-    TryCompress(best, best_mode, CompressPPM5(rle_data), 26);
+// Entropy decoder at the head of a hybrid decode chain
+using ChainCoder = void (*)(const uint8_t *, size_t, ByteSink &);
 
-    // Also try RLE first, then LZOpt
-    auto rle_first = RLECompress(in);
-    auto lzopt_then = LZOptCompress(rle_first);
-    TryCompress(best, best_mode, CompressPPM5(lzopt_then), 27);
-  }
+// Inverse transforms that can consume their input a chunk at a time
+enum class StreamStage { LZ77, RLE, Delta, Word, MTF };
 
-  // Try Record Interleave with 512-byte blocks (for TAR and similar formats)
-  // This groups same positions across records together, improving PPM context
-  if (in.size() >= 1024 && in.size() <= 1024 * 1024) {  // 1KB to 1MB
-    auto rec512 = RecordInterleave(in, 512);
-    TryCompress(best, best_mode, CompressPPM5(rec512), 28);
+// Chunks in flight between the coder thread and the stages (64 KB each)
+constexpr size_t STREAM_QUEUE_CHUNKS = 4;
 
-    // Also try with RLE after interleaving (groups runs of same byte)
-    auto rec512_rle = RLECompress(rec512);
-    TryCompress(best, best_mode, CompressPPM5(rec512_rle), 29);
+static std::unique_ptr<ByteSink> MakeStreamStage(StreamStage stage, ByteSink &next) {
+  switch (stage) {
+    case StreamStage::LZ77: return std::make_unique<LZ77StreamDecoder>(next);
+    case StreamStage::RLE: return std::make_unique<RLEStreamDecoder>(next);
+    case StreamStage::Delta: return std::make_unique<DeltaStreamDecoder>(next);
+    case StreamStage::Word: return std::make_unique<WordStreamDecoder>(next);
+    case StreamStage::MTF: return std::make_unique<MTFStreamDecoder>(next);
   }
+  return nullptr;
+}
 
-  // Try Dictionary-based compression for small files
-  // Prepends a static dictionary to bootstrap PPM with common patterns
-  // This helps small files (like brotli's dictionary approach)
-  if (in.size() <= 65535) {  // Only for files up to 64KB
-    auto dict_data = DictEncode(in);
-    // Compress dict+data together, PPM learns from dict first
-    TryCompress(best, best_mode, CompressPPM5(dict_data), 32);
-    TryCompress(best, best_mode, CompressPPM6(dict_data), 33);
-
-    // Also try Word+Dict for HTML/text
-    auto word_data = WordEncode(in);
-    if (word_data.size() < in.size()) {
-      auto word_dict = DictEncode(word_data);
-      TryCompress(best, best_mode, CompressPPM6(word_dict), 34);
-    }
+// Decode `coder` output through `stages` (in decode order) without
+// materialising any intermediate stage: data moves in 64 KB chunks and only
+// the last stage's output is collected. With more than one thread the coder
+// runs on its own thread and hands chunks over a bounded channel, so the
+// stages work on one chunk while the coder produces the next. `out_size`,
+// if known, is the exact size of the result.
+static std::vector<uint8_t> DecodeChain(unsigned threads, ChainCoder coder, const uint8_t *p,
+                                        size_t n, std::initializer_list<StreamStage> stages = {},
+                                        size_t out_size = 0) {
+  VectorSink result(out_size ? out_size : stages.size() == 0 ? n * 3 : 0);
+  std::vector<std::unique_ptr<ByteSink>> chain;
+  ByteSink *head = &result;
+  for (auto it = stages.end(); it != stages.begin();) {
+    chain.push_back(MakeStreamStage(*--it, *head));
+    head = chain.back().get();
   }
 
-  // Try Sparse encoding - optimized for files with many zeros (TAR, binary)
-  {
-    auto sparse_data = SparseEncode(in);
-    if (sparse_data.size() < in.size()) {
-      TryCompress(best, best_mode, CompressPPM5(sparse_data), 39);
-      TryCompress(best, best_mode, CompressPPM6(sparse_data), 40);
-
-      // Sparse+Word - for TAR with source code
-      auto sparse_word = WordEncode(sparse_data);
-      if (sparse_word.size() < sparse_data.size()) {
-        TryCompress(best, best_mode, CompressPPM6(sparse_word), 41);
-      }
-    }
+  if (chain.empty() || threads <= 1) {
+    coder(p, n, *head);
+    head->Close();
+    return result.Take();
   }
 
-  // Try LZMA-style optimal parsing (1MB window) - best for text/code
-  {
-    auto lzma_data = LZMACompress(in);
-    TryCompress(best, best_mode, CompressPPM5(lzma_data), 42);
-    TryCompress(best, best_mode, CompressPPM6(lzma_data), 43);
-
-    if (lzma_data.size() <= MAX_BWT_SIZE) {
-      uint32_t bwt_idx = 0;
-      auto bwt_data = BWTEncode(lzma_data, bwt_idx);
-      auto mtf_data = MTFEncode(bwt_data);
-      bwt_data.clear();
-      std::vector<uint8_t> prefix = {
-        (uint8_t)((bwt_idx >> 24) & 0xFF),
-        (uint8_t)((bwt_idx >> 16) & 0xFF),
-        (uint8_t)((bwt_idx >> 8) & 0xFF),
-        (uint8_t)(bwt_idx & 0xFF)
-      };
-      auto ppm5 = CompressPPM5(mtf_data);
-      std::vector<uint8_t> full;
-      full.reserve(4 + ppm5.size());
-      full.insert(full.end(), prefix.begin(), prefix.end());
-      full.insert(full.end(), ppm5.begin(), ppm5.end());
-      TryCompress(best, best_mode, std::move(full), 44);
-    }
+  ChunkChannel channel(STREAM_QUEUE_CHUNKS);
+  std::exception_ptr error;
+  std::thread producer([&] {
+    ChannelSink sink(channel);
+    try {
+      coder(p, n, sink);
+    } catch (const ChunkChannel::Abandoned &) {
+      // The consumer failed and reports its own error
+    } catch (...) {
+      error = std::current_exception();
+    }
+    sink.Close();
+  });
+
+  try {
+    std::vector<uint8_t> chunk;
+    while (channel.Pop(chunk)) head->Write(chunk.data(), chunk.size());
+    head->Close();
+  } catch (...) {
+    channel.Abandon();
+    producer.join();
+    throw;
   }
+  producer.join();
+  if (error) std::rethrow_exception(error);
+  return result.Take();
+}
 
-  // Try Word+LZMA - tokenize first for better long-range matching
-  {
-    auto word_data = WordEncode(in);
-    if (word_data.size() < in.size()) {
-      auto lzma_data = LZMACompress(word_data);
-      TryCompress(best, best_mode, CompressPPM5(lzma_data), 45);
-      TryCompress(best, best_mode, CompressPPM6(lzma_data), 46);
-    }
-  }
+// BWT+MTF chains: 4-byte primary index, then the coder stream. MTF decoding
+// is streamed; the BWT inverse needs its whole input, which has the size
+// of its output (`out_size`).
+static std::vector<uint8_t> DecodeBWTChain(unsigned threads, ChainCoder coder,
+                                           const uint8_t *p, size_t n, size_t out_size) {
+  uint32_t bwt_idx = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+                     ((uint32_t)p[2] << 8) | p[3];
+  auto bwt_data = DecodeChain(threads, coder, p + 4, n - 4, {StreamStage::MTF}, out_size);
+  return BWTDecode(bwt_data, bwt_idx);
+}
 
-  // Try Dict+LZMA for small files
-  if (in.size() <= 65535) {
-    auto dict_data = DictEncode(in);
-    auto lzma_data = LZMACompress(dict_data);
-    TryCompress(best, best_mode, CompressPPM5(lzma_data), 47);
-    TryCompress(best, best_mode, CompressPPM6(lzma_data), 48);
-  }
+// Recorded stage output sizes of a stream (see SIZED_MODE); every lookup
+// is 0 for streams written without them
+class StageHints {
+public:
+  StageHints() = default;
+  explicit StageHints(std::vector<size_t> sizes) : sizes_(std::move(sizes)) {}
 
-  // Try RLE+LZMA for TAR/archives
-  {
-    auto rle_data = RLECompress(in);
-    if (rle_data.size() < in.size()) {
-      auto lzma_data = LZMACompress(rle_data);
-      TryCompress(best, best_mode, CompressPPM5(lzma_data), 49);
-      TryCompress(best, best_mode, CompressPPM6(lzma_data), 50);
-    }
-  }
+  // Output size of decode step `i` (0 = the entropy coder)
+  size_t At(size_t i) const { return i < sizes_.size() ? sizes_[i] : 0; }
 
-  // If nothing compresses well, store raw (mode 255)
-  // Only store raw if compressed size >= original size
-  if (best.size() >= in.size()) {
-    std::vector<uint8_t> result;
-    result.reserve(1 + in.size());
-    result.push_back(255);  // Store raw mode
-    result.insert(result.end(), in.begin(), in.end());
-    return result;
-  }
+  // Decoded size of the whole stream
+  size_t Final() const { return sizes_.empty() ? 0 : sizes_.back(); }
 
-  // Build final result
-  std::vector<uint8_t> result;
-  result.reserve(1 + best.size());
-  result.push_back((uint8_t)best_mode);
-  result.insert(result.end(), best.begin(), best.end());
+private:
+  std::vector<size_t> sizes_;
+};
 
-  return result;
+// Coder then LZMA, freeing the coder output before the next stage runs
+static std::vector<uint8_t> DecodeLZMAChain(unsigned threads, ChainCoder coder,
+                                            const uint8_t *p, size_t n, const StageHints &z) {
+  auto lzma_data = DecodeChain(threads, coder, p, n, {}, z.At(0));
+  return LZMADecompress(lzma_data, z.At(1));
 }
 
-std::vector<uint8_t> DecompressHybrid(const std::vector<uint8_t> &in) {
-  if (in.empty()) return {};
-
-  uint8_t mode = in[0];
-  std::vector<uint8_t> payload(in.begin() + 1, in.end());
+// Decode the payload of a `mode` stream. Chains whose stages all stream
+// (coder -> LZ77/RLE/Delta/Word) never hold more than the final output plus
+// a few chunks; the others free each intermediate as soon as the next stage
+// has consumed it. Every buffer is allocated at the size `z` records.
+static std::vector<uint8_t> DecodeMode(uint8_t mode, const uint8_t *p, size_t n,
+                                       unsigned threads, const StageHints &z) {
+  ChainCoder ppm3 = DecompressPPM3;
+  ChainCoder ppm5 = DecompressPPM5;
+  ChainCoder ppm6 = DecompressPPM6;
+  using S = StreamStage;
+  size_t out = z.Final();
 
   switch (mode) {
     case 0: // PPM5
-      return DecompressPPM5(payload);
-    case 1: { // LZ77+PPM3
-      auto lz77_data = DecompressPPM3(payload);
-      return LZ77Decompress(lz77_data);
-    }
-    case 2: { // LZ77+PPM5
-      auto lz77_data = DecompressPPM5(payload);
-      return LZ77Decompress(lz77_data);
-    }
+      return DecodeChain(threads, ppm5, p, n, {}, out);
+    case 1: // LZ77+PPM3
+      return DecodeChain(threads, ppm3, p, n, {S::LZ77}, out);
+    case 2: // LZ77+PPM5
+      return DecodeChain(threads, ppm5, p, n, {S::LZ77}, out);
     case 3: // PPM6
-      return DecompressPPM6(payload);
-    case 4: { // LZ77+PPM6
-      auto lz77_data = DecompressPPM6(payload);
-      return LZ77Decompress(lz77_data);
-    }
+      return DecodeChain(threads, ppm6, p, n, {}, out);
+    case 4: // LZ77+PPM6
+      return DecodeChain(threads, ppm6, p, n, {S::LZ77}, out);
     case 5: { // LZOpt+PPM3
-      auto lzopt_data = DecompressPPM3(payload);
-      return LZOptDecompress(lzopt_data);
+      auto lzopt_data = DecodeChain(threads, ppm3, p, n, {}, z.At(0));
+      return LZOptDecompress(lzopt_data, out);
     }
     case 6: { // LZOpt+PPM5
-      auto lzopt_data = DecompressPPM5(payload);
-      return LZOptDecompress(lzopt_data);
+      auto lzopt_data = DecodeChain(threads, ppm5, p, n, {}, z.At(0));
+      return LZOptDecompress(lzopt_data, out);
     }
     case 7: { // LZOpt+PPM6
-      auto lzopt_data = DecompressPPM6(payload);
-      return LZOptDecompress(lzopt_data);
-    }
-    case 8: { // BWT+MTF+PPM3
-      if (payload.size() < 4) return {};
-      uint32_t bwt_idx = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) |
-                         ((uint32_t)payload[2] << 8) | payload[3];
-      std::vector<uint8_t> ppm_payload(payload.begin() + 4, payload.end());
-      auto mtf_data = DecompressPPM3(ppm_payload);
-      auto bwt_data = MTFDecode(mtf_data);
-      return BWTDecode(bwt_data, bwt_idx);
-    }
-    case 9: { // BWT+MTF+PPM5
-      if (payload.size() < 4) return {};
-      uint32_t bwt_idx = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) |
-                         ((uint32_t)payload[2] << 8) | payload[3];
-      std::vector<uint8_t> ppm_payload(payload.begin() + 4, payload.end());
-      auto mtf_data = DecompressPPM5(ppm_payload);
-      auto bwt_data = MTFDecode(mtf_data);
-      return BWTDecode(bwt_data, bwt_idx);
-    }
+      auto lzopt_data = DecodeChain(threads, ppm6, p, n, {}, z.At(0));
+      return LZOptDecompress(lzopt_data, out);
+    }
+    case 8: // BWT+MTF+PPM3
+      if (n < 4) return {};
+      return DecodeBWTChain(threads, ppm3, p, n, out);
+    case 9: // BWT+MTF+PPM5
+      if (n < 4) return {};
+      return DecodeBWTChain(threads, ppm5, p, n, out);
     case 10: { // LZX+PPM5
-      auto lzx_data = DecompressPPM5(payload);
-      return LZXDecompress(lzx_data);
+      auto lzx_data = DecodeChain(threads, ppm5, p, n, {}, z.At(0));
+      return LZXDecompress(lzx_data, out);
     }
     case 11: { // LZX+PPM6
-      auto lzx_data = DecompressPPM6(payload);
-      return LZXDecompress(lzx_data);
+      auto lzx_data = DecodeChain(threads, ppm6, p, n, {}, z.At(0));
+      return LZXDecompress(lzx_data, out);
     }
     case 12: // CM (Context Mixing)
-      return DecompressCM(payload);
-    case 13: { // BWT+MTF+PPM6
-      if (payload.size() < 4) return {};
-      uint32_t bwt_idx = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) |
-                         ((uint32_t)payload[2] << 8) | payload[3];
-      std::vector<uint8_t> ppm_payload(payload.begin() + 4, payload.end());
-      auto mtf_data = DecompressPPM6(ppm_payload);
-      auto bwt_data = MTFDecode(mtf_data);
-      return BWTDecode(bwt_data, bwt_idx);
-    }
-    case 14: { // RLE+PPM5
-      auto rle_data = DecompressPPM5(payload);
-      return RLEDecompress(rle_data);
-    }
-    case 15: { // RLE+PPM6
-      auto rle_data = DecompressPPM6(payload);
-      return RLEDecompress(rle_data);
-    }
+      return DecompressCM(p, n, out);
+    case 13: // BWT+MTF+PPM6
+      if (n < 4) return {};
+      return DecodeBWTChain(threads, ppm6, p, n, out);
+    case 14: // RLE+PPM5
+      return DecodeChain(threads, ppm5, p, n, {S::RLE}, out);
+    case 15: // RLE+PPM6
+      return DecodeChain(threads, ppm6, p, n, {S::RLE}, out);
     case 16: { // LZ77+BWT+MTF+PPM5
-      if (payload.size() < 4) return {};
-      uint32_t bwt_idx = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) |
-                         ((uint32_t)payload[2] << 8) | payload[3];
-      std::vector<uint8_t> ppm_payload(payload.begin() + 4, payload.end());
-      auto mtf_data = DecompressPPM5(ppm_payload);
-      auto bwt_data = MTFDecode(mtf_data);
-      auto lz_data = BWTDecode(bwt_data, bwt_idx);
-      return LZ77Decompress(lz_data);
-    }
-    case 17: { // Delta+PPM5
-      auto delta_data = DecompressPPM5(payload);
-      return DeltaDecode(delta_data);
-    }
-    case 18: { // Delta+RLE+PPM5
-      auto rle_data = DecompressPPM5(payload);
-      auto delta_data = RLEDecompress(rle_data);
-      return DeltaDecode(delta_data);
-    }
+      if (n < 4) return {};
+      auto lz_data = DecodeBWTChain(threads, ppm5, p, n, z.At(1));
+      return LZ77Decompress(lz_data, out);
+    }
+    case 17: // Delta+PPM5
+      return DecodeChain(threads, ppm5, p, n, {S::Delta}, out);
+    case 18: // Delta+RLE+PPM5
+      return DecodeChain(threads, ppm5, p, n, {S::RLE, S::Delta}, out);
     case 19: // Pattern repeat
-      return PatternDecode(payload);
-    case 20: { // Word+PPM5
-      auto word_data = DecompressPPM5(payload);
-      return WordDecode(word_data);
-    }
-    case 21: { // Word+PPM6
-      auto word_data = DecompressPPM6(payload);
-      return WordDecode(word_data);
-    }
+      return PatternDecode(p, n);
+    case 20: // Word+PPM5
+      return DecodeChain(threads, ppm5, p, n, {S::Word}, out);
+    case 21: // Word+PPM6
+      return DecodeChain(threads, ppm6, p, n, {S::Word}, out);
     case 22: { // Delta+BWT+MTF+PPM5
-      if (payload.size() < 4) return {};
-      uint32_t bwt_idx = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) |
-                         ((uint32_t)payload[2] << 8) | payload[3];
-      std::vector<uint8_t> ppm_payload(payload.begin() + 4, payload.end());
-      auto mtf_data = DecompressPPM5(ppm_payload);
-      auto bwt_data = MTFDecode(mtf_data);
-      auto delta_data = BWTDecode(bwt_data, bwt_idx);
+      if (n < 4) return {};
+      auto delta_data = DecodeBWTChain(threads, ppm5, p, n, z.At(1));
       return DeltaDecode(delta_data);
     }
-    case 23: { // RLE+LZ77+PPM5
-      auto lz_data = DecompressPPM5(payload);
-      auto rle_data = LZ77Decompress(lz_data);
-      return RLEDecompress(rle_data);
-    }
-    case 24: { // LZ77+RLE+PPM5
-      auto rle_data = DecompressPPM5(payload);
-      auto lz_data = RLEDecompress(rle_data);
-      return LZ77Decompress(lz_data);
-    }
+    case 23: // RLE+LZ77+PPM5
+      return DecodeChain(threads, ppm5, p, n, {S::LZ77, S::RLE}, out);
+    case 24: // LZ77+RLE+PPM5
+      return DecodeChain(threads, ppm5, p, n, {S::RLE, S::LZ77}, out);
     case 25: { // RLE+BWT+MTF+PPM5
-      if (payload.size() < 4) return {};
-      uint32_t bwt_idx = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) |
-                         ((uint32_t)payload[2] << 8) | payload[3];
-      std::vector<uint8_t> ppm_payload(payload.begin() + 4, payload.end());
-      auto mtf_data = DecompressPPM5(ppm_payload);
-      auto bwt_data = MTFDecode(mtf_data);
-      auto rle_data = BWTDecode(bwt_data, bwt_idx);
-      return RLEDecompress(rle_data);
+      if (n < 4) return {};
+      auto rle_data = DecodeBWTChain(threads, ppm5, p, n, z.At(1));
+      return RLEDecompress(rle_data, out);
     }
     case 26: { // LZOpt+RLE+PPM5
-      auto rle_data = DecompressPPM5(payload);
-      auto lzopt_data = RLEDecompress(rle_data);
-      return LZOptDecompress(lzopt_data);
+      auto lzopt_data = DecodeChain(threads, ppm5, p, n, {S::RLE}, z.At(1));
+      return LZOptDecompress(lzopt_data, out);
     }
     case 27: { // RLE+LZOpt+PPM5
-      auto lzopt_data = DecompressPPM5(payload);
-      auto rle_data = LZOptDecompress(lzopt_data);
-      return RLEDecompress(rle_data);
+      std::vector<uint8_t> rle_data;
+      {
+        auto lzopt_data = DecodeChain(threads, ppm5, p, n, {}, z.At(0));
+        rle_data = LZOptDecompress(lzopt_data, z.At(1));
+      }
+      return RLEDecompress(rle_data, out);
     }
     case 28: { // RecordInterleave(512)+PPM5
-      auto rec_data = DecompressPPM5(payload);
+      auto rec_data = DecodeChain(threads, ppm5, p, n, {}, z.At(0));
       return RecordDeinterleave(rec_data);
     }
     case 29: { // RecordInterleave(512)+RLE+PPM5
-      auto rle_data = DecompressPPM5(payload);
-      auto rec_data = RLEDecompress(rle_data);
+      auto rec_data = DecodeChain(threads, ppm5, p, n, {S::RLE}, z.At(1));
       return RecordDeinterleave(rec_data);
     }
-    case 30: { // Word+RLE+PPM5
-      auto rle_data = DecompressPPM5(payload);
-      auto word_data = RLEDecompress(rle_data);
-      return WordDecode(word_data);
-    }
-    case 31: { // Word+RLE+PPM6
-      auto rle_data = DecompressPPM6(payload);
-      auto word_data = RLEDecompress(rle_data);
-      return WordDecode(word_data);
-    }
+    case 30: // Word+RLE+PPM5
+      return DecodeChain(threads, ppm5, p, n, {S::RLE, S::Word}, out);
+    case 31: // Word+RLE+PPM6
+      return DecodeChain(threads, ppm6, p, n, {S::RLE, S::Word}, out);
     case 32: { // Dict+PPM5
-      auto dict_data = DecompressPPM5(payload);
-      return DictDecode(dict_data);
+      auto dict_data = DecodeChain(threads, ppm5, p, n, {}, z.At(0));
+      return DictDecode(dict_data, out);
     }
     case 33: { // Dict+PPM6
-      auto dict_data = DecompressPPM6(payload);
-      return DictDecode(dict_data);
+      auto dict_data = DecodeChain(threads, ppm6, p, n, {}, z.At(0));
+      return DictDecode(dict_data, out);
     }
     case 34: { // Word+Dict+PPM6
-      auto dict_data = DecompressPPM6(payload);
-      auto word_data = DictDecode(dict_data);
-      return WordDecode(word_data);
-    }
-    case 35: { // Word+LZ77+PPM5
-      auto word_lz = DecompressPPM5(payload);
-      auto word_data = LZ77Decompress(word_lz);
-      return WordDecode(word_data);
-    }
-    case 36: { // Word+LZ77+PPM6
-      auto word_lz = DecompressPPM6(payload);
-      auto word_data = LZ77Decompress(word_lz);
-      return WordDecode(word_data);
-    }
-    case 37: { // LZ77+Word+PPM5
-      auto lz_word = DecompressPPM5(payload);
-      auto lz_data = WordDecode(lz_word);
-      return LZ77Decompress(lz_data);
-    }
-    case 38: { // LZ77+Word+PPM6
-      auto lz_word = DecompressPPM6(payload);
-      auto lz_data = WordDecode(lz_word);
-      return LZ77Decompress(lz_data);
-    }
+      std::vector<uint8_t> word_data;
+      {
+        auto dict_data = DecodeChain(threads, ppm6, p, n, {}, z.At(0));
+        word_data = DictDecode(dict_data, z.At(1));
+      }
+      return WordDecode(word_data, out);
+    }
+    case 35: // Word+LZ77+PPM5
+      return DecodeChain(threads, ppm5, p, n, {S::LZ77, S::Word}, out);
+    case 36: // Word+LZ77+PPM6
+      return DecodeChain(threads, ppm6, p, n, {S::LZ77, S::Word}, out);
+    case 37: // LZ77+Word+PPM5
+      return DecodeChain(threads, ppm5, p, n, {S::Word, S::LZ77}, out);
+    case 38: // LZ77+Word+PPM6
+      return DecodeChain(threads, ppm6, p, n, {S::Word, S::LZ77}, out);
     case 39: { // Sparse+PPM5
-      auto sparse_data = DecompressPPM5(payload);
-      return SparseDecode(sparse_data);
+      auto sparse_data = DecodeChain(threads, ppm5, p, n, {}, z.At(0));
+      return SparseDecode(sparse_data, out);
     }
     case 40: { // Sparse+PPM6
-      auto sparse_data = DecompressPPM6(payload);
-      return SparseDecode(sparse_data);
+      auto sparse_data = DecodeChain(threads, ppm6, p, n, {}, z.At(0));
+      return SparseDecode(sparse_data, out);
     }
     case 41: { // Sparse+Word+PPM6
-      auto sparse_word = DecompressPPM6(payload);
-      auto sparse_data = WordDecode(sparse_word);
-      return SparseDecode(sparse_data);
+      auto sparse_data = DecodeChain(threads, ppm6, p, n, {S::Word}, z.At(1));
+      return SparseDecode(sparse_data, out);
     }
     case 42: { // LZMA+PPM5
-      auto lzma_data = DecompressPPM5(payload);
-      return LZMADecompress(lzma_data);
+      auto lzma_data = DecodeChain(threads, ppm5, p, n, {}, z.At(0));
+      return LZMADecompress(lzma_data, out);
     }
     case 43: { // LZMA+PPM6
-      auto lzma_data = DecompressPPM6(payload);
-      return LZMADecompress(lzma_data);
+      auto lzma_data = DecodeChain(threads, ppm6, p, n, {}, z.At(0));
+      return LZMADecompress(lzma_data, out);
     }
     case 44: { // LZMA+BWT+MTF+PPM5
-      if (payload.size() < 4) return {};
-      uint32_t bwt_idx = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) |
-                         ((uint32_t)payload[2] << 8) | payload[3];
-      std::vector<uint8_t> ppm_payload(payload.begin() + 4, payload.end());
-      auto mtf_data = DecompressPPM5(ppm_payload);
-      auto bwt_data = MTFDecode(mtf_data);
-      auto lzma_data = BWTDecode(bwt_data, bwt_idx);
-      return LZMADecompress(lzma_data);
+      if (n < 4) return {};
+      auto lzma_data = DecodeBWTChain(threads, ppm5, p, n, z.At(1));
+      return LZMADecompress(lzma_data, out);
     }
     case 45: { // Word+LZMA+PPM5
-      auto lzma_data = DecompressPPM5(payload);
-      auto word_data = LZMADecompress(lzma_data);
-      return WordDecode(word_data);
+      auto word_data = DecodeLZMAChain(threads, ppm5, p, n, z);
+      return WordDecode(word_data, out);
     }
     case 46: { // Word+LZMA+PPM6
-      auto lzma_data = DecompressPPM6(payload);
-      auto word_data = LZMADecompress(lzma_data);
-      return WordDecode(word_data);
+      auto word_data = DecodeLZMAChain(threads, ppm6, p, n, z);
+      return WordDecode(word_data, out);
     }
     case 47: { // Dict+LZMA+PPM5
-      auto lzma_data = DecompressPPM5(payload);
-      auto dict_data = LZMADecompress(lzma_data);
-      return DictDecode(dict_data);
+      auto dict_data = DecodeLZMAChain(threads, ppm5, p, n, z);
+      return DictDecode(dict_data, out);
     }
     case 48: { // Dict+LZMA+PPM6
-      auto lzma_data = DecompressPPM6(payload);
-      auto dict_data = LZMADecompress(lzma_data);
-      return DictDecode(dict_data);
+      auto dict_data = DecodeLZMAChain(threads, ppm6, p, n, z);
+      return DictDecode(dict_data, out);
     }
     case 49: { // RLE+LZMA+PPM5
-      auto lzma_data = DecompressPPM5(payload);
-      auto rle_data = LZMADecompress(lzma_data);
-      return RLEDecompress(rle_data);
+      auto rle_data = DecodeLZMAChain(threads, ppm5, p, n, z);
+      return RLEDecompress(rle_data, out);
     }
     case 50: { // RLE+LZMA+PPM6
-      auto lzma_data = DecompressPPM6(payload);
-      auto rle_data = LZMADecompress(lzma_data);
-      return RLEDecompress(rle_data);
+      auto rle_data = DecodeLZMAChain(threads, ppm6, p, n, z);
+      return RLEDecompress(rle_data, out);
     }
+    case BLOCK_MODE: // Block container
+      return DecompressBlocks(p, n, threads, out);
     case 255: // Store raw (incompressible data)
-      return payload;
+      return std::vector<uint8_t>(p, p + n);
     default:
-      return DecompressPPM5(payload);
+      return DecodeChain(threads, ppm5, p, n, {}, out);
   }
 }
+
+std::vector<uint8_t> DecompressHybrid(const std::vector<uint8_t> &in, unsigned threads) {
+  return DecompressHybrid(in.data(), in.size(), threads);
+}
+
+// Largest unconfirmed decoded size trusted as a reservation, as in CM
+constexpr size_t SIZED_RESERVE_LIMIT = 64 << 20;
+
+std::vector<uint8_t> DecompressHybrid(const uint8_t *in, size_t size, unsigned threads,
+                                      size_t out_size) {
+  if (size == 0) return {};
+  if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+  const uint8_t *p = in + 1;
+  size_t n = size - 1;
+  if (in[0] == BLOCK_MODE) return DecompressBlocks(p, n, threads, out_size);
+  if (in[0] != SIZED_MODE) return DecodeMode(in[0], p, n, threads, StageHints());
+
+  size_t count = n > 0 ? p[0] : 0;
+  if (count == 0 || count > MAX_STAGE_SIZES || n < 2 + 4 * count ||
+      p[1 + 4 * count] == SIZED_MODE) {
+    throw std::runtime_error("corrupt sized stream");
+  }
+  std::vector<size_t> sizes;
+  for (size_t i = 0; i < count; i++) {
+    const uint8_t *q = p + 1 + 4 * i;
+    sizes.push_back((size_t)q[0] | ((size_t)q[1] << 8) | ((size_t)q[2] << 16) |
+                    ((size_t)q[3] << 24));
+  }
+
+  // The sizes become allocations, so they are checked first: against the
+  // caller's size when there is one, and every stage against the result
+  if (out_size && sizes.back() != out_size) throw std::runtime_error("corrupt sized stream");
+  for (size_t v : sizes) {
+    if (v > MaxStageSize(sizes.back())) throw std::runtime_error("corrupt sized stream");
+  }
+  // Without a size to confirm them, large ones are only hints: the decoders
+  // grow to what the data really holds instead of reserving it up front
+  StageHints hints(sizes);
+  if (!out_size && sizes.back() > SIZED_RESERVE_LIMIT) hints = StageHints();
+
+  size_t skip = 1 + 4 * count;
+  auto out = DecodeMode(p[skip], p + skip + 1, n - skip - 1, threads, hints);
+  if (out.size() != sizes.back()) {
+    throw std::runtime_error("sized stream decodes to the wrong size");
+  }
+  return out;
+}
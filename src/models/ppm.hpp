@@ -1,21 +1,124 @@
 #pragma once
 
+#include "../io/byte_sink.hpp"
+#include "decode_cost.hpp"
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
+// Decoders allocate `out_size` bytes up front when the caller knows the
+// decoded size (0 = unknown: guess from the input size and grow). The
+// hybrid coders (PPM3/5/6) leave `front` zero bytes ahead of their stream
+// for a header the caller fills in afterwards.
 std::vector<uint8_t> CompressPPM1(const std::vector<uint8_t> &in);
-std::vector<uint8_t> DecompressPPM1(const std::vector<uint8_t> &in);
+std::vector<uint8_t> DecompressPPM1(const std::vector<uint8_t> &in, size_t out_size = 0);
 std::vector<uint8_t> CompressPPM2(const std::vector<uint8_t> &in);
-std::vector<uint8_t> DecompressPPM2(const std::vector<uint8_t> &in);
-std::vector<uint8_t> CompressPPM3(const std::vector<uint8_t> &in);
-std::vector<uint8_t> DecompressPPM3(const std::vector<uint8_t> &in);
+std::vector<uint8_t> DecompressPPM2(const std::vector<uint8_t> &in, size_t out_size = 0);
+std::vector<uint8_t> CompressPPM3(const std::vector<uint8_t> &in, size_t front = 0);
+std::vector<uint8_t> DecompressPPM3(const std::vector<uint8_t> &in, size_t out_size = 0);
 std::vector<uint8_t> CompressPPM4(const std::vector<uint8_t> &in);
-std::vector<uint8_t> DecompressPPM4(const std::vector<uint8_t> &in);
-std::vector<uint8_t> CompressPPM5(const std::vector<uint8_t> &in);
-std::vector<uint8_t> DecompressPPM5(const std::vector<uint8_t> &in);
-std::vector<uint8_t> CompressPPM6(const std::vector<uint8_t> &in);
-std::vector<uint8_t> DecompressPPM6(const std::vector<uint8_t> &in);
+std::vector<uint8_t> DecompressPPM4(const std::vector<uint8_t> &in, size_t out_size = 0);
+std::vector<uint8_t> CompressPPM5(const std::vector<uint8_t> &in, size_t front = 0);
+std::vector<uint8_t> DecompressPPM5(const std::vector<uint8_t> &in, size_t out_size = 0);
+std::vector<uint8_t> CompressPPM6(const std::vector<uint8_t> &in, size_t front = 0);
+std::vector<uint8_t> DecompressPPM6(const std::vector<uint8_t> &in, size_t out_size = 0);
+
+// Streaming decoders: write the output to `out` in chunks as it is decoded
+// (the caller closes `out`)
+void DecompressPPM3(const uint8_t *in, size_t n, ByteSink &out);
+void DecompressPPM5(const uint8_t *in, size_t n, ByteSink &out);
+void DecompressPPM6(const uint8_t *in, size_t n, ByteSink &out);
+
+// Compression levels accepted by HybridOptions::level
+constexpr int MIN_LEVEL = 1;
+constexpr int MAX_LEVEL = 9;
+
+// Tuning knobs for the hybrid compressor
+struct HybridOptions {
+  unsigned threads = 0;  // Worker threads for candidate evaluation (0 = auto)
+
+  // 1 (fastest, one or two cheap pipelines) to 9 (every mode); see the
+  // level table next to CompressHybrid
+  int level = MAX_LEVEL;
+
+  // Wall-clock budget in seconds (0 = unlimited). Candidates start cheapest
+  // and most promising first; once the budget has run out and at least one
+  // candidate has finished, the rest are skipped or aborted and the best
+  // result so far is returned.
+  double time_budget = 0;
+
+  // End of the time budget. Unset, a call starts its own time_budget; code
+  // that splits the input into blocks or frames sets it once (StartBudget)
+  // so they all share one budget instead of each getting a fresh one.
+  std::chrono::steady_clock::time_point deadline{};
+
+  // Memory cap in bytes for the whole search (0 = unlimited). Limits how
+  // many candidates run at once and skips those whose estimated peak alone
+  // does not fit. If none fits, the one estimated to need least runs alone.
+  size_t max_memory = 0;
+
+  // Decode-speed-aware selection. Each candidate scores its size plus
+  // `decode_weight` bytes per millisecond of estimated decode time (0 =
+  // smallest wins), and modes estimated slower than `min_decode_speed` MB/s
+  // are not tried. Estimates come from `decode_profile` if set, otherwise
+  // from the built-in table.
+  double decode_weight = 0;
+  double min_decode_speed = 0;
+  std::shared_ptr<const DecodeProfile> decode_profile;
+
+  // Skip candidates that the input statistics rule out, and store data that
+  // looks incompressible without trying any candidate
+  bool prefilter = true;
+
+  // Sample-then-confirm selection: score every mode on head/middle/tail
+  // slices, then run only the `top_k` best on the full input. Inputs no
+  // larger than the slices themselves are always searched exhaustively.
+  bool sample = false;
+  unsigned top_k = 3;
+  size_t slice_size = 64 * 1024;
+
+  // Per-block selection (see blocks.hpp): cut the input into blocks of
+  // `block_size` bytes, or where its content changes if `adaptive_blocks`
+  // (then `block_size` caps the block length), and pick a mode per block.
+  // 0 / false = one mode for the whole input.
+  size_t block_size = 0;
+  bool adaptive_blocks = false;
+
+  // Prefix the stream with the size of every stage output (SIZED_MODE), so
+  // the decoder allocates each stage exactly once instead of guessing and
+  // growing. The .kc container always sets this.
+  bool record_sizes = false;
+
+  // Zero bytes to leave in front of the stream for a header the caller
+  // writes in place (counted in the returned size)
+  size_t front = 0;
+};
+
+// `opts` with its deadline set to now + time_budget, if it has a budget and
+// no deadline yet
+HybridOptions StartBudget(const HybridOptions &opts);
+
+// Sized stream, little-endian: SIZED_MODE, u8 count, count u32 stage
+// output sizes in decode order (coder output first, decoded size last),
+// then the mode byte and payload of the stream they describe
+constexpr uint8_t SIZED_MODE = 253;
+
+// Largest stage output a sized stream may record for `raw_size` decoded
+// bytes. Transforms rarely outgrow twice their input (escaped literals);
+// a candidate whose stages do is written without sizes, so decoders can
+// reject anything larger before allocating it.
+constexpr size_t MaxStageSize(size_t raw_size) { return 2 * raw_size + 4096; }
 
 // Hybrid: Auto-selects best algorithm
 std::vector<uint8_t> CompressHybrid(const std::vector<uint8_t> &in);
-std::vector<uint8_t> DecompressHybrid(const std::vector<uint8_t> &in);
+std::vector<uint8_t> CompressHybrid(const std::vector<uint8_t> &in,
+                                    const HybridOptions &opts);
+// Multi-stage chains decode as a pipeline; with `threads` > 1 the entropy
+// decoder overlaps with the inverse transforms (0 = one per CPU core).
+// `out_size`, if known, is the decoded size; block containers and recorded
+// stage sizes are checked against it before they allocate.
+std::vector<uint8_t> DecompressHybrid(const std::vector<uint8_t> &in, unsigned threads = 0);
+std::vector<uint8_t> DecompressHybrid(const uint8_t *in, size_t n, unsigned threads = 0,
+                                      size_t out_size = 0);
@@ -21,24 +21,24 @@ run_test() {
 
   if ! "$bin" c "$input_file" "$test_dir/output.kcomp" >/dev/null 2>&1; then
     echo "${red}FAIL${reset} (compression)"
-    ((failed++))
+    failed=$((failed + 1))
     return
   fi
 
   if ! "$bin" d "$test_dir/output.kcomp" "$test_dir/restored.txt" >/dev/null 2>&1; then
     echo "${red}FAIL${reset} (decompression)"
-    ((failed++))
+    failed=$((failed + 1))
     return
   fi
 
   if ! cmp -s "$input_file" "$test_dir/restored.txt"; then
     echo "${red}FAIL${reset} (mismatch)"
-    ((failed++))
+    failed=$((failed + 1))
     return
   fi
 
   echo "${green}PASS${reset}"
-  ((passed++))
+  passed=$((passed + 1))
   rm -f "$test_dir/output.kcomp" "$test_dir/restored.txt"
 }
 
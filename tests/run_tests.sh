@@ -5,17 +5,19 @@ set -e
 
 cd "$(dirname "$0")/.."
 
-SRCS="src/models/ppm.cpp src/models/bwt.cpp src/models/lz77.cpp src/models/lzopt.cpp \
+SRCS="src/models/ppm.cpp src/models/pipeline.cpp src/models/blocks.cpp src/models/bwt.cpp src/models/lz77.cpp src/models/lzopt.cpp \
       src/models/lzx.cpp src/models/cm.cpp src/models/dict.cpp src/models/lzma.cpp \
       src/models/mixer.cpp src/models/model257.cpp src/models/rle.cpp \
-      src/core/range_coder.cpp src/io/file_io.cpp"
+      src/core/range_coder.cpp src/core/data_stats.cpp src/core/container.cpp src/core/checksum.cpp src/core/dedup.cpp \
+      src/core/archive.cpp \
+      src/io/file_io.cpp"
 
 build_test() {
     local name=$1
     local src=$2
     if [ ! -f "build/$name" ] || [ "$src" -nt "build/$name" ]; then
         echo "Building $name..."
-        g++ -std=c++17 -O2 -I. "$src" $SRCS -o "build/$name"
+        g++ -std=c++17 -O2 -pthread -I. "$src" $SRCS -o "build/$name"
     fi
 }
 
@@ -69,6 +71,12 @@ echo "Running corruption detection tests..."
 build_test test_corruption tests/test_corruption.cpp
 ./build/test_corruption
 
+echo ""
+echo "Running container format tests..."
+# KCOMP_LARGE_TESTS=1 adds a 4.5 GB streamed roundtrip (takes minutes)
+build_test test_container tests/test_container.cpp
+./build/test_container
+
 echo ""
 echo "Running performance tests..."
 build_test test_performance tests/test_performance.cpp
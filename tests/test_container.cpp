@@ -0,0 +1,1283 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <string>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <thread>
+#include <unistd.h>
+#include "../src/core/archive.hpp"
+#include "../src/core/checksum.hpp"
+#include "../src/core/container.hpp"
+#include "../src/io/file_io.hpp"
+#include "../src/models/ppm.hpp"
+
+int passed = 0, failed = 0;
+
+void test(const std::string& name, bool condition) {
+    if (condition) {
+        std::cout << "  [PASS] " << name << "\n";
+        passed++;
+    } else {
+        std::cout << "  [FAIL] " << name << "\n";
+        failed++;
+    }
+}
+
+std::vector<uint8_t> make_test_data(size_t size) {
+    std::vector<uint8_t> data;
+    data.reserve(size);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        data.push_back(i % 3000 < 2000 ? "The quick brown fox jumps over the lazy dog. "[i % 46]
+                                       : (uint8_t)(seed >> 16));
+    }
+    return data;
+}
+
+HybridOptions fast_options(unsigned threads) {
+    HybridOptions opts;
+    opts.level = 1;
+    opts.threads = threads;
+    return opts;
+}
+
+ContainerOptions frames_of(size_t frame_size, bool index = false, bool hash = false) {
+    ContainerOptions copts;
+    copts.frame_size = frame_size;
+    copts.index = index;
+    copts.hash = hash;
+    return copts;
+}
+
+bool throws(const std::vector<uint8_t>& file) {
+    std::string name;
+    try {
+        ReadContainer(file, name, 1);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+void test_v3_roundtrip() {
+    std::cout << "\n=== v3 Container Tests ===\n";
+
+    for (size_t size : {0, 1, 1000, 60000}) {
+        auto data = make_test_data(size);
+        auto file = WriteContainer(data, "dir/sample.txt", fast_options(1), frames_of(16 * 1024));
+        std::string name;
+        auto back = ReadContainer(file, name, 1);
+        test("v3 roundtrip size=" + std::to_string(size), back == data);
+        test("v3 stores base name size=" + std::to_string(size), name == "sample.txt");
+        test("v3 version byte size=" + std::to_string(size), file.size() > 2 && file[2] == 3);
+    }
+
+    // Frame count follows the frame size: 60000 bytes = 4 frames of 16 KB
+    auto data = make_test_data(60000);
+    auto file = WriteContainer(data, "a", fast_options(1), frames_of(16 * 1024));
+    size_t header = (file[6] & KC_FLAG_CRC) ? 16 : 8;
+    size_t pos = 5 + 1 + 1, frames = 0, sized = 0;
+    while (pos + 4 <= file.size()) {
+        uint32_t raw = file[pos] | (file[pos + 1] << 8) | (file[pos + 2] << 16) | ((uint32_t)file[pos + 3] << 24);
+        if (raw == 0) break;
+        uint32_t size = file[pos + 4] | (file[pos + 5] << 8) | (file[pos + 6] << 16) | ((uint32_t)file[pos + 7] << 24);
+        if (file[pos + header] == SIZED_MODE) sized++;
+        pos += header + size;
+        frames++;
+    }
+    test("v3 frame count", frames == 4);
+    test("v3 frames record stage sizes", sized == frames);
+}
+
+void test_thread_independence() {
+    std::cout << "\n=== Thread Count Tests ===\n";
+
+    auto data = make_test_data(100000);
+    auto serial = WriteContainer(data, "x", fast_options(1), frames_of(16 * 1024));
+    auto parallel = WriteContainer(data, "x", fast_options(4), frames_of(16 * 1024));
+    test("Output identical for 1 and 4 threads", serial == parallel);
+
+    std::string name;
+    test("Parallel decode", ReadContainer(serial, name, 4) == data);
+}
+
+void test_older_formats() {
+    std::cout << "\n=== Older Format Tests ===\n";
+
+    auto data = make_test_data(5000);
+    auto stream = CompressHybrid(data, fast_options(1));
+
+    // v2: magic, version 2, name, one hybrid stream
+    std::vector<uint8_t> v2 = {'K', 'C', 2, 4, 0, 'o', 'l', 'd', '1'};
+    v2.insert(v2.end(), stream.begin(), stream.end());
+    std::string name;
+    test("v2 file decodes", ReadContainer(v2, name, 1) == data);
+    test("v2 file name", name == "old1");
+
+    // No header at all
+    test("Bare stream decodes", ReadContainer(stream, name, 1) == data);
+    test("Bare stream has no name", name.empty());
+}
+
+// `file` with its first `frame_size`-byte frame claiming 2 GB instead
+std::vector<uint8_t> oversized(std::vector<uint8_t> file, uint32_t frame_size) {
+    const uint8_t first[] = {(uint8_t)frame_size, (uint8_t)(frame_size >> 8),
+                             (uint8_t)(frame_size >> 16), (uint8_t)(frame_size >> 24)};
+    auto at = std::search(file.begin(), file.end(), first, first + 4);
+    if (at != file.end()) at[3] = 0x80;
+    return file;
+}
+
+void test_corrupt_v3() {
+    std::cout << "\n=== Corrupt v3 Tests ===\n";
+
+    auto data = make_test_data(40000);
+    auto file = WriteContainer(data, "c", fast_options(1), frames_of(16 * 1024));
+
+    test("Truncated file rejected", throws(std::vector<uint8_t>(file.begin(), file.end() - 10)));
+    test("Missing end marker rejected", throws(std::vector<uint8_t>(file.begin(), file.end() - 4)));
+
+    auto flagged = file;
+    flagged[6] = 0x80;
+    test("Unknown flags rejected", throws(flagged));
+
+    auto trailing = file;
+    trailing.push_back(0);
+    test("Trailing bytes rejected", throws(trailing));
+
+    test("Oversized frame rejected", throws(oversized(file, 16 * 1024)));
+}
+
+// Range read of `file` written to disk, compared against the same slice of `data`
+bool range_matches(const std::vector<uint8_t>& file, const std::vector<uint8_t>& data,
+                   uint64_t offset, uint64_t length) {
+    const char* path = "build/test_range.kc";
+    WriteAll(path, file);
+    std::string name;
+    auto got = ReadContainerRange(path, offset, length, name, 1);
+    std::remove(path);
+    size_t begin = std::min<uint64_t>(offset, data.size());
+    size_t end = std::min<uint64_t>(data.size(), begin + std::min<uint64_t>(length, data.size()));
+    return got == std::vector<uint8_t>(data.begin() + begin, data.begin() + end);
+}
+
+void test_range() {
+    std::cout << "\n=== Range Read Tests ===\n";
+
+    auto data = make_test_data(60000);
+    auto indexed = WriteContainer(data, "r", fast_options(1), frames_of(16 * 1024, true));
+    auto plain = WriteContainer(data, "r", fast_options(1), frames_of(16 * 1024));
+    test("Index flag set", (indexed[6] & KC_FLAG_INDEX) && !(plain[6] & KC_FLAG_INDEX));
+    test("Footer magic", std::string(indexed.end() - 4, indexed.end()) == "KCIX");
+
+    std::string name;
+    test("Indexed file decodes in full", ReadContainer(indexed, name, 1) == data);
+
+    struct { uint64_t offset, length; const char* what; } cases[] = {
+        {0, 10, "start"},
+        {16384 - 5, 10, "across a frame boundary"},
+        {20000, 30000, "several frames"},
+        {59990, 100, "clamped at end"},
+        {60000, 10, "at end"},
+        {1ull << 40, 10, "far past end"},
+        {0, 60000, "everything"},
+    };
+    for (const auto& c : cases) {
+        test(std::string("Indexed range ") + c.what, range_matches(indexed, data, c.offset, c.length));
+        test(std::string("Unindexed range ") + c.what, range_matches(plain, data, c.offset, c.length));
+    }
+
+    // Older files are decoded in full, then sliced
+    auto stream = CompressHybrid(data, fast_options(1));
+    std::vector<uint8_t> v2 = {'K', 'C', 2, 1, 0, 'r'};
+    v2.insert(v2.end(), stream.begin(), stream.end());
+    test("v2 range", range_matches(v2, data, 30000, 50));
+    test("Bare stream range", range_matches(stream, data, 30000, 50));
+
+    auto empty = WriteContainer({}, "e", fast_options(1), frames_of(16 * 1024, true));
+    test("Empty indexed file", ReadContainer(empty, name, 1).empty() &&
+                               range_matches(empty, {}, 0, 10));
+
+    // The index must agree with the frames it describes
+    auto moved = indexed;
+    moved[moved.size() - 16 - 16 * 4 + 16] ^= 1;  // Second frame's file offset
+    test("Bad index entry rejected", throws(moved));
+    bool range_threw = false;
+    try {
+        range_matches(moved, data, 20000, 10);
+    } catch (const std::runtime_error&) {
+        range_threw = true;
+    }
+    test("Bad index entry rejected by range read", range_threw);
+
+    auto unmarked = indexed;
+    unmarked[unmarked.size() - 1] = 'Y';
+    test("Bad footer magic rejected", throws(unmarked));
+}
+
+// Temporary stream holding `bytes`, rewound for reading
+std::FILE* stream_of(const std::vector<uint8_t>& bytes) {
+    std::FILE* f = std::tmpfile();
+    WriteBytes(f, bytes.data(), bytes.size());
+    std::rewind(f);
+    return f;
+}
+
+std::vector<uint8_t> drain(std::FILE* f) {
+    std::rewind(f);
+    std::vector<uint8_t> out;
+    int c;
+    while ((c = std::fgetc(f)) != EOF) out.push_back((uint8_t)c);
+    std::fclose(f);
+    return out;
+}
+
+bool stream_decodes(const std::vector<uint8_t>& file, const std::vector<uint8_t>& data,
+                    const std::string& name, unsigned threads = 1) {
+    std::FILE* in = stream_of(file);
+    ContainerReader reader(in, threads);
+    bool named = reader.Name() == name;
+    std::FILE* out = std::tmpfile();
+    uint64_t n = reader.DecodeTo(out);
+    std::fclose(in);
+    return named && n == data.size() && drain(out) == data;
+}
+
+bool stream_throws(const std::vector<uint8_t>& file) {
+    std::FILE* in = stream_of(file);
+    std::FILE* out = std::tmpfile();
+    bool threw = false;
+    try {
+        ContainerReader reader(in, 1);
+        reader.DecodeTo(out);
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    std::fclose(in);
+    std::fclose(out);
+    return threw;
+}
+
+void test_streaming() {
+    std::cout << "\n=== Streaming Tests ===\n";
+
+    for (size_t size : {0, 1000, 60000}) {
+        for (bool index : {false, true}) {
+            auto data = make_test_data(size);
+            auto copts = frames_of(16 * 1024, index);
+            auto whole = WriteContainer(data, "dir/s.txt", fast_options(2), copts);
+
+            std::FILE* in = stream_of(data);
+            std::FILE* out = std::tmpfile();
+            uint64_t n = WriteContainerStream(in, out, "dir/s.txt", fast_options(2), copts);
+            std::fclose(in);
+            auto streamed = drain(out);
+
+            std::string tag = " size=" + std::to_string(size) + (index ? " indexed" : "");
+            test("Streamed file matches WriteContainer" + tag, streamed == whole && n == whole.size());
+            test("Stream decode" + tag, stream_decodes(whole, data, "s.txt", 2));
+        }
+    }
+
+    // Batches of one frame per thread; more frames than threads
+    auto data = make_test_data(100000);
+    auto file = WriteContainer(data, "m", fast_options(1), frames_of(8 * 1024));
+    test("Stream decode, 1 thread, 13 frames", stream_decodes(file, data, "m", 1));
+    test("Stream decode, 3 threads, 13 frames", stream_decodes(file, data, "m", 3));
+
+    auto stream = CompressHybrid(make_test_data(5000), fast_options(1));
+    std::vector<uint8_t> v2 = {'K', 'C', 2, 2, 0, 'o', 'k'};
+    v2.insert(v2.end(), stream.begin(), stream.end());
+    test("Stream decode v2", stream_decodes(v2, make_test_data(5000), "ok"));
+    test("Stream decode bare stream", stream_decodes(stream, make_test_data(5000), ""));
+
+    test("Stream truncated frame rejected",
+         stream_throws(std::vector<uint8_t>(file.begin(), file.end() - 10)));
+    test("Stream missing end marker rejected",
+         stream_throws(std::vector<uint8_t>(file.begin(), file.end() - 4)));
+    auto trailing = file;
+    trailing.push_back(0);
+    test("Stream trailing bytes rejected", stream_throws(trailing));
+    auto indexed = WriteContainer(data, "m", fast_options(1), frames_of(8 * 1024, true));
+    indexed[indexed.size() - 8] ^= 1;  // Frame count in the footer
+    test("Stream bad index rejected", stream_throws(indexed));
+    test("Stream oversized frame rejected", stream_throws(oversized(file, 8 * 1024)));
+}
+
+void test_checksums() {
+    std::cout << "\n=== Checksum Tests ===\n";
+
+    const uint8_t* digits = (const uint8_t*)"123456789";
+    test("CRC32C check value", Crc32c(digits, 9) == 0xE3069283);
+    test("CRC32C software check value", Crc32cSoftware(digits, 9) == 0xE3069283);
+    test("CRC32C empty", Crc32c(digits, 0) == 0);
+
+    auto data = make_test_data(100003);
+    bool same = true;
+    for (size_t n : {1, 7, 8, 15, 64, 1000, 100003}) {
+        same = same && Crc32c(data.data() + 1, n - 1) == Crc32cSoftware(data.data() + 1, n - 1);
+    }
+    test("CRC32C hardware and software agree", same);
+    test("CRC32C chains", Crc32c(data.data() + 5000, data.size() - 5000, Crc32c(data.data(), 5000)) ==
+                              Crc32c(data.data(), data.size()));
+
+    auto xxh = [](const char* s) {
+        Hash64 h;
+        h.Update((const uint8_t*)s, std::string(s).size());
+        return h.Digest();
+    };
+    test("XXH64 empty", xxh("") == 0xEF46DB3751D8E999ULL);
+    test("XXH64 abc", xxh("abc") == 0x44BC2CF5AD770999ULL);
+    Hash64 whole, pieces;
+    whole.Update(data.data(), data.size());
+    for (size_t i = 0; i < data.size(); i += 37) {
+        pieces.Update(data.data() + i, std::min<size_t>(37, data.size() - i));
+    }
+    test("XXH64 incremental", whole.Digest() == pieces.Digest());
+
+    // Every read path verifies the frame CRCs and the file hash
+    data = make_test_data(60000);
+    auto file = WriteContainer(data, "k", fast_options(1), frames_of(16 * 1024, true, true));
+    test("Checksum and hash flags set", file[6] == (KC_FLAG_INDEX | KC_FLAG_CRC | KC_FLAG_HASH));
+    std::string name;
+    test("Checksummed file decodes", ReadContainer(file, name, 1) == data);
+    test("Checksummed file streams", stream_decodes(file, data, "k"));
+    test("Checksummed range", range_matches(file, data, 20000, 30000));
+
+    size_t first_stream = 7 + 16;
+    auto damaged = file;
+    damaged[first_stream + 40] ^= 0x04;
+    test("Damaged stream rejected", throws(damaged) && stream_throws(damaged));
+    bool range_threw = false;
+    try {
+        range_matches(damaged, data, 0, 10);
+    } catch (const std::runtime_error&) {
+        range_threw = true;
+    }
+    test("Damaged stream rejected by range read", range_threw);
+
+    auto bad_raw_crc = file;
+    bad_raw_crc[7 + 12] ^= 0x01;
+    test("Wrong data CRC rejected", throws(bad_raw_crc) && stream_throws(bad_raw_crc));
+
+    auto bad_hash = file;
+    bad_hash[bad_hash.size() - 16 - 4 * 16 - 8] ^= 0x01;
+    test("Wrong file hash rejected", throws(bad_hash) && stream_throws(bad_hash));
+
+    auto unchecked = frames_of(16 * 1024);
+    unchecked.checksum = false;
+    auto plain = WriteContainer(data, "k", fast_options(1), unchecked);
+    test("Files without checksums still decode", plain[6] == 0 && ReadContainer(plain, name, 1) == data);
+}
+
+// Decode `file` through a pipe, which the reader cannot seek back in
+bool pipe_decodes(const std::vector<uint8_t>& file, const std::vector<uint8_t>& data) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    std::thread writer([&] {
+        std::FILE* w = fdopen(fds[1], "wb");
+        WriteBytes(w, file.data(), file.size());
+        std::fclose(w);
+    });
+    std::FILE* in = fdopen(fds[0], "rb");
+    std::FILE* out = std::tmpfile();
+    bool ok = false;
+    try {
+        ContainerReader reader(in, 1);
+        ok = reader.DecodeTo(out) == data.size();
+    } catch (const std::runtime_error&) {
+    }
+    writer.join();
+    std::fclose(in);
+    return ok && drain(out) == data;
+}
+
+void test_dedup() {
+    std::cout << "\n=== Deduplication Tests ===\n";
+
+    // Chunk cuts depend on content, so they resynchronise after an insertion
+    auto base = make_test_data(300000);
+    auto ends = ChunkEnds(base.data(), base.size());
+    bool bounded = ends.back() == base.size();
+    for (size_t i = 0; i < ends.size(); i++) {
+        size_t len = ends[i] - (i ? ends[i - 1] : 0);
+        bounded = bounded && len <= CDC_MAX_CHUNK && (len >= CDC_MIN_CHUNK || i + 1 == ends.size());
+    }
+    test("Chunk sizes within bounds", bounded && ends.size() > 5);
+    auto shifted = base;
+    shifted.insert(shifted.begin() + 1000, 77, 'x');
+    auto shifted_ends = ChunkEnds(shifted.data(), shifted.size());
+    size_t shared = 0;
+    for (size_t e : ends) {
+        shared += std::count(shifted_ends.begin(), shifted_ends.end(), e + 77);
+    }
+    test("Chunk cuts survive an insertion", shared + 2 >= ends.size());
+
+    // Random blocks repeated far apart, beyond any LZ window
+    std::vector<uint8_t> block(300000), data;
+    uint32_t seed = 7;
+    for (auto& b : block) {
+        seed = seed * 1103515245 + 12345;
+        b = (uint8_t)(seed >> 16);
+    }
+    auto filler = make_test_data(70000);
+    for (int i = 0; i < 3; i++) {
+        data.insert(data.end(), block.begin(), block.end());
+        data.insert(data.end(), filler.begin() + i * 1000, filler.end());
+    }
+
+    ContainerOptions copts = frames_of(256 * 1024, true);
+    copts.dedup = true;
+    auto plain = WriteContainer(data, "d", fast_options(1), frames_of(256 * 1024, true));
+    auto file = WriteContainer(data, "d", fast_options(1), copts);
+    test("Dedup flag set", (file[6] & KC_FLAG_DEDUP) && !(plain[6] & KC_FLAG_DEDUP));
+    test("Repeats stored once", file.size() + block.size() < plain.size());
+    std::string name;
+    test("Dedup roundtrip", ReadContainer(file, name, 1) == data);
+    test("Dedup thread independence",
+         WriteContainer(data, "d", fast_options(3), copts) == file &&
+             ReadContainer(file, name, 3) == data);
+    test("Dedup streams", stream_decodes(file, data, "d"));
+    test("Dedup streams from a pipe", pipe_decodes(file, data));
+    test("Dedup range in a repeat", range_matches(file, data, data.size() - 80000, 30000));
+    test("Dedup range across frames", range_matches(file, data, 200000, 500000));
+
+    std::FILE* in = stream_of(data);
+    std::FILE* out = std::tmpfile();
+    WriteContainerStream(in, out, "d", fast_options(2), copts);
+    test("Streamed writer matches", drain(out) == file);
+    std::fclose(in);
+
+    ContainerOptions unindexed = copts;
+    unindexed.index = false;
+    auto walked = WriteContainer(data, "d", fast_options(1), unindexed);
+    test("Dedup range without index", range_matches(walked, data, data.size() - 5000, 5000));
+
+    // The fingerprint index is a window of recent chunks; one that --max-memory
+    // shrinks to a few chunks has forgotten each block before it repeats
+    HybridOptions capped = fast_options(1);
+    capped.max_memory = 4 * DEDUP_ENTRY_BYTES;
+    auto forgetful = WriteContainer(data, "d", capped, copts);
+    test("Small dedup window forgets old chunks", forgetful.size() > file.size() + block.size());
+    test("Small dedup window roundtrip", ReadContainer(forgetful, name, 1) == data);
+    Deduplicator window(4);
+    window.Learn(block.data(), block.size(), 0);
+    window.Learn(filler.data(), filler.size(), block.size());
+    window.CompressFrames(block, {block.size()}, block.size() + filler.size(), fast_options(1));
+    test("Evicted chunks are not referenced", window.DuplicateBytes() == 0);
+
+    // Entries must tile the frame and copy only bytes before themselves
+    auto recipe = [](std::vector<uint32_t> fields) {
+        std::vector<uint8_t> out;
+        for (uint32_t v : fields) {
+            for (int i = 0; i < 4; i++) out.push_back((uint8_t)(v >> (8 * i)));
+        }
+        return out;
+    };
+    auto parses = [](const std::vector<uint8_t>& stream, uint64_t raw_offset, uint32_t raw_size) {
+        try {
+            ParseRecipe(stream.data(), stream.size(), raw_offset, raw_size);
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+        return true;
+    };
+    const uint32_t REF = 0x80000000u;
+    test("Recipe with a back reference", parses(recipe({1, REF | 10, 50, 0}), 100, 10));
+    test("Reference overlapping itself rejected", !parses(recipe({1, REF | 10, 95, 0}), 100, 10));
+    test("Forward reference rejected", !parses(recipe({1, REF | 10, 200, 0}), 100, 10));
+    test("Entries must tile the frame", !parses(recipe({1, REF | 10, 0, 0}), 100, 11));
+    test("Literal stream required", !parses(recipe({1, 10}), 100, 10));
+}
+
+void write_file(const std::filesystem::path& path, const std::vector<uint8_t>& data) {
+    std::filesystem::create_directories(path.parent_path());
+    std::FILE* f = std::fopen(path.string().c_str(), "wb");
+    if (!data.empty()) std::fwrite(data.data(), 1, data.size(), f);
+    std::fclose(f);
+}
+
+bool same_file(const std::filesystem::path& path, const std::vector<uint8_t>& data) {
+    return std::filesystem::exists(path) && ReadAll(path.string()) == data;
+}
+
+// Archive with a single member whose name is written verbatim
+void write_raw_archive(const std::string& path, const std::string& member) {
+    std::vector<uint8_t> table = {1, 0, 0, 0, (uint8_t)member.size(), 0};
+    table.insert(table.end(), member.begin(), member.end());
+    std::vector<uint8_t> fields = {0xA4, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 5, 0, 0, 0, 0, 0, 0, 0};
+    table.insert(table.end(), fields.begin(), fields.end());
+
+    std::FILE* out = std::fopen(path.c_str(), "wb");
+    ContainerWriter writer(out, "", frames_of(4096, true), table);
+    writer.AddFrames({'h', 'e', 'l', 'l', 'o'}, {5}, fast_options(1));
+    writer.Finish();
+    std::fclose(out);
+}
+
+void test_archive() {
+    std::cout << "\n=== Archive Tests ===\n";
+    namespace fs = std::filesystem;
+
+    fs::path root = "build/test_archive";
+    fs::remove_all(root);
+    auto text = make_test_data(30000);
+    auto large = make_test_data(50000);
+    std::vector<uint8_t> other(text.rbegin(), text.rend());
+    write_file(root / "in/docs/a.txt", text);
+    write_file(root / "in/docs/b.txt", other);
+    write_file(root / "in/lib/c.bin", other);
+    write_file(root / "in/lib/empty.bin", {});
+    write_file(root / "in/large.dat", large);
+    fs::permissions(root / "in/lib/c.bin", fs::perms(0755));
+
+    std::string archive = (root / "t.kc").string();
+    auto members = WriteArchive(archive, {(root / "in").string()}, fast_options(2),
+                                frames_of(40000));
+    test("Archive lists every file", members.size() == 5 && ListArchive(archive).size() == 5);
+    test("Small files grouped by extension",
+         members[0].name == "in/lib/c.bin" && members[1].name == "in/lib/empty.bin" &&
+             members[2].name == "in/docs/a.txt" && members[3].name == "in/docs/b.txt");
+    test("Large files after the solid groups", members[4].name == "in/large.dat");
+    uint8_t flags = ReadAll(archive)[5];  // Archives have an empty name
+    test("Archive carries index and archive flags",
+         (flags & KC_FLAG_ARCHIVE) && (flags & KC_FLAG_INDEX));
+
+    size_t count = ExtractArchive(archive, (root / "all").string(), {}, 2);
+    test("Extract all", count == 5 && same_file(root / "all/in/docs/a.txt", text) &&
+                            same_file(root / "all/in/docs/b.txt", other) &&
+                            same_file(root / "all/in/lib/c.bin", other) &&
+                            same_file(root / "all/in/large.dat", large));
+    test("Empty member extracted", fs::is_regular_file(root / "all/in/lib/empty.bin") &&
+                                       fs::file_size(root / "all/in/lib/empty.bin") == 0);
+    test("Permissions restored", (fs::status(root / "all/in/lib/c.bin").permissions() &
+                                  fs::perms::owner_exec) != fs::perms::none);
+
+    count = ExtractArchive(archive, (root / "one").string(), {"in/docs/b.txt", "in/large.dat"}, 1);
+    test("Extract selected members", count == 2 && same_file(root / "one/in/docs/b.txt", other) &&
+                                         same_file(root / "one/in/large.dat", large) &&
+                                         !fs::exists(root / "one/in/docs/a.txt"));
+
+    bool unknown = false;
+    try {
+        ExtractArchive(archive, (root / "one").string(), {"missing"}, 1);
+    } catch (const std::runtime_error&) {
+        unknown = true;
+    }
+    test("Unknown member rejected", unknown);
+
+    std::string name;
+    bool plain_rejected = false;
+    try {
+        ReadContainer(ReadAll(archive), name, 1);
+    } catch (const std::runtime_error&) {
+        plain_rejected = true;
+    }
+    test("Archive decodes as a plain container", !plain_rejected && name.empty());
+
+    for (const char* unsafe : {"../evil", "/tmp/evil", "a/../../evil"}) {
+        std::string path = (root / "unsafe.kc").string();
+        write_raw_archive(path, unsafe);
+        bool threw = false;
+        try {
+            ExtractArchive(path, (root / "unsafe").string(), {}, 1);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        test(std::string("Unsafe name rejected: ") + unsafe, threw && !fs::exists(root / "evil"));
+    }
+
+    write_raw_archive((root / "safe.kc").string(), "ok.txt");
+    test("Hand-built archive extracts",
+         ExtractArchive((root / "safe.kc").string(), (root / "safe").string(), {}, 1) == 1 &&
+             same_file(root / "safe/ok.txt", {'h', 'e', 'l', 'l', 'o'}));
+
+    bool not_archive = false;
+    std::string plain = (root / "plain.kc").string();
+    auto file = WriteContainer(text, "x", fast_options(1), frames_of(4096, true));
+    write_file(plain, file);
+    try {
+        ListArchive(plain);
+    } catch (const std::runtime_error&) {
+        not_archive = true;
+    }
+    test("Plain container is not an archive", not_archive);
+}
+
+// UpdateContainer into a file, keeping the old file's frame size
+UpdateStats update_file(const std::string& old_path, const std::string& in_path,
+                        const std::string& out_path) {
+    std::FILE* out = std::fopen(out_path.c_str(), "wb");
+    try {
+        UpdateStats stats = UpdateContainer(old_path, in_path, out, fast_options(2), frames_of(0));
+        std::fclose(out);
+        return stats;
+    } catch (...) {
+        std::fclose(out);
+        throw;
+    }
+}
+
+bool update_rejected(const std::string& old_path, const std::string& in_path,
+                     const std::string& out_path) {
+    try {
+        update_file(old_path, in_path, out_path);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+void test_update() {
+    std::cout << "\n=== Incremental Update Tests ===\n";
+    namespace fs = std::filesystem;
+
+    // 100000 bytes in 8 KB frames: 12 full frames and a short one
+    fs::path root = "build/test_update";
+    fs::remove_all(root);
+    auto data = make_test_data(100000);
+    std::string input = (root / "in.dat").string();
+    std::string v1 = (root / "v1.kc").string(), v2 = (root / "v2.kc").string();
+    std::string v3 = (root / "v3.kc").string();
+    write_file(v1, WriteContainer(data, "in.dat", fast_options(1), frames_of(8192)));
+    std::string name;
+
+    // A patch in place: the old file has no frame hashes, so it is decoded
+    auto patched = data;
+    patched[50000] ^= 0xFF;
+    write_file(input, patched);
+    UpdateStats stats = update_file(v1, input, v2);
+    auto file = ReadAll(v2);
+    test("Patch recompresses one frame", stats.frames == 13 && stats.reused_frames == 12 &&
+                                             stats.reused_bytes == 100000 - 8192);
+    test("Patched file decodes", ReadContainer(file, name, 1) == patched && name == "in.dat");
+    test("Update writes the hashed index", stats.size == file.size() &&
+                                               (file[11] & KC_FLAG_INDEX) &&
+                                               (file[11] & KC_FLAG_FRAME_HASH));
+    test("Hashed index serves ranges",
+         ReadContainerRange(v2, 49990, 20, name, 1) ==
+             std::vector<uint8_t>(patched.begin() + 49990, patched.begin() + 50010));
+
+    // Nothing changed: every frame is copied and the file comes out the same
+    stats = update_file(v2, input, v3);
+    test("Unchanged update copies every frame", stats.reused_frames == stats.frames &&
+                                                    stats.reused_bytes == patched.size());
+    test("Unchanged update reproduces the file", ReadAll(v3) == file);
+
+    // An insertion shifts the frames after it; they are found from the end
+    auto inserted = patched;
+    inserted.insert(inserted.begin() + 30000, 100, 'x');
+    write_file(input, inserted);
+    stats = update_file(v2, input, v3);
+    test("Insertion recompresses only around it", stats.reused_frames == 12 &&
+                                                      stats.reused_bytes == 100000 - 8192);
+    test("Insertion decodes", ReadContainer(ReadAll(v3), name, 1) == inserted);
+
+    // An append recompresses the short last frame together with the new data
+    auto appended = patched;
+    appended.insert(appended.end(), data.begin(), data.begin() + 5000);
+    write_file(input, appended);
+    stats = update_file(v2, input, v3);
+    test("Append keeps frames full", stats.reused_frames == 12 && stats.frames == 13);
+    test("Append decodes", ReadContainer(ReadAll(v3), name, 1) == appended);
+
+    // Frames of deduplicated files and archives depend on other frames
+    ContainerOptions dedup = frames_of(8192);
+    dedup.dedup = true;
+    write_file(v1, WriteContainer(data, "in.dat", fast_options(1), dedup));
+    test("Deduplicated file not updated", update_rejected(v1, input, v3));
+    WriteArchive(v1, {input}, fast_options(1), frames_of(8192));
+    test("Archive not updated", update_rejected(v1, input, v3));
+}
+
+void test_meta() {
+    std::cout << "\n=== Header Metadata Tests ===\n";
+    namespace fs = std::filesystem;
+    fs::path root = "build/test_meta";
+    fs::remove_all(root);
+    fs::create_directories(root);
+    std::string path = (root / "m.kc").string();
+    auto data = make_test_data(60000);
+    std::string name;
+
+    ContainerOptions copts = frames_of(16 * 1024, true);
+    copts.meta = true;
+    copts.mtime = 1700000000;
+    copts.created = 1800000000;
+    auto file = WriteContainer(data, "dir/m.txt", fast_options(1), copts);
+    write_file(path, file);
+    ContainerInfo info = InspectContainer(path);
+    test("Metadata flag set", (info.flags & KC_FLAG_META) && info.version == KC_VERSION);
+    test("Metadata sizes", info.meta.raw_size == data.size() && info.meta.frames == 4 &&
+                               info.size == file.size() && info.name == "m.txt");
+    test("Metadata times", info.meta.mtime == 1700000000 && info.meta.created == 1800000000);
+    test("Metadata modes", info.meta.modes.any() && !info.meta.modes[SIZED_MODE]);
+    test("Metadata file decodes", ReadContainer(file, name, 1) == data && name == "m.txt");
+    test("Metadata file stream decodes", stream_decodes(file, data, "m.txt"));
+    test("Metadata file serves ranges",
+         ReadContainerRange(path, 20000, 10, name, 1) ==
+             std::vector<uint8_t>(data.begin() + 20000, data.begin() + 20010));
+    std::FILE* in = stream_of(file);
+    ContainerReader reader(in, 1);
+    test("Reader exposes metadata", reader.Meta().raw_size == data.size() &&
+                                        reader.Meta().modes == info.meta.modes);
+    std::fclose(in);
+
+    // The streaming writer fills the header in once the totals are known
+    in = stream_of(data);
+    std::FILE* out = std::tmpfile();
+    WriteContainerStream(in, out, "dir/m.txt", fast_options(1), copts);
+    std::fclose(in);
+    test("Streamed metadata matches WriteContainer", drain(out) == file);
+
+    // ... which a pipe cannot take, so the listing falls back to the index
+    int fds[2];
+    test("Pipe created", pipe(fds) == 0);
+    std::thread writer([&] {
+        std::FILE* src = stream_of(data);
+        std::FILE* w = fdopen(fds[1], "wb");
+        WriteContainerStream(src, w, "m.txt", fast_options(1), copts);
+        std::fclose(w);
+        std::fclose(src);
+    });
+    std::FILE* r = fdopen(fds[0], "rb");
+    std::vector<uint8_t> piped;
+    for (int c; (c = std::fgetc(r)) != EOF;) piped.push_back((uint8_t)c);
+    writer.join();
+    std::fclose(r);
+    write_file(path, piped);
+    in = stream_of(piped);
+    ContainerReader pipe_reader(in, 1);
+    test("Piped metadata left unknown", pipe_reader.Meta().raw_size == KC_UNKNOWN &&
+                                            pipe_reader.Meta().frames == KC_UNKNOWN &&
+                                            pipe_reader.Meta().mtime == 1700000000);
+    std::fclose(in);
+    info = InspectContainer(path);
+    test("Piped file listed from the index",
+         info.meta.raw_size == data.size() && info.meta.frames == 4);
+    test("Piped file decodes", ReadContainer(piped, name, 1) == data);
+
+    // Files without metadata: index, frame headers, older layouts
+    write_file(path, WriteContainer(data, "m", fast_options(1), frames_of(16 * 1024)));
+    info = InspectContainer(path);
+    test("Unindexed file listed from its frames", info.meta.raw_size == data.size() &&
+                                                      info.meta.frames == 4 &&
+                                                      info.meta.mtime == 0);
+    auto stream = CompressHybrid(make_test_data(5000), fast_options(1));
+    std::vector<uint8_t> v2 = {'K', 'C', 2, 2, 0, 'o', 'k'};
+    v2.insert(v2.end(), stream.begin(), stream.end());
+    write_file(path, v2);
+    info = InspectContainer(path);
+    test("v2 file listed", info.version == 2 && info.name == "ok" &&
+                               info.meta.raw_size == KC_UNKNOWN);
+    write_file(path, stream);
+    test("Bare stream listed", InspectContainer(path).version == 0);
+
+    // Fields a later version appends are skipped
+    copts.index = false;
+    auto longer = WriteContainer(data, "m", fast_options(1), copts);
+    size_t at = 7;  // Metadata length, after a one-byte name and the flags
+    longer[at] += 4;
+    longer.insert(longer.begin() + at + 2 + 60, 4, 0xEE);
+    test("Longer metadata skipped", ReadContainer(longer, name, 1) == data &&
+                                        stream_decodes(longer, data, "m"));
+    write_file(path, longer);
+    test("Longer metadata listed", InspectContainer(path).meta.raw_size == data.size());
+    auto cut = file;
+    cut[11] = 10;  // Shorter than the fields this version knows
+    test("Short metadata rejected", throws(cut) && stream_throws(cut));
+    cut = std::vector<uint8_t>(file.begin(), file.begin() + 40);
+    test("Truncated metadata rejected", throws(cut) && stream_throws(cut));
+
+    // Archives carry metadata ahead of the member table
+    std::string member = (root / "a.dat").string();
+    write_file(member, data);
+    ContainerOptions acopts = frames_of(16 * 1024);
+    acopts.meta = true;
+    WriteArchive(path, {member}, fast_options(1), acopts);
+    info = InspectContainer(path);
+    test("Archive metadata", (info.flags & KC_FLAG_ARCHIVE) && info.meta.raw_size == data.size());
+    test("Archive with metadata lists members", ListArchive(path).size() == 1);
+    test("Archive with metadata extracts",
+         ExtractArchive(path, (root / "x").string()) == 1 &&
+             same_file(root / "x" / "a.dat", data));
+}
+
+// Records when the decoded output first holds `want`
+class WatchSink : public ByteSink {
+public:
+    explicit WatchSink(const std::vector<uint8_t>& want) : want_(want) {}
+    void Write(const uint8_t* data, size_t n) override {
+        got.insert(got.end(), data, data + n);
+        if (got.size() >= want_.size() && std::equal(want_.begin(), want_.end(), got.begin()))
+            seen = true;
+    }
+
+    std::vector<uint8_t> got;
+    std::atomic<bool> seen{false};
+
+private:
+    std::vector<uint8_t> want_;
+};
+
+void test_flush_points() {
+    std::cout << "\n=== Flush Point Tests ===\n";
+    auto data = make_test_data(5000);
+
+    // A byte threshold cuts frames of that size; the file still decodes
+    ContainerOptions copts = frames_of(16 * 1024);
+    copts.flush_bytes = 1000;
+    std::FILE* in = stream_of(data);
+    std::FILE* out = std::tmpfile();
+    WriteContainerStream(in, out, "f", fast_options(1), copts);
+    std::fclose(in);
+    auto file = drain(out);
+    test("Flush bytes cut frames", file == WriteContainer(data, "f", fast_options(1),
+                                                          frames_of(1000)));
+    std::string name;
+    test("Flushed file decodes", ReadContainer(file, name, 1) == data);
+
+    // Live pipes: the first part must come out of the reader while the
+    // writer is still waiting for the rest of its input
+    int input[2], output[2];
+    test("Pipes created", pipe(input) == 0 && pipe(output) == 0);
+    std::vector<uint8_t> first(data.begin(), data.begin() + 300);
+    WatchSink sink(first);
+    bool early = false;
+    std::thread feeder([&] {
+        std::FILE* w = fdopen(input[1], "wb");
+        WriteBytes(w, first.data(), first.size());
+        std::fflush(w);
+        for (int i = 0; i < 1000 && !sink.seen; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        early = sink.seen;
+        WriteBytes(w, data.data() + first.size(), data.size() - first.size());
+        std::fclose(w);
+    });
+    ContainerOptions live;
+    live.flush_interval = 0.05;
+    std::thread writer([&] {
+        std::FILE* r = fdopen(input[0], "rb");
+        std::FILE* w = fdopen(output[1], "wb");
+        WriteContainerStream(r, w, "", fast_options(1), live);
+        std::fclose(w);
+        std::fclose(r);
+    });
+    std::FILE* r = fdopen(output[0], "rb");
+    ContainerReader reader(r, 2);
+    reader.SetLive(true);
+    uint64_t n = reader.DecodeTo(sink);
+    feeder.join();
+    writer.join();
+    std::fclose(r);
+    test("Flushed frame decodes before the input ends", early);
+    test("Live stream decodes", n == data.size() && sink.got == data);
+}
+
+uint32_t get32(const std::vector<uint8_t>& v, size_t pos) {
+    return v[pos] | (v[pos + 1] << 8) | (v[pos + 2] << 16) | ((uint32_t)v[pos + 3] << 24);
+}
+
+bool resume_rejected(const std::string& in, const std::string& out) {
+    try {
+        ResumeContainer(in, out, fast_options(1));
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+void test_resume() {
+    std::cout << "\n=== Resume Tests ===\n";
+    namespace fs = std::filesystem;
+    fs::path root = "build/test_resume";
+    fs::remove_all(root);
+    fs::create_directories(root);
+    std::string input = (root / "in.dat").string(), out = (root / "in.dat.kc").string();
+
+    // 100000 bytes in 8 KB frames: 13 frames after a 74-byte header
+    auto data = make_test_data(100000);
+    write_file(input, data);
+    ContainerOptions copts = frames_of(8192, true, true);
+    copts.meta = true;
+    copts.created = 1800000000;
+    auto full = WriteContainer(data, "in.dat", fast_options(1), copts);
+    size_t header = 6 + 6 + 62;
+    size_t frame2 = header + 16 + get32(full, header + 4);
+    size_t frame3 = frame2 + 16 + get32(full, frame2 + 4);
+
+    struct Cut { size_t at; uint64_t kept; const char* what; };
+    for (Cut cut : {Cut{header, 0, "after the header"}, Cut{frame3 - 5, 1, "inside a frame"},
+                    Cut{frame3, 2, "after a frame"}, Cut{full.size() - 100, 13, "in the index"},
+                    Cut{full.size(), 13, "complete file"}}) {
+        write_file(out, std::vector<uint8_t>(full.begin(), full.begin() + cut.at));
+        ResumeStats stats = ResumeContainer(input, out, fast_options(1), copts);
+        uint64_t kept_bytes = std::min<uint64_t>(cut.kept * 8192, data.size());
+        test(std::string("Resume ") + cut.what,
+             stats.kept_frames == cut.kept && stats.kept_bytes == kept_bytes &&
+                 stats.size == full.size() && ReadAll(out) == full);
+    }
+
+    // A damaged frame and everything after it are compressed again
+    auto damaged = std::vector<uint8_t>(full.begin(), full.begin() + frame3 + 100);
+    damaged[frame2 + 20] ^= 1;
+    write_file(out, damaged);
+    ResumeStats stats = ResumeContainer(input, out, fast_options(1), copts);
+    test("Resume drops a damaged frame", stats.kept_frames == 1 && ReadAll(out) == full);
+
+    fs::remove(out);
+    stats = ResumeContainer(input, out, fast_options(1), copts);
+    test("Resume without output starts afresh", stats.kept_frames == 0 && ReadAll(out) == full);
+
+    // Deduplicated files rebuild the chunk index from the kept frames
+    auto repeated = make_test_data(40000);
+    repeated.insert(repeated.end(), repeated.begin(), repeated.end());
+    write_file(input, repeated);
+    ContainerOptions dedup = frames_of(8192);
+    dedup.dedup = true;
+    auto whole = WriteContainer(repeated, "in.dat", fast_options(1), dedup);
+    write_file(out, std::vector<uint8_t>(whole.begin(), whole.begin() + whole.size() / 2));
+    stats = ResumeContainer(input, out, fast_options(1), dedup);
+    test("Resume deduplicated file", stats.kept_frames > 0 && ReadAll(out) == whole);
+
+    // Nothing to resume from: other data, no checksums, not a .kc file
+    auto other = data;
+    other[100] ^= 1;
+    write_file(input, other);
+    write_file(out, std::vector<uint8_t>(full.begin(), full.begin() + frame3));
+    test("Resume with other input rejected", resume_rejected(input, out));
+    ContainerOptions unchecked = frames_of(8192);
+    unchecked.checksum = false;
+    write_file(out, WriteContainer(repeated, "in.dat", fast_options(1), unchecked));
+    test("Resume without checksums rejected", resume_rejected(input, out));
+    write_file(out, repeated);
+    test("Resume over another file rejected", resume_rejected(input, out));
+}
+
+void test_mapped_input() {
+    std::cout << "\n=== Mapped Input Tests ===\n";
+    namespace fs = std::filesystem;
+    fs::path root = "build/test_mapped";
+    fs::remove_all(root);
+    fs::create_directories(root);
+    std::string path = (root / "in.dat").string(), empty = (root / "empty").string();
+    auto data = make_test_data(60000);
+    write_file(path, data);
+    write_file(empty, {});
+
+    MappedFile map(path);
+    test("Regular file is mapped",
+         map.Mapped() && std::vector<uint8_t>(map.Data(), map.Data() + map.Size()) == data);
+    MappedFile populated(path, true);
+    test("Populated mapping", populated.Mapped() && populated.Size() == data.size());
+    MappedFile none(empty);
+    test("Empty file maps to nothing", none.Size() == 0);
+
+    // Pipes cannot be mapped and are read instead
+    int fds[2];
+    test("Pipe created", pipe(fds) == 0);
+    std::thread feeder([&] {
+        std::FILE* w = fdopen(fds[1], "wb");
+        WriteBytes(w, data.data(), data.size());
+        std::fclose(w);
+    });
+    std::FILE* r = fdopen(fds[0], "rb");
+    MappedFile piped(r);
+    feeder.join();
+    std::fclose(r);
+    test("Pipe falls back to reading",
+         !piped.Mapped() &&
+             std::vector<uint8_t>(piped.Data(), piped.Data() + piped.Size()) == data);
+
+    // Pointer + length entry points give the same bytes as the vector ones
+    auto copts = frames_of(16 * 1024, true, true);
+    auto file = WriteContainer(data, "in.dat", fast_options(2), copts);
+    test("WriteContainer from a mapping",
+         WriteContainer(map.Data(), map.Size(), "in.dat", fast_options(2), copts) == file);
+    copts.dedup = true;
+    test("Deduplicated WriteContainer from a mapping",
+         WriteContainer(map.Data(), map.Size(), "in.dat", fast_options(2), copts) ==
+             WriteContainer(data, "in.dat", fast_options(2), copts));
+    std::string name;
+    test("ReadContainer from a pointer",
+         ReadContainer(file.data(), file.size(), name, 2) == data && name == "in.dat");
+    auto stream = CompressHybrid(data, fast_options(1));
+    test("DecompressHybrid from a pointer", DecompressHybrid(stream.data(), stream.size()) == data);
+
+    // A stream already positioned part way: only the rest is compressed
+    std::FILE* in = std::fopen(path.c_str(), "rb");
+    std::fseek(in, 1000, SEEK_SET);
+    std::FILE* out = std::tmpfile();
+    WriteContainerStream(in, out, "in.dat", fast_options(2), frames_of(16 * 1024));
+    std::fclose(in);
+    std::vector<uint8_t> rest(data.begin() + 1000, data.end());
+    test("Mapped stream starts at the file position",
+         drain(out) == WriteContainer(rest, "in.dat", fast_options(2), frames_of(16 * 1024)));
+
+    // Older layouts read from a file decode from the mapping
+    std::vector<uint8_t> v2 = {'K', 'C', 2, 2, 0, 'o', 'k'};
+    v2.insert(v2.end(), stream.begin(), stream.end());
+    write_file(path, v2);
+    in = std::fopen(path.c_str(), "rb");
+    out = std::tmpfile();
+    ContainerReader reader(in, 2);
+    uint64_t n = reader.DecodeTo(out);
+    std::fclose(in);
+    test("Mapped v2 file decodes", n == data.size() && drain(out) == data);
+    write_file(path, stream);
+    in = std::fopen(path.c_str(), "rb");
+    out = std::tmpfile();
+    ContainerReader bare(in, 2);
+    n = bare.DecodeTo(out);
+    std::fclose(in);
+    test("Mapped bare stream decodes", n == data.size() && drain(out) == data);
+}
+
+void test_overlapped_io() {
+    std::cout << "\n=== Overlapped I/O Tests ===\n";
+    auto data = make_test_data(100000);
+    auto copts = frames_of(8 * 1024, true);
+    auto whole = WriteContainer(data, "p", fast_options(3), copts);
+
+    // Pipe input is read ahead a batch (3 frames) at a time
+    int fds[2];
+    test("Pipe created", pipe(fds) == 0);
+    std::thread feeder([&] {
+        std::FILE* w = fdopen(fds[1], "wb");
+        for (size_t pos = 0; pos < data.size(); pos += 7000) {
+            WriteBytes(w, data.data() + pos, std::min<size_t>(7000, data.size() - pos));
+            std::fflush(w);
+        }
+        std::fclose(w);
+    });
+    std::FILE* r = fdopen(fds[0], "rb");
+    std::FILE* out = std::tmpfile();
+    uint64_t n = WriteContainerStream(r, out, "p", fast_options(3), copts);
+    feeder.join();
+    std::fclose(r);
+    test("Read-ahead pipe matches WriteContainer", drain(out) == whole && n == whole.size());
+
+    test("Pipe created", pipe(fds) == 0);
+    close(fds[1]);
+    r = fdopen(fds[0], "rb");
+    out = std::tmpfile();
+    WriteContainerStream(r, out, "p", fast_options(3), copts);
+    std::fclose(r);
+    test("Empty pipe", drain(out) == WriteContainer({}, "p", fast_options(3), copts));
+
+    // A write that fails behind the compressor is still reported
+    std::FILE* full = std::fopen("/dev/full", "wb");
+    if (full) {
+        std::FILE* in = stream_of(data);
+        bool reported = false;
+        try {
+            WriteContainerStream(in, full, "p", fast_options(3), copts);
+        } catch (const std::runtime_error&) {
+            reported = true;
+        }
+        std::fclose(in);
+        std::fclose(full);
+        test("Failed background write reported", reported);
+    }
+
+    // Regular files go through io_uring where the kernel allows it; the
+    // output matches the threaded fallback either way
+    IoRing ring(4);
+    if (ring.Available()) {
+        std::FILE* f = std::tmpfile();
+        std::vector<uint8_t> back(data.size());
+        bool queued = ring.Write(fileno(f), data.data(), data.size(), 0, 1);
+        uint64_t tag = 0;
+        int64_t res = 0;
+        ring.Wait(tag, res);
+        bool wrote = queued && tag == 1 && res == (int64_t)data.size();
+        queued = ring.Read(fileno(f), back.data(), 5000, 0, 2) &&
+                 ring.Read(fileno(f), back.data() + 5000, data.size() - 5000, 5000, 3);
+        int64_t total = 0;
+        for (int i = 0; i < 2; i++) {
+            ring.Wait(tag, res);
+            total += res;
+        }
+        std::fclose(f);
+        test("io_uring write and read back", wrote && queued && total == (int64_t)data.size() &&
+                                                 back == data && ring.Pending() == 0);
+    }
+    ContainerOptions threaded = copts;
+    threaded.io_uring = false;
+    for (const ContainerOptions& o : {copts, threaded}) {
+        std::FILE* in = stream_of(data);
+        out = std::tmpfile();
+        n = WriteContainerStream(in, out, "p", fast_options(3), o);
+        std::fclose(in);
+        test(o.io_uring ? "io_uring file matches WriteContainer"
+                        : "Threaded file matches WriteContainer",
+             drain(out) == whole && n == whole.size());
+    }
+
+    // An appending output (>>) ignores write offsets and cannot have its
+    // header patched, so it is written in order and keeps the metadata
+    // placeholder, as a pipe does; large stored frames keep several big
+    // writes in flight
+    std::vector<uint8_t> noise(4 << 20);
+    uint32_t seed = 3;
+    for (auto& b : noise) {
+        seed = seed * 1103515245 + 12345;
+        b = (uint8_t)(seed >> 16);
+    }
+    auto wide = frames_of(256 * 1024);
+    wide.meta = true;
+    const char* appended = "build/test_append.kc";
+    std::remove(appended);
+    test("Pipe created", pipe(fds) == 0);
+    std::thread noisy([&] {
+        std::FILE* w = fdopen(fds[1], "wb");
+        WriteBytes(w, noise.data(), noise.size());
+        std::fclose(w);
+    });
+    r = fdopen(fds[0], "rb");
+    out = std::fopen(appended, "ab");
+    n = WriteContainerStream(r, out, "p", fast_options(3), wide);
+    noisy.join();
+    std::fclose(r);
+    std::fclose(out);
+    auto file = ReadAll(appended);
+    std::string name;
+    test("Appended file decodes", n == file.size() && ReadContainer(file, name, 1) == noise);
+    std::remove(appended);
+
+    // A compressor that gives up does not wait for a pipe that has gone
+    // quiet without closing
+    test("Pipe created", pipe(fds) == 0);
+    std::atomic<bool> done{false};
+    std::thread stalled([&] {
+        std::FILE* w = fdopen(fds[1], "wb");
+        WriteBytes(w, data.data(), 50000);
+        std::fflush(w);
+        auto until = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+        while (!done && std::chrono::steady_clock::now() < until) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        std::fclose(w);
+    });
+    r = fdopen(fds[0], "rb");
+    out = std::tmpfile();
+    auto began = std::chrono::steady_clock::now();
+    bool stopped = false;
+    try {
+        WriteContainerStream(r, out, "p", fast_options(3), copts,
+                             [](uint64_t) { throw std::runtime_error("stop"); });
+    } catch (const std::runtime_error&) {
+        stopped = true;
+    }
+    auto took = std::chrono::steady_clock::now() - began;
+    done = true;
+    test("Reader stops when compression fails",
+         stopped && took < std::chrono::seconds(10));
+    stalled.join();
+    std::fclose(r);
+    std::fclose(out);
+}
+
+// Byte `i` of the large input: repeated text with the number of each 1 MB
+// block written over its first 8 bytes, so no two blocks are the same
+uint8_t large_byte(uint64_t i) {
+    static const char text[] = "The quick brown fox jumps over the lazy dog. ";
+    uint64_t block = i >> 20, at = i & ((1 << 20) - 1);
+    return at < 8 ? (uint8_t)(block >> (8 * at)) : (uint8_t)text[i % 45];
+}
+
+// Hashes and counts what it is given instead of keeping it
+class HashSink : public ByteSink {
+public:
+    void Write(const uint8_t* data, size_t n) override {
+        hash.Update(data, n);
+        size += n;
+    }
+
+    Hash64 hash;
+    uint64_t size = 0;
+};
+
+// An input past 4 GB, fed through a pipe and decoded into a hash so it is
+// never held whole. Takes minutes, so it only runs with KCOMP_LARGE_TESTS set.
+void test_large_input() {
+    if (!std::getenv("KCOMP_LARGE_TESTS")) return;
+    std::cout << "\n=== Large Input Tests ===\n";
+
+    const uint64_t size = (uint64_t(9) << 29) + 12345;  // 4.5 GB and a bit
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    int fds[2];
+    test("Pipe created", pipe(fds) == 0);
+    Hash64 expected;
+    std::thread feeder([&] {
+        std::FILE* w = fdopen(fds[1], "wb");
+        std::vector<uint8_t> block(1 << 20);
+        for (uint64_t at = 0; at < size; at += block.size()) {
+            size_t n = (size_t)std::min<uint64_t>(block.size(), size - at);
+            for (size_t k = 0; k < n; k++) block[k] = large_byte(at + k);
+            expected.Update(block.data(), n);
+            if (std::fwrite(block.data(), 1, n, w) != n) break;
+        }
+        std::fclose(w);
+    });
+
+    const char* path = "build/test_large.kc";
+    std::FILE* r = fdopen(fds[0], "rb");
+    std::FILE* out = std::fopen(path, "w+b");
+    uint64_t raw = 0;
+    uint64_t written = WriteContainerStream(r, out, "large", fast_options(threads),
+                                            frames_of(64 << 20, true, true),
+                                            [&](uint64_t done) { raw = done; });
+    feeder.join();
+    std::fclose(r);
+    std::fseek(out, 0, SEEK_END);
+    test("Large input compressed", raw == size && written == (uint64_t)ftello(out));
+
+    std::rewind(out);
+    HashSink sink;
+    ContainerReader reader(out, threads);
+    test("Large input decodes",
+         reader.DecodeTo(sink) == size && sink.size == size &&
+             sink.hash.Digest() == expected.Digest());
+    std::fclose(out);
+
+    // The frame index locates a range that spans the 4 GB mark
+    uint64_t at = (uint64_t(1) << 32) - 16;
+    std::vector<uint8_t> want;
+    for (uint64_t i = at; i < at + 64; i++) want.push_back(large_byte(i));
+    std::string name;
+    test("Range across 4 GB", ReadContainerRange(path, at, 64, name, threads) == want);
+    std::remove(path);
+}
+
+int main() {
+    std::cout << "=== Container Tests ===\n";
+
+    test_v3_roundtrip();
+    test_thread_independence();
+    test_older_formats();
+    test_corrupt_v3();
+    test_range();
+    test_streaming();
+    test_checksums();
+    test_archive();
+    test_dedup();
+    test_update();
+    test_meta();
+    test_flush_points();
+    test_resume();
+    test_mapped_input();
+    test_overlapped_io();
+    test_large_input();
+
+    std::cout << "\n=== Results: " << passed << " passed, " << failed << " failed ===\n";
+    return failed > 0 ? 1 : 0;
+}
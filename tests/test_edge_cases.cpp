@@ -5,6 +5,7 @@
 #include <cstring>
 #include "../src/models/ppm.hpp"
 #include "../src/models/bwt.hpp"
+#include "../src/models/cm.hpp"
 
 int passed = 0, failed = 0;
 
@@ -282,6 +283,38 @@ void test_binary_patterns() {
     }
 }
 
+void test_size_fields() {
+    std::cout << "\n=== Size Field Tests ===\n";
+
+    std::string text = "size fields must not wrap, size fields must not wrap";
+    std::vector<uint8_t> data(text.begin(), text.end());
+
+    // A CM stream may carry its size as 0xFFFFFFFF plus a u64
+    auto cm = CompressCM(data);
+    std::vector<uint8_t> wide = {0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0};
+    wide.insert(wide.end(), cm.begin(), cm.end());
+    test("CM escaped size", DecompressCM(wide) == data);
+    test("CM recorded size", DecompressCM(cm, data.size()) == data);
+
+    bool threw = false;
+    try {
+        DecompressCM(cm, data.size() + 1);
+    } catch (const std::exception&) {
+        threw = true;
+    }
+    test("CM size mismatch throws", threw);
+
+    uint32_t idx;
+    auto bwt = BWTEncode(data, idx);
+    threw = false;
+    try {
+        BWTDecode(bwt, (uint32_t)bwt.size());
+    } catch (const std::exception&) {
+        threw = true;
+    }
+    test("BWT index past the end throws", threw);
+}
+
 int main() {
     std::cout << "=== Edge Case Tests ===\n";
 
@@ -294,6 +327,7 @@ int main() {
     test_special_patterns();
     test_text_variations();
     test_binary_patterns();
+    test_size_fields();
 
     std::cout << "\n=== Results: " << passed << " passed, " << failed << " failed ===\n";
     return failed > 0 ? 1 : 0;
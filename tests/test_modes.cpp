@@ -2,7 +2,14 @@
 #include <vector>
 #include <cstdint>
 #include <string>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
 #include "../src/models/ppm.hpp"
+#include "../src/models/pipeline.hpp"
+#include "../src/models/blocks.hpp"
+#include "../src/core/data_stats.hpp"
 #include "../src/models/bwt.hpp"
 #include "../src/models/lz77.hpp"
 #include "../src/models/lzopt.hpp"
@@ -119,6 +126,12 @@ void test_lz_variants() {
         auto c = LZ77Compress(data);
         auto d = LZ77Decompress(c);
         test("LZ77 roundtrip", data == d);
+
+        // A repeat exactly one window back must not be coded as offset 0
+        auto block = make_test_data(65536, 2);
+        std::vector<uint8_t> twice(block);
+        twice.insert(twice.end(), block.begin(), block.end());
+        test("LZ77 roundtrip at full window distance", LZ77Decompress(LZ77Compress(twice)) == twice);
     }
 
     // LZOpt
@@ -215,6 +228,475 @@ void test_hybrid_modes() {
     }
 }
 
+void test_hybrid_threads() {
+    std::cout << "\n=== Parallel Hybrid Tests ===\n";
+
+    // Thread count must never change the chosen mode or the output bytes
+    for (int pattern = 0; pattern < 5; pattern++) {
+        auto data = make_test_data(4000, pattern);
+        HybridOptions serial;
+        serial.threads = 1;
+        HybridOptions parallel;
+        parallel.threads = 4;
+        auto a = CompressHybrid(data, serial);
+        auto b = CompressHybrid(data, parallel);
+        test("Hybrid threads=1 vs 4 identical, pattern=" + std::to_string(pattern), a == b);
+        test("Hybrid parallel roundtrip, pattern=" + std::to_string(pattern),
+             DecompressHybrid(b) == data);
+    }
+}
+
+// Hybrid stream for `mode`: mode byte, then `payload`
+static std::vector<uint8_t> hybrid_stream(int mode, const std::vector<uint8_t>& payload) {
+    std::vector<uint8_t> stream = {(uint8_t)mode};
+    stream.insert(stream.end(), payload.begin(), payload.end());
+    return stream;
+}
+
+void test_stream_decode() {
+    std::cout << "\n=== Pipelined Decode Tests ===\n";
+
+    // Words in pseudo-random order with occasional runs: compressible, but
+    // without long repeats (BWTEncode sorts suffixes naively), and large
+    // enough that the coder hands over several chunks
+    const char* words[] = {"the ", "quick ", "brown ", "fox ", "jumps ", "over ",
+                           "lazy ", "dog ", "and ", "runs ", "away ", "\n"};
+    std::vector<uint8_t> data;
+    uint32_t seed = 7;
+    while (data.size() < 150000) {
+        seed = seed * 1103515245 + 12345;
+        const char* w = words[(seed >> 16) % 12];
+        data.insert(data.end(), w, w + strlen(w));
+        if ((seed >> 8) % 64 == 0) data.insert(data.end(), 12, (uint8_t)(seed >> 24));
+    }
+
+    uint32_t idx;
+    auto bwt = BWTEncode(data, idx);
+    auto bwt_payload = CompressPPM5(MTFEncode(bwt));
+    bwt_payload.insert(bwt_payload.begin(), {(uint8_t)(idx >> 24), (uint8_t)(idx >> 16),
+                                            (uint8_t)(idx >> 8), (uint8_t)idx});
+
+    std::vector<std::pair<int, std::vector<uint8_t>>> streams = {
+        {2, CompressPPM5(LZ77Compress(data))},
+        {9, bwt_payload},
+        {18, CompressPPM5(RLECompress(DeltaEncode(data)))},
+        {23, CompressPPM5(LZ77Compress(RLECompress(data)))},
+        {37, CompressPPM5(WordEncode(LZ77Compress(data)))},
+    };
+    for (auto& [mode, payload] : streams) {
+        auto stream = hybrid_stream(mode, payload);
+        std::string name = "mode " + std::to_string(mode);
+        test("Pipelined decode inline, " + name, DecompressHybrid(stream, 1) == data);
+        test("Pipelined decode threaded, " + name, DecompressHybrid(stream, 4) == data);
+    }
+
+    // A bad match offset stops the LZ77 stage early; the coder thread must
+    // still run to completion and the output match the inline decode
+    auto bad = hybrid_stream(2, CompressPPM5({'a', 'b', 0xFE, 0, 9}));
+    test("Pipelined decode bad stream", DecompressHybrid(bad, 4) == DecompressHybrid(bad, 1));
+}
+
+// Sized stream: SIZED_MODE, stage sizes, then the `mode` stream
+static std::vector<uint8_t> sized_stream(int mode, const std::vector<size_t>& sizes,
+                                         const std::vector<uint8_t>& payload) {
+    std::vector<uint8_t> stream = {SIZED_MODE, (uint8_t)sizes.size()};
+    for (size_t v : sizes) {
+        for (int i = 0; i < 4; i++) stream.push_back((uint8_t)(v >> (8 * i)));
+    }
+    auto inner = hybrid_stream(mode, payload);
+    stream.insert(stream.end(), inner.begin(), inner.end());
+    return stream;
+}
+
+void test_sized_streams() {
+    std::cout << "\n=== Sized Stream Tests ===\n";
+
+    // Recording sizes wraps the same mode and payload
+    HybridOptions sized;
+    sized.record_sizes = true;
+    for (int pattern = 0; pattern < 5; pattern++) {
+        auto data = make_test_data(3000, pattern);
+        auto plain = CompressHybrid(data);
+        auto c = CompressHybrid(data, sized);
+        std::string name = "pattern=" + std::to_string(pattern);
+        if (plain[0] == 255) {
+            test("Sized stream leaves stored data alone, " + name, c == plain);
+            continue;
+        }
+        test("Sized stream wraps the plain stream, " + name,
+             c[0] == SIZED_MODE && c.size() == plain.size() + 2 + 4 * (size_t)c[1] &&
+             std::equal(plain.begin(), plain.end(), c.end() - plain.size()));
+        test("Sized stream roundtrip, " + name, DecompressHybrid(c) == data);
+    }
+
+    // Chains that materialise their intermediates, sized at every step
+    auto data = make_test_data(20000, 0);
+    auto lz = LZ77Compress(data);
+    uint32_t idx;
+    auto bwt = BWTEncode(lz, idx);
+    auto bwt_payload = CompressPPM5(MTFEncode(bwt));
+    bwt_payload.insert(bwt_payload.begin(), {(uint8_t)(idx >> 24), (uint8_t)(idx >> 16),
+                                            (uint8_t)(idx >> 8), (uint8_t)idx});
+    auto rle = RLECompress(data);
+    auto rle_lzopt = LZOptCompress(rle);
+    auto word = WordEncode(data);
+    auto word_lzma = LZMACompress(word);
+
+    std::vector<std::vector<uint8_t>> streams = {
+        sized_stream(16, {bwt.size(), lz.size(), data.size()}, bwt_payload),
+        sized_stream(27, {rle_lzopt.size(), rle.size(), data.size()}, CompressPPM5(rle_lzopt)),
+        sized_stream(45, {word_lzma.size(), word.size(), data.size()}, CompressPPM5(word_lzma)),
+        sized_stream(2, {lz.size(), data.size()}, CompressPPM5(lz)),
+    };
+    for (const auto& stream : streams) {
+        std::string name = "mode " + std::to_string(stream[2 + 4 * stream[1]]);
+        test("Sized decode, " + name, DecompressHybrid(stream, 1) == data);
+        test("Sized decode threaded, " + name, DecompressHybrid(stream, 4) == data);
+    }
+
+    // A malformed size header, or a final size the data does not decode to
+    auto throws = [](const std::vector<uint8_t>& stream) {
+        try {
+            DecompressHybrid(stream);
+        } catch (const std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    auto good = streams[3];
+    test("Sized stream without sizes rejected",
+         throws({SIZED_MODE, 0, 2}) && throws({SIZED_MODE}));
+    test("Sized stream truncated header rejected", throws({SIZED_MODE, 2, 1, 0, 0, 0}));
+    test("Nested sized stream rejected",
+         throws(sized_stream(SIZED_MODE, {data.size()}, good)));
+    auto wrong = good;
+    wrong[6]++;
+    test("Sized stream with wrong size rejected", throws(wrong));
+
+    // Sizes out of proportion to the result are refused before anything is
+    // reserved for them, and a known decoded size must match the last one
+    auto payload = CompressPPM5(lz);
+    test("Sized stream with inflated stage size rejected",
+         throws(sized_stream(2, {0xFFFFFFF0u, data.size()}, payload)) &&
+         throws(sized_stream(2, {lz.size(), 0xFFFFFFF0u}, payload)));
+    bool mismatch = false;
+    try {
+        DecompressHybrid(good.data(), good.size(), 1, data.size() + 1);
+    } catch (const std::runtime_error&) {
+        mismatch = true;
+    }
+    test("Sized stream checked against the known size", mismatch &&
+         DecompressHybrid(good.data(), good.size(), 1, data.size()) == data);
+}
+
+void test_hybrid_sampling() {
+    std::cout << "\n=== Sampled Hybrid Selection Tests ===\n";
+
+    auto data = make_test_data(12000, 0);
+    HybridOptions exhaustive;
+    exhaustive.threads = 1;
+    auto full = CompressHybrid(data, exhaustive);
+
+    // Confirming every mode must reproduce the exhaustive result
+    HybridOptions all = exhaustive;
+    all.sample = true;
+    all.top_k = 255;
+    all.slice_size = 1024;
+    test("Sampled top-k=all matches exhaustive", CompressHybrid(data, all) == full);
+
+    // A single confirmed mode still round-trips and ignores thread count
+    HybridOptions one = all;
+    one.top_k = 1;
+    auto a = CompressHybrid(data, one);
+    one.threads = 4;
+    auto b = CompressHybrid(data, one);
+    test("Sampled top-k=1 roundtrip", DecompressHybrid(a) == data);
+    test("Sampled top-k=1 threads=1 vs 4 identical", a == b);
+}
+
+void test_prefilter() {
+    std::cout << "\n=== Pre-classifier Tests ===\n";
+
+    // Statistics on inputs with known answers (odd sizes cover the scalar tail)
+    {
+        std::vector<uint8_t> zeros(1001, 0);
+        auto st = AnalyzeData(zeros.data(), zeros.size());
+        test("Stats zeros: entropy0 = 0", st.entropy0 == 0);
+        test("Stats zeros: zero ratio = 1", st.zero_ratio == 1.0);
+        test("Stats zeros: run ratio", st.run_ratio == 1000.0 / 1001.0);
+        test("Stats zeros: zero-run ratio", st.zero_run_ratio == 1000.0 / 1001.0);
+    }
+    {
+        auto text = make_test_data(4999, 0);
+        auto st = AnalyzeData(text.data(), text.size());
+        test("Stats text: mostly ASCII", st.ascii_ratio > 0.95);
+        test("Stats text: repeated 4-grams", st.repeat4_ratio > 0.9);
+        test("Stats text: order-1 below order-0", st.entropy1 < st.entropy0);
+    }
+
+    // Random data is stored without trying any candidate
+    {
+        auto rnd = make_test_data(20000, 2);
+        auto st = AnalyzeData(rnd.data(), rnd.size());
+        test("Stats random: entropy0 near 8", st.entropy0 > 7.9);
+        auto c = CompressHybrid(rnd);
+        test("Random data stored raw", !c.empty() && c[0] == 255 && c.size() == rnd.size() + 1);
+    }
+
+    // Gating never produces an undecodable stream
+    for (int pattern = 0; pattern < 5; pattern++) {
+        auto data = make_test_data(3000, pattern);
+        HybridOptions opts;
+        opts.threads = 1;
+        auto c = CompressHybrid(data, opts);
+        test("Prefiltered roundtrip, pattern=" + std::to_string(pattern),
+             DecompressHybrid(c) == data);
+    }
+}
+
+void test_levels() {
+    std::cout << "\n=== Compression Level Tests ===\n";
+
+    auto data = make_test_data(3000, 0);
+    size_t prev = 0;
+    for (int level = MIN_LEVEL; level <= MAX_LEVEL; level++) {
+        HybridOptions opts;
+        opts.threads = 1;
+        opts.level = level;
+        auto c = CompressHybrid(data, opts);
+        test("Level " + std::to_string(level) + " roundtrip", DecompressHybrid(c) == data);
+        // Each level searches a superset of the previous one
+        if (level > MIN_LEVEL) {
+            test("Level " + std::to_string(level) + " no larger than level " +
+                 std::to_string(level - 1), c.size() <= prev);
+        }
+        prev = c.size();
+    }
+
+    // Level 1 only ever runs LZ77+PPM3
+    HybridOptions fast;
+    fast.level = 1;
+    auto c = CompressHybrid(make_test_data(3000, 3), fast);
+    test("Level 1 uses LZ77+PPM3 or store", !c.empty() && (c[0] == 1 || c[0] == 255));
+
+    // Text past the 64 KB LZ77 window: words drawn from a large vocabulary,
+    // with the first 64 KB repeated so some matches lie exactly one window back
+    std::vector<std::string> words;
+    uint32_t seed = 7;
+    for (int w = 0; w < 4000; w++) {
+        std::string word;
+        for (int k = 3 + w % 7; k > 0; k--) {
+            seed = seed * 1103515245 + 12345;
+            word += (char)('a' + (seed >> 16) % 26);
+        }
+        words.push_back(word);
+    }
+    std::vector<uint8_t> text;
+    while (text.size() < 65536) {
+        seed = seed * 1103515245 + 12345;
+        const std::string& word = words[(seed >> 16) % words.size()];
+        text.insert(text.end(), word.begin(), word.end());
+        text.push_back(' ');
+    }
+    text.resize(65536);
+    const std::vector<uint8_t> first(text);
+    for (int r = 0; r < 3; r++) text.insert(text.end(), first.begin(), first.end());
+    c = CompressHybrid(text, fast);
+    test("Level 1 roundtrip past the LZ77 window", DecompressHybrid(c) == text);
+}
+
+void test_time_budget() {
+    std::cout << "\n=== Time Budget Tests ===\n";
+
+    auto data = make_test_data(3000, 0);
+
+    // An already-expired budget still yields the first (cheapest) candidate
+    HybridOptions tiny;
+    tiny.threads = 1;
+    tiny.time_budget = 1e-6;
+    auto c = CompressHybrid(data, tiny);
+    test("Expired budget roundtrip", DecompressHybrid(c) == data);
+    test("Expired budget keeps first candidate", !c.empty() && c[0] == 1);
+
+    // Sampling is bound by the budget too: past the deadline no slice is
+    // scored, and the full-size run again keeps its first candidate
+    auto text = make_test_data(20000, 0);
+    HybridOptions sampled = tiny;
+    sampled.sample = true;
+    sampled.slice_size = 2000;
+    c = CompressHybrid(text, sampled);
+    test("Expired budget skips sampling", !c.empty() && c[0] == 1);
+    test("Expired sampled budget roundtrip", DecompressHybrid(c) == text);
+
+    // A generous budget matches the unbounded search
+    HybridOptions roomy;
+    roomy.threads = 1;
+    roomy.time_budget = 3600;
+    HybridOptions unbounded;
+    unbounded.threads = 1;
+    test("Large budget matches unbounded",
+         CompressHybrid(data, roomy) == CompressHybrid(data, unbounded));
+
+    // Blocks share the caller's deadline: once it has passed, every block
+    // keeps its first candidate instead of starting a budget of its own
+    HybridOptions shared = roomy;
+    shared.block_size = 1000;
+    shared.deadline = std::chrono::steady_clock::now();
+    auto blocked = CompressHybrid(data, shared);
+    bool first_only = !blocked.empty() && blocked[0] == BLOCK_MODE;
+    for (size_t pos = 5; first_only && pos + 8 < blocked.size();) {
+        uint32_t size;
+        std::memcpy(&size, blocked.data() + pos + 4, 4);
+        first_only = blocked[pos + 8] == 1 || blocked[pos + 8] == 255;
+        pos += 8 + size;
+    }
+    test("Blocks share an expired deadline", first_only);
+    test("Shared deadline roundtrip", DecompressHybrid(blocked) == data);
+}
+
+void test_memory_budget() {
+    std::cout << "\n=== Memory Budget Tests ===\n";
+
+    auto text = make_test_data(3000, 0);
+    test("PPM estimate covers the order-2 table", PipelinePeakMemory(0, text) > 100u << 20);
+    test("Random data estimated above text",
+         PipelinePeakMemory(3, make_test_data(20000, 2)) >
+         PipelinePeakMemory(3, make_test_data(20000, 0)));
+
+    // 64 MB admits CM but none of the PPM coders
+    HybridOptions opts;
+    opts.threads = 2;
+    opts.max_memory = 64u << 20;
+    auto c = CompressHybrid(text, opts);
+    test("64 MB cap roundtrip", DecompressHybrid(c) == text);
+    test("64 MB cap skips PPM candidates", !c.empty() && (c[0] == 12 || c[0] == 255));
+
+    // A cap that fits one candidate at a time still finds the best mode
+    HybridOptions serial;
+    serial.threads = 4;
+    serial.max_memory = 200u << 20;
+    HybridOptions unbounded;
+    unbounded.threads = 1;
+    unbounded.level = serial.level = 3;
+    test("Tight cap matches unbounded",
+         CompressHybrid(text, serial) == CompressHybrid(text, unbounded));
+
+    // A cap below three times the input leaves no room for any candidate,
+    // yet one still runs instead of the input being stored
+    HybridOptions starved;
+    starved.threads = 2;
+    starved.level = 3;
+    starved.max_memory = 2 * text.size();
+    c = CompressHybrid(text, starved);
+    test("Over-tight cap still compresses", !c.empty() && c[0] != 255 && c.size() < text.size());
+    test("Over-tight cap roundtrip", DecompressHybrid(c) == text);
+}
+
+void test_decode_speed() {
+    std::cout << "\n=== Decode Speed Tests ===\n";
+
+    auto text = make_test_data(3000, 0);
+    HybridOptions base;
+    base.threads = 1;
+    base.level = 3;
+
+    HybridOptions zero = base;
+    zero.decode_weight = 0;
+    test("Zero weight matches default", CompressHybrid(text, zero) == CompressHybrid(text, base));
+
+    // Every chosen mode must meet the floor under the default estimates
+    HybridOptions floor = base;
+    floor.min_decode_speed = 50;
+    auto c = CompressHybrid(text, floor);
+    test("Speed floor roundtrip", DecompressHybrid(c) == text);
+    test("Speed floor respected",
+         !c.empty() && (c[0] == 255 || DefaultDecodeProfile()[c[0]].MBps(text.size()) >= 50));
+
+    // A profile that makes every coder prohibitively slow favours store raw
+    auto slow = std::make_shared<DecodeProfile>();
+    for (auto &cost : *slow) cost.setup_ms = 1e6;
+    (*slow)[255] = DecodeCost{};
+    HybridOptions weighted = base;
+    weighted.decode_weight = 1;
+    weighted.decode_profile = slow;
+    c = CompressHybrid(text, weighted);
+    test("Heavy decode weight stores raw", !c.empty() && c[0] == 255);
+    test("Heavy decode weight roundtrip", DecompressHybrid(c) == text);
+}
+
+void test_blocks() {
+    std::cout << "\n=== Per-Block Selection Tests ===\n";
+
+    // Text, then random bytes, then zeros
+    auto text = make_test_data(100000, 0);
+    auto noise = make_test_data(100000, 2);
+    std::vector<uint8_t> data = text;
+    data.insert(data.end(), noise.begin(), noise.end());
+    data.insert(data.end(), 60000, 0);
+
+    auto ends = SplitBlocks(data, 0, true);
+    test("Change points split mixed input", ends.size() == 3);
+    test("Change points near region boundaries",
+         ends.size() == 3 && ends[0] >= 96 * 1024 && ends[0] <= 112 * 1024 &&
+         ends[1] >= 192 * 1024 && ends[1] <= 208 * 1024 && ends[2] == data.size());
+    test("Uniform input stays one block", SplitBlocks(text, 0, true).size() == 1);
+    test("Fixed blocks", SplitBlocks(data, 65536, false).size() == (data.size() + 65535) / 65536);
+
+    HybridOptions opts;
+    opts.level = 2;
+    opts.threads = 1;
+    opts.adaptive_blocks = true;
+    auto c = CompressHybrid(data, opts);
+    test("Adaptive blocks roundtrip", DecompressHybrid(c) == data);
+    test("Adaptive blocks use the container", !c.empty() && c[0] == BLOCK_MODE);
+
+    HybridOptions whole = opts;
+    whole.adaptive_blocks = false;
+    test("Adaptive blocks beat one mode", c.size() < CompressHybrid(data, whole).size());
+
+    HybridOptions parallel = opts;
+    parallel.threads = 4;
+    auto p = CompressHybrid(data, parallel);
+    test("Block threads=1 vs 4 identical", p == c);
+    test("Block parallel decode", DecompressHybrid(p, 4) == data);
+
+    HybridOptions fixed = opts;
+    fixed.adaptive_blocks = false;
+    fixed.block_size = 50000;
+    c = CompressHybrid(data, fixed);
+    test("Fixed blocks roundtrip", DecompressHybrid(c) == data);
+
+    // Inputs that fit in one block keep the plain single-mode format
+    fixed.block_size = 1 << 20;
+    test("Single block has no container", CompressHybrid(text, fixed) == CompressHybrid(text, whole));
+
+    // Truncated container
+    std::vector<uint8_t> cut(c.begin(), c.begin() + c.size() / 2);
+    bool threw = false;
+    try {
+        DecompressHybrid(cut);
+    } catch (const std::exception&) {
+        threw = true;
+    }
+    test("Truncated container rejected", threw);
+
+    // A block raw size the stream cannot back is rejected, checked up front
+    // when the decoded size is known and after decoding when it is not
+    std::vector<uint8_t> inflated = c;
+    std::memset(inflated.data() + 5, 0xFF, 4);
+    for (size_t out_size : {data.size(), (size_t)0}) {
+        threw = false;
+        try {
+            DecompressHybrid(inflated.data(), inflated.size(), 1, out_size);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        test(out_size ? "Inflated block size rejected up front" : "Inflated block size rejected",
+             threw);
+    }
+    test("Decoded size hint roundtrip", DecompressHybrid(c.data(), c.size(), 1, data.size()) == data);
+}
+
 void test_cm() {
     std::cout << "\n=== Context Mixing Tests ===\n";
 
@@ -236,6 +718,16 @@ int main() {
     test_lz_variants();
     test_bwt_mtf();
     test_hybrid_modes();
+    test_hybrid_threads();
+    test_stream_decode();
+    test_sized_streams();
+    test_hybrid_sampling();
+    test_prefilter();
+    test_levels();
+    test_time_budget();
+    test_memory_budget();
+    test_decode_speed();
+    test_blocks();
     test_cm();
 
     std::cout << "\n=== Results: " << passed << " passed, " << failed << " failed ===\n";
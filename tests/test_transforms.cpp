@@ -2,6 +2,7 @@
 #include <vector>
 #include <cstdint>
 #include <string>
+#include <algorithm>
 #include "../src/models/ppm.hpp"
 #include "../src/models/bwt.hpp"
 #include "../src/models/lz77.hpp"
@@ -394,6 +395,74 @@ void test_combined_transforms() {
     }
 }
 
+// Feed `in` to a streaming decoder `chunk` bytes at a time
+template <typename Decoder>
+std::vector<uint8_t> stream_decode(const std::vector<uint8_t>& in, size_t chunk) {
+    VectorSink out;
+    Decoder dec(out);
+    for (size_t i = 0; i < in.size(); i += chunk) {
+        dec.Write(in.data() + i, std::min(chunk, in.size() - i));
+    }
+    dec.Close();
+    return out.Take();
+}
+
+template <typename Decoder>
+bool stream_gives(const std::vector<uint8_t>& in, const std::vector<uint8_t>& expected) {
+    for (size_t chunk : {1, 2, 3, 7, 4096, 1 << 20}) {
+        if (stream_decode<Decoder>(in, chunk) != expected) return false;
+    }
+    return true;
+}
+
+template <typename Decoder>
+bool stream_matches(const std::vector<uint8_t>& in,
+                    std::vector<uint8_t> (*decode)(const std::vector<uint8_t>&)) {
+    return stream_gives<Decoder>(in, decode(in));
+}
+
+// Decoders taking an output size hint, here unknown
+template <typename Decoder>
+bool stream_matches(const std::vector<uint8_t>& in,
+                    std::vector<uint8_t> (*decode)(const std::vector<uint8_t>&, size_t)) {
+    return stream_gives<Decoder>(in, decode(in, 0));
+}
+
+void test_stream_decoders() {
+    std::cout << "\n=== Streaming Decoder Tests ===\n";
+
+    // Text with repeats further apart than one 64 KB chunk, escape bytes
+    // and runs, so every token type gets split across chunk boundaries
+    std::vector<uint8_t> data;
+    for (int i = 0; i < 300000; i++) {
+        data.push_back("The quick brown fox jumps over the lazy dog. "[i % 46]);
+        if (i % 997 == 0) data.insert(data.end(), 40, 0xFF);
+        if (i % 1499 == 0) data.insert(data.end(), 20, 0xFE);
+        if (i % 2003 == 0) data.push_back(0x7F);
+        if (i % 50000 == 0) {
+            for (int j = 0; j < 3000; j++) data.push_back((uint8_t)(j * 7919 >> 3));
+        }
+    }
+
+    test("LZ77 stream", stream_matches<LZ77StreamDecoder>(LZ77Compress(data), LZ77Decompress));
+    test("RLE stream", stream_matches<RLEStreamDecoder>(RLECompress(data), RLEDecompress));
+    test("Delta stream", stream_matches<DeltaStreamDecoder>(DeltaEncode(data), DeltaDecode));
+    test("Word stream", stream_matches<WordStreamDecoder>(WordEncode(data), WordDecode));
+    test("MTF stream", stream_matches<MTFStreamDecoder>(MTFEncode(data), MTFDecode));
+
+    // Malformed input decodes exactly like the one-shot decoders
+    std::vector<uint8_t> lz_cut = {'a', 'b', 'c', 0xFE, 0, 3, 'd', 0xFF, 1};
+    test("LZ77 stream truncated match", stream_matches<LZ77StreamDecoder>(lz_cut, LZ77Decompress));
+    std::vector<uint8_t> lz_bad = {'a', 0xFE, 0, 9, 'b', 'c'};
+    test("LZ77 stream bad offset", stream_matches<LZ77StreamDecoder>(lz_bad, LZ77Decompress));
+    std::vector<uint8_t> rle_cut = {'x', 0xFF, 'y'};
+    test("RLE stream truncated run", stream_matches<RLEStreamDecoder>(rle_cut, RLEDecompress));
+    std::vector<uint8_t> word_cut = {'a', 0x80, 0x7F};
+    test("Word stream trailing escape", stream_matches<WordStreamDecoder>(word_cut, WordDecode));
+    std::vector<uint8_t> empty;
+    test("LZ77 stream empty", stream_decode<LZ77StreamDecoder>(empty, 1).empty());
+}
+
 int main() {
     std::cout << "=== Transform Tests ===\n";
 
@@ -404,6 +473,7 @@ int main() {
     test_record_interleave();
     test_dict_encoding();
     test_combined_transforms();
+    test_stream_decoders();
 
     std::cout << "\n=== Results: " << passed << " passed, " << failed << " failed ===\n";
     return failed > 0 ? 1 : 0;